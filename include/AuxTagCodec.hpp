@@ -0,0 +1,121 @@
+/*
+Optional SAM fields (aux tags) are stored in typed columns: one stream per
+tag key and type (.opt.<key><type>.lz, e.g. .opt.NHi.lz). The layout stream
+(.opt.lz) tells which tags a record has and in what order: every distinct
+ordered list of tags gets an id the first time it shows up, the record then
+stores just the id (varint). Id 0 announces a new layout:
+
+	0 <number of tags, varint> (<key 2 bytes> <type 1 byte>)*
+
+Integer types (c C s S i I) are all kept as 'i' since SAM prints them alike.
+Column values:
+
+	i		zigzag varint of the difference to the previous value in the column
+	A		one byte
+	f		four bytes, little-endian
+	Z, H	dictionary: varint index + 1 of an earlier value, or 0 followed by a
+			zero-terminated string that becomes the next dictionary entry
+	B		subtype byte, element count (varint), then the elements: integers
+			as zigzag varints, floats as four bytes
+
+MD has no column: it is rebuilt from the edits, the layout keeps its position.
+
+Layout ids, dictionaries and previous values run over the whole file (the
+blocks of the columns do not line up w/ the records), so the fields are
+decoded from the first record on; view leaves them out.
+*/
+
+#ifndef AUX_TAG_CODEC_H
+#define AUX_TAG_CODEC_H
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+// string dictionaries stop growing past this many entries
+#define AUX_DICT_MAX (1 << 16)
+
+////////////////////////////////////////////////////////////////
+// one aux field as stored in BAM: key, type, payload (little-endian)
+////////////////////////////////////////////////////////////////
+struct AuxField {
+	uint8_t const * data;
+	int len;
+
+	AuxField(char const * d, int l): data( (uint8_t const *)d), len(l) {}
+
+	char key0() const {return data[0];}
+
+	char key1() const {return data[1];}
+
+	char type() const {return data[2];}
+
+	uint8_t const * payload() const {return data + 3;}
+
+	bool isMD() const {return data[0] == 'M' && data[1] == 'D';}
+};
+
+////////////////////////////////////////////////////////////////
+// type under which the field is stored; 0 for types SAM does not have
+////////////////////////////////////////////////////////////////
+char auxColumnType(char type) {
+	switch (type) {
+		case 'c': case 'C': case 's': case 'S': case 'i': case 'I':
+			return 'i';
+		case 'A': case 'f': case 'Z': case 'H': case 'B':
+			return type;
+		default:
+			return 0;
+	}
+}
+
+string auxColumnSuffix(char key0, char key1, char type) {
+	string suffix = ".opt.";
+	suffix.push_back(key0);
+	suffix.push_back(key1);
+	suffix.push_back(type);
+	return suffix + ".lz";
+}
+
+////////////////////////////////////////////////////////////////
+// size of an integer or float of BAM type t, 0 if not a number
+////////////////////////////////////////////////////////////////
+int auxValueSize(char t) {
+	switch (t) {
+		case 'c': case 'C': return 1;
+		case 's': case 'S': return 2;
+		case 'i': case 'I': case 'f': return 4;
+		default: return 0;
+	}
+}
+
+int64_t auxInteger(char t, uint8_t const * p) {
+	switch (t) {
+		case 'c': return (int8_t)p[0];
+		case 'C': return p[0];
+		case 's': return (int16_t)(p[0] | (p[1] << 8) );
+		case 'S': return (uint16_t)(p[0] | (p[1] << 8) );
+		case 'i': return (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24) );
+		case 'I': return (uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24) );
+		default: return 0;
+	}
+}
+
+float auxFloat(uint8_t const * p) {
+	uint32_t bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	float f;
+	memcpy(&f, &bits, 4);
+	return f;
+}
+
+uint64_t zigzag(int64_t v) {
+	return ( (uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif
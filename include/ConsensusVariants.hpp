@@ -0,0 +1,185 @@
+/*
+Sliding consensus of the mismatches seen in the recent alignments (sorted by
+position). A site holds the base seen most often at a reference position
+(majority vote); once CONSENSUS_MIN_SUPPORT alignments agree on it, the site
+is a known variant. A mismatch that matches a known variant is written as
+
+	K <rank>
+
+in place of the base and the gap: rank counts the known variants between the
+previous edit and this one. Compressor and decompressor run the same
+consensus: an alignment looks up known variants first and adds its own
+mismatches after that. Sites left of the alignment start are dropped.
+
+Positions are tracked from the gaps of the edit ops (see LongEdits.hpp for
+the op list) so both sides agree on them w/o looking at the clips.
+
+Enabled w/ --consensusEdits; the decoder has to see every alignment from the
+start of a chromosome, so these archives decompress sequentially only.
+*/
+
+#ifndef CONSENSUS_VARIANTS_H
+#define CONSENSUS_VARIANTS_H
+
+#include <map>
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+#define EDIT_KNOWN_VARIANT 'K'
+
+// alignments that have to agree on a base before it becomes a known variant
+#define CONSENSUS_MIN_SUPPORT 2
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class ConsensusVariants {
+
+	struct Site {
+		uint8_t base = 0;
+		int support = 0;
+	};
+
+	map<int, Site> sites;
+
+	int chromo = -1;
+
+	// reference position of the read position the next gap counts from
+	int cursor = 0;
+
+	// mismatches of the current alignment
+	vector<pair<int, uint8_t>> seen;
+
+	bool isKnown(Site const & s) const { return s.support >= CONSENSUS_MIN_SUPPORT; }
+
+public:
+	static bool isBase(int op) {
+		return op == 'A' || op == 'C' || op == 'G' || op == 'T' || op == 'N';
+	}
+
+	////////////////////////////////////////////////////////////////
+	void beginAlignment(int ref, int offset) {
+		if (ref != chromo) {
+			sites.clear();
+			chromo = ref;
+		}
+		sites.erase(sites.begin(), sites.lower_bound(offset) );
+		cursor = offset;
+		seen.clear();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// move past an op that is gap bases after the previous one
+	////////////////////////////////////////////////////////////////
+	void advance(int op, int gap, int splice_len = 0) {
+		cursor += gap;
+		if (isBase(op) )
+			seen.emplace_back(cursor, op);
+		else if (op == 'D')
+			cursor++;
+		else if (op >= 'V' && op <= 'Z')
+			cursor--;
+		else if (op == 'E' || op == ('E' | 128) )
+			cursor += splice_len;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// rank of a mismatch gap bases ahead among the known variants, -1 if it
+	// is not a known variant
+	////////////////////////////////////////////////////////////////
+	int rank(int gap, uint8_t base) {
+		auto site = sites.find(cursor + gap);
+		if (site == sites.end() || !isKnown(site->second) || site->second.base != base) return -1;
+		int r = 0;
+		for (auto it = sites.lower_bound(cursor); it != site; it++)
+			if (isKnown(it->second) ) r++;
+		return r;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// known variant of the given rank: gap from the previous op and base
+	////////////////////////////////////////////////////////////////
+	bool variant(int r, int & gap, uint8_t & base) {
+		for (auto it = sites.lower_bound(cursor); it != sites.end(); it++) {
+			if (!isKnown(it->second) ) continue;
+			if (r-- == 0) {
+				gap = it->first - cursor;
+				base = it->second.base;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// fold the mismatches of the current alignment into the consensus
+	////////////////////////////////////////////////////////////////
+	void endAlignment() {
+		for (auto & m : seen) {
+			Site & s = sites[m.first];
+			if (s.base == m.second)
+				s.support++;
+			else if (s.support > 0)
+				s.support--;
+			else {
+				s.base = m.second;
+				s.support = 1;
+			}
+		}
+		seen.clear();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// decoder: replace known variant ops w/ the mismatches they stand for;
+	// edits are short form ops (expanded from the long form if needed)
+	////////////////////////////////////////////////////////////////
+	void resolve(int ref, int offset, vector<int> & edits) {
+		beginAlignment(ref, offset);
+		size_t j = 0;
+		while (j < edits.size() ) {
+			int op = edits[j];
+			switch (op) {
+				case 'L': case 'R':
+					j++;
+					break;
+				case 'l': case 'r':
+					j += 2;
+					break;
+				case 'E':
+					if (j + 3 < edits.size() ) advance(op, edits[j + 1], (edits[j + 2] << 8) | edits[j + 3]);
+					j += 4;
+					break;
+				case 'E' | 128:
+					if (j + 4 < edits.size() )
+						advance(op, edits[j + 1], (edits[j + 2] << 16) | (edits[j + 3] << 8) | edits[j + 4]);
+					j += 5;
+					break;
+				case EDIT_KNOWN_VARIANT: {
+					int gap = 0;
+					uint8_t base = 'N';
+					if (j + 1 >= edits.size() || !variant(edits[j + 1], gap, base) ) {
+						cerr << "[ERROR] Unknown consensus variant in the edits" << endl;
+						exit(1);
+					}
+					edits[j] = base;
+					edits[j + 1] = gap;
+					advance(base, gap);
+					j += 2;
+					break;
+				}
+				default:
+					if (j + 1 < edits.size() ) advance(op, edits[j + 1]);
+					j += 2;
+			}
+		}
+		endAlignment();
+	}
+};
+
+#endif
@@ -12,6 +12,7 @@
 
 #include "RefereeUtils.hpp"
 #include "TranscriptsStream.hpp"
+#include "AuxTagCodec.hpp"
 
 using namespace std;
 
@@ -64,12 +65,33 @@ inline bool isMismatch(unsigned char const & edit_op) {
     return edit_op == 'A' || edit_op == 'C' || edit_op == 'G' || edit_op == 'T' || edit_op == 'N';
 }
 
+////////////////////////////////////////////////////////////////
+// bases [start, start + len) of a BAM sequence, 2 bits each; bases other
+// than A, C, G, T go to the exceptions w/ their position
+////////////////////////////////////////////////////////////////
+vector<uint8_t> packBases(char * seq, int start, int len, vector<pair<int,uint8_t>> & exceptions) {
+	vector<uint8_t> bit_seq( (len + 3) >> 2, 0);
+	exceptions.clear();
+	for (int i = 0; i < len; i++) {
+		uint8_t code = bam_seqi(seq, start + i);
+		// A, C, G, T are 1, 2, 4, 8 in BAM
+		if (code != 1 && code != 2 && code != 4 && code != 8)
+			exceptions.push_back(make_pair(i, "=ACMGRSVTWYHKDBN"[code]) );
+		bit_seq[i >> 2] |= samToTwoBit[code] << (2 * (i & 3) );
+	}
+	return bit_seq;
+}
+
 struct UnalignedRead {
 	vector<uint8_t> seq;
 	vector<uint8_t> qual;
 	vector<uint8_t> read_name;
+	// seq and qual are reverse complemented
+	bool rc = false;
 
-	UnalignedRead(char * rn, int name_len, vector<uint8_t> s, char * q, bool rc = false): seq(s) {
+	UnalignedRead() {}
+
+	UnalignedRead(char * rn, int name_len, vector<uint8_t> s, char * q, bool rc = false): seq(s), rc(rc) {
 		for (auto i = 0; i < name_len; i++)
 			read_name.push_back(rn[i]);
 		auto q_len = s.size();
@@ -102,6 +124,20 @@ public:
 
 	}
 
+	////////////////////////////////////////////////////////////////
+	// point to the next record; the edit vectors keep their capacity, so
+	// an alignment reused across a batch stops allocating once they've grown
+	////////////////////////////////////////////////////////////////
+	void reset(bam_seq_t* r) {
+		read = r;
+		merged_edits.clear();
+		md_edits.clear();
+		cigar_edits.clear();
+		left_soft_clip = left_hard_clip = 0;
+		right_soft_clip = right_hard_clip = 0;
+		rejected = false;
+	}
+
 	////////////////////////////////////////////////////////////////
 	bool isPrimary() {
 		return ((bam_flag(read) & 0x100) == 0) && ( (bam_flag(read) & 0x900) == 0);
@@ -146,39 +182,43 @@ public:
 	////////////////////////////////////////////////////////////////
 	int tlen() { return bam_ins_size(read); }
 
+	////////////////////////////////////////////////////////////////
+	// one past the last reference base covered by the alignment
+	////////////////////////////////////////////////////////////////
+	int ref_end() {
+		int end = bam_pos(read);
+		auto cigar = bam_cigar(read);
+		for (int i = 0; i < (int)bam_cigar_len(read); i++) {
+			switch (cigar[i] & BAM_CIGAR_MASK) {
+				case BAM_CMATCH:
+				case BAM_CDEL:
+				case BAM_CREF_SKIP:
+				case BAM_CBASE_MATCH:
+				case BAM_CBASE_MISMATCH:
+					end += cigar[i] >> BAM_CIGAR_SHIFT;
+			}
+		}
+		return end;
+	}
+
 	////////////////////////////////////////////////////////////////
 	char * quals() { return bam_qual(read); }
 
 	////////////////////////////////////////////////////////////////
-	// w/o MD string
-	string opt_fields() { 
-		// auto auxillary_fields = bam_aux(read);
-		// TODO
-		// return bam_qual(read); 
-		// return opt_fields;
-		char *iter_handle;
-		char *key;
+	// optional fields in their original order, as raw BAM bytes
+	////////////////////////////////////////////////////////////////
+	void aux_fields(vector<AuxField> & fields) {
+		fields.clear();
+		char * iter_handle = NULL;
+		char k3[3];
 		char type;
 		bam_aux_t val;
-		char k3[3];
-		string flags = "";
-		// cerr << "Calling iter ";
-		iter_handle = NULL;
+		// the handle points past the field it just returned
+		char * start = (char *)bam_aux(read);
 		while (0 == bam_aux_iter(read, &iter_handle, k3, &type, &val) ) {
-			// cerr << "called ";
-			if ( (k3[0] == 'M' && k3[1] == 'D') || (k3[0]=='N' && k3[1] == 'M') || (k3[0]=='X') ) { // skip
-				// cerr << "md flag | nm"; // edit dist to ref OR md OR user flag
-			}
-			else {
-				flags.push_back(k3[0]);
-				flags.push_back(k3[1]);
-				// push value
-				flags += to_string(val.i);
-				flags.push_back(' ');
-				// cerr << flags << " ";
-			}
+			fields.push_back(AuxField(start, iter_handle - start) );
+			start = iter_handle;
 		}
-		return flags;
 	}
 
 	int lsc() { return left_soft_clip;}
@@ -200,16 +240,11 @@ public:
 	}
 
 	////////////////////////////////////////////////////////////////
-	// 2-bit encoding: <num_bytes> + char seq of 2-bit-encoded packed seq
+	// 2-bit packed left clip, four bases per byte starting from the low bits;
+	// bases other than A, C, G, T go to exceptions as (position, base)
 	////////////////////////////////////////////////////////////////
-	vector<uint8_t> getLeftSoftClip2() {
-		auto seq = bam_seq(read);
-		unsigned char num_bytes = (left_soft_clip >> 2) + ( (left_soft_clip & 3) > 0 );
-		vector<uint8_t> bit_seq(num_bytes, 0);
-		for (int i = 0; i < left_soft_clip; i++) {
-			bit_seq[ i >> 2 ] = bit_seq[ i >> 2 ] | ( samToTwoBit[bam_seqi(seq, i)] << (2 * (i & 3) ) );
-		}
-		return bit_seq;
+	vector<uint8_t> getLeftSoftClip2(vector<pair<int,uint8_t>> & exceptions) {
+		return packBases(0, left_soft_clip, exceptions);
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -226,18 +261,10 @@ public:
 	}
 
 	////////////////////////////////////////////////////////////////
-	// 2-bit encoding: <num_bytes> + char seq of 2-bit-encoded packed seq
+	// 2-bit packed right clip, see getLeftSoftClip2
 	////////////////////////////////////////////////////////////////
-	vector<unsigned char> getRightSoftClip2() {
-		auto seq = bam_seq(read);
-		auto seq_len = bam_seq_len(read);
-		auto num_bytes = (right_soft_clip >> 2) + ( (right_soft_clip & 3) > 0 );
-		// char * bit_seq = malloc( num_bytes * sizeof(unsigned char) );
-		vector<unsigned char> bit_seq(num_bytes, 0);
-		for (int i = 0; i < right_soft_clip; i++) {
-			bit_seq[ i >> 2 ] = bit_seq[ i >> 2 ] | ( samToTwoBit[bam_seqi(seq, seq_len - right_soft_clip + i)] << (2 * (i & 3) ) );
-		}
-		return bit_seq;
+	vector<uint8_t> getRightSoftClip2(vector<pair<int,uint8_t>> & exceptions) {
+		return packBases(bam_seq_len(read) - right_soft_clip, right_soft_clip, exceptions);
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -273,15 +300,22 @@ public:
 private:
 	bam_seq_t * read;
 
-	unsigned char left_soft_clip = 0;
-	unsigned char left_hard_clip = 0;
+	int left_soft_clip = 0;
+	int left_hard_clip = 0;
 
-	unsigned char right_soft_clip = 0;
-	unsigned char right_hard_clip = 0;
+	int right_soft_clip = 0;
+	int right_hard_clip = 0;
 
 	bool rejected = false;
 
-	// maybe replace w/ something else to save on mem allocs
+	////////////////////////////////////////////////////////////////
+	// bases [start, start + len) of the read, 2 bits each
+	////////////////////////////////////////////////////////////////
+	vector<uint8_t> packBases(int start, int len, vector<pair<int,uint8_t>> & exceptions) {
+		return ::packBases(bam_seq(read), start, len, exceptions);
+	}
+
+	// cleared, not freed, by reset()
 	vector<edit_pair> md_edits;
 	vector<edit_pair> cigar_edits;
 
@@ -364,14 +398,12 @@ private:
 	        	if (offset_into_read > 0) { // S is the last character in the cigar string
 	        		// cerr << "S ";
 					right_soft_clip = opLen; // this->seq.substr(read_pos);
-					if (right_soft_clip > 256) rejected = true;
 					cigar_edits.push_back( edit_pair('R', opLen) );
 				}
 				else {
 					// cerr << "S ";
 					offset_into_read+= opLen;
 					left_soft_clip = opLen;
-					if (left_soft_clip > 256) rejected = true;
 					cigar_edits.push_back( edit_pair('L', opLen) );
 				}
 	        	break;
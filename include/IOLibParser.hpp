@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <cstdlib>
 
 extern "C" {
     #include "io_lib/scram.h"
@@ -13,6 +15,12 @@ extern "C" {
 
 using namespace std;
 
+// records decoded per call to read_batch
+#define IOLIB_BATCH_SIZE 4096
+
+// bytes the record buffers of a batch may hold (long reads fill a batch early)
+#define IOLIB_BATCH_BYTES (1 << 26)
+
 class IOLibParser {
 public:
 	IOLibParser (std::string const & file_name, int t) {
@@ -45,6 +53,39 @@ public:
 		return result;
 	}
 
+	////////////////////////////////////////////////////////////////
+	// fill the arena w/ up to IOLIB_BATCH_SIZE records, return how many were
+	// read. The bam_seq_t buffers are reused from batch to batch (io_lib
+	// only grows them), so records are valid until the next call. A batch
+	// ends early once its buffers hold max_bytes; the buffers past it are
+	// freed then, so the arena stays within max_bytes plus one record
+	////////////////////////////////////////////////////////////////
+	int read_batch(size_t max_bytes = IOLIB_BATCH_BYTES) {
+		if (batch.empty() ) batch.assign(IOLIB_BATCH_SIZE, NULL);
+		batch_size = 0;
+		size_t bytes = 0;
+		while (batch_size < (int)batch.size() && bytes < max_bytes &&
+				scram_get_seq(fp_, &batch[batch_size]) >= 0) {
+			bytes += batch[batch_size]->alloc;
+			batch_size++;
+			lines++;
+			if (lines % 1000000 == 0) {
+				std::cerr << lines / 1000000 << "mln ";
+			}
+		}
+		if (bytes >= max_bytes) {
+			for (size_t i = batch_size; i < batch.size(); i++) {
+				free(batch[i]);
+				batch[i] = NULL;
+			}
+		}
+		return batch_size;
+	}
+
+	bam_seq_t* getRead(int i) {
+		return batch[i];
+	}
+
 	SAM_hdr* header() {
 		return header_;
 	}
@@ -56,6 +97,8 @@ public:
 	void close() {
 		std::cerr << "Read " << lines << " alignments" << std::endl;
 		scram_close(fp_);
+		for (auto b : batch) free(b);
+		batch.clear();
 	}
 
 private:
@@ -63,6 +106,8 @@ private:
 	scram_fd* fp_ = NULL; 		// file pointer
 	SAM_hdr* header_ = NULL;		// SAM file header
 	bam_seq_t* the_read = NULL;	// pointer to an alignment
+	vector<bam_seq_t*> batch;	// arena for read_batch
+	int batch_size = 0;
 	bool failed_ = false;
 };
 
@@ -241,12 +241,12 @@ public:
         --depth;
         IntervalStartSorter<T,K> intervalStartSorter;
         if (depth == 0 || (ivals.size() < minbucket && ivals.size() < maxbucket)) {
-            std::sort(ivals.begin(), ivals.end(), intervalStartSorter);
+            std::stable_sort(ivals.begin(), ivals.end(), intervalStartSorter);
             intervals = ivals;
         } else {
             if (leftextent == 0 && rightextent == 0) {
                 // sort intervals by start
-              std::sort(ivals.begin(), ivals.end(), intervalStartSorter);
+              std::stable_sort(ivals.begin(), ivals.end(), intervalStartSorter);
             }
 
             K leftp = 0;
@@ -0,0 +1,148 @@
+/*
+Long form of an alignment's edits, used when the edits do not fit the short
+form (one length byte, one-byte gaps and hard clip lengths): long reads,
+long clips, many edits. The record starts with a zero byte where the short
+form has its length, then the body length as a varint, then the ops. Gaps
+count bases since the previous edit as in the short form, all numbers are
+varints:
+
+	L, R				soft clips (bases are in the clip streams)
+	l <len>, r <len>	hard clips
+	A C G T N <gap>		mismatch
+	B <gap> <n> <n bases>	n mismatches at consecutive positions
+	D <gap> <n>			run of n deleted bases
+	I <gap> <n> <n ops>	run of n inserted bases, ops V..Z as in the short form
+	E <gap> <len>		splice
+	K <rank>			known variant (see ConsensusVariants.hpp)
+	J <gap> <id>		splice w/ a length from the junction table (see SpliceJunctions.hpp)
+
+EditsStream expands the long form into the op sequence of the short form
+w/ unbounded values, so both go through the same reconstruction.
+*/
+
+#ifndef LONG_EDITS_H
+#define LONG_EDITS_H
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+using namespace std;
+
+#define EDITS_LONG_FORM 0
+
+#define EDIT_MISMATCH_BLOCK 'B'
+#define EDIT_INSERTION_RUN 'I'
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+void appendEditVarint(vector<uint8_t> & v, uint64_t x) {
+	while (x >= 128) {
+		v.push_back( (x & 127) | 128);
+		x >>= 7;
+	}
+	v.push_back(x);
+}
+
+uint64_t nextEditVarint(vector<uint8_t> const & v, size_t & j) {
+	uint64_t x = 0;
+	int shift = 0;
+	while (j < v.size() ) {
+		uint8_t b = v[j++];
+		x |= (uint64_t)(b & 127) << shift;
+		if ( (b & 128) == 0) break;
+		shift += 7;
+	}
+	return x;
+}
+
+////////////////////////////////////////////////////////////////
+// entries a short form op takes, the op included
+////////////////////////////////////////////////////////////////
+int editOpSize(int op) {
+	if (op == 'L' || op == 'R') return 1;
+	if (op == 'E') return 4;
+	if (op == ('E' | 128) ) return 5;
+	if (op == 'J') return 3;
+	return 2;
+}
+
+////////////////////////////////////////////////////////////////
+// long form body -> short form ops
+////////////////////////////////////////////////////////////////
+void expandLongEdits(vector<uint8_t> const & body, vector<int> & edits) {
+	edits.clear();
+	size_t j = 0;
+	while (j < body.size() ) {
+		uint8_t op = body[j++];
+		switch (op) {
+			case 'L': case 'R':
+				edits.push_back(op);
+				break;
+			case 'l': case 'r':
+				edits.push_back(op);
+				edits.push_back(nextEditVarint(body, j) );
+				break;
+			case 'D': {
+				int gap = nextEditVarint(body, j);
+				int n = nextEditVarint(body, j);
+				for (int i = 0; i < n; i++) {
+					edits.push_back('D');
+					edits.push_back(i == 0 ? gap : 0);
+				}
+				break;
+			}
+			case EDIT_INSERTION_RUN: {
+				int gap = nextEditVarint(body, j);
+				int n = nextEditVarint(body, j);
+				for (int i = 0; i < n && j < body.size(); i++) {
+					edits.push_back(body[j++]);
+					edits.push_back(i == 0 ? gap : 0);
+				}
+				break;
+			}
+			case EDIT_MISMATCH_BLOCK: {
+				int gap = nextEditVarint(body, j);
+				int n = nextEditVarint(body, j);
+				for (int i = 0; i < n && j < body.size(); i++) {
+					edits.push_back(body[j++]);
+					edits.push_back(i == 0 ? gap : 1);
+				}
+				break;
+			}
+			case 'E': {
+				int gap = nextEditVarint(body, j);
+				int len = nextEditVarint(body, j);
+				// long splice op: three length "bytes", the first one takes the excess
+				edits.push_back('E' | 128);
+				edits.push_back(gap);
+				edits.push_back(len >> 16);
+				edits.push_back( (len >> 8) & 255);
+				edits.push_back(len & 255);
+				break;
+			}
+			case 'J': {
+				int gap = nextEditVarint(body, j);
+				edits.push_back(op);
+				edits.push_back(gap);
+				edits.push_back(nextEditVarint(body, j) );
+				break;
+			}
+			case 'K':
+				// resolved against the consensus by the decoder
+				edits.push_back(op);
+				edits.push_back(nextEditVarint(body, j) );
+				break;
+			case 'A': case 'C': case 'G': case 'T': case 'N':
+				edits.push_back(op);
+				edits.push_back(nextEditVarint(body, j) );
+				break;
+			default:
+				cerr << "[ERROR] Unknown op in the long form edits: " << (int)op << endl;
+				exit(1);
+		}
+	}
+}
+
+#endif
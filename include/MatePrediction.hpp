@@ -0,0 +1,40 @@
+/*
+pnext and tlen of properly paired mates on the same chromosome follow from
+the mates' positions, reference ends, and strands. When both mates are close
+to each other in the file, the flags stream stores only the distance to the
+later mate on the earlier mate's line and a marker on the later mate's line;
+see writeMateFlags. Aligners compute tlen differently, so a pair names the
+model that reproduces both of its tlen values.
+
+	MATE_MODEL_SPAN		leftmost start to rightmost end
+	MATE_MODEL_5P		between the 5' ends of the mates (BWA)
+*/
+
+#ifndef MATE_PREDICTION_H
+#define MATE_PREDICTION_H
+
+#include <algorithm>
+
+#define MATE_MODEL_SPAN 0
+#define MATE_MODEL_5P 1
+#define MATE_MODELS 2
+
+////////////////////////////////////////////////////////////////
+// a is the mate that comes first in the file (a_pos <= b_pos); ends are
+// exclusive, positions 0-based
+////////////////////////////////////////////////////////////////
+void predictTlen(int model, int a_pos, int a_end, bool a_rev, int b_pos, int b_end, bool b_rev,
+	int & a_tlen, int & b_tlen) {
+	if (model == MATE_MODEL_SPAN) {
+		a_tlen = std::max(a_end, b_end) - a_pos;
+		b_tlen = -a_tlen;
+	}
+	else {
+		int p0 = a_rev ? a_end - 1 : a_pos;
+		int p1 = b_rev ? b_end - 1 : b_pos;
+		a_tlen = p1 - p0 + (p0 > p1 ? -1 : 1);
+		b_tlen = p0 - p1 + (p1 > p0 ? -1 : 1);
+	}
+}
+
+#endif
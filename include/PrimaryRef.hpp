@@ -0,0 +1,68 @@
+/*
+Secondary and supplementary alignments (flag 0x900) refer back to the
+primary alignment of the same read and mate if it was seen within the last
+PRIMARY_WINDOW alignments. Such alignments take the read name and the
+quality values from the primary: nothing goes into the read name streams,
+and the qualities are restored from the primary's qualities instead of '*'
+when they are identical up to the strand. The .primary.lz stream holds one
+varint per alignment:
+
+	0								no primary; the name is stored w/ the alignment
+	distance << 2 | rev << 1 | qual	distance >= 1 alignments back to the primary;
+									rev if the strands differ, qual if the
+									qualities are inherited
+
+The window is also bounded in bytes: the encoder and the decoder both keep
+the alignments w/ a 0 token while the sum of their read lengths stays within
+PRIMARY_WINDOW_BYTES, dropping the oldest first, so the decoder never holds
+more than that many quality values for the window. The encoder keeps the
+qualities of the primaries in its window too, and inherits them only when
+they match byte for byte.
+*/
+
+#ifndef PRIMARY_REF_H
+#define PRIMARY_REF_H
+
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+#define PRIMARY_WINDOW (1 << 16)
+
+#define PRIMARY_WINDOW_BYTES (1 << 26)
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+uint64_t primaryRefToken(uint64_t distance, bool rev, bool qual) {
+	return (distance << 2) | (rev << 1) | qual;
+}
+
+uint64_t primaryRefDistance(uint64_t token) { return token >> 2; }
+
+bool primaryRefReversed(uint64_t token) { return (token & 2) > 0; }
+
+bool primaryRefQuals(uint64_t token) { return (token & 1) > 0; }
+
+////////////////////////////////////////////////////////////////
+// a read's primary and secondary alignments share the name; the mate bits
+// tell apart the two reads of a pair
+////////////////////////////////////////////////////////////////
+string primaryKey(char const * name, int flags) {
+	string key(name);
+	key.push_back('0' + ( (flags >> 6) & 3) );
+	return key;
+}
+
+////////////////////////////////////////////////////////////////
+// the quality values equal the primary's, read backwards if rev
+////////////////////////////////////////////////////////////////
+bool primaryQualsMatch(char const * q, string const & primary, bool rev) {
+	int len = primary.size();
+	for (int i = 0; i < len; i++)
+		if (q[rev ? len - i - 1 : i] != primary[i]) return false;
+	return true;
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+Lossy quality modes: every quality value is replaced by the representative of
+its bin, and the bin ids are range coded with a small context model. Binned
+archives skip the quality clustering; the mode is recorded in the *.head file
+as qual_mode=<spec> so that the decompressor knows how to restore the values.
+
+	lossless				cluster and code the original values (default)
+	bin8					Illumina 8-level binning
+	custom:<lo>-<hi>=<q>,...	Phred values lo..hi become q; values not covered by
+							any range go to the closest range below them,
+							values below the first range to the first range
+*/
+
+#ifndef QUALITY_BINNING_H
+#define QUALITY_BINNING_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdint.h>
+
+#include "QualityCodec.hpp"
+
+using namespace std;
+
+#define QB_MAX_BINS 16
+#define QB_END QB_MAX_BINS
+#define QB_SYMBOLS (QB_MAX_BINS + 1)
+#define QB_POS_BUCKETS 8
+
+// suffix of the stream w/ binned qualities
+#define BINNED_QUALS_SUFFIX ".quals.binned.ac"
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+struct QualityBinning {
+	string spec = "lossless";
+
+	uint8_t bin_of[256];	// quality char -> bin id
+
+	vector<char> representative;	// bin id -> quality char
+
+	bool lossy() const { return representative.size() > 0; }
+};
+
+////////////////////////////////////////////////////////////////
+// fill out the bins from "lo-hi=q,..." ranges over Phred values
+////////////////////////////////////////////////////////////////
+bool parseBinRanges(string const & ranges, QualityBinning & b) {
+	vector<int> lo, rep;
+	stringstream ss(ranges);
+	string item;
+	while (getline(ss, item, ',')) {
+		int l = 0, h = 0, q = 0;
+		char dash = 0, eq = 0;
+		stringstream is(item);
+		if ( !(is >> l >> dash >> h >> eq >> q) || dash != '-' || eq != '=' ||
+				l < 0 || h < l || h > 93 || q < 0 || q > 93) {
+			cerr << "[ERROR] Can not parse quality bin \"" << item << "\". Expected format: lo-hi=q" << endl;
+			return false;
+		}
+		if (lo.size() > 0 && l <= lo.back() ) {
+			cerr << "[ERROR] Quality bins have to be listed in increasing order" << endl;
+			return false;
+		}
+		lo.push_back(l);
+		rep.push_back(q);
+	}
+	if (lo.size() == 0 || lo.size() > QB_MAX_BINS) {
+		cerr << "[ERROR] Expected between 1 and " << QB_MAX_BINS << " quality bins" << endl;
+		return false;
+	}
+	b.representative.clear();
+	for (auto q : rep) b.representative.push_back( (char)(q + '!') );
+	for (int c = 0; c < 256; c++) {
+		int phred = c - '!';
+		int bin = 0;
+		while (bin + 1 < (int)lo.size() && lo[bin + 1] <= phred) bin++;
+		b.bin_of[c] = bin;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// parse the value of --qual-mode (or of the qual_mode line in *.head)
+////////////////////////////////////////////////////////////////
+bool parseQualityMode(string const & spec, QualityBinning & b) {
+	b.spec = spec;
+	b.representative.clear();
+	if (spec.compare("lossless") == 0)
+		return true;
+	if (spec.compare("bin8") == 0)
+		return parseBinRanges("0-2=2,3-9=6,10-19=15,20-24=22,25-29=27,30-34=33,35-39=37,40-93=40", b);
+	if (spec.compare(0, 7, "custom:") == 0)
+		return parseBinRanges(spec.substr(7), b);
+	cerr << "[ERROR] Unknown quality mode: " << spec << ". Expected lossless, bin8 or custom:<map>" << endl;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////
+// model for binned quality strings: symbols are bin ids, QB_END terminates
+// the string; context is the two previous bins and the position in the read
+////////////////////////////////////////////////////////////////
+class BinnedQualityModel {
+	vector<AdaptiveModel<QB_SYMBOLS>> models;
+
+	QualityBinning binning;
+
+	int context(int b1, int b2, int pos) {
+		int bucket = pos >> 4;
+		if (bucket >= QB_POS_BUCKETS) bucket = QB_POS_BUCKETS - 1;
+		return (b1 * QB_SYMBOLS + b2) * QB_POS_BUCKETS + bucket;
+	}
+
+public:
+	BinnedQualityModel(QualityBinning const & b): models(QB_SYMBOLS * QB_SYMBOLS * QB_POS_BUCKETS), binning(b) {}
+
+	// in place, at the start of every block
+	void reset() {
+		for (auto & m : models) m.reset();
+	}
+
+	// bytes a model takes
+	static size_t footprint() {
+		return sizeof(BinnedQualityModel) + QB_SYMBOLS * QB_SYMBOLS * QB_POS_BUCKETS * sizeof(AdaptiveModel<QB_SYMBOLS>);
+	}
+
+	void encode(string const & q_v, RangeEncoder & rc) {
+		int b1 = QB_END, b2 = QB_END;
+		for (size_t i = 0; i < q_v.size(); i++) {
+			int s = binning.bin_of[ (uint8_t)q_v[i] ];
+			models[context(b1, b2, i)].encode(rc, s);
+			b2 = b1;
+			b1 = s;
+		}
+		models[context(b1, b2, q_v.size())].encode(rc, QB_END);
+	}
+
+	// appends the representatives of the decoded bins to q_v
+	void decode(RangeDecoder & rc, string & q_v) {
+		int b1 = QB_END, b2 = QB_END;
+		for (int i = 0; ; i++) {
+			int s = models[context(b1, b2, i)].decode(rc);
+			if (s == QB_END) break;
+			q_v.push_back(binning.representative[s]);
+			b2 = b1;
+			b1 = s;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,256 @@
+/*
+Context-model range coder for quality values. Used by the compressor to encode
+the cores of the quality clusters and by the decompressor to restore them.
+
+Carryless range coder after D. Subbotin; each symbol is coded with an adaptive
+frequency model chosen by the previous quality, by whether the quality went up
+or down one step before, and by the position in the read. Every cluster owns a
+model, so the cluster id is part of the context implicitly.
+*/
+
+#ifndef QUALITY_CODEC_H
+#define QUALITY_CODEC_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <algorithm>
+
+using namespace std;
+
+#define RC_TOP (1u << 24)
+#define RC_BOT (1u << 16)
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+class RangeEncoder {
+	uint32_t low = 0;
+	uint32_t range = 0xFFFFFFFF;
+	vector<uint8_t> out;
+
+public:
+	void encode(uint32_t cum_freq, uint32_t freq, uint32_t tot_freq) {
+		range /= tot_freq;
+		low += cum_freq * range;
+		range *= freq;
+		while ( (low ^ (low + range)) < RC_TOP ||
+				(range < RC_BOT && ( (range = -low & (RC_BOT - 1)), true) ) ) {
+			out.push_back(low >> 24);
+			low <<= 8;
+			range <<= 8;
+		}
+	}
+
+	// push out the remaining state; the encoder can be reused after reset()
+	void finish() {
+		for (int i = 0; i < 4; i++) {
+			out.push_back(low >> 24);
+			low <<= 8;
+		}
+	}
+
+	void reset() {
+		low = 0;
+		range = 0xFFFFFFFF;
+		out.clear();
+	}
+
+	vector<uint8_t> & bytes() {return out;}
+
+	size_t size() {return out.size(); }
+};
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+class RangeDecoder {
+	uint32_t low = 0;
+	uint32_t range = 0xFFFFFFFF;
+	uint32_t code = 0;
+	uint8_t const * in;
+	size_t size;
+	size_t pos = 0;
+
+	// reading past the end yields zeros; the block header tells how many symbols to expect
+	uint8_t nextByte() { return (pos < size) ? in[pos++] : 0; }
+
+public:
+	RangeDecoder(uint8_t const * data, size_t n): in(data), size(n) {
+		for (int i = 0; i < 4; i++) code = (code << 8) | nextByte();
+	}
+
+	uint32_t getFreq(uint32_t tot_freq) {
+		uint32_t f = (code - low) / (range /= tot_freq);
+		return (f < tot_freq) ? f : tot_freq - 1;
+	}
+
+	void decode(uint32_t cum_freq, uint32_t freq) {
+		low += cum_freq * range;
+		range *= freq;
+		while ( (low ^ (low + range)) < RC_TOP ||
+				(range < RC_BOT && ( (range = -low & (RC_BOT - 1)), true) ) ) {
+			code = (code << 8) | nextByte();
+			low <<= 8;
+			range <<= 8;
+		}
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// adaptive frequencies over N symbols; symbols are kept roughly sorted by
+// frequency so that the cumulative sums stop after a few entries
+////////////////////////////////////////////////////////////////
+template <int N>
+class AdaptiveModel {
+	uint16_t freq[N];	// by rank
+	uint8_t sym[N];		// symbol at each rank
+	uint8_t rank[N];	// rank of each symbol
+	uint32_t total;
+
+	static const int increment = 24;
+
+	void rescale() {
+		total = 0;
+		for (int i = 0; i < N; i++) {
+			freq[i] = (freq[i] + 1) >> 1;
+			total += freq[i];
+		}
+	}
+
+	void update(int r) {
+		freq[r] += increment;
+		total += increment;
+		// move up past the less frequent symbols
+		while (r > 0 && freq[r] > freq[r - 1]) {
+			swap(freq[r], freq[r - 1]);
+			swap(sym[r], sym[r - 1]);
+			rank[sym[r]] = r;
+			rank[sym[r - 1]] = r - 1;
+			r--;
+		}
+		if (total > RC_BOT - increment) rescale();
+	}
+
+public:
+	AdaptiveModel() { reset(); }
+
+	void reset() {
+		for (int i = 0; i < N; i++) {
+			freq[i] = 1;
+			sym[i] = i;
+			rank[i] = i;
+		}
+		total = N;
+	}
+
+	void encode(RangeEncoder & rc, int s) {
+		int r = rank[s];
+		uint32_t cum = 0;
+		for (int i = 0; i < r; i++) cum += freq[i];
+		rc.encode(cum, freq[r], total);
+		update(r);
+	}
+
+	int decode(RangeDecoder & rc) {
+		uint32_t target = rc.getFreq(total);
+		uint32_t cum = 0;
+		int r = 0;
+		while (cum + freq[r] <= target) cum += freq[r++];
+		rc.decode(cum, freq[r]);
+		int s = sym[r];
+		update(r);
+		return s;
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// model for whole quality strings: symbols 0..62 are qualities offset by '!',
+// QM_ESCAPE is followed by a raw byte, QM_END terminates the string
+////////////////////////////////////////////////////////////////
+#define QM_ESCAPE 63
+#define QM_END 64
+#define QM_SYMBOLS 65
+#define QM_POS_BUCKETS 16
+
+class QualityModel {
+	// context: previous symbol (QM_END at the start), slope, position bucket
+	vector<AdaptiveModel<QM_SYMBOLS>> models;
+
+	int context(int q1, int q2, int pos) {
+		int slope = (q2 < q1) ? 0 : ( (q2 == q1) ? 1 : 2);
+		int bucket = pos >> 3;
+		if (bucket >= QM_POS_BUCKETS) bucket = QM_POS_BUCKETS - 1;
+		return (q1 * 3 + slope) * QM_POS_BUCKETS + bucket;
+	}
+
+public:
+	QualityModel(): models(QM_SYMBOLS * 3 * QM_POS_BUCKETS) {}
+
+	// in place, at the start of every block
+	void reset() {
+		for (auto & m : models) m.reset();
+	}
+
+	// bytes a model takes
+	static size_t footprint() {
+		return sizeof(QualityModel) + QM_SYMBOLS * 3 * QM_POS_BUCKETS * sizeof(AdaptiveModel<QM_SYMBOLS>);
+	}
+
+	void encode(string const & q_v, RangeEncoder & rc) {
+		int q1 = QM_END, q2 = QM_END;
+		for (size_t i = 0; i < q_v.size(); i++) {
+			int s = (uint8_t)q_v[i] - '!';
+			auto & m = models[context(q1, q2, i)];
+			if (s < 0 || s >= QM_ESCAPE) {
+				m.encode(rc, QM_ESCAPE);
+				rc.encode( (uint8_t)q_v[i], 1, 256);
+				s = QM_ESCAPE;
+			}
+			else {
+				m.encode(rc, s);
+			}
+			q2 = q1;
+			q1 = s;
+		}
+		models[context(q1, q2, q_v.size())].encode(rc, QM_END);
+	}
+
+	// appends the decoded string to q_v
+	void decode(RangeDecoder & rc, string & q_v) {
+		int q1 = QM_END, q2 = QM_END;
+		for (int i = 0; ; i++) {
+			int s = models[context(q1, q2, i)].decode(rc);
+			if (s == QM_END) break;
+			if (s == QM_ESCAPE) {
+				uint32_t b = rc.getFreq(256);
+				rc.decode(b, 1);
+				q_v.push_back( (char)b);
+			}
+			else {
+				q_v.push_back( (char)(s + '!') );
+			}
+			q2 = q1;
+			q1 = s;
+		}
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// coded blocks on disk: magic, number of strings, coded size, coded bytes;
+// the model is reset at the start of every block
+////////////////////////////////////////////////////////////////
+const char QUALITY_BLOCK_MAGIC[5] = "RQC1";
+const int QUALITY_BLOCK_HEADER = 12;
+
+void putUint32(uint8_t * p, uint32_t v) {
+	for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i) );
+}
+
+uint32_t getUint32(uint8_t const * p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+}
+
+#endif
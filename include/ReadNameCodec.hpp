@@ -0,0 +1,70 @@
+/*
+Read names are split into tokens: maximal runs of digits and maximal runs of
+anything else. For every name the control stream (.ids.lz) gets one byte per
+token telling how the token is stored, followed by NAME_TOK_END; token data
+goes into one column stream per token position (.ids.N.lz). Tokens past
+NAME_MAX_TOKENS are glued into the last one. The first name that starts in a
+block of the control stream does not refer to the previous name, so decoding
+can start there after a seek.
+
+	NAME_TOK_MATCH		same as the token at this position in the previous name; no data
+	NAME_TOK_STRING		bytes followed by a zero byte
+	NAME_TOK_NUMBER		number w/o leading zeros, varint
+	NAME_TOK_DELTA		number 1..255 above the previous number at this position, one byte
+*/
+
+#ifndef READ_NAME_CODEC_H
+#define READ_NAME_CODEC_H
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <stdint.h>
+
+using namespace std;
+
+#define NAME_MAX_TOKENS 16
+
+#define NAME_TOK_END 0
+#define NAME_TOK_MATCH 1
+#define NAME_TOK_STRING 2
+#define NAME_TOK_NUMBER 3
+#define NAME_TOK_DELTA 4
+
+// numbers longer than this are kept as strings
+#define NAME_MAX_NUMBER_DIGITS 9
+
+////////////////////////////////////////////////////////////////
+// token boundaries of a name: starts of the tokens plus the end of the name
+////////////////////////////////////////////////////////////////
+void tokenizeName(char const * name, vector<int> & bounds) {
+	bounds.clear();
+	int i = 0;
+	while (name[i] != 0) {
+		if (bounds.size() == NAME_MAX_TOKENS) {
+			// the rest goes into the last token
+			while (name[i] != 0) i++;
+			break;
+		}
+		bounds.push_back(i);
+		bool digit = isdigit(name[i]);
+		while (name[i] != 0 && (bool)isdigit(name[i]) == digit) i++;
+	}
+	bounds.push_back(i);
+}
+
+////////////////////////////////////////////////////////////////
+// true if the token can be stored as a number and restored exactly
+////////////////////////////////////////////////////////////////
+bool nameTokenNumber(char const * token, int len, uint32_t & value) {
+	if (len == 0 || len > NAME_MAX_NUMBER_DIGITS) return false;
+	if (token[0] == '0' && len > 1) return false;
+	value = 0;
+	for (int i = 0; i < len; i++) {
+		if (!isdigit(token[i])) return false;
+		value = value * 10 + (token[i] - '0');
+	}
+	return true;
+}
+
+#endif
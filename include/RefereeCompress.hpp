@@ -5,45 +5,52 @@
 #include <unistd.h>
 #include <lzip.h>
 #include <compress.h>
-#include <chrono>
 
+#include "RefereeProfile.hpp"
 #include "compress/Compressor.hpp"
 
 struct Parser_args {
 	Output_args output;
 	string file_name;
+	string name_prefix;
 	string ref_file_name;
 	int num_parsing_threads;
 	Packet_courier * courier;
 	bool seq_only;
 	bool discard_secondary_alignments;
+	bool consensus_edits;
+	bool failed = false;	// set by parseSAM
 };
 
 ////////////////////////////////////////////////////////////////
 void * parseSAM( void * pa) {
 	// cerr << "parser Launched" << endl;
-	const Parser_args & tmp = *(Parser_args *)pa;
+	Parser_args & tmp = *(Parser_args *)pa;
 
 	Packet_courier * courier = tmp.courier;
 	Output_args outs = tmp.output;
 	// will write out a BAM/SAM header
-	Compressor c(tmp.file_name, tmp.ref_file_name, tmp.num_parsing_threads, outs, 
-			tmp.seq_only, tmp.discard_secondary_alignments);
+	Compressor c(tmp.file_name, tmp.name_prefix, tmp.ref_file_name, tmp.num_parsing_threads, outs, 
+			tmp.seq_only, tmp.discard_secondary_alignments, tmp.consensus_edits);
 	// cerr << "created compressor successfully" << endl;
 	if (c.failed() ) {
 		cerr << "[INFO] Terminating. " << endl;
+		tmp.failed = true;
 		courier->finish();
 	}
 	else {
-		auto start_time = chrono::system_clock::now();
-		c.compress();
+		{
+			PROFILE_SCOPE("parser.total");
+			c.compress();
+		}
+		// the streams are complete up to the error
+		tmp.failed = c.failed();
 		// finished parsing SAM -- might have data remaining in the buffers
-		auto end_time = chrono::system_clock::now();
-		// cerr << "Parsing wall time: " << chrono::duration_cast<chrono::microseconds>(end_time - start_time).count() << " us" << endl;
 		// flush all output buffers (get rid of remaining packets)
-		outs.flush();
-		auto flush_time = chrono::system_clock::now();
-		// cerr << "Flushing wall time: " << chrono::duration_cast<chrono::microseconds>(flush_time - end_time).count() << "us" << endl;
+		{
+			PROFILE_SCOPE("parser.flush");
+			outs.flush();
+		}
 		// let courier know that no more packages are coming
 		courier->finish();
 		// cerr << "finished parsing" << endl;
@@ -51,41 +58,53 @@ void * parseSAM( void * pa) {
 };
 
 ////////////////////////////////////////////////////////////////
-Output_args initializeOutputStreams(string & name_prefix, bool seq_only, 
-		bool discard_secondary_alignments, Packet_courier * courier) {
-	shared_ptr<ofstream> intervals(new ofstream("genomic_intervals.txt"));
+Output_args initializeOutputStreams(string const & name_prefix, bool seq_only, 
+		bool discard_secondary_alignments, Packet_courier * courier, int num_workers,
+		QualityBinning const & binning, shared_ptr<TrainedQualityModel const> qual_model) {
+	shared_ptr<ofstream> intervals(new ofstream(name_prefix + INTERVALS_SUFFIX));
 	Output_args oa(seq_only);
 	oa.offsets_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".offs.lz", 1<<22, 20) );
 	oa.edits_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".edits.lz" ) );
 	// set dictionary size to be small -- this is a barely compressible stream, so we won't try hard
 	oa.has_edits_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".has_edits.lz", 1 << 20, 5 ) );
+	oa.read_lens_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".read_lens.lz", 1 << 20, 5 ) );
+	oa.read_lens_buf->keepRecordsWhole();
 	oa.left_clips_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".left_clip.lz", 1<<22, 20) );
 	oa.right_clips_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".right_clip.lz", 1<<22, 20) );
 	oa.unaligned_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, name_prefix, ".unaligned.lz", 3<<20, 12 ) );
 	if (!seq_only) {
 		oa.flags_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".flags.lz" ) );
-		oa.ids_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".ids.lz", 3 << 20,  12 ) );
-		oa.opt_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".opt.lz" ) );
-		oa.quals_buf = shared_ptr<QualityCompressor>(new QualityCompressor(courier, intervals, name_prefix.c_str(), 0.05, 200000, 4 ) );
+		oa.primary_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, intervals, name_prefix, ".primary.lz", 1 << 20, 5 ) );
+		oa.ids_buf = shared_ptr<ReadNameEncoder>(new ReadNameEncoder(courier, intervals, name_prefix) );
+		oa.opt_buf = shared_ptr<AuxTagEncoder>(new AuxTagEncoder(courier, intervals, name_prefix) );
+		oa.quals_buf = shared_ptr<QualityCompressor>(new QualityCompressor(courier, intervals, name_prefix.c_str(), 0.05, memoryBudget().bootstrapVectors(200000), 3, num_workers, binning, qual_model ) );
 	}
 	return oa;
 };
 
 ////////////////////////////////////////////////////////////////
-void compressFile(string & file_name, string const & ref_file_name, const int num_workers, 
-	bool seq_only, bool discard_secondary_alignments) {
-	int dictionary_size = 1<<23;
+// file_name can be "-" for stdin; everything is written in one pass.
+// Returns false if the file could not be compressed
+////////////////////////////////////////////////////////////////
+bool compressFile(string const & file_name, string const & name_prefix, string const & ref_file_name, const int num_workers, 
+	bool seq_only, bool discard_secondary_alignments, QualityBinning const & binning,
+	string const & qual_model, bool consensus_edits, size_t max_memory = 0) {
+	// sizes the blocks, slots and buffers below; 0 leaves the defaults
+	memoryBudget().setLimit(max_memory, num_workers);
+	int dictionary_size = std::min(1<<23, memoryBudget().blockCap() );
 	int match_len_limit = 36; // equivalent to -6 option
 
 	// const int num_workers = num_threads - 1;//max(2, num_threads - 1); // one for parsing
 	const int slots_per_worker = 20;
-	const int num_slots =
-		( ( num_workers > 1 ) ? num_workers * slots_per_worker : 1 );
+	const int num_slots = memoryBudget().slots(
+		( ( num_workers > 1 ) ? num_workers * slots_per_worker : 1 ), num_workers);
 
 	Packet_courier courier(num_workers, num_slots);
 
 	// open output streams
-	Output_args output_args = initializeOutputStreams(file_name, seq_only, discard_secondary_alignments, &courier);
+	shared_ptr<TrainedQualityModel const> model;
+	if (qual_model.size() > 0) model = loadQualityModel(qual_model);
+	Output_args output_args = initializeOutputStreams(name_prefix, seq_only, discard_secondary_alignments, &courier, num_workers, binning, model);
 
 	// cerr << "Initialized output streams" << endl;
 
@@ -94,10 +113,12 @@ void compressFile(string & file_name, string const & ref_file_name, const int nu
 	Parser_args parser_args;
 	parser_args.output = output_args;
 	parser_args.file_name = file_name;
+	parser_args.name_prefix = name_prefix;
 	parser_args.ref_file_name = ref_file_name;
 	parser_args.courier = &courier;
 	parser_args.seq_only = seq_only;
 	parser_args.discard_secondary_alignments = discard_secondary_alignments;
+	parser_args.consensus_edits = consensus_edits;
 
 	pthread_t * parser_thread = new pthread_t();
 	int errcode = pthread_create( parser_thread, 0, parseSAM, &parser_args );
@@ -125,7 +146,7 @@ void compressFile(string & file_name, string const & ref_file_name, const int nu
 	// cerr << "launched threads" << endl;
 
 	// concurrently wait for threads to return compressed packets; write them to disk
-	muxer(courier);
+	muxer(courier, memoryBudget().writeWindow(default_write_window) );
 
 	// join worker threads
 	for( int i = num_workers - 1; i >= 0; --i ) {
@@ -146,6 +167,232 @@ void compressFile(string & file_name, string const & ref_file_name, const int nu
 	}
 
 	// destructor in OutputBuffer will close file output streams
+	return !parser_args.failed;
+};
+
+////////////////////////////////////////////////////////////////
+// one line of a compress-batch manifest
+////////////////////////////////////////////////////////////////
+struct BatchEntry {
+	string input;
+	string name_prefix;
+	string ref_file_name;
 };
 
+////////////////////////////////////////////////////////////////
+// tab separated: input, output prefix (default: the input), reference
+// (default: -r); empty lines and lines starting w/ # are skipped
+////////////////////////////////////////////////////////////////
+vector<BatchEntry> readBatchManifest(string const & path, string const & default_ref) {
+	ifstream f_in(path);
+	check_file_open(f_in, path);
+	vector<BatchEntry> entries;
+	unordered_set<string> prefixes;
+	string line;
+	int line_num = 0;
+	while (getline(f_in, line) ) {
+		line_num++;
+		if (line.size() == 0 || line[0] == '#') continue;
+		vector<string> columns;
+		istringstream ss(line);
+		string col;
+		while (getline(ss, col, '\t') ) columns.push_back(col);
+		BatchEntry e;
+		e.input = columns[0];
+		e.name_prefix = columns.size() > 1 && columns[1].size() > 0 ? columns[1] : e.input;
+		e.ref_file_name = columns.size() > 2 && columns[2].size() > 0 ? columns[2] : default_ref;
+		if (e.input == "-") {
+			cerr << "[ERROR] " << path << ":" << line_num << ": stdin can not be part of a batch" << endl;
+			exit(1);
+		}
+		if (e.ref_file_name.size() == 0) {
+			cerr << "[ERROR] " << path << ":" << line_num << ": no reference for " << e.input << " (use -r)" << endl;
+			exit(1);
+		}
+		if (!prefixes.insert(e.name_prefix).second) {
+			cerr << "[ERROR] " << path << ":" << line_num << ": output prefix used twice: " << e.name_prefix << endl;
+			exit(1);
+		}
+		entries.push_back(e);
+	}
+	return entries;
+}
+
+////////////////////////////////////////////////////////////////
+// state shared by the job threads of a batch
+////////////////////////////////////////////////////////////////
+struct Batch_args {
+	vector<BatchEntry> const * entries;
+	Packet_courier * courier;
+	int num_workers;
+	bool seq_only;
+	bool discard_secondary_alignments;
+	bool consensus_edits;
+	QualityBinning const * binning;
+	shared_ptr<TrainedQualityModel const> qual_model;	// read once for all the files
+
+	pthread_mutex_t mutex;
+	size_t next = 0;	// next entry to compress
+	int failed = 0;
+};
+
+////////////////////////////////////////////////////////////////
+// compress entries until none are left; each file is its own producer
+// for the shared courier
+////////////////////////////////////////////////////////////////
+void * batchJob(void * ba) {
+	Batch_args & batch = *(Batch_args *)ba;
+	while (true) {
+		pthread_mutex_lock(&batch.mutex);
+		size_t i = batch.next++;
+		pthread_mutex_unlock(&batch.mutex);
+		if (i >= batch.entries->size() ) break;
+		BatchEntry const & e = batch.entries->at(i);
+		cerr << "[INFO] Compressing " << e.input << " into " << e.name_prefix << ".*" << endl;
+
+		Packet_courier::source() = i + 1;
+		Parser_args parser_args;
+		parser_args.output = initializeOutputStreams(e.name_prefix, batch.seq_only, batch.discard_secondary_alignments,
+			batch.courier, batch.num_workers, *batch.binning, batch.qual_model);
+		parser_args.file_name = e.input;
+		parser_args.name_prefix = e.name_prefix;
+		parser_args.ref_file_name = e.ref_file_name;
+		parser_args.num_parsing_threads = 1;
+		parser_args.courier = batch.courier;
+		parser_args.seq_only = batch.seq_only;
+		parser_args.discard_secondary_alignments = batch.discard_secondary_alignments;
+		parser_args.consensus_edits = batch.consensus_edits;
+		parseSAM(&parser_args);
+		// the files close when the streams go out of scope
+		batch.courier->wait_written();
+		if (parser_args.failed) {
+			pthread_mutex_lock(&batch.mutex);
+			batch.failed++;
+			pthread_mutex_unlock(&batch.mutex);
+		}
+		else
+			cerr << "[INFO] Compressed streams written to " << e.name_prefix << ".*" << endl;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// compress every file of the manifest in one process: up to num_jobs
+// files at a time share the reference cache, the workers and the muxer.
+// Returns the number of files that could not be compressed
+////////////////////////////////////////////////////////////////
+int compressBatch(vector<BatchEntry> const & entries, const int num_workers, const int num_jobs,
+	bool seq_only, bool discard_secondary_alignments, QualityBinning const & binning,
+	string const & qual_model, bool consensus_edits, size_t max_memory = 0) {
+	if (entries.size() == 0) return 0;
+	int jobs = std::max(1, std::min(num_jobs, (int)entries.size() ) );
+
+	// a chromosome is read once for all the files on the same reference
+	size_t cache_cap = max_memory > 0 ? max_memory / 4 : REFERENCE_CACHE_BYTES;
+	referenceCache().setCap(cache_cap);
+	memoryBudget().setLimit( (max_memory - (max_memory > 0 ? cache_cap : 0) ) / jobs, num_workers);
+
+	int dictionary_size = std::min(1<<23, memoryBudget().blockCap() );
+	int match_len_limit = 36; // equivalent to -6 option
+	const int slots_per_worker = 20;
+	const int num_slots = memoryBudget().slots(
+		( ( num_workers > 1 ) ? num_workers * slots_per_worker : 1 ), num_workers);
+
+	Packet_courier courier(num_workers, num_slots);
+	courier.set_producers(entries.size() );
+
+	Batch_args batch;
+	batch.entries = &entries;
+	batch.courier = &courier;
+	batch.num_workers = num_workers;
+	batch.seq_only = seq_only;
+	batch.discard_secondary_alignments = discard_secondary_alignments;
+	batch.consensus_edits = consensus_edits;
+	batch.binning = &binning;
+	if (qual_model.size() > 0) batch.qual_model = loadQualityModel(qual_model);
+	pthread_mutex_init(&batch.mutex, 0);
+
+	vector<pthread_t> job_threads(jobs);
+	for (int i = 0; i < jobs; i++) {
+		int errcode = pthread_create(&job_threads[i], 0, batchJob, &batch);
+		if (errcode) {
+			show_error( "Can't create batch threads", errcode ); cleanup_and_fail();
+		}
+	}
+
+	Worker_arg worker_arg;
+	worker_arg.courier = &courier;
+	worker_arg.dictionary_size = dictionary_size;
+	worker_arg.match_len_limit = match_len_limit;
+	vector<pthread_t> worker_threads(num_workers);
+	for (int i = 0; i < num_workers; i++) {
+		int errcode = pthread_create(&worker_threads[i], 0, cworker, &worker_arg);
+		if (errcode) {
+			show_error( "Can't create worker threads", errcode ); cleanup_and_fail();
+		}
+	}
+
+	muxer(courier, memoryBudget().writeWindow(default_write_window) );
+
+	for (int i = 0; i < num_workers; i++) {
+		int errcode = pthread_join(worker_threads[i], 0);
+		if (errcode) {
+			show_error( "Can't join worker threads", errcode ); cleanup_and_fail();
+		}
+	}
+	for (int i = 0; i < jobs; i++) {
+		int errcode = pthread_join(job_threads[i], 0);
+		if (errcode) {
+			show_error( "Can't join batch threads", errcode ); cleanup_and_fail();
+		}
+	}
+	pthread_mutex_destroy(&batch.mutex);
+	referenceCache().setCap(0);
+	cerr << "[INFO] Batch done: " << entries.size() - batch.failed << " of " << entries.size() << " files compressed" << endl;
+	return batch.failed;
+}
+
+////////////////////////////////////////////////////////////////
+// cluster a sample of the quality vectors of a whole file and save the
+// clusters for --qual-model
+////////////////////////////////////////////////////////////////
+void trainQualityModel(string const & file_name, string const & model_path, const int num_threads) {
+	IOLibParser parser(file_name, num_threads);
+	if (parser.failed() ) {
+		cerr << "[ERROR] Could not read alignments from " << file_name << endl;
+		exit(1);
+	}
+	shared_ptr<QualityReservoir> reservoir(new QualityReservoir(200000) );
+	string q_v;
+	while ( parser.read_next() ) {
+		IOLibAlignment al(parser.getRead() );
+		if ( al.isUnalined() || !al.isPrimary() ) continue;
+		// same orientation and offset as in Compressor::handleQuals
+		int len = al.read_len();
+		auto* q = al.quals();
+		q_v.resize(len);
+		for (int i = 0; i < len; i++)
+			q_v[al.isRC() ? len - i - 1 : i] = q[i] + '!';
+		reservoir->offer(q_v);
+	}
+	parser.close();
+
+	// rounds over the same sample pick up what the earlier clusters missed
+	QualityAlphabet alphabet;
+	bool alphabet_ready = false;
+	int K = 3;
+	vector<shared_ptr<QualityCluster>> clusters;
+	for (int round = 0; round < 4; round++) {
+		QualityDiscovery discovery(nullptr, reservoir, clusters, alphabet, alphabet_ready, K, 0.05);
+		discovery.start();
+		discovery.join();
+		alphabet = discovery.getAlphabet();
+		alphabet_ready = true;
+		auto & found = discovery.getClusters();
+		if (found.size() == 0) break;
+		clusters.insert(clusters.end(), found.begin(), found.end() );
+	}
+	saveQualityModel(model_path, alphabet, K, clusters);
+}
+
 #endif
@@ -40,7 +40,8 @@ void stitchAlignmentsSerial(
 	RefereeHeader & header) {
 	// keep stitching alignments while there is data available
 	Decompressor D(input_fname, output_name, ref_name);
-	uint8_t options = D_SEQ | D_FLAGS | D_READIDS | D_OPTIONAL_FIELDS;
+	// optional fields are decoded from the start of the file only
+	uint8_t options = D_SEQ | D_FLAGS | D_READIDS;
 	D.decompressInterval(requested_interval, header, input_streams, options);
 }
 
@@ -103,7 +104,7 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 
 	// set up inputs
 	unordered_map<string,shared_ptr<vector<TrueGenomicInterval>>> all_intervals =
-		parseGenomicIntervals("genomic_intervals.txt");
+		parseGenomicIntervals(intervalsFile(file_name) );
 	InputStreams input_streams;
 
 	int buffer_size = pow(2, 24); // 16Mb
@@ -117,7 +118,8 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 	streams_used.insert(".offs.lz"); streams_used.insert(".edits.lz"); streams_used.insert(".has_edits.lz");
 	streams_used.insert(".left_clip.lz"); streams_used.insert(".right_clip.lz");
 	streams_used.insert(".flags.lz"); streams_used.insert(".ids.lz");
-	streams_used.insert(".membership.lz");
+	streams_used.insert(".membership.lz"); streams_used.insert(".opt.lz");
+	streams_used.insert(".read_lens.lz"); streams_used.insert(".primary.lz");
 
 	// parse head file and get transcript mapping as well as remappings of the 
 	// flags, mapq, and other numerical fields
@@ -138,6 +140,14 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 			// already saw this suffix and initialized buffers for it
 			continue;
 
+		// binned qualities are range coded rather than lzip'ed
+		if (suffix.compare(BINNED_QUALS_SUFFIX) == 0) {
+			input_streams.qualities = shared_ptr<QualitySource>(
+				new BinnedQualityStream(file_name + suffix, intervals, header.getQualityBinning() ) );
+			suffixes.insert(suffix);
+			continue;
+		}
+
 		// not processing some streams
 		if (streams_used.find(suffix) == streams_used.end()) continue;
 		shared_ptr<InputBuffer> buf(new InputBuffer(file_name + suffix, intervals, buffer_size, buffer_id));
@@ -152,6 +162,12 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 			buffer_map.emplace(buffer_id++, has_edits_ib);
 			input_streams.edits = shared_ptr<EditsStream>(new EditsStream(buf, has_edits_ib) );
 		}
+		else if (suffix.compare(".read_lens.lz") == 0) {
+			input_streams.read_lens = shared_ptr<ReadLenStream>(new ReadLenStream(buf, read_len) );
+		}
+		else if (suffix.compare(".primary.lz") == 0) {
+			input_streams.primary_refs = shared_ptr<PrimaryRefStream>(new PrimaryRefStream(buf) );
+		}
 		else if (suffix.compare(".left_clip.lz") == 0) {
 			input_streams.left_clips = shared_ptr<ClipStream>(new ClipStream(buf) );
 		}
@@ -162,10 +178,31 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 			input_streams.flags = shared_ptr<FlagsStream>(new FlagsStream(buf, flag_map, mapq_map, rnext_map) );
 		}
 		else if (suffix.compare(".ids.lz") == 0) {
-			input_streams.readIDs = shared_ptr<ReadIDStream>(new ReadIDStream(buf) );
+			// token columns; positions that never carried data have no stream
+			vector<shared_ptr<InputBuffer>> columns(NAME_MAX_TOKENS);
+			for (int i = 0; i < NAME_MAX_TOKENS; i++) {
+				string column_suffix = ".ids." + to_string(i) + ".lz";
+				auto it = all_intervals.find(column_suffix);
+				if (it == all_intervals.end() ) continue;
+				columns[i] = shared_ptr<InputBuffer>(new InputBuffer(file_name + column_suffix,
+					it->second, buffer_size, buffer_id) );
+				buffer_map.emplace(buffer_id++, columns[i]);
+			}
+			input_streams.readIDs = shared_ptr<ReadIDStream>(new ReadIDStream(buf, columns) );
+		}
+		else if (suffix.compare(".opt.lz") == 0) {
+			// one column per tag key and type
+			unordered_map<string, shared_ptr<InputBuffer>> columns;
+			for (auto & p : all_intervals) {
+				if (p.first.compare(0, 5, ".opt.") != 0 || p.first.compare(".opt.lz") == 0) continue;
+				columns[p.first] = shared_ptr<InputBuffer>(new InputBuffer(file_name + p.first,
+					p.second, buffer_size, buffer_id) );
+				buffer_map.emplace(buffer_id++, columns[p.first]);
+			}
+			input_streams.optional_fields = shared_ptr<AuxTagStream>(new AuxTagStream(buf, columns) );
 		}
 		else if (suffix.compare(".membership.lz") == 0) {
-			input_streams.qualities = shared_ptr<QualityStream>(new QualityStream(buf, file_name, all_intervals, buffer_size) );
+			input_streams.qualities = shared_ptr<QualitySource>(new QualityStream(buf, file_name, all_intervals, buffer_size) );
 		}
 		suffixes.insert(suffix);
 	}
@@ -183,7 +220,10 @@ int decompressFileSequential(string const & file_name, string const & ref_file_n
 	else {
 		// keep stitching alignments while there is data available
 		Decompressor D(file_name, fname_out, ref_file_name);
-		D.decompress(header, input_streams, D_READIDS | D_SEQ | D_FLAGS /*| D_QUALS*/ | D_OPTIONAL_FIELDS);
+		uint8_t options = D_READIDS | D_SEQ | D_FLAGS | D_OPTIONAL_FIELDS;
+		// qualities are restored whenever they were archived
+		if (input_streams.qualities != nullptr) options |= D_QUALS;
+		D.decompress(header, input_streams, options);
 	}
 }
 
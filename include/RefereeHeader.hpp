@@ -1,6 +1,8 @@
 #ifndef REFEREE_HEADER_LIB
 #define REFEREE_HEADER_LIB
 
+#include "QualityBinning.hpp"
+
 class RefereeHeader {
 
 	string version;
@@ -22,6 +24,12 @@ class RefereeHeader {
 
 	int read_len;
 
+	// how quality values were encoded (qual_mode=...); archives without the line are lossless
+	QualityBinning binning;
+
+	// mismatches refer to a consensus built while decoding (consensus_edits=1)
+	bool consensus_edits = false;
+
 	pair<int,int> parseFlagLine(string const & line) {
 		// cerr << line << endl;
 		auto idx = line.find(" ");
@@ -52,7 +60,19 @@ public:
 		string line, t_name, type, chromo;
 		while (getline(f_in, line)) {
 			// cerr << line << endl;
-			if (line.find("HD") != string::npos) {
+			if (line.find("qual_mode=") == 0) {
+				if ( !parseQualityMode(line.substr(10), binning) ) {
+					cerr << "[ERROR] Unsupported quality mode in " << path << endl;
+					exit(1);
+				}
+			}
+			else if (line.find("consensus_edits=") == 0) {
+				consensus_edits = line.substr(16) == "1";
+			}
+			else if (line == INTERVALS_HEAD_LINE) {
+				// see intervalsFile
+			}
+			else if (line.find("HD") != string::npos) {
 				// version
 				auto idx = line.find(separator);
 				version = line.substr(idx+1);
@@ -108,6 +128,10 @@ public:
 
 	int getReadLen() { return read_len;}
 
+	QualityBinning const & getQualityBinning() { return binning; }
+
+	bool hasConsensusEdits() { return consensus_edits; }
+
 	size_t getTranscriptLength(int t_id) {
 		if (lengths.find(t_id) == lengths.end()) return -1;
 		return lengths[t_id];
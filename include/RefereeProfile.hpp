@@ -0,0 +1,150 @@
+/*
+Scoped timers and counters for the compression and decompression stages.
+Everything here compiles to nothing unless REFEREE_PROFILE is defined
+(make PROFILE=1). Each thread accumulates into its own table; tables are
+merged into a global one when the thread exits or a report is written.
+*/
+
+#ifndef REFEREE_PROFILE_H
+#define REFEREE_PROFILE_H
+
+#include <string>
+#include <iostream>
+
+#ifdef REFEREE_PROFILE
+
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <chrono>
+#include <stdint.h>
+#include <pthread.h>
+
+struct ProfileStat {
+	uint64_t calls = 0;	// times a scope was entered
+	uint64_t nanos = 0;	// total time spent in the scope
+	uint64_t count = 0;	// items reported through PROFILE_COUNT
+};
+
+////////////////////////////////////////////////////////////////
+// totals over all threads that exited or were flushed so far
+////////////////////////////////////////////////////////////////
+class ProfileRegistry {
+	pthread_mutex_t mutex;
+
+	std::map<std::string, ProfileStat> totals;
+
+	int num_threads = 0;
+
+public:
+	ProfileRegistry() { pthread_mutex_init(&mutex, 0); }
+
+	~ProfileRegistry() { pthread_mutex_destroy(&mutex); }
+
+	void merge(std::unordered_map<const char *, ProfileStat> & stats) {
+		if (stats.empty()) return;
+		pthread_mutex_lock(&mutex);
+		for (auto & s : stats) {
+			ProfileStat & t = totals[s.first];
+			t.calls += s.second.calls;
+			t.nanos += s.second.nanos;
+			t.count += s.second.count;
+		}
+		num_threads++;
+		pthread_mutex_unlock(&mutex);
+		stats.clear();
+	}
+
+	void write(std::ostream & out) {
+		pthread_mutex_lock(&mutex);
+		out << "{" << std::endl;
+		out << "\t\"threads\": " << num_threads << "," << std::endl;
+		out << "\t\"stages\": {";
+		bool first = true;
+		for (auto & t : totals) {
+			out << (first ? "" : ",") << std::endl;
+			out << "\t\t\"" << t.first << "\": {\"calls\": " << t.second.calls <<
+				", \"seconds\": " << t.second.nanos / 1e9 <<
+				", \"count\": " << t.second.count << "}";
+			first = false;
+		}
+		out << std::endl << "\t}" << std::endl << "}" << std::endl;
+		pthread_mutex_unlock(&mutex);
+	}
+};
+
+inline ProfileRegistry & profileRegistry() {
+	static ProfileRegistry registry;
+	return registry;
+}
+
+////////////////////////////////////////////////////////////////
+// per-thread table; handed over to the registry when the thread exits
+////////////////////////////////////////////////////////////////
+struct ThreadProfile {
+	std::unordered_map<const char *, ProfileStat> stats;
+
+	ThreadProfile() { profileRegistry(); } // registry must outlive the thread tables
+
+	~ThreadProfile() { profileRegistry().merge(stats); }
+};
+
+inline ThreadProfile & threadProfile() {
+	thread_local ThreadProfile profile;
+	return profile;
+}
+
+////////////////////////////////////////////////////////////////
+class ProfileScope {
+	ProfileStat & stat;
+
+	std::chrono::steady_clock::time_point start;
+
+public:
+	ProfileScope(const char * name):
+		stat(threadProfile().stats[name]),
+		start(std::chrono::steady_clock::now()) {}
+
+	~ProfileScope() {
+		stat.calls++;
+		stat.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+inline void profileCount(const char * name, uint64_t n) {
+	threadProfile().stats[name].count += n;
+}
+
+////////////////////////////////////////////////////////////////
+// merge the calling thread's table and dump everything as JSON
+////////////////////////////////////////////////////////////////
+inline void writeProfileReport(std::string const & path) {
+	profileRegistry().merge(threadProfile().stats);
+	std::ofstream out(path);
+	if (!out) {
+		std::cerr << "[ERROR] Could not write the profile report to " << path << std::endl;
+		return;
+	}
+	profileRegistry().write(out);
+	std::cerr << "[INFO] Profile report written to " << path << std::endl;
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(name, n) profileCount(name, n)
+
+#else
+
+inline void writeProfileReport(std::string const & path) {
+	std::cerr << "[INFO] Profiling is not compiled in (rebuild with make PROFILE=1); " <<
+		"no report written to " << path << std::endl;
+}
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, n)
+
+#endif
+
+#endif
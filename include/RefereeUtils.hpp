@@ -25,6 +25,13 @@ char CODE_ORDER[L+1] = "ACDEHGLNRTVWXYZ";
 #define position_t int
 #define edit_dist_t vector<unsigned short>
 
+// block intervals of all the streams, written next to them; older archives
+// have them in genomic_intervals.txt in the working directory
+#define INTERVALS_SUFFIX ".genomic_intervals.txt"
+#define LEGACY_INTERVALS_FILE "genomic_intervals.txt"
+// line in the .head of archives w/ intervals under their own prefix
+#define INTERVALS_HEAD_LINE "intervals=prefix"
+
 ////////////////////////////////////////////////////////////////
 void check_file_open(ifstream & ref_in, string const & fname) {
   if (!ref_in) {
@@ -47,6 +54,26 @@ void check_file_open(ofstream & f, string const & fname) {
   }
 }
 
+////////////////////////////////////////////////////////////////
+// block intervals of an archive. Archives that record INTERVALS_HEAD_LINE
+// in their .head have their own file; older ones share the one in the
+// working directory
+////////////////////////////////////////////////////////////////
+string intervalsFile(string const & name_prefix) {
+  string own = name_prefix + INTERVALS_SUFFIX;
+  if (ifstream(own) ) return own;
+  ifstream head(name_prefix + ".head");
+  string line;
+  while (getline(head, line) ) {
+    if (line == INTERVALS_HEAD_LINE) {
+      cerr << "[ERROR] Missing " << own << endl;
+      exit(1);
+    }
+  }
+  cerr << "[INFO] No " << own << ", using " << LEGACY_INTERVALS_FILE << " of an older archive" << endl;
+  return LEGACY_INTERVALS_FILE;
+}
+
 ////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////
@@ -112,12 +139,38 @@ inline vector<uint8_t> reverse_complement(vector<uint8_t> & v) {
 }
 
 ////////////////////////////////////////////////////////////////
-inline string getMinimizer(vector<uint8_t> & v, int len) {
-	vector<string> kmers;
-	for (int i = 0; i < v.size() - len + 1; i++)
-		kmers.push_back( string(v.begin() + i, v.begin() + i + len) );
-	sort(kmers.begin(), kmers.end() );
-	return kmers[0];
+// smallest k-mer (k <= 16, 2 bits per base) over both strands, in one pass;
+// rc is set when it only occurs on the reverse complement. Bases other than
+// A, C, G, T restart the window. ~0 if the read has no full k-mer
+////////////////////////////////////////////////////////////////
+inline uint32_t canonicalMinimizer(vector<uint8_t> const & v, int k, bool & rc) {
+	uint32_t mask = (k < 16) ? (1u << (2 * k) ) - 1 : ~0u;
+	uint32_t fwd = 0, rev = 0, best = ~0u;
+	int valid = 0;
+	rc = false;
+	for (auto c : v) {
+		uint32_t b;
+		switch (c) {
+			case 'A': b = 0; break;
+			case 'C': b = 1; break;
+			case 'G': b = 2; break;
+			case 'T': b = 3; break;
+			default: valid = 0; continue;
+		}
+		fwd = ( (fwd << 2) | b) & mask;
+		rev = (rev >> 2) | ( (3 - b) << (2 * (k - 1) ) );
+		if (++valid < k) continue;
+		// ties go to the forward strand
+		if (fwd <= best) {
+			best = fwd;
+			rc = false;
+		}
+		if (rev < best) {
+			best = rev;
+			rc = true;
+		}
+	}
+	return best;
 }
 
 ////////////////////////////////////////////////////////////////
@@ -0,0 +1,138 @@
+/*
+Intron lengths of the splices in the edits stream, numbered in the order
+they first appear in a block. A splice whose length is already in the table
+is written as
+
+	J <gap> <id>		short form: one byte each; long form: varints
+
+instead of E <gap> <len>. Lengths of new splices go into the table after
+the alignment, so an alignment only refers to lengths from earlier
+alignments. The table starts empty in every block of the edits stream (the
+block the first byte of an alignment falls into), which keeps the ids of a
+block independent of the blocks before it.
+
+The table is keyed by the intron length only: EditsStream decodes the edits
+w/o the offset of the alignment, so the donor position is not known there.
+The table itself is not stored, the decoder builds the same one from the
+splices of the block; tools counting splices go through the resolved ops.
+*/
+
+#ifndef SPLICE_JUNCTIONS_H
+#define SPLICE_JUNCTIONS_H
+
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <cstdlib>
+
+#include "LongEdits.hpp"
+
+using namespace std;
+
+#define EDIT_JUNCTION 'J'
+
+#define JUNCTION_TABLE_MAX (1 << 16)
+
+// ids the short form can refer to
+#define JUNCTION_SHORT_IDS 256
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class JunctionTable {
+
+	unordered_map<int, int> ids;
+
+	vector<int> lengths;
+
+	// splices of the current alignment
+	vector<int> seen;
+
+	////////////////////////////////////////////////////////////////
+	void pushSplice(vector<int> & out, int gap, int len) {
+		if (len > 65535) {
+			out.push_back('E' | 128);
+			out.push_back(gap);
+			out.push_back(len >> 16);
+			out.push_back( (len >> 8) & 255);
+			out.push_back(len & 255);
+		}
+		else {
+			out.push_back('E');
+			out.push_back(gap);
+			out.push_back(len >> 8);
+			out.push_back(len & 255);
+		}
+	}
+
+public:
+
+	////////////////////////////////////////////////////////////////
+	// -1 if the length is not in the table
+	////////////////////////////////////////////////////////////////
+	int id(int len) {
+		auto it = ids.find(len);
+		return (it == ids.end() ) ? -1 : it->second;
+	}
+
+	void observe(int len) { seen.push_back(len); }
+
+	////////////////////////////////////////////////////////////////
+	// add the new lengths of the current alignment
+	////////////////////////////////////////////////////////////////
+	void endAlignment() {
+		for (auto len : seen) {
+			if (lengths.size() >= JUNCTION_TABLE_MAX) break;
+			if (ids.find(len) != ids.end() ) continue;
+			ids[len] = lengths.size();
+			lengths.push_back(len);
+		}
+		seen.clear();
+	}
+
+	void clear() {
+		ids.clear();
+		lengths.clear();
+		seen.clear();
+	}
+
+	size_t size() { return lengths.size(); }
+
+	////////////////////////////////////////////////////////////////
+	// decoder: replace junction ops w/ splice ops, then add the new lengths;
+	// edits are short form ops (expanded from the long form if needed)
+	////////////////////////////////////////////////////////////////
+	void resolve(vector<int> & edits) {
+		vector<int> out;
+		out.reserve(edits.size() + 4);
+		size_t j = 0;
+		while (j < edits.size() ) {
+			int op = edits[j];
+			int n = editOpSize(op);
+			if (j + n > edits.size() ) {
+				cerr << "[ERROR] Truncated edit op: " << op << endl;
+				exit(1);
+			}
+			if (op == EDIT_JUNCTION) {
+				int id = edits[j + 2];
+				if (id < 0 || id >= (int)lengths.size() ) {
+					cerr << "[ERROR] Unknown splice junction in the edits: " << id << endl;
+					exit(1);
+				}
+				pushSplice(out, edits[j + 1], lengths[id]);
+			}
+			else {
+				if (op == 'E') observe( (edits[j + 2] << 8) | edits[j + 3]);
+				else if (op == ('E' | 128) ) observe( (edits[j + 2] << 16) | (edits[j + 3] << 8) | edits[j + 4]);
+				out.insert(out.end(), edits.begin() + j, edits.begin() + j + n);
+			}
+			j += n;
+		}
+		endAlignment();
+		edits.swap(out);
+	}
+};
+
+#endif
@@ -2,15 +2,102 @@
 #define TRANS_STREAM_H
 
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <list>
 #include <algorithm>
+#include <functional>
+#include <pthread.h>
 
 #include "RefereeUtils.hpp"
+#include "RefereeProfile.hpp"
 #include "FastaReader.h"
 
 const string separator = "\t\s ";
 
+// reference cache size for compress-batch w/o --max-memory (a human genome fits)
+#define REFERENCE_CACHE_BYTES (1ul << 32)
+
+////////////////////////////////////////////////////////////////
+// reference sequences shared by the compressors of a batch: keeps the most
+// recently used ones up to cap bytes. The cap is 0 (nothing kept) unless set
+////////////////////////////////////////////////////////////////
+class ReferenceCache {
+
+	pthread_mutex_t mutex;
+
+	size_t cap = 0;
+
+	size_t held = 0;
+
+	// most recent in front; keyed by reference path and sequence name
+	list<pair<string, shared_ptr<string>>> recent;
+
+	unordered_map<string, list<pair<string, shared_ptr<string>>>::iterator> index;
+
+	// keys being read from disk; loaded is signalled when one is done
+	unordered_set<string> loading;
+
+	pthread_cond_t loaded;
+
+public:
+	ReferenceCache() {
+		pthread_mutex_init(&mutex, 0);
+		pthread_cond_init(&loaded, 0);
+	}
+
+	~ReferenceCache() {
+		pthread_cond_destroy(&loaded);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	void setCap(size_t bytes) { cap = bytes; }
+
+	////////////////////////////////////////////////////////////////
+	// cached sequence, or the one load() returns (nullptr if it failed).
+	// A sequence is loaded once: jobs that want it while it is being read
+	// wait for that load, jobs that want other sequences do not
+	////////////////////////////////////////////////////////////////
+	shared_ptr<string> get(string const & path, string const & name, function<shared_ptr<string>()> load) {
+		if (cap == 0) return load();
+		string key = path + '\t' + name;
+		pthread_mutex_lock(&mutex);
+		while (loading.count(key) > 0) pthread_cond_wait(&loaded, &mutex);
+		auto it = index.find(key);
+		if (it != index.end() ) {
+			recent.splice(recent.begin(), recent, it->second);
+			auto seq = it->second->second;
+			pthread_mutex_unlock(&mutex);
+			return seq;
+		}
+		loading.insert(key);
+		pthread_mutex_unlock(&mutex);
+
+		auto seq = load();
+
+		pthread_mutex_lock(&mutex);
+		loading.erase(key);
+		if (seq != nullptr) {
+			recent.push_front(make_pair(key, seq) );
+			index[key] = recent.begin();
+			held += seq->size();
+			while (held > cap && recent.size() > 1) {
+				held -= recent.back().second->size();
+				index.erase(recent.back().first);
+				recent.pop_back();
+			}
+		}
+		pthread_cond_broadcast(&loaded);
+		pthread_mutex_unlock(&mutex);
+		return seq;
+	}
+};
+
+inline ReferenceCache & referenceCache() {
+	static ReferenceCache cache;
+	return cache;
+}
+
 
 class TranscriptsStream {
 
@@ -49,6 +136,12 @@ class TranscriptsStream {
 
 	int read_len = 0;
 
+	// compressing: errors are reported through failed() so that the other
+	// files of a batch go on; decompressing: errors end the process
+	bool compressing = false;
+
+	bool failed_ = false;
+
 	////////////////////////////////////////////////////////////////
 	// build a fai index for a file
 	////////////////////////////////////////////////////////////////
@@ -185,10 +278,11 @@ class TranscriptsStream {
 	//
 	////////////////////////////////////////////////////////////////
 	shared_ptr<string> readTranscriptSequence(string const & ref_name, FaiEntry & entry) {
+		PROFILE_SCOPE("reference.load");
 		ifstream f_in(ref_name);
 		if (!f_in) {
 			cerr << "[ERROR] Could not open reference sequence file: " << ref_name << endl;
-			exit(1);
+			return nullptr;
 		}
 		int num_lines = (int) ceil( (double)entry.num_bases / entry.bases_per_line );
 		int newline_chars = entry.bytes_per_line - entry.bases_per_line;
@@ -200,7 +294,6 @@ class TranscriptsStream {
 		f_in.read( (char*)&S[0], bytes_to_read);	// read all bytes representing the sequence
 
 		// remove newline characters
-		auto start_time = chrono::system_clock::now();
 		int i = 0, prev_i = 0, N = bytes_to_read;
 		string str;
 		while (i < N) {
@@ -213,7 +306,6 @@ class TranscriptsStream {
 				prev_i = i;
 			}
 		}
-		auto end_time = chrono::system_clock::now();
 		assert(str.size() == entry.num_bases);
 		// append to the prev line
 		return make_shared<string>(str);
@@ -226,6 +318,7 @@ public:
 		unordered_map<int, string> const & Ts = {{0, "" }}) : ref_path(ref) {
 		if (mode.compare("-c") == 0) {
 			// if compressing: build a t_map
+			compressing = true;
 		}
 		else {
 			// if decompressing: read a t_map
@@ -270,6 +363,7 @@ public:
 	////////////////////////////////////////////////////////////////
 	// offset -- 0-based offset into the reference sequence
 	// len -- lenght of the sequence to extract
+	// w/ an error while compressing: Ns, and failed() is set
 	////////////////////////////////////////////////////////////////
 	string getTranscriptSequence(int const ref_id, int const offset, int const len) {
 		// use fai to read one seq at a time
@@ -278,26 +372,33 @@ public:
 		if (it == ref_sequence.end() ) {
 			cerr << "[INFO] Loading sequence for " << mapped_name;
 			if ( fai_index.find(mapped_name) == fai_index.end() ) {
-				cerr << "[ERROR] Reference name " << mapped_name << " not in the index." << endl;
-				exit(1);
+				cerr << endl << "[ERROR] Reference name " << mapped_name << " not in the index." << endl;
+				if (!compressing) exit(1);
+				failed_ = true;
+				return string(len, 'N');
 			}
 			auto entry = fai_index[mapped_name];
-			auto seq = readTranscriptSequence(ref_path, entry);
-			if (seq->size() < offset + len) {
-				cerr << "seq size: " << seq->size() << " vs  offs " << offset << " len " << len << endl;
+			auto seq = referenceCache().get(ref_path, mapped_name,
+				[&]() { return readTranscriptSequence(ref_path, entry); });
+			if (seq == nullptr) {
+				if (!compressing) exit(1);
+				failed_ = true;
+				return string(len, 'N');
 			}
-			assert(offset + len <= seq->size() );
 			cerr << " - loaded." << endl;
 			// store for fast access later
-			ref_sequence[mapped_name] = seq;
-			return seq->substr(offset, len);
+			it = ref_sequence.insert(make_pair(mapped_name, seq) ).first;
 		}
 		if (it->second->size() < offset + len) {
-			cerr << "[ERROR] Offset is past the length of the reference sequence" << endl;
-			return "";
+			cerr << "[ERROR] Offset is past the length of the reference sequence " << mapped_name << endl;
+			if (!compressing) return "";
+			failed_ = true;
+			return string(len, 'N');
 		}
 		return it->second->substr(offset, len);
 	}
+
+	bool failed() { return failed_; }
 };
 
 #endif
@@ -0,0 +1,175 @@
+/*
+Optional fields in typed columns plus a layout stream; see AuxTagCodec.hpp
+for the format
+*/
+
+#ifndef AUX_TAG_ENCODER_H
+#define AUX_TAG_ENCODER_H
+
+#include <unordered_map>
+
+#include <compress.h>
+
+#include "OutputBuffer.hpp"
+#include "AuxTagCodec.hpp"
+
+////////////////////////////////////////////////////////////////
+// stream for one tag key and type
+////////////////////////////////////////////////////////////////
+struct AuxColumn {
+	shared_ptr<OutputBuffer> buf;
+
+	// last integer value
+	int64_t prev = 0;
+
+	unordered_map<string, uint32_t> dict;
+};
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class AuxTagEncoder {
+
+	Packet_courier * courier;
+
+	shared_ptr<ofstream> genomic_coord_out;
+
+	string fname;
+
+	shared_ptr<OutputBuffer> layout_buf;
+
+	// layout (keys and types) -> id; ids start at 1
+	unordered_map<string, uint32_t> layouts;
+
+	// opened when the tag first shows up; keyed by column suffix
+	unordered_map<string, AuxColumn> columns;
+
+	string layout;
+
+	GenomicCoordinate startCoord;
+
+	AuxColumn & column(char key0, char key1, char type) {
+		string suffix = auxColumnSuffix(key0, key1, type);
+		AuxColumn & c = columns[suffix];
+		if (c.buf == nullptr) {
+			c.buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, genomic_coord_out,
+				fname, suffix, 1 << 20, 12) );
+			c.buf->setInitialCoordinate(startCoord.chromosome, startCoord.offset);
+		}
+		return c;
+	}
+
+	////////////////////////////////////////////////////////////////
+	void encodeString(AuxColumn & c, char const * s, GenomicCoordinate & gc, size_t num) {
+		string value(s);
+		auto it = c.dict.find(value);
+		if (it != c.dict.end() ) {
+			writeVarint(it->second + 1, c.buf, gc, num);
+			return;
+		}
+		writeVarint(0, c.buf, gc, num);
+		writeNameToken(value.c_str(), value.size(), c.buf, gc, num);
+		if (c.dict.size() < AUX_DICT_MAX) {
+			uint32_t idx = c.dict.size();
+			c.dict[value] = idx;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+	void encodeArray(AuxColumn & c, uint8_t const * p, GenomicCoordinate & gc, size_t num) {
+		char subtype = p[0];
+		uint32_t count = auxInteger('I', p + 1);
+		int size = auxValueSize(subtype);
+		addUnsignedByte(subtype, c.buf, gc, num);
+		writeVarint(count, c.buf, gc, num);
+		p += 5;
+		if (subtype == 'f')
+			writeBytes(p, count * size, c.buf, gc, num);
+		else {
+			for (uint32_t i = 0; i < count; i++, p += size)
+				writeVarint(zigzag(auxInteger(subtype, p) ), c.buf, gc, num);
+		}
+	}
+
+public:
+	AuxTagEncoder(Packet_courier * c, shared_ptr<ofstream> gc_out, string const & fn):
+		courier(c),
+		genomic_coord_out(gc_out),
+		fname(fn) {
+		layout_buf = shared_ptr<OutputBuffer>(new OutputBuffer(courier, gc_out, fname, ".opt.lz", 1 << 20, 12) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	void encode(vector<AuxField> const & fields, GenomicCoordinate & gc, size_t num) {
+		layout.clear();
+		for (auto & f : fields) {
+			char type = auxColumnType(f.type() );
+			if (type == 0) continue;
+			layout.push_back(f.key0() );
+			layout.push_back(f.key1() );
+			layout.push_back(type);
+		}
+		auto it = layouts.find(layout);
+		if (it != layouts.end() )
+			writeVarint(it->second, layout_buf, gc, num);
+		else {
+			uint32_t id = layouts.size() + 1;
+			layouts[layout] = id;
+			writeVarint(0, layout_buf, gc, num);
+			writeVarint(layout.size() / 3, layout_buf, gc, num);
+			writeBytes( (uint8_t const *)layout.data(), layout.size(), layout_buf, gc, num);
+		}
+
+		for (auto & f : fields) {
+			char type = auxColumnType(f.type() );
+			// MD comes back from the edits
+			if (type == 0 || f.isMD() ) continue;
+			AuxColumn & c = column(f.key0(), f.key1(), type);
+			switch (type) {
+				case 'i': {
+					int64_t value = auxInteger(f.type(), f.payload() );
+					writeVarint(zigzag(value - c.prev), c.buf, gc, num);
+					c.prev = value;
+					break;
+				}
+				case 'A':
+					addUnsignedByte(f.payload()[0], c.buf, gc, num);
+					break;
+				case 'f':
+					writeBytes(f.payload(), 4, c.buf, gc, num);
+					break;
+				case 'Z':
+				case 'H':
+					encodeString(c, (char const *)f.payload(), gc, num);
+					break;
+				case 'B':
+					encodeArray(c, f.payload(), gc, num);
+					break;
+			}
+		}
+	}
+
+	void setInitialCoordinate(int chromo, int offset) {
+		startCoord.chromosome = chromo;
+		startCoord.offset = offset;
+		layout_buf->setInitialCoordinate(chromo, offset);
+		for (auto & c : columns)
+			c.second.buf->setInitialCoordinate(chromo, offset);
+	}
+
+	void setLastCoordinate(int chromo, int offset, size_t num) {
+		layout_buf->setLastCoordinate(chromo, offset, num);
+		for (auto & c : columns)
+			c.second.buf->setLastCoordinate(chromo, offset, num);
+	}
+
+	void flush() {
+		layout_buf->flush();
+		for (auto & c : columns)
+			c.second.buf->flush();
+	}
+};
+
+#endif
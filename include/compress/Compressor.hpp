@@ -4,6 +4,7 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <deque>
 #include <unordered_set>
 #include <unordered_map>
 #include <memory>
@@ -20,9 +21,17 @@
 #include "IntervalTree.h"
 #include "IOLibParser.hpp"
 #include "IOLibAlignment.hpp"
+#include "EditsEncoder.hpp"
 #include "OutputBuffer.hpp"
 #include "QualityCompressor.hpp"
+#include "ReadNameEncoder.hpp"
+#include "AuxTagEncoder.hpp"
+#include "UnalignedBuckets.hpp"
+#include "MateWindow.hpp"
+#include "PrimaryWindow.hpp"
+#include "PrimaryRef.hpp"
 #include "RefereeUtils.hpp"
+#include "RefereeProfile.hpp"
 #include "TranscriptsStream.hpp"
 
 ////////////////////////////////////////////////////////////////
@@ -39,23 +48,27 @@ public:
 	shared_ptr<OutputBuffer> offsets_buf;
 	shared_ptr<OutputBuffer> edits_buf;
 	shared_ptr<OutputBuffer> has_edits_buf;
+	shared_ptr<OutputBuffer> read_lens_buf;
 	shared_ptr<OutputBuffer> left_clips_buf;
 	shared_ptr<OutputBuffer> right_clips_buf;
-	shared_ptr<OutputBuffer> ids_buf;
+	shared_ptr<ReadNameEncoder> ids_buf;
 	shared_ptr<OutputBuffer> flags_buf;
+	shared_ptr<OutputBuffer> primary_buf;
 	shared_ptr<QualityCompressor> quals_buf;
-	shared_ptr<OutputBuffer> opt_buf;
+	shared_ptr<AuxTagEncoder> opt_buf;
 	shared_ptr<OutputBuffer> unaligned_buf;
 
 	void flush() {
 		offsets_buf->flush();
 		edits_buf->flush();
 		has_edits_buf->flush();
+		read_lens_buf->flush();
 		left_clips_buf->flush();
 		right_clips_buf->flush();
 		unaligned_buf->flush();
 		if (!seq_only) {
 			flags_buf->flush();
+			primary_buf->flush();
 			ids_buf->flush();
 			quals_buf->flush(); // causes individual clusters to flush their OutputBuffers; notify the courier
 			opt_buf->flush();
@@ -66,12 +79,14 @@ public:
 		offsets_buf->setInitialCoordinate(chromo, offset);
 		edits_buf->setInitialCoordinate(chromo, offset);
 		has_edits_buf->setInitialCoordinate(chromo, offset);
+		read_lens_buf->setInitialCoordinate(chromo, offset);
 		left_clips_buf->setInitialCoordinate(chromo, offset);
 		right_clips_buf->setInitialCoordinate(chromo, offset);
 
 		if (!seq_only) {
 			ids_buf->setInitialCoordinate(chromo, offset);
 			flags_buf->setInitialCoordinate(chromo, offset);
+			primary_buf->setInitialCoordinate(chromo, offset);
 			quals_buf->setInitialCoordinate(chromo, offset);
 			opt_buf->setInitialCoordinate(chromo, offset);
 		}
@@ -81,12 +96,14 @@ public:
 		offsets_buf->setLastCoordinate(chromo, offset, num);
 		edits_buf->setLastCoordinate(chromo, offset, num);
 		has_edits_buf->setLastCoordinate(chromo, offset, num);
+		read_lens_buf->setLastCoordinate(chromo, offset, num);
 		left_clips_buf->setLastCoordinate(chromo, offset, num);
 		right_clips_buf->setLastCoordinate(chromo, offset, num);
 
 		if (!seq_only) {
 			ids_buf->setLastCoordinate(chromo, offset, num);
 			flags_buf->setLastCoordinate(chromo, offset, num);
+			primary_buf->setLastCoordinate(chromo, offset, num);
 			quals_buf->setLastCoordinate(chromo, offset, num);
 			opt_buf->setLastCoordinate(chromo, offset, num);
 		}
@@ -108,13 +125,16 @@ class Compressor {
 ////////////////////////////////////////////////////////////////
 private:
 
-	int64_t edit_count = 0;
-
 	bool failed_ = false;
 
 	bool seq_only = false; // compress all aligned sequence, including the multimaps
 
 	bool discard_secondary_alignments = false;	// omit multimaps, record data for a given read only once
+
+	// write mismatches that match the recent alignments as known variants
+	bool consensus_edits = false;
+
+	EditsEncoder edits;
 	// TODO: strategies for choosing the alignement: smallest errors, most consistent offsets
 
 	size_t count = 0;
@@ -134,11 +154,17 @@ private:
 
 	vector<bool> edit_flags;
 
-	// vector<IOLibAlignment> unaligned_reads;
-	vector<UnalignedRead> unaligned_reads;
+	// grouped by minimizer across the whole input
+	UnalignedBuckets unaligned_reads;
 
 	Output_args out_buffers;
 
+	// holds back flags until the mate shows up
+	shared_ptr<MateWindow> mates;
+
+	// secondary alignments refer back to their primary
+	shared_ptr<PrimaryWindow> primaries;
+
 	string file_name;
 
 	// store the mapping for the flags, mapq and rnext
@@ -153,13 +179,9 @@ private:
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
 
 		auto clip_length = al.lsc();
-		auto clip_bytes = al.getLeftSoftClip();
-		// for 2 bit encoding
-		// lc_stream << clip_length; 
-		// for (auto i = 0; i < clip_length; i++) lc_stream << clip_bytes[i];
-		// lc_stream << endl;
+		auto packed = al.getLeftSoftClip2(clip_exceptions);
 		GenomicCoordinate g(al.ref(), al.offset() );
-		writeClip(clip_bytes, clip_length, out_buffers.left_clips_buf, g, count);
+		writeClip(packed, clip_length, clip_exceptions, out_buffers.left_clips_buf, g, count);
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -167,144 +189,49 @@ private:
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
 
 		auto clip_length = al.rsc();
-		auto clip_bytes = al.getRightSoftClip();
-		// for 2 bit encoding
-		// rc_stream << clip_length;
-		// for (auto i = 0; i < clip_length; i++) rc_stream << clip_bytes[i];
-		// rc_stream << endl;
+		auto packed = al.getRightSoftClip2(clip_exceptions);
 		GenomicCoordinate g(al.ref(), al.offset() );
-		writeClip(clip_bytes, clip_length, out_buffers.right_clips_buf, g, count);
+		writeClip(packed, clip_length, clip_exceptions, out_buffers.right_clips_buf, g, count);
 	}
+	vector<pair<int,uint8_t>> clip_exceptions; // reused across clips
 
 	////////////////////////////////////////////////////////////////
-	// write out edits to a compressed stream
+	// edits from the cigar and the MD string; an alignment whose edits go
+	// backwards can not be written (see EditsEncoder.hpp) and is rejected
 	////////////////////////////////////////////////////////////////
-	bool handleEdits(IOLibAlignment & al) {
+	bool parseEdits(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.edits");
 		if ( !al.isPrimary() && discard_secondary_alignments ) return false;
 
 		bool hasEdits = al.handleEdits(ref_seq_handler);
-
-		// return early if no edits or can not encode the edits for some reason
-		if (al.isRejected() || !hasEdits) {
-			return hasEdits;
-		}
-
-	    int num_edit_bytes = 0;
-	    // calculate number of bytes needed for edits
-	    if (al.lsc() > 0) {
-	    	// cerr << "L";
-	    	num_edit_bytes++;
-	    }
-	    if (al.rsc() > 0) {
-	    	// cerr << "R";
-	    	num_edit_bytes++;
-	    }
-	    if (al.lhc() > 0) {
-	    	// cerr << "l";
-	    	edit_count++;
-	    	num_edit_bytes += 2;
-	    }
-	    if (al.rhc() > 0) {
-	    	// cerr << "r";
-	    	edit_count++;
-	    	num_edit_bytes += 2;
-	    }
-	    if (al.merged_edits.size() > 0) {
-	    	// cerr << "checking merged edits... ";
-	        for (auto pr : al.merged_edits) {
-	            if (pr.edit_op == 'E') { 
-	            	// cerr << "E";
-	            	if (pr.splice_len > 65535 )
-	            		num_edit_bytes += 5;
-	            	else
-	                	num_edit_bytes += 4;
-	            }
-	            else if (pr.edit_op != 'R' && pr.edit_op != 'L') {
-	            	// cerr << pr.edit_op;
-	                num_edit_bytes += 2;
-	            }
-	        }
-	    }
-	    // assert(num_edit_bytes < 256);
-		if (num_edit_bytes > 256) {
-	    	al.set_rejected(true);
-	    	return hasEdits;
+		if (hasEdits && !al.isRejected() && EditsEncoder::backwards(al.merged_edits, editClips(al) ) ) {
+			al.set_rejected(true);
+			backwards_cnt++;
 		}
-		if (num_edit_bytes == 0) {// TODO: this should be caught up stream
-			// write "no edits", move on to the next alignment
-			// addUnsignedByte(num_edit_bytes, out_buffers.edits_buf);
-			cerr << "no edits after all" << endl;
-			return false;
-		}
-		// cerr << " Edit len: " << (int)num_edit_bytes << endl;
-	    // edit_stream << (unsigned char)num_edit_bytes;
-	    GenomicCoordinate gc(al.ref(), al.offset() );
+		return hasEdits;
+	}
+	int backwards_cnt = 0;
 
-	    addUnsignedByte(num_edit_bytes, out_buffers.edits_buf, gc, count);
+	EditClips editClips(IOLibAlignment & al) {
+		return EditClips{al.lsc(), al.rsc(), al.lhc(), al.rhc()};
+	}
 
-	    edit_count += al.merged_edits.size();
+	////////////////////////////////////////////////////////////////
+	// write out edits to a compressed stream
+	////////////////////////////////////////////////////////////////
+	bool handleEdits(IOLibAlignment & al, bool hasEdits) {
+		PROFILE_SCOPE("encode.edits");
+		if (!hasEdits) return false;
 
-	    // write out clipping events
-	    int prev_edit_offset = 0;
-	    if (al.lsc() > 0) {
-	        // edit_stream << 'L';
-	        prev_edit_offset += al.lsc();
-	        addUnsignedByte('L', out_buffers.edits_buf, gc, count);
-	        writeLeftClip(al);
-	    }
-	    if (al.rsc() > 0) {
-	        // edit_stream << 'R';
-	        addUnsignedByte('R', out_buffers.edits_buf, gc, count);
-	        writeRightClip(al);
-	    }
-	    // if (al.lhc() > 0) edit_stream << 'l' << (unsigned char)al.lhc();
-	    // if (al.rhc() > 0) edit_stream << 'r' << (unsigned char)al.rhc();
-	    if (al.lhc() > 0) {
-		    addUnsignedByte('l', out_buffers.edits_buf, gc, count);
-		    addUnsignedByte(al.lhc(), out_buffers.edits_buf, gc, count);
-		    prev_edit_offset += al.lhc();
-		}
-		if (al.rhc() > 0) {
-		    addUnsignedByte('r', out_buffers.edits_buf, gc, count);
-		    addUnsignedByte(al.rhc(), out_buffers.edits_buf, gc, count);
+	    GenomicCoordinate gc(al.ref(), al.offset() );
+		if ( !edits.write(al.merged_edits, editClips(al), out_buffers.edits_buf, gc, count) ) {
+			// TODO: this should be caught up stream
+			cerr << "no edits after all" << endl;
+			return false;
 		}
-
-		
-		// cerr << al.offset() << " ";
-	    // write out all other edits
-	    if (al.merged_edits.size() > 0) {
-	        for (auto edit : al.merged_edits) {
-	        	// cerr << (char) edit.edit_op << "(" << edit.edit_pos << ")";
-	            if (edit.edit_op != 'E') {
-	            	if (edit.edit_op != 'R' && edit.edit_op != 'L') {// these are handled separately
-	            		writeOp(edit, prev_edit_offset, out_buffers.edits_buf, gc, count);
-	                	// edit_stream << (unsigned char) edit.edit_op; // edit code            
-	                	// edit_stream << (unsigned char) (edit.edit_pos - prev_edit_offset);    // record how many bases since the last edit
-	                	prev_edit_offset = edit.edit_pos;
-	            	}
-	            }
-	            else {
-	                // write out 'E', offset into the read
-	                int splice_len = edit.splice_len;
-	                // al.splices.erase(al.splices.begin());
-	                // edit_stream << edit.edit_op << (unsigned char) (edit.edit_pos - prev_edit_offset);
-	                // write out length of intron
-	                // writeShort(edit_stream, splice_len);
-	                // cerr << "Splice offset: " << (int)(edit.edit_pos - prev_edit_offset) << " len: " << splice_len;
-	                if (splice_len > 65535 ) {
-                		// cerr << " (long splice)" << endl;
-                		writeLongSpliceOp(edit, prev_edit_offset, splice_len, out_buffers.edits_buf, gc, count);
-	                }
-	                else {
-	                	// cerr << " (short splice)" << endl;
-	                	writeSpliceOp(edit, prev_edit_offset, splice_len, out_buffers.edits_buf, gc, count);
-	                }
-	                prev_edit_offset = edit.edit_pos;
-	            }
-	        }
-	    }
-	    // cerr << endl;
-		return hasEdits;
+		if (al.lsc() > 0) writeLeftClip(al);
+		if (al.rsc() > 0) writeRightClip(al);
+		return true;
 	}
 
 	void outputPair(pair<int,int> const & offset_pair, int chromo_id, int real_offset) {
@@ -328,6 +255,7 @@ private:
 	// bug 2: can accumulate starting with the first 1
 	////////////////////////////////////////////////////////////////
 	void handleOffsets(IOLibAlignment & al, bool hasEdits, bool first) {
+		PROFILE_SCOPE("encode.offsets");
 		// if only want to encode a single read once ever, will skip all secondary alignements
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
 
@@ -357,12 +285,22 @@ private:
 	    // edit_flags.push_back(hasEdits);
 	    GenomicCoordinate coord(al.ref(), al.offset());
 	    writeBool(hasEdits, out_buffers.has_edits_buf, coord, count);
+	    writeReadLen(al.read_len(), coord);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// 0 if same as the previous alignment, length + 1 otherwise
+	////////////////////////////////////////////////////////////////
+	int prev_read_len = -1;
+	void writeReadLen(int len, GenomicCoordinate & coord) {
+		::writeReadLen(len, prev_read_len, out_buffers.read_lens_buf, coord, count);
 	}
 
 	////////////////////////////////////////////////////////////////
 	// transform the flags before writing out
 	////////////////////////////////////////////////////////////////
 	void handleFlags(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.flags");
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
 
 		// remap flags, mapq, and rnext to a smaller domain
@@ -385,40 +323,43 @@ private:
 		}
 		rnext = rnext_map[rnext];
 
+		MateEntry e;
+		e.flags = flags;
+		e.mapq = mapq;
+		e.rnext = rnext;
+		e.raw_flags = al.flags();
+		e.ref = al.ref();
+		e.pos = al.offset();
+		e.end = al.ref_end();
+		e.mate_ref = al.rnext();
+		e.pnext = al.pnext();
+		e.tlen = al.tlen();
+		e.name = al.read_name();
+		e.gc = GenomicCoordinate(al.ref(), al.offset());
+		e.num = count;
+		mates->add(e);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// link secondary and supplementary alignments to their primary (see
+	// PrimaryRef.hpp); returns true if the name comes from the primary
+	////////////////////////////////////////////////////////////////
+	bool handlePrimaryRef(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.primary_refs");
+		if ( !al.isPrimary() && discard_secondary_alignments ) return false;
 		GenomicCoordinate gc(al.ref(), al.offset());
-		writeFlags(flags, mapq, rnext, al.pnext(), al.pnext() - al.tlen(), out_buffers.flags_buf, gc, count);
+		// before handleQuals flips the qualities
+		return primaries->add(count, al.read_name(), al.flags(), al.quals(), al.read_len(), gc);
 	}
 
 	////////////////////////////////////////////////////////////////
-	// unordered_map<string, int> dictionary;
-	// size_t unique_chunk_id = 0;
-	// string delimiters = ".:_\s#";
-	void handleReadNames(IOLibAlignment & al) {
+	void handleReadNames(IOLibAlignment & al, bool from_primary) {
+		PROFILE_SCOPE("encode.read_names");
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
+		if (from_primary) return;
 
-		// TODO: need to transform the read IDs before passing it down to the lzip
 		GenomicCoordinate gc(al.ref(), al.offset());
-		writeName(al.read_name(), out_buffers.ids_buf, gc, count);
-
-		// split, diff, minimize!
-		// this can make compression for read ids faster and provide marginal improvements
-		// string read_name = al.read_name();
-		// size_t left = 0;
-		// size_t right = read_name.find_first_of(delimiter);
-		// vector<int> remapped_name;
-		// while (right != string::npos ) {
-		// 	string chunk = read_name.substr(left, right);
-		// 	// if have not seen this before -- add to dictionary, increment unique_id
-		// 	if (dictionary.find(chunk) == dictionary.end() ) {
-		// 		dictionary[chunk] = unique_chunk_id;
-		// 		unique_chunk_id++;
-		// 	}
-		// 	// output the mapped id instead of the chunk itself
-		// 	remapped_name.push_back(dictionary[chunk]);
-		// 	left = read_name.find_first_not_of(delimiter, right + 1);
-		// 	right = read_name.find_first_of(delimiter, left + 1);
-		// }
-		// writeName2(remapped_name, out_buffers.ids_buf);
+		out_buffers.ids_buf->encode(al.read_name(), gc, count);
 	}
 
 	// QualityCompressor qual_compressor;
@@ -426,6 +367,7 @@ private:
 	int total_quals = 0;
 	int primary = 0;
 	void handleQuals(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.quals");
 		total_quals++;
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
 
@@ -449,12 +391,13 @@ private:
 
 	////////////////////////////////////////////////////////////////
 	void handleOptionalFields(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.optional_fields");
 		if ( !al.isPrimary() && discard_secondary_alignments ) return;
-		// find MD and excise it
-		string opt = al.opt_fields();
+		al.aux_fields(aux_fields);
 		GenomicCoordinate gc(al.ref(), al.offset());
-		writeOpt(opt, out_buffers.opt_buf, gc, count);
+		out_buffers.opt_buf->encode(aux_fields, gc, count);
 	}
+	vector<AuxField> aux_fields; // reused across alignments
 
 	////////////////////////////////////////////////////////////////
 	//
@@ -462,55 +405,38 @@ private:
 	bool printed_warning = false;
 	int used_rc = 0;
 	void processUnalignedRead(IOLibAlignment & al) {
+		PROFILE_SCOPE("encode.unaligned");
 		// save for later
 		// cerr << "Read name: " << al.read_name_len() << endl;
 
 		// consider read's RC -- if it has a smaller minimizer, then pick RC
 		vector<uint8_t> seq = al.getSeq();
-		auto minimizer = getMinimizer(seq, 12);
-		auto r_seq = reverse_complement(seq);
-		auto r_min = getMinimizer(r_seq, 12);
-		// pick the smaller one
 		bool rc = false;
-		if ( minimizer.compare(r_min) > 0 ) {
-			rc = true; 
-			// cerr << "Using rc";
+		uint32_t minimizer = canonicalMinimizer(seq, UNALIGNED_K, rc);
+		if (rc) {
 			used_rc++;
-			seq = r_seq;
-		}
-		unaligned_reads.emplace_back(al.read_name(), al.read_name_len(), seq, al.quals(), rc);
-		if (unaligned_reads.size() >= 10000) {
-			// cerr << "Used rc " << used_rc << " ";
-			flushUnalignedReads();
+			seq = reverse_complement(seq);
 		}
+		unaligned_reads.add(minimizer,
+			UnalignedRead(al.read_name(), al.read_name_len(), seq, al.quals(), rc) );
 	}
 
 	void flushUnalignedReads() {
-		// cerr << "flushing unaligned n=" << unaligned_reads.size() << endl;
-		//for (auto r : unaligned_reads) { for (auto c : r.seq) cerr << c; cerr << endl;}
-		sort(unaligned_reads.begin(), unaligned_reads.end(), [] (UnalignedRead const & a, UnalignedRead const & b) {
-			// returns ​true if the first argument is less than (i.e. is ordered before) the second.
-	//		for (auto c : b.seq) cerr << (char)c; cerr << " --" << endl;
-	//		assert(a.seq.size() == b.seq.size());
-			for (int i = 0; (i < a.seq.size() ) && (i < b.seq.size() ); i++) {
-				if (a.seq[i] < b.seq[i]) return true;
-				else if (a.seq[i] > b.seq[i]) return false;
-			}
-			// reads identical -- return false as per strict weak ordering
-			return false;
-		});
-		// write out
-		for (auto read : unaligned_reads) {
-			writeUnaligned(read, seq_only, out_buffers.unaligned_buf);
-		}
-		unaligned_reads.clear();
+		unaligned_reads.flush(seq_only, out_buffers.unaligned_buf);
 	}
 
 	////////////////////////////////////////////////////////////////
 	//
 	////////////////////////////////////////////////////////////////
 	bool processRead(IOLibAlignment & al, bool & first) {
-	    bool rejected = false, new_transcript = false;
+	    // nothing is written for a rejected alignment: its bases, qualities
+	    // and name are kept w/ the unaligned reads
+	    bool hasEdits = parseEdits(al);
+	    if (al.isRejected() ) {
+	    	processUnalignedRead(al);
+	    	return true;
+	    }
+	    bool new_transcript = false;
 	    // get reference sequence ID
 	    auto ref = al.ref();
 	    // if this is the first alignment
@@ -537,13 +463,10 @@ private:
 	    	new_transcript = true;
 	    }
 
-	    bool hasEdits = handleEdits(al);
-	    if (al.isRejected()) {
-	    	return true;
-	    }
+	    hasEdits = handleEdits(al, hasEdits);
 	    handleOffsets(al, hasEdits, first || new_transcript);
 	    if (!seq_only) {
-	    	handleReadNames(al);
+	    	handleReadNames(al, handlePrimaryRef(al) );
 	    	handleFlags(al);
 	    	handleQuals(al);
 	    	handleOptionalFields(al);
@@ -561,18 +484,25 @@ private:
 ////////////////////////////////////////////////////////////////
 public:
 	////////////////////////////////////////////////////////////////
-	//
+	// reads from input ("-" for stdin), writes files named name_prefix.*
 	////////////////////////////////////////////////////////////////
-	Compressor (string const & file_name, string const & ref_file, int t, 
+	Compressor (string const & input, string const & name_prefix, string const & ref_file, int t, 
 			Output_args & output_buffers, 
-			bool seq_only, bool discard_secondary):
-		parser(file_name, t),
-		ref_seq_handler(file_name, ref_file, "-c"),
+			bool seq_only, bool discard_secondary, bool consensus_edits = false):
+		parser(input, t),
+		ref_seq_handler(name_prefix, ref_file, "-c"),
+		unaligned_reads(name_prefix, memoryBudget().unalignedCap(UNALIGNED_MEMORY_CAP) ),
 		out_buffers(output_buffers),
-		file_name(file_name),
+		file_name(name_prefix),
 		seq_only(seq_only),
-		discard_secondary_alignments(discard_secondary) {
+		discard_secondary_alignments(discard_secondary),
+		consensus_edits(consensus_edits),
+		edits(consensus_edits) {
 		failed_ = parser.failed();
+		if (!seq_only) {
+			mates = make_shared<MateWindow>(out_buffers.flags_buf);
+			primaries = make_shared<PrimaryWindow>(out_buffers.primary_buf);
+		}
 	}
 
 	bool failed() {return failed_;}
@@ -589,6 +519,7 @@ public:
 		// get version information and record it in the *.head file
 		auto version_type = sam_hdr_find(h, "HD", NULL, NULL);
 		head_out << "HD " << version_type->tag->str << endl;
+		head_out << INTERVALS_HEAD_LINE << endl;
 
 		auto num_ref = h->nref;
 		for (auto i = 0; i < num_ref; i++) {
@@ -597,41 +528,78 @@ public:
 		}
 
 		int line_id = 0;
-		IOLibAlignment last_aligned;
-	    while ( parser.read_next() ) {
-	        bam_seq_t* read = parser.getRead();
-	        IOLibAlignment al(read);
-	        if ( al.isUnalined() ) {
-	        	unaligned_cnt++;
-	            processUnalignedRead(al);
-	        }
-	        else {
-	        	last_aligned = al;
-	        	if (first) {
-	        		head_out << "read_len=" << al.read_len() << endl;
-	        	}
-	            processRead(al, first);
-	            first = false;
+		// coordinate of the last aligned read; the record itself gets reused
+		uint32_t last_ref = 0, last_offset = 0;
+		// one alignment per batch slot, reset for every record
+		vector<IOLibAlignment> arena(IOLIB_BATCH_SIZE);
+	    // an error in this file stops it, the other files of a batch go on
+	    while ( !failed_ ) {
+	    	int batch_size = 0;
+	        {
+	        	PROFILE_SCOPE("parser.read");
+	        	batch_size = parser.read_batch(memoryBudget().parserBatch(IOLIB_BATCH_BYTES) );
 	        }
-	        line_id++;
+	        if (batch_size == 0) break;
+	        PROFILE_COUNT("parser.alignments", batch_size);
+	        for (int i = 0; i < batch_size; i++) {
+		        IOLibAlignment & al = arena[i];
+		        al.reset(parser.getRead(i) );
+		        if ( al.isUnalined() ) {
+		        	unaligned_cnt++;
+		            processUnalignedRead(al);
+		        }
+		        else {
+		        	bool was_first = first;
+		        	// a rejected alignment goes w/ the unaligned reads and leaves first set
+		            if ( !processRead(al, first) ) {
+		            	if (was_first) head_out << "read_len=" << al.read_len() << endl;
+		        		last_ref = al.ref();
+		        		last_offset = al.offset();
+		        	}
+		        }
+		        line_id++;
+		        if (ref_seq_handler.failed() ) {
+		        	cerr << "[ERROR] Stopped at alignment " << line_id << " of " << file_name << endl;
+		        	failed_ = true;
+		        	break;
+		        }
+		    }
 	    }
-	    out_buffers.setLastCoordinate(last_aligned.ref(), last_aligned.offset(), count);
+	    if (mates != nullptr) mates->flush();
+	    if (primaries != nullptr) primaries->clear();
+	    out_buffers.setLastCoordinate(last_ref, last_offset, count);
 	    flushUnalignedReads();
+	    if (unaligned_reads.failed() ) failed_ = true;
 	    parser.close();
 	    cerr << "Of them unaligned: " << unaligned_cnt << endl;
 	    if (discard_secondary_alignments)
 	    	cerr << "Unique total reads: " << count << endl;
-	    cerr << "Total edits: " << edit_count << endl;
+	    cerr << "Total edits: " << edits.edit_count << endl;
+	    if (edits.junctions_written > 0)
+	    	cerr << "[INFO] Splices written as junction ids: " << edits.junctions_written << endl;
+	    if (edits.known_variants_written > 0)
+	    	cerr << "[INFO] Mismatches written as known variants: " << edits.known_variants_written << endl;
+	    if (edits.long_edits_written > 0)
+	    	cerr << "[INFO] Alignments w/ long form edits: " << edits.long_edits_written << endl;
+	    if (backwards_cnt > 0)
+	    	cerr << "[INFO] Alignments w/ edits that go backwards, kept as unaligned reads: " << backwards_cnt << endl;
 
 	    // write out mappings for the flags, mapq, rnext
 	    for (auto p : flags_map) head_out << "flags " << p.first << " " << p.second << endl;
 	    for (auto p : mapq_map) head_out << "mapq " << p.first << " " << p.second << endl;
 	    for (auto p : rnext_map) head_out << "rnext " << p.first << " " << p.second << endl;
+	    if (out_buffers.quals_buf != nullptr)
+	    	head_out << "qual_mode=" << out_buffers.quals_buf->getMode() << endl;
+	    if (consensus_edits)
+	    	head_out << "consensus_edits=1" << endl;
 	    head_out.close();
 
 	    // output the last offset
 	    outputPair(offset_pair, prev_ref, prev_offset);
 	    
+	    if (primaries != nullptr && primaries->inherited_names > 0)
+	    	cerr << "[INFO] Secondary alignments w/ the name from the primary: " << primaries->inherited_names <<
+	    		", also w/ its qualities: " << primaries->inherited_quals << endl;
 	    cerr << "saw " << total_quals << "qual vector" << endl;
 	    cerr << "of them primary " << primary << endl;
 	}
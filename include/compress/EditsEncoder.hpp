@@ -0,0 +1,298 @@
+/*
+Edits record of an alignment in .edits.lz: the short form (one length byte,
+one-byte gaps, see OutputBuffer.hpp) when every gap and hard clip length fits
+in a byte and the record in 255 bytes, the long form (see LongEdits.hpp)
+otherwise. Splices refer to the junction table of the block (see
+SpliceJunctions.hpp); w/ --consensusEdits mismatches at known variants are
+written as such (see ConsensusVariants.hpp). Soft clip bases go to the clip
+streams, the caller writes them.
+*/
+
+#ifndef EDITS_ENCODER_H
+#define EDITS_ENCODER_H
+
+#include <vector>
+#include <memory>
+
+#include "IOLibAlignment.hpp"
+#include "OutputBuffer.hpp"
+#include "LongEdits.hpp"
+#include "ConsensusVariants.hpp"
+#include "SpliceJunctions.hpp"
+
+// soft and hard clip lengths of an alignment
+struct EditClips {
+	int lsc, rsc, lhc, rhc;
+};
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class EditsEncoder {
+
+	// write mismatches that match the recent alignments as known variants
+	bool consensus_edits;
+	ConsensusVariants consensus;
+
+	// splice lengths seen in the current block of the edits stream
+	JunctionTable junctions;
+	// block the first byte of the last record went into
+	size_t table_block = 0;
+
+	vector<uint8_t> record, body; // reused across alignments
+
+	static bool isClip(int op) { return op == 'R' || op == 'L' || op == 'r' || op == 'l'; }
+
+	////////////////////////////////////////////////////////////////
+	// bytes of the short form; fits is false if a gap or a hard clip
+	// length needs more than a byte
+	////////////////////////////////////////////////////////////////
+	int shortSize(vector<edit_pair> const & edits, EditClips const & clips, bool & fits) {
+		int size = (clips.lsc > 0) + (clips.rsc > 0) + (clips.lhc > 0 ? 2 : 0) + (clips.rhc > 0 ? 2 : 0);
+		fits = clips.lhc <= 255 && clips.rhc <= 255;
+		int prev_edit_offset = clips.lsc + clips.lhc;
+		for (auto & edit : edits) {
+			if (edit.edit_op == 'R' || edit.edit_op == 'L') continue;
+			int gap = edit.edit_pos - prev_edit_offset;
+			if (gap < 0 || gap > 255) fits = false;
+			prev_edit_offset = edit.edit_pos;
+			if (edit.edit_op != 'E') {
+				size += 2;
+				continue;
+			}
+			if (edit.splice_len > 0xFFFFFF) fits = false;
+			int id = junctions.id(edit.splice_len);
+			if (id >= 0 && id < JUNCTION_SHORT_IDS)
+				size += 3;
+			else if (edit.splice_len > 65535)
+				size += 5;
+			else
+				size += 4;
+		}
+		return size;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// short form op; a mismatch at a known variant becomes K <rank>
+	////////////////////////////////////////////////////////////////
+	void shortConsensusOp(edit_pair const & edit, int gap) {
+		int rank = isMismatch(edit.edit_op) ? consensus.rank(gap, edit.edit_op) : -1;
+		if (rank >= 0 && rank < 256) {
+			record.push_back(EDIT_KNOWN_VARIANT);
+			record.push_back(rank);
+			known_variants_written++;
+		}
+		else {
+			record.push_back(edit.edit_op);
+			record.push_back(gap);
+		}
+		consensus.advance(edit.edit_op, gap);
+	}
+
+	////////////////////////////////////////////////////////////////
+	void shortEdits(vector<edit_pair> const & edits, EditClips const & clips, int size) {
+		record.clear();
+		record.push_back(size);
+		if (clips.lsc > 0) record.push_back('L');
+		if (clips.rsc > 0) record.push_back('R');
+		if (clips.lhc > 0) {
+			record.push_back('l');
+			record.push_back(clips.lhc);
+		}
+		if (clips.rhc > 0) {
+			record.push_back('r');
+			record.push_back(clips.rhc);
+		}
+		int prev_edit_offset = clips.lsc + clips.lhc;
+		for (auto & edit : edits) {
+			// soft clips were written above
+			if (edit.edit_op == 'R' || edit.edit_op == 'L') continue;
+			uint8_t gap = edit.edit_pos - prev_edit_offset;
+			prev_edit_offset = edit.edit_pos;
+			if (edit.edit_op != 'E') {
+				if (consensus_edits && edit.edit_op != 'l' && edit.edit_op != 'r')
+					shortConsensusOp(edit, gap);
+				else {
+					record.push_back(edit.edit_op);
+					record.push_back(gap);
+				}
+				continue;
+			}
+			int len = edit.splice_len;
+			int id = junctions.id(len);
+			if (id >= 0 && id < JUNCTION_SHORT_IDS) {
+				record.push_back(EDIT_JUNCTION);
+				record.push_back(gap);
+				record.push_back(id);
+				junctions_written++;
+			}
+			else if (len > 65535) {
+				// three length bytes, the op gets its top bit set
+				record.push_back('E' | 128);
+				record.push_back(gap);
+				record.push_back(len >> 16);
+				record.push_back(len >> 8);
+				record.push_back(len & 255);
+			}
+			else {
+				record.push_back('E');
+				record.push_back(gap);
+				record.push_back(len >> 8);
+				record.push_back(len & 255);
+			}
+			if (id < 0) junctions.observe(len);
+			if (consensus_edits) consensus.advance('E', gap, len);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+	// edits w/ varint fields; runs of deletions, insertions and adjacent
+	// mismatches are written as one op each
+	////////////////////////////////////////////////////////////////
+	void longEdits(vector<edit_pair> const & edits, EditClips const & clips) {
+		body.clear();
+		int prev_edit_offset = clips.lsc + clips.lhc;
+		if (clips.lsc > 0) body.push_back('L');
+		if (clips.rsc > 0) body.push_back('R');
+		if (clips.lhc > 0) {
+			body.push_back('l');
+			appendEditVarint(body, clips.lhc);
+		}
+		if (clips.rhc > 0) {
+			body.push_back('r');
+			appendEditVarint(body, clips.rhc);
+		}
+
+		size_t i = 0;
+		while (i < edits.size() ) {
+			auto & edit = edits[i];
+			// clips were written above
+			if (isClip(edit.edit_op) ) {
+				i++;
+				continue;
+			}
+			int gap = edit.edit_pos - prev_edit_offset;
+			bool insertion = edit.edit_op >= 'V' && edit.edit_op <= 'Z';
+			if (edit.edit_op == 'E') {
+				int id = junctions.id(edit.splice_len);
+				if (id >= 0) {
+					body.push_back(EDIT_JUNCTION);
+					appendEditVarint(body, gap);
+					appendEditVarint(body, id);
+					junctions_written++;
+				}
+				else {
+					body.push_back('E');
+					appendEditVarint(body, gap);
+					appendEditVarint(body, edit.splice_len);
+					junctions.observe(edit.splice_len);
+				}
+				if (consensus_edits) consensus.advance('E', gap, edit.splice_len);
+				prev_edit_offset = edit.edit_pos;
+				i++;
+				continue;
+			}
+			int rank = (consensus_edits && isMismatch(edit.edit_op) ) ? consensus.rank(gap, edit.edit_op) : -1;
+			if (rank >= 0) {
+				body.push_back(EDIT_KNOWN_VARIANT);
+				appendEditVarint(body, rank);
+				consensus.advance(edit.edit_op, gap);
+				known_variants_written++;
+				prev_edit_offset = edit.edit_pos;
+				i++;
+				continue;
+			}
+			if (consensus_edits) consensus.advance(edit.edit_op, gap);
+			// extent of the run: deletions and insertions share a position,
+			// mismatches are one base apart
+			size_t k = i + 1;
+			int step = isMismatch(edit.edit_op) ? 1 : 0;
+			while (k < edits.size() && edits[k].edit_pos == edits[k - 1].edit_pos + step &&
+				(edits[k].edit_op == edit.edit_op ||
+				 (insertion && edits[k].edit_op >= 'V' && edits[k].edit_op <= 'Z') ||
+				 (step == 1 && isMismatch(edits[k].edit_op) ) ) ) {
+				// known variants are written on their own
+				if (consensus_edits && step == 1 && consensus.rank(1, edits[k].edit_op) >= 0) break;
+				if (consensus_edits) consensus.advance(edits[k].edit_op, step);
+				k++;
+			}
+			int n = k - i;
+			if (edit.edit_op == 'D') {
+				body.push_back('D');
+				appendEditVarint(body, gap);
+				appendEditVarint(body, n);
+			}
+			else if (insertion || n > 1) {
+				body.push_back(insertion ? EDIT_INSERTION_RUN : EDIT_MISMATCH_BLOCK);
+				appendEditVarint(body, gap);
+				appendEditVarint(body, n);
+				for (size_t e = i; e < k; e++) body.push_back(edits[e].edit_op);
+			}
+			else {
+				body.push_back(edit.edit_op);
+				appendEditVarint(body, gap);
+			}
+			prev_edit_offset = edits[k - 1].edit_pos;
+			i = k;
+		}
+		record.clear();
+		record.push_back(EDITS_LONG_FORM);
+		appendEditVarint(record, body.size() );
+		record.insert(record.end(), body.begin(), body.end() );
+		long_edits_written++;
+	}
+
+public:
+	size_t edit_count = 0, junctions_written = 0, known_variants_written = 0, long_edits_written = 0;
+
+	EditsEncoder(bool consensus_edits = false): consensus_edits(consensus_edits) {}
+
+	////////////////////////////////////////////////////////////////
+	// true if an edit comes before the one ahead of it: gaps are
+	// unsigned in both forms, so such edits can not be written
+	////////////////////////////////////////////////////////////////
+	static bool backwards(vector<edit_pair> const & edits, EditClips const & clips) {
+		int prev_edit_offset = clips.lsc + clips.lhc;
+		for (auto & edit : edits) {
+			if (isClip(edit.edit_op) ) continue;
+			if (edit.edit_pos < prev_edit_offset) return true;
+			prev_edit_offset = edit.edit_pos;
+		}
+		return false;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// writes the record of an alignment (at gc) to the edits stream;
+	// false if there is nothing to write or the edits go backwards
+	////////////////////////////////////////////////////////////////
+	bool write(vector<edit_pair> const & edits, EditClips const & clips,
+		shared_ptr<OutputBuffer> out, GenomicCoordinate & gc, size_t num) {
+		if (backwards(edits, clips) ) return false;
+		// the junction table starts over w/ every block (see SpliceJunctions.hpp);
+		// the next byte goes into block blocks()
+		if (out->blocks() != table_block) {
+			junctions.clear();
+			table_block = out->blocks();
+		}
+		bool fits = true;
+		int size = shortSize(edits, clips, fits);
+		if (size == 0) return false;
+
+		if (consensus_edits) consensus.beginAlignment(gc.chromosome, gc.offset);
+		if (size > 255 || !fits)
+			longEdits(edits, clips);
+		else
+			shortEdits(edits, clips, size);
+		if (consensus_edits) consensus.endAlignment();
+		edit_count += edits.size();
+
+		writeBytes(record.data(), record.size(), out, gc, num);
+		// add the new splice lengths
+		junctions.endAlignment();
+		return true;
+	}
+};
+
+#endif
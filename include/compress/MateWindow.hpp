@@ -0,0 +1,151 @@
+/*
+Look-ahead window over the flags stream: the line of a paired alignment
+waits until its mate shows up (or the window moves past it) so that both
+lines can be written w/o pnext and tlen; see MatePrediction.hpp. Lines also
+leave early while the memory budget is exhausted (see MemoryBudget.hpp)
+*/
+
+#ifndef MATE_WINDOW_H
+#define MATE_WINDOW_H
+
+#include <deque>
+#include <unordered_map>
+
+#include "OutputBuffer.hpp"
+#include "MatePrediction.hpp"
+
+// alignments a line may wait for its mate
+#define MATE_WINDOW_SIZE (1 << 14)
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+struct MateEntry {
+	// remapped values, as written to the flags stream
+	int flags, mapq, rnext;
+
+	// values from the alignment
+	int raw_flags, ref, pos, end, mate_ref, pnext, tlen;
+
+	string name;
+
+	GenomicCoordinate gc;
+
+	size_t num;
+
+	// > 0: mate is this many lines ahead; -1: mate is behind
+	int mate = 0;
+
+	int model = 0;
+
+	// waiting for the mate
+	bool open = false;
+
+	bool paired() const {
+		return (raw_flags & 1) && !(raw_flags & 4) && !(raw_flags & 8) && !(raw_flags & 0x900) &&
+			mate_ref == ref;
+	}
+};
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class MateWindow {
+
+	shared_ptr<OutputBuffer> out;
+
+	deque<MateEntry> queue;
+
+	// line number of the queue front and of the next line
+	unsigned long front = 0, next = 0;
+
+	// open lines by read name
+	unordered_map<string, unsigned long> waiting;
+
+	size_t predicted = 0;
+
+	////////////////////////////////////////////////////////////////
+	// model that reproduces the tlen values of both mates, -1 if none
+	////////////////////////////////////////////////////////////////
+	int findModel(MateEntry const & a, MateEntry const & b) {
+		if (a.pnext != b.pos || b.pnext != a.pos) return -1;
+		for (int model = 0; model < MATE_MODELS; model++) {
+			int a_tlen = 0, b_tlen = 0;
+			predictTlen(model, a.pos, a.end, a.raw_flags & 16, b.pos, b.end, b.raw_flags & 16, a_tlen, b_tlen);
+			if (a_tlen == a.tlen && b_tlen == b.tlen) return model;
+		}
+		return -1;
+	}
+
+	void write(MateEntry & e) {
+		if (e.mate == 0)
+			writeFlags(e.flags, e.mapq, e.rnext, e.pnext, e.pnext - e.tlen, out, e.gc, e.num);
+		else
+			writeMateFlags(e.flags, e.mapq, e.rnext, e.mate, e.model, out, e.gc, e.num);
+	}
+
+	// charged to the memory budget per line
+	size_t cost(MateEntry const & e) {
+		return sizeof(MateEntry) + 2 * e.name.size() + WORKING_ENTRY_BYTES;
+	}
+
+	void drain(bool all) {
+		while (!queue.empty() ) {
+			MateEntry & e = queue.front();
+			if (e.open) {
+				if (!all && next - front <= MATE_WINDOW_SIZE && !memoryBudget().exhausted() ) break;
+				// mate too far away or out of memory
+				waiting.erase(e.name);
+				e.open = false;
+			}
+			write(e);
+			memoryBudget().release(cost(e) );
+			queue.pop_front();
+			front++;
+		}
+	}
+
+public:
+	MateWindow(shared_ptr<OutputBuffer> o): out(o) {}
+
+	////////////////////////////////////////////////////////////////
+	void add(MateEntry & e) {
+		unsigned long line = next++;
+		if (e.paired() && e.pnext <= e.pos) {
+			auto it = waiting.find(e.name);
+			if (it != waiting.end() ) {
+				MateEntry & a = queue[it->second - front];
+				int model = findModel(a, e);
+				if (model >= 0) {
+					a.mate = line - it->second;
+					a.model = model;
+					a.open = false;
+					e.mate = -1;
+					predicted += 2;
+					waiting.erase(it);
+				}
+			}
+		}
+		if (e.mate == 0 && e.paired() && e.pnext >= e.pos) {
+			// an earlier line w/ the same name gives up its place
+			auto it = waiting.find(e.name);
+			if (it != waiting.end() ) queue[it->second - front].open = false;
+			e.open = true;
+			waiting[e.name] = line;
+		}
+		memoryBudget().charge(cost(e) );
+		queue.push_back(e);
+		drain(false);
+	}
+
+	////////////////////////////////////////////////////////////////
+	void flush() {
+		drain(true);
+		if (predicted > 0)
+			cerr << "[INFO] pnext/tlen predicted from the mate for " << predicted << " alignments" << endl;
+	}
+};
+
+#endif
@@ -0,0 +1,250 @@
+/*
+Memory budget for compression (--max-memory). The limit is split up front:
+
+	unaligned reads		1/8		spilled to disk past this (UnalignedBuckets)
+	working set			1/8		quality vectors sampled for cluster discovery,
+								the primary and mate windows, quality batches
+								waiting for the assigner threads, the context
+								models of the quality clusters; a quarter
+								of it bounds the parser's record buffers
+	stream buffers		1/4		bytes OutputBuffers collect before a dump
+	packets, workers	rest	blocks waiting in courier slots plus the
+								LZMA encoders working on them
+
+In a batch (compress-batch) the limit set here is the share of one job,
+limit / jobs: unaligned reads and the bootstrap sample are sized per job, while
+stream buffers, slots, encoders and the working set are shared, which errs on
+the safe side.
+
+The packet share picks the block size and the number of courier slots.
+Slots are where the backpressure comes from: once they are all taken the
+parser blocks in receive_packet until a worker frees one. Stream buffers
+take their block size from the buffer share as they are created; quality
+clusters show up late, so once the share runs out new buffers get
+MIN_BLOCK_SIZE blocks. W/o a limit every size stays as requested.
+
+The working set is charged as it grows. Once it is exhausted the producers
+give back what they hold instead of taking more: the parser waits for the
+quality batches in flight and for a running cluster discovery, the sample
+for discovery stops growing, the mate window writes out its oldest lines
+w/o waiting for their mates, and the primary window drops its oldest
+primaries. No more quality clusters are installed once their models
+would not fit. The parser's batches end early once their records fill the
+parser's part. Memory of the reference sequences and of io_lib itself is not
+covered by the limit.
+*/
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+
+using namespace std;
+
+// smallest block a stream buffer or a packet gets
+#define MIN_BLOCK_SIZE (1 << 16)
+
+// LZMA encoder memory per byte of dictionary (lzlib match finder)
+#define LZ_ENCODER_FACTOR 11
+
+// bytes per quality vector held for the bootstrap (string + overhead)
+#define BOOTSTRAP_VECTOR_BYTES 256
+
+// container and allocator overhead per item charged to the working set
+#define WORKING_ENTRY_BYTES 64
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class MemoryBudget {
+
+	pthread_mutex_t mutex;
+
+	size_t limit = 0;
+
+	// largest block any buffer or packet gets
+	int block_cap = 1 << 23;
+
+	// bytes granted to stream buffers so far
+	size_t reserved = 0;
+
+	bool squeezed = false;
+
+	// bytes charged to the working set
+	size_t working = 0;
+
+	size_t buffersShare() { return limit / 4; }
+
+	size_t workingShare() { return limit / 8; }
+
+	size_t packetsShare() { return limit - limit / 4 - limit / 8 - limit / 8; }
+
+public:
+	MemoryBudget() { pthread_mutex_init(&mutex, 0); }
+
+	~MemoryBudget() { pthread_mutex_destroy(&mutex); }
+
+	bool limited() { return limit > 0; }
+
+	////////////////////////////////////////////////////////////////
+	// size the blocks for the workers: each one holds an encoder and its
+	// packets (in and out) need at least two slots
+	////////////////////////////////////////////////////////////////
+	void setLimit(size_t bytes, int num_workers) {
+		limit = bytes;
+		reserved = 0;
+		squeezed = false;
+		working = 0;
+		if (!limited() ) return;
+		size_t per_worker = packetsShare() / std::max(1, num_workers);
+		size_t block = per_worker / (LZ_ENCODER_FACTOR + 2 * 2);
+		block_cap = std::max( (size_t)MIN_BLOCK_SIZE, std::min( (size_t)block_cap, block) );
+		cerr << "[INFO] Memory limit " << (limit >> 20) << "MB: blocks of " << (block_cap >> 10) << "KB" << endl;
+	}
+
+	int blockCap() { return block_cap; }
+
+	////////////////////////////////////////////////////////////////
+	// courier slots that fit next to the encoders, at least one per worker
+	////////////////////////////////////////////////////////////////
+	int slots(int requested, int num_workers) {
+		if (!limited() ) return requested;
+		size_t encoders = (size_t)std::max(1, num_workers) * LZ_ENCODER_FACTOR * block_cap;
+		size_t left = packetsShare() > encoders ? packetsShare() - encoders : 0;
+		int fit = left / (2 * (size_t)block_cap);
+		return std::max(std::max(1, num_workers), std::min(requested, fit) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	// block size for a new stream buffer
+	////////////////////////////////////////////////////////////////
+	int reserveBlock(int requested) {
+		if (!limited() ) return requested;
+		pthread_mutex_lock(&mutex);
+		size_t left = buffersShare() > reserved ? buffersShare() - reserved : 0;
+		int granted = std::min( (size_t)std::min(requested, block_cap), left);
+		if (granted < MIN_BLOCK_SIZE) {
+			granted = std::min(requested, MIN_BLOCK_SIZE);
+			if (!squeezed)
+				cerr << "[INFO] Stream buffers are past the memory limit, new streams get " <<
+					(granted >> 10) << "KB blocks" << endl;
+			squeezed = true;
+		}
+		reserved += granted;
+		pthread_mutex_unlock(&mutex);
+		return granted;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// a stream buffer was closed (several files go through one budget in a batch)
+	////////////////////////////////////////////////////////////////
+	void releaseBlock(int granted) {
+		if (!limited() ) return;
+		pthread_mutex_lock(&mutex);
+		reserved -= std::min(reserved, (size_t)granted);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// compressed bytes the muxer may hand to the writer threads
+	////////////////////////////////////////////////////////////////
+	long long writeWindow(long long requested) {
+		if (!limited() ) return requested;
+		return std::min(requested, 4LL * block_cap);
+	}
+
+	////////////////////////////////////////////////////////////////
+	size_t unalignedCap(size_t requested) {
+		if (!limited() ) return requested;
+		return std::min(requested, limit / 8);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// vectors sampled for cluster discovery, half of the working set
+	////////////////////////////////////////////////////////////////
+	int bootstrapVectors(int requested) {
+		if (!limited() ) return requested;
+		size_t fit = workingShare() / 2 / BOOTSTRAP_VECTOR_BYTES;
+		return std::max(1, (int)std::min( (size_t)requested, fit) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	// bytes of records the parser decodes in a batch, a quarter of the working set
+	////////////////////////////////////////////////////////////////
+	size_t parserBatch(size_t requested) {
+		if (!limited() ) return requested;
+		return std::max( (size_t)1, std::min(requested, workingShare() / 4) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	// working set bytes taken and given back (see above)
+	////////////////////////////////////////////////////////////////
+	void charge(size_t bytes) {
+		if (!limited() ) return;
+		pthread_mutex_lock(&mutex);
+		working += bytes;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	void release(size_t bytes) {
+		if (!limited() ) return;
+		pthread_mutex_lock(&mutex);
+		working -= std::min(working, bytes);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// bytes that can still be charged to the working set
+	////////////////////////////////////////////////////////////////
+	bool fits(size_t bytes) {
+		if (!limited() ) return true;
+		pthread_mutex_lock(&mutex);
+		bool fit = working + bytes <= workingShare();
+		pthread_mutex_unlock(&mutex);
+		return fit;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// producers give back what they hold while this is set
+	////////////////////////////////////////////////////////////////
+	bool exhausted() {
+		if (!limited() ) return false;
+		pthread_mutex_lock(&mutex);
+		bool over = working > workingShare();
+		pthread_mutex_unlock(&mutex);
+		return over;
+	}
+};
+
+inline MemoryBudget & memoryBudget() {
+	static MemoryBudget budget;
+	return budget;
+}
+
+////////////////////////////////////////////////////////////////
+// 512M, 4G, 1048576 etc.; 0 if the value can't be parsed
+////////////////////////////////////////////////////////////////
+size_t parseMemorySize(string const & s) {
+	char * end = NULL;
+	double v = strtod(s.c_str(), &end);
+	if (end == s.c_str() || v <= 0) return 0;
+	size_t unit = 1;
+	switch (*end) {
+		case 'k': case 'K': unit = 1ul << 10; end++; break;
+		case 'm': case 'M': unit = 1ul << 20; end++; break;
+		case 'g': case 'G': unit = 1ul << 30; end++; break;
+		case '\0': break;
+		default: return 0;
+	}
+	if (*end == 'B' || *end == 'b') end++;
+	if (*end != '\0') return 0;
+	return (size_t)(v * unit);
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <queue>
+#include <limits>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -10,6 +11,7 @@
 #include <compress.h>
 
 #include "IntervalTree.h"
+#include "MemoryBudget.hpp"
 
 const mode_t usr_rw = S_IRUSR | S_IWUSR;
 const mode_t all_rw = usr_rw | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
@@ -39,9 +41,9 @@ public:
 		courier(c),
 		genomic_coordinates_out(genomic_coord_out),
 		stream_suffix(suff),
-		dictionary_size(d),
+		dictionary_size(memoryBudget().reserveBlock(d) ),
 		match_len_limit(match_len) {
-		int flags = O_CREAT | O_WRONLY | o_binary;
+		int flags = O_CREAT | O_WRONLY | O_TRUNC | o_binary;
 		out_fd = open( (fn + suff).c_str(), flags, outfd_mode );
 		// cerr << suff << " fd=" << out_fd << endl;
 	}
@@ -51,15 +53,16 @@ public:
 			int d = 1<<23, int match_len = 36): 
 		courier(c),
 		stream_suffix(suff),
-		dictionary_size(d),
+		dictionary_size(memoryBudget().reserveBlock(d) ),
 		match_len_limit(match_len) {
-		int flags = O_CREAT | O_WRONLY | o_binary;
+		int flags = O_CREAT | O_WRONLY | O_TRUNC | o_binary;
 		out_fd = open( (fn + suff).c_str(), flags, outfd_mode );
 	}
 
 	///////////////////////////////////////////////////////////
 	~OutputBuffer() {
 		close(out_fd);
+		memoryBudget().releaseBlock(dictionary_size);
 	}
 
 	void setInitialCoordinate(int c, int off) {
@@ -99,19 +102,25 @@ public:
 
 	friend void writeLongSpliceOp(const edit_pair & edit, int prev_edit_offset, int splice_len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
-	friend void writeReadLen(uint8_t read_len, shared_ptr<OutputBuffer> o_str);
+	friend void writeReadLen(int len, int & prev_len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
 	friend void writeQualVector(char * q, int len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
-	friend void writeString(string & s, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+	friend void writeString(string const & s, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
-	friend void writeClip(vector<uint8_t> & clip_bytes, int clip_length, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+	friend void writeClip(vector<uint8_t> const & packed, int clip_length, vector<pair<int,uint8_t>> const & exceptions, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
 	friend void writeName(char * read_name, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
+	friend void writeNameToken(char const * token, int len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+
+	friend void writeVarint(uint64_t v, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+
 	friend void writeFlags(int flags, int mapq, int rnext, int pnext, int tlen, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
-	friend void writeOpt(string opt, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+	friend void writeMateFlags(int flags, int mapq, int rnext, int mate, int model, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
+
+	friend void writeBytes(uint8_t const * bytes, int len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num);
 
 	friend void writeUnaligned(UnalignedRead & read, bool seq_only, shared_ptr<OutputBuffer> o_str);
 
@@ -121,6 +130,13 @@ public:
 	// stream size
 	int size() { return data.size(); }
 
+	// blocks handed to the compressor so far; the next byte goes into block blocks()
+	size_t blocks() { return blocks_written; }
+
+	// cut blocks only after a record: a block ends w/ the record that filled
+	// it, so every block starts w/ a record of its own
+	void keepRecordsWhole() { whole_records = true; }
+
 	void flush() {
 		// TODO: last chromosome, max coordinate
 		GenomicCoordinate g(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
@@ -141,6 +157,8 @@ private:
 
 	int64_t total_bytes = 0;
 
+	size_t blocks_written = 0;
+
 	// vector<uint8_t> data;
 	deque<uint8_t> data;
 	int out_fd; // output file descriptor
@@ -148,6 +166,8 @@ private:
 
 	int dictionary_size = 1<<23;
 
+	bool whole_records = false;
+
 	int match_len_limit = 36; // equivalent to -6 option
 
 	// int packet_size = 2<<22;
@@ -160,7 +180,9 @@ private:
 	//
 	////////////////////////////////////////////////////////////////
 	void compressAndWriteOut(GenomicCoordinate & currentCoord, size_t num_alignments, bool flush_all = false) {
+		PROFILE_SCOPE("buffer.dump");
 		int data_size = data.size();
+		PROFILE_COUNT("buffer.dump", data_size);
 		total_bytes += data_size;
 
 		if (!flush_all)
@@ -168,30 +190,35 @@ private:
 
 		// TODO: is this usually one packet?
 		// can we avoid memcpy and just give away this data vector to the packet?
+		int block_size = whole_records ? std::max(data_size, 1) : dictionary_size;
 		int max_size = 0;
 		if (flush_all) 
 			max_size = data_size;
 		else 
-			max_size = (data_size / dictionary_size) * dictionary_size;
+			max_size = (data_size / block_size) * block_size;
 
 		// cerr << "max packet size: " << max_size << endl;
 
 		// coord output is not set for the stream of unaligned reads
-		// and chromosome is not set if flushing data out
+		// and chromosome is not set if flushing data out;
+		// one line per block: a record longer than a block fills several
+		int lines = std::max(1, (max_size + block_size - 1) / block_size);
 		if (currentCoord.chromosome != -1 && genomic_coordinates_out != nullptr)
-			(*genomic_coordinates_out) << stream_suffix << " " << prev_num_alignments << " " << 
-				startCoord.chromosome << ":" << 
-				startCoord.offset << "-" <<
-				endCoord.chromosome << ":" << endCoord.offset << endl;
+			for (int l = 0; l < lines; l++)
+				(*genomic_coordinates_out) << stream_suffix << " " << prev_num_alignments << " " <<
+					startCoord.chromosome << ":" <<
+					startCoord.offset << "-" <<
+					endCoord.chromosome << ":" << endCoord.offset << endl;
 
-		for (int ate = 0; ate < max_size; ate += dictionary_size) {
+		for (int ate = 0; ate < max_size; ate += block_size) {
 			// cerr << "sending the block to PLZIP" << endl;
 			int remainder = data_size - ate;
-			int size = std::min(dictionary_size, remainder);
+			int size = std::min(block_size, remainder);
 			uint8_t * block_data = new( std::nothrow ) uint8_t[ size ];
 			int i;
 			for (i = 0; i < size; i++) block_data[i] = data[i];
 			courier->receive_packet( block_data, size, out_fd ); // associate an output stream to the packet
+			blocks_written++;
 			// erase the elements that we sent to a packet
 			// pop_front is better for this
 			i = 0;
@@ -293,12 +320,6 @@ void writeLongSpliceOp(const edit_pair & edit, int prev_edit_offset,
 	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
 }
 
-void writeReadLen(uint8_t read_len, shared_ptr<OutputBuffer> o_str) {
-	o_str->data.push_back(read_len);
-	// GenomicCoordinate g;
-	// if (o_str->timeToDump() ) o_str->compressAndWriteOut(g, 0);
-}
-
 void writeQualVector(char * q, int len, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num) {
 	for (auto i = 0; i < len; i++)
 		o_str->data.push_back( (uint8_t)(q[i] + '!') );
@@ -306,12 +327,49 @@ void writeQualVector(char * q, int len, shared_ptr<OutputBuffer> o_str, GenomicC
 	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
 }
 
-void writeClip(vector<uint8_t> & clip_bytes, 
-	int clip_length, 
+// 7 bits per byte, least significant first
+inline void appendVarint(deque<uint8_t> & data, uint64_t v) {
+	while (v >= 128) {
+		data.push_back( (v & 127) | 128);
+		v >>= 7;
+	}
+	data.push_back(v);
+}
+
+////////////////////////////////////////////////////////////////
+// 0 if the same as prev_len, length + 1 otherwise; the first record of a
+// block always has the length (see ReadLenStream.hpp)
+////////////////////////////////////////////////////////////////
+void writeReadLen(int len, int & prev_len, shared_ptr<OutputBuffer> o_str,
+	GenomicCoordinate & coord, size_t num) {
+	appendVarint(o_str->data, len == prev_len ? 0 : len + 1);
+	prev_len = len;
+	if (o_str->timeToDump() ) {
+		o_str->compressAndWriteOut(coord, num);
+		// a block was cut right after this record
+		if (o_str->data.size() == 0) prev_len = -1;
+	}
+}
+
+// varint (length << 1 | 1 if there are exceptions), the 2-bit packed bases,
+// then for clips w/ bases other than A, C, G, T: varint count and
+// (varint gap to the previous exception, base) pairs
+void writeClip(vector<uint8_t> const & packed,
+	int clip_length,
+	vector<pair<int,uint8_t>> const & exceptions,
 	shared_ptr<OutputBuffer> o_str, 
 	GenomicCoordinate & coord, size_t num) {
-	for (auto i = 0; i < clip_length; i++) o_str->data.push_back(clip_bytes[i]);
-	o_str->data.push_back('\n');
+	appendVarint(o_str->data, ( (uint64_t)clip_length << 1) | (exceptions.size() > 0) );
+	o_str->data.insert(o_str->data.end(), packed.begin(), packed.end() );
+	if (exceptions.size() > 0) {
+		appendVarint(o_str->data, exceptions.size() );
+		int prev = 0;
+		for (auto & e : exceptions) {
+			appendVarint(o_str->data, e.first - prev);
+			o_str->data.push_back(e.second);
+			prev = e.first;
+		}
+	}
 	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
 }
 
@@ -325,11 +383,27 @@ void writeName(char * read_name,
 	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
 }
 
-void writeOpt(string opt, shared_ptr<OutputBuffer> o_str, 
+// zero-terminated string (read name tokens, aux tag values)
+void writeNameToken(char const * token, int len,
+	shared_ptr<OutputBuffer> o_str,
 	GenomicCoordinate & coord, size_t num) {
-	for (auto c : opt) o_str->data.push_back(c);
-	o_str->data.push_back('\n');
-	if (o_str->timeToDump()) o_str->compressAndWriteOut(coord, num);
+	for (auto i = 0; i < len; i++)
+		o_str->data.push_back(token[i]);
+	o_str->data.push_back(0);
+	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
+}
+
+void writeVarint(uint64_t v, shared_ptr<OutputBuffer> o_str,
+	GenomicCoordinate & coord, size_t num) {
+	appendVarint(o_str->data, v);
+	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
+}
+
+void writeBytes(uint8_t const * bytes, int len,
+	shared_ptr<OutputBuffer> o_str,
+	GenomicCoordinate & coord, size_t num) {
+	o_str->data.insert(o_str->data.end(), bytes, bytes + len);
+	if (o_str->timeToDump() ) o_str->compressAndWriteOut(coord, num);
 }
 
 void writeFlags(int flags, int mapq, int rnext, int pnext, int tlen, 
@@ -355,6 +429,24 @@ void writeFlags(int flags, int mapq, int rnext, int pnext, int tlen,
 	if (o_str->timeToDump()) o_str->compressAndWriteOut(coord, num);
 }
 
+////////////////////////////////////////////////////////////////
+// pnext and tlen follow from the mate: ">lines model" on the first mate,
+// "<" on the second one (see MatePrediction.hpp)
+////////////////////////////////////////////////////////////////
+void writeMateFlags(int flags, int mapq, int rnext, int mate, int model,
+	shared_ptr<OutputBuffer> o_str,
+	GenomicCoordinate & coord, size_t num) {
+	string line = to_string(flags) + ' ' + to_string(mapq) + ' ' + to_string(rnext) + ' ';
+	if (mate > 0)
+		line += '>' + to_string(mate) + ' ' + to_string(model);
+	else
+		line += '<';
+	line += '\n';
+	for (auto c : line)
+		o_str->data.push_back(c);
+	if (o_str->timeToDump()) o_str->compressAndWriteOut(coord, num);
+}
+
 void writeUnaligned(UnalignedRead & read, bool seq_only, 
 	shared_ptr<OutputBuffer> o_str) {
 	o_str->data.push_back('>');
@@ -374,14 +466,14 @@ void writeUnaligned(UnalignedRead & read, bool seq_only,
 		for (auto c : read.qual) o_str->data.push_back(c);
 		o_str->data.push_back('\n');
 		// strand
-		o_str->data.push_back('+');
+		o_str->data.push_back(read.rc ? '-' : '+');
 		o_str->data.push_back('\n');
 	}
 	GenomicCoordinate g;	// empty coordinate
 	if (o_str->timeToDump()) o_str->compressAndWriteOut(g, 0);
 }
 
-void writeString(string & s, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num) {
+void writeString(string const & s, shared_ptr<OutputBuffer> o_str, GenomicCoordinate & coord, size_t num) {
 	for (auto c : s) o_str->data.push_back(c);
 	o_str->data.push_back('\n');
 	if (o_str->timeToDump()) o_str->compressAndWriteOut(coord, num);
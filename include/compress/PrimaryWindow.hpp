@@ -0,0 +1,124 @@
+/*
+Window of recent primary alignments for the encoder: secondary and
+supplementary alignments found in it refer back to their primary through
+the .primary.lz stream (see PrimaryRef.hpp). The window drops its oldest
+entries while the memory budget is exhausted (see MemoryBudget.hpp)
+*/
+
+#ifndef PRIMARY_WINDOW_H
+#define PRIMARY_WINDOW_H
+
+#include <deque>
+#include <unordered_map>
+
+#include "OutputBuffer.hpp"
+#include "MemoryBudget.hpp"
+#include "PrimaryRef.hpp"
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class PrimaryWindow {
+
+	shared_ptr<OutputBuffer> out;
+
+	////////////////////////////////////////////////////////////////
+	// primaries seen within the last PRIMARY_WINDOW alignments; the order
+	// holds every alignment w/ a 0 token to mirror the decoder's window,
+	// key points into recent_primaries for primaries
+	////////////////////////////////////////////////////////////////
+	struct RecentPrimary {
+		size_t num;
+		bool rev;
+		string quals;
+	};
+	struct WindowEntry {
+		size_t num;
+		int len;
+		string const * key;
+		size_t charged;	// to the memory budget
+	};
+	unordered_map<string, RecentPrimary> recent_primaries;
+	deque<WindowEntry> primary_order;
+	size_t window_bytes = 0;
+
+	void evict() {
+		WindowEntry & e = primary_order.front();
+		if (e.key != nullptr) {
+			auto it = recent_primaries.find(*e.key);
+			if (it != recent_primaries.end() && it->second.num == e.num)
+				recent_primaries.erase(it);
+		}
+		window_bytes -= e.len;
+		memoryBudget().release(e.charged);
+		primary_order.pop_front();
+	}
+
+	void push(size_t num, int len, string const * key) {
+		while (!primary_order.empty() && window_bytes + len > PRIMARY_WINDOW_BYTES)
+			evict();
+		size_t charged = sizeof(WindowEntry) +
+			(key != nullptr ? key->size() + sizeof(RecentPrimary) + len + WORKING_ENTRY_BYTES : 0);
+		memoryBudget().charge(charged);
+		primary_order.push_back(WindowEntry{num, len, key, charged});
+		window_bytes += len;
+	}
+
+public:
+	size_t inherited_names = 0, inherited_quals = 0;
+
+	PrimaryWindow(shared_ptr<OutputBuffer> o): out(o) {}
+
+	~PrimaryWindow() { clear(); }
+
+	////////////////////////////////////////////////////////////////
+	// writes the token of the num-th alignment (quals as in the input,
+	// len of them); returns true if the name comes from the primary
+	////////////////////////////////////////////////////////////////
+	bool add(size_t num, char const * name, int flags, char const * q, int len, GenomicCoordinate & gc) {
+		// the decoder keeps at least this window, dropping more is always safe
+		while (!primary_order.empty() &&
+				(num - primary_order.front().num >= PRIMARY_WINDOW || memoryBudget().exhausted() ) )
+			evict();
+
+		auto key = primaryKey(name, flags);
+		bool rev = (flags & 16) > 0;
+		if ( (flags & 0x900) == 0) {
+			auto it = recent_primaries.emplace(key, RecentPrimary() ).first;
+			RecentPrimary & p = it->second;
+			p.num = num;
+			p.rev = rev;
+			p.quals.assign(q, len);
+			push(num, len, &it->first);
+			writeVarint(0, out, gc, num);
+			return false;
+		}
+
+		auto it = recent_primaries.find(key);
+		if (it == recent_primaries.end() ) {
+			push(num, len, nullptr);
+			writeVarint(0, out, gc, num);
+			return false;
+		}
+		RecentPrimary & p = it->second;
+		bool flip = p.rev != rev;
+		// missing qualities start w/ 0xff
+		bool same_quals = len > 0 && (uint8_t)q[0] != 0xff && len == (int)p.quals.size() &&
+			primaryQualsMatch(q, p.quals, flip);
+		writeVarint(primaryRefToken(num - p.num, flip, same_quals), out, gc, num);
+		inherited_names++;
+		if (same_quals) inherited_quals++;
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// hand the window back to the memory budget
+	////////////////////////////////////////////////////////////////
+	void clear() {
+		while (!primary_order.empty() ) evict();
+	}
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+Vantage point tree over the dense k-mer profiles of the quality clusters:
+finds the cluster nearest to a quality vector w/o comparing it to every cluster
+*/
+
+#ifndef PROFILE_INDEX_H
+#define PROFILE_INDEX_H
+
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "QualityCluster.hpp"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class ProfileIndex {
+
+	struct Node {
+		int item;	// profile used as the vantage point
+		float radius;	// median distance from the vantage point to the profiles below it
+		int inside = -1;	// subtree w/ profiles closer than radius
+		int outside = -1;	// subtree w/ profiles at radius or further
+	};
+
+	vector<Node> nodes;
+
+	vector<float const *> points;
+
+	int dims = 0;
+
+	int root = -1;
+
+	float dist(float const * a, float const * b) const {
+		return sqrt(d2_dense(a, b, dims));
+	}
+
+	///////////////////////////////////////////////////////////
+	// build a subtree over items[lo, hi)
+	///////////////////////////////////////////////////////////
+	int build(vector<pair<float,int>> & items, int lo, int hi) {
+		if (lo >= hi) return -1;
+		int n = nodes.size();
+		nodes.emplace_back();
+		nodes[n].item = items[lo].second;
+		nodes[n].radius = 0;
+		if (hi - lo == 1) return n;
+
+		float const * vp = points[items[lo].second];
+		for (int i = lo + 1; i < hi; i++)
+			items[i].first = dist(vp, points[items[i].second]);
+		int mid = (lo + 1 + hi) / 2;
+		nth_element(items.begin() + lo + 1, items.begin() + mid, items.begin() + hi);
+		nodes[n].radius = items[mid].first;
+		int in = build(items, lo + 1, mid);
+		int out = build(items, mid, hi);
+		nodes[n].inside = in;
+		nodes[n].outside = out;
+		return n;
+	}
+
+	///////////////////////////////////////////////////////////
+	void search(int n, float const * q, float & tau, int & best) const {
+		if (n < 0) return;
+		Node const & node = nodes[n];
+		float d = dist(q, points[node.item]);
+		if (d < tau || (d == tau && node.item < best) ) {
+			tau = d;
+			best = node.item;
+		}
+		if (d < node.radius) {
+			if (d - tau <= node.radius) search(node.inside, q, tau, best);
+			if (d + tau >= node.radius) search(node.outside, q, tau, best);
+		}
+		else {
+			if (d + tau >= node.radius) search(node.outside, q, tau, best);
+			if (d - tau <= node.radius) search(node.inside, q, tau, best);
+		}
+	}
+
+public:
+	ProfileIndex() {}
+
+	///////////////////////////////////////////////////////////
+	// index the first n clusters; results are positions in the cluster list
+	///////////////////////////////////////////////////////////
+	void build(vector<shared_ptr<QualityCluster>> const & clusters, int n) {
+		nodes.clear();
+		points.clear();
+		root = -1;
+		if (n <= 0) return;
+		nodes.reserve(n);
+		vector<pair<float,int>> items;
+		for (int i = 0; i < n; i++) {
+			points.push_back(clusters[i]->getProfileKmers().data());
+			items.push_back(make_pair(0.0f, i));
+		}
+		dims = clusters[0]->getProfileKmers().size();
+		root = build(items, 0, n);
+	}
+
+	int size() const {return points.size(); }
+
+	///////////////////////////////////////////////////////////
+	// nearest indexed profile w/ d2 below max_d2, -1 if there is none;
+	// d2 of the match is returned in best_d2
+	///////////////////////////////////////////////////////////
+	int nearest(vector<float> const & q, float max_d2, float & best_d2) const {
+		float tau = sqrt(max_d2);
+		int best = -1;
+		search(root, q.data(), tau, best);
+		best_d2 = (best < 0) ? max_d2 : tau * tau;
+		return best;
+	}
+};
+
+#endif
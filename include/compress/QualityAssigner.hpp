@@ -0,0 +1,279 @@
+/*
+Quality vector assignment stage: after the bootstrap the clusters are fixed, so
+vectors are matched against them by a pool of threads. Vectors are submitted
+in batches; batches come back in submission order so that the writes to the
+cluster streams and to the membership stream stay in the order of the alignments
+*/
+
+#ifndef QUALITY_ASSIGNER_H
+#define QUALITY_ASSIGNER_H
+
+#include <map>
+#include <queue>
+
+#include <compress.h>
+
+#include "QualityCluster.hpp"
+#include "ProfileIndex.hpp"
+
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+string trim_ends_s(string const & q_v, char mode, string & prefix, string & suffix) {
+	int i = 0, j = q_v.size() - 1;
+	while (i < (int)q_v.size() - 1 ) {
+		if (q_v[i] != mode && q_v[i+1] != mode) i++; // stricter
+		else {
+			i++;
+			break;
+		}
+	}
+	while (j > (i + 1) ) {
+		if (q_v[j] != mode && q_v[j-1] != mode) j--;
+		else {
+			// j--;
+			break;
+		}
+	}
+	if (i < 8) {
+		// do not cut prefix
+		prefix = "";
+		i = 0;
+	}
+	else {
+		prefix = q_v.substr(0, i);
+	}
+	if (q_v.size() - j < 8) {
+		// do not cut suffix
+		suffix = "";
+		j = q_v.size();
+	}
+	else {
+		suffix = q_v.substr(j);
+	}
+	return q_v.substr(i, j-i);
+}
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+char weighted_mode(string const & qual, int & f) {
+	// TODO: a more careful implementation: need 90 or less? space or smthing else?
+	float weights[90];
+	int frequencies[90];
+	for (int i = 0; i < 90; i++)  {
+		weights[i] = 0;
+		frequencies[i] = 0;
+	}
+	for (auto c: qual) {
+		int w = c - ' ';
+		weights[c - ' '] += 0.1 * w; // w * w
+		frequencies[c-' ']++;
+	}
+	// find max
+	float max_f = 0, max_i = -1;
+	for (int i = 0; i < 90; i++) {
+		if (weights[i] >= max_f) {
+			// max_f = weights[i];
+			max_f = frequencies[i];
+			max_i = i;
+		}
+	}
+	f = max_f;
+	return max_i + ' ';
+}
+
+////////////////////////////////////////////////////////////////
+// a quality vector waiting for (or done with) cluster assignment
+////////////////////////////////////////////////////////////////
+struct QualityAssignment {
+	string core;	// whole vector on input; trimmed core if assigned to a cluster
+	string prefix;
+	string suffix;
+	int cluster_idx = -1;	// index into the cluster list, -1 for the generic pile
+	GenomicCoordinate gc;
+	size_t num_align;
+};
+
+struct QualityBatch {
+	int id = 0;	// serial number assigned on submission
+	vector<QualityAssignment> items;
+	size_t charged = 0;	// to the memory budget
+};
+
+////////////////////////////////////////////////////////////////
+// find the nearest cluster for a single vector; mirrors the bootstrap
+// assignment except that no new clusters are created
+////////////////////////////////////////////////////////////////
+void assignToCluster(QualityAssignment & a, ProfileIndex const & index,
+		int K, QualityAlphabet const & alphabet, vector<float> & q_kmers) {
+	int mode_frequency = 0;
+	char m = weighted_mode(a.core, mode_frequency);
+	a.cluster_idx = -1;
+	if (mode_frequency < 0.26 * a.core.size()) return;
+
+	a.core = trim_ends_s(a.core, m, a.prefix, a.suffix);
+	countKmers(a.core, K, alphabet, q_kmers);
+	float d = 0;
+	a.cluster_idx = index.nearest(q_kmers, 0.05, d);
+	// the generic pile keeps whole vectors
+	if (a.cluster_idx < 0) {
+		a.core = a.prefix + a.core + a.suffix;
+		a.prefix.clear();
+		a.suffix.clear();
+	}
+}
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class QualityAssigner {
+
+	// built over the clusters once; clusters and the alphabet do not change
+	// for the lifetime of the assigner
+	ProfileIndex index;
+
+	QualityAlphabet const & alphabet;
+
+	int K;
+
+	int num_threads;
+
+	pthread_t * threads = nullptr;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t iav_or_eof;	// batch available or no more batches coming
+	pthread_cond_t oav;		// a batch was assigned
+
+	queue<QualityBatch *> todo;
+
+	map<int, QualityBatch *> done;	// assigned batches keyed by serial number
+
+	int submit_id = 0;	// id of the next batch submitted
+
+	int collect_id = 0;	// id of the next batch handed back
+
+	bool eof = false;
+
+	///////////////////////////////////////////////////////////
+	static void * run(void * arg) {
+		QualityAssigner & qa = *(QualityAssigner *)arg;
+		vector<float> q_kmers;
+		while (true) {
+			xlock(&qa.mutex);
+			while (qa.todo.empty() && !qa.eof)
+				xwait(&qa.iav_or_eof, &qa.mutex);
+			if (qa.todo.empty()) {
+				xunlock(&qa.mutex);
+				break;
+			}
+			QualityBatch * b = qa.todo.front();
+			qa.todo.pop();
+			xunlock(&qa.mutex);
+
+			{
+				PROFILE_SCOPE("quals.assign");
+				PROFILE_COUNT("quals.assign", b->items.size());
+				for (auto & a : b->items)
+					assignToCluster(a, qa.index, qa.K, qa.alphabet, q_kmers);
+			}
+
+			xlock(&qa.mutex);
+			qa.done[b->id] = b;
+			if (b->id == qa.collect_id) xsignal(&qa.oav);
+			xunlock(&qa.mutex);
+		}
+		return 0;
+	}
+
+public:
+	///////////////////////////////////////////////////////////
+	QualityAssigner(vector<shared_ptr<QualityCluster>> const & c, QualityAlphabet const & a, int k, int n):
+		alphabet(a),
+		K(k),
+		num_threads(std::max(1, n)) {
+		index.build(c, c.size());
+		xinit(&mutex);
+		xinit(&iav_or_eof);
+		xinit(&oav);
+		threads = new pthread_t[num_threads];
+		for (int i = 0; i < num_threads; i++) {
+			int errcode = pthread_create(threads + i, 0, run, this);
+			if (errcode) {
+				cerr << "[ERROR] Can't create quality assignment threads" << endl;
+				exit(1);
+			}
+		}
+	}
+
+	~QualityAssigner() {
+		finish();
+		xdestroy(&oav);
+		xdestroy(&iav_or_eof);
+		xdestroy(&mutex);
+	}
+
+	int getNumThreads() {return num_threads;}
+
+	///////////////////////////////////////////////////////////
+	// batches submitted but not collected yet
+	///////////////////////////////////////////////////////////
+	int inFlight() { return submit_id - collect_id; }
+
+	///////////////////////////////////////////////////////////
+	void submit(QualityBatch * b) {
+		xlock(&mutex);
+		b->id = submit_id++;
+		todo.push(b);
+		xsignal(&iav_or_eof);
+		xunlock(&mutex);
+	}
+
+	///////////////////////////////////////////////////////////
+	// next batch in submission order; waits for it if block is set,
+	// otherwise returns nullptr if it is not ready
+	///////////////////////////////////////////////////////////
+	QualityBatch * collect(bool block) {
+		QualityBatch * b = nullptr;
+		xlock(&mutex);
+		if (collect_id < submit_id) {
+			auto it = done.find(collect_id);
+			while (block && it == done.end()) {
+				xwait(&oav, &mutex);
+				it = done.find(collect_id);
+			}
+			if (it != done.end()) {
+				b = it->second;
+				done.erase(it);
+				collect_id++;
+			}
+		}
+		xunlock(&mutex);
+		return b;
+	}
+
+	///////////////////////////////////////////////////////////
+	// no more batches: let the threads drain the queue and exit
+	///////////////////////////////////////////////////////////
+	void finish() {
+		if (threads == nullptr) return;
+		xlock(&mutex);
+		eof = true;
+		xbroadcast(&iav_or_eof);
+		xunlock(&mutex);
+		for (int i = 0; i < num_threads; i++) {
+			int errcode = pthread_join(threads[i], 0);
+			if (errcode) {
+				cerr << "[ERROR] Can't join quality assignment threads" << endl;
+				exit(1);
+			}
+		}
+		delete[] threads;
+		threads = nullptr;
+	}
+};
+
+#endif
@@ -4,39 +4,140 @@
 #include <memory>
 #include <fstream>
 #include <string>
-#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
 
 #include <compress.h>
 #include "OutputBuffer.hpp"
+#include "QualityCoreBuffer.hpp"
 
 using namespace std;
 
 
 ////////////////////////////////////////////////////////////////
-// convert kmer from base 89 ('z' - '!') to base 10
+// quality values compacted to the symbols actually observed in the data;
+// at most MAX_QUAL_ALPHABET codes, the rarest symbols share the last code
 ////////////////////////////////////////////////////////////////
-chrono::duration<double> elapsed_seconds_d2_loop1;
-int range = 'z' - '!' + 1;
-// only for 4-mers
-// 5mers would require int64_t
-int r_base[] = {range*range*range, range*range, range, 1};
+#define MAX_QUAL_ALPHABET 16
+
+class QualityAlphabet {
+	uint8_t codes[256];
+	int alphabet_size = 1;
+	vector<int> ranked;	// symbols w/ a code of their own, most frequent first
+
+	void assignCodes() {
+		// unseen symbols and the overflow go into the last code
+		memset(codes, alphabet_size - 1, sizeof(codes));
+		for (int i = 0; i < (int)ranked.size(); i++) codes[ranked[i]] = i;
+	}
+
+public:
+	QualityAlphabet() { memset(codes, 0, sizeof(codes)); }
+
+	////////////////////////////////////////////////////////////////
+	// assign codes to symbols by decreasing frequency in the sample
+	////////////////////////////////////////////////////////////////
+	void build(vector<string> const & sample) {
+		size_t freq[256] = {0};
+		for (auto & q_v : sample)
+			for (auto c : q_v) freq[(uint8_t)c]++;
+		vector<int> symbols;
+		for (int c = 0; c < 256; c++)
+			if (freq[c] > 0) symbols.push_back(c);
+		sort(symbols.begin(), symbols.end(), [&freq](int a, int b) {
+			return freq[a] > freq[b];
+		});
+		alphabet_size = std::max(1, std::min( (int)symbols.size(), MAX_QUAL_ALPHABET) );
+		ranked.assign(symbols.begin(), symbols.begin() + (alphabet_size - 1) );
+		assignCodes();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// one line: size followed by the ranked symbols
+	////////////////////////////////////////////////////////////////
+	void save(ostream & out) const {
+		out << alphabet_size;
+		for (auto c : ranked) out << " " << c;
+		out << endl;
+	}
+
+	bool load(istream & in) {
+		if ( !(in >> alphabet_size) || alphabet_size < 1 || alphabet_size > MAX_QUAL_ALPHABET)
+			return false;
+		ranked.resize(alphabet_size - 1);
+		for (auto & c : ranked)
+			if ( !(in >> c) || c < 0 || c > 255) return false;
+		assignCodes();
+		return true;
+	}
+
+	int size() const { return alphabet_size; }
+
+	uint8_t code(char c) const { return codes[(uint8_t)c]; }
+
+	// number of distinct k-mers over this alphabet, padded for the SIMD kernel
+	int dims(int K) const {
+		int d = 1;
+		for (int i = 0; i < K; i++) d *= alphabet_size;
+		return (d + 7) & ~7;
+	}
+};
 
 ////////////////////////////////////////////////////////////////
-unordered_map<int, int> countKmers(string const & q_v, int const K) {
-	chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
-	unordered_map<int, int> kmers;
-	for (int i = 0; i < q_v.size() - K + 1; i++) {
-		int kmer_int = 0;
-		for (int j = 0; j < K; j++) {
-			kmer_int += (q_v[i + j] - '!') * r_base[j];
-		}
-		if (kmers.find(kmer_int) == kmers.end() )
-			kmers[kmer_int] = 0;
-		kmers[kmer_int]++;
+// dense histogram of k-mer frequencies normalized by the number of k-mers
+////////////////////////////////////////////////////////////////
+void countKmers(string const & q_v, int const K, QualityAlphabet const & alphabet, vector<float> & hist) {
+	hist.assign(alphabet.dims(K), 0);
+	int n = (int)q_v.size() - K + 1;
+	if (n <= 0) return;
+	float w = 1.0f / n;
+	int A = alphabet.size(), top = 1;
+	for (int j = 1; j < K; j++) top *= A;
+	int kmer_int = 0;
+	for (int j = 0; j < K - 1; j++)
+		kmer_int = kmer_int * A + alphabet.code(q_v[j]);
+	for (int i = K - 1; i < q_v.size(); i++) {
+		// roll the window: drop the leading symbol, append the next one
+		kmer_int = kmer_int * A + alphabet.code(q_v[i]);
+		hist[kmer_int] += w;
+		kmer_int %= top;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// squared euclidean distance between two dense profiles; n is a multiple of 8
+////////////////////////////////////////////////////////////////
+float d2_dense(float const * a, float const * b, int const n) {
+#if defined(__AVX__)
+	__m256 acc = _mm256_setzero_ps();
+	for (int i = 0; i < n; i += 8) {
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+	}
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+#elif defined(__SSE__)
+	__m128 s = _mm_setzero_ps();
+	for (int i = 0; i < n; i += 4) {
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		s = _mm_add_ps(s, _mm_mul_ps(d, d));
+	}
+#endif
+#if defined(__AVX__) || defined(__SSE__)
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+#else
+	float d2_ = 0;
+	for (int i = 0; i < n; i++) {
+		float d = a[i] - b[i];
+		d2_ += d * d;
 	}
-	chrono::time_point<chrono::system_clock> end = chrono::system_clock::now();
-	elapsed_seconds_d2_loop1 += (end - start);
-	return kmers;
+	return d2_;
+#endif
 }
 
 
@@ -54,13 +155,10 @@ private:
 	int cluster_id = -1;
 	size_t total_vectors = 0;
 	string profile;
-	shared_ptr<unordered_map<int, int>> profile_kmers;
-	vector<string> data;
-	vector<string> prefices;
-	vector<string> suffices;
-	vector<int> ids;	// a vector of qual IDs -- its index in the original SAM file
+	vector<float> profile_kmers;
 
-	shared_ptr<OutputBuffer> output_str;
+	shared_ptr<OutputBuffer> output_str;	// generic pile only
+	shared_ptr<QualityCoreBuffer<QualityModel>> core_str;
 	shared_ptr<OutputBuffer> prefix_str;
 	shared_ptr<OutputBuffer> suffix_str;
 
@@ -69,90 +167,45 @@ public:
 
 	QualityCluster(Packet_courier * c, bool p = false): courier(c), is_pile(p) {}
 
-	QualityCluster(Packet_courier * c, string & profile, int K, char m, bool p = false): 
+	QualityCluster(Packet_courier * c, string & profile, int K, char m, 
+		QualityAlphabet const & alphabet, bool p = false): 
 		courier(c), 
 		is_pile(p), 
 		mode(m) {
 		this->profile = profile;
 		// build profile kmers
 		// store them within the class instead of recomputing every time
-		auto kmers = countKmers(profile, K);
-		profile_kmers = make_shared<unordered_map<int,int>>( kmers );
+		countKmers(profile, K, alphabet, profile_kmers);
 	}
 
 	~QualityCluster() {
 		// cerr << "Cluster " << cluster_id << ": " << total_vectors << " vectors" << endl;
 	}
 
-	shared_ptr<unordered_map<int,int>> getProfileKmers() {return profile_kmers;} 
+	vector<float> const & getProfileKmers() {return profile_kmers;} 
 
 	int getProfileSize() {return profile.size(); }
 
+	string const & getProfile() {return profile; }
+
+	char getMode() {return mode; }
+
 	int getClusterID() {return cluster_id;}
 
 	void setClusterID(int id) {cluster_id = id;}
 
-	int size () {return data.size(); }
-
-	////////////////////////////////////////////////////////////////
-	// add string's core, pref, suffix
-	////////////////////////////////////////////////////////////////
-	void add(string & q_v, int id, string & prefix, string & suffix) {
-		total_vectors++;
-		data.push_back(q_v);
-		ids.push_back(id);
-		prefices.push_back(prefix);
-		suffices.push_back(suffix);
-	}
+	size_t getTotalVectors() {return total_vectors; }
 
 	////////////////////////////////////////////////////////////////
-	// add string as is, w/o breaking it into core, pref and suff
-	////////////////////////////////////////////////////////////////
-	void add(string & q_v, int id) {
-		total_vectors++;
-		data.push_back(q_v);
-		ids.push_back(id);
-	}
-
+	// cores of the real clusters go through the cluster's context model;
+	// the generic pile is stored as plain lines
 	////////////////////////////////////////////////////////////////
-	/*
-	# for i in xrange(n):
-	# 	symbol = line[i]
-	# 	if symbol.isdigit():
-	# 		# remap to a 130 range
-	# 		symbol =  chr(130 + int(symbol) )
-	# 	if symbol != 'J':
-	# 		delta = i - prev_pos - 1
-	# 		if delta > 0:
-	# 			edit_str += str(delta)
-	# 		edit_str += symbol
-	# 		prev_pos = i
-	*/
 	void writeCore(string const & core, GenomicCoordinate & currentCoord) {
 		total_vectors++;
-		string deltas = "";
-		if (mode >= '!') {
-			// cerr << "Delta on quals!" << endl;
-			// transform core into a string of deltas to the mode
-			int prev_pos = 0;
-			for (int i = 0; i < core.size(); i++) {
-				uint8_t symbol = core[i];
-				if (isdigit(symbol))
-					symbol = (uint8_t)(symbol + (uint8_t)130);
-				if (symbol != mode) {
-					int delta = i - prev_pos - 1;
-					if (delta > 0)
-						deltas += to_string(delta);
-					deltas.push_back(symbol);
-					prev_pos = i;
-				}
-			}
-			// cerr << deltas << endl;
-		}
-		else {
-			deltas = core;
-		}
-		writeString(deltas, output_str, currentCoord, 0);
+		if (is_pile)
+			writeString(core, output_str, currentCoord, 0);
+		else
+			core_str->write(core, currentCoord);
 	}
 
 	////////////////////////////////////////////////////////////////
@@ -166,64 +219,15 @@ public:
 	}
 
 	void flush() {
-		output_str->flush();
-		if (!is_pile) {
+		if (is_pile)
+			output_str->flush();
+		else {
+			core_str->flush();
 			prefix_str->flush();
 			suffix_str->flush();
 		}
 	}
 
-	////////////////////////////////////////////////////////////////
-	void flushBootstrapData() {
-		// TODO: keep track of the gneomic coordinates
-		GenomicCoordinate gc;
-		for (int j = 0; j < data.size(); j++) {
-			writeCore(data[j], gc);
-			if (!is_pile) {
-				writePrefix(prefices[j], gc);
-				writeSuffix(suffices[j], gc);
-			}
-			// else: prefix and suffix are not filled out
-		}
-		data.clear();
-		prefices.clear();
-		suffices.clear();
-	}
-
-	////////////////////////////////////////////////////////////////
-	void fillOutClusterMembership(vector<int> & cluster_membership) {
-		for (auto i : ids) {
-			cluster_membership[i] = cluster_id;
-		}
-	}
-
-	////////////////////////////////////////////////////////////////
-	// merge the data from cluster to "this", taking into account their order
-	////////////////////////////////////////////////////////////////
-	void mergeCluster(shared_ptr<QualityCluster> cluster) {
-		if (is_pile) {
-			int i = 0, j = 0;
-			while (j < cluster->size() && i < data.size()) {
-				while (ids[i] < cluster->ids[j]) {
-					i++;
-				}
-				// insert before i-th element
-				// TODO: this is O(n), should use another data structure
-				ids.push_back(cluster->ids[j]); // order does not matter -- it is an index
-				data.insert( data.begin() + i, cluster->prefices[j] + cluster->data[j] + cluster->suffices[j] );
-				j++;
-				i++;
-			}
-			while (j < cluster->size()) {
-				ids.push_back(cluster->ids[j]);
-				data.push_back( cluster->prefices[j] + cluster->data[j] + cluster->suffices[j] );
-				j++;
-			}
-		}
-		// else: should not happen at this iteration
-		// TODO: may merge non-empty clusters later
-	}
-
 	////////////////////////////////////////////////////////////////
 	void openOutputStream(string & fname_prefix, shared_ptr<ofstream> genomic_coords_out, int K_c) {
 		if (cluster_id < 0 || is_pile) {
@@ -231,8 +235,8 @@ public:
 				genomic_coords_out, fname_prefix, ".quals.other.lz", 3 << 20,  12 ) ); // equivalent of -4
 		}
 		else {
-			output_str = shared_ptr<OutputBuffer>(new OutputBuffer(courier, 
-				genomic_coords_out, fname_prefix, ".quals." + to_string(cluster_id) + ".lz" ) );
+			core_str = shared_ptr<QualityCoreBuffer<QualityModel>>(new QualityCoreBuffer<QualityModel>(courier, 
+				genomic_coords_out, fname_prefix, ".quals." + to_string(cluster_id) + ".ac" ) );
 			// prefices, suffices
 			prefix_str = shared_ptr<OutputBuffer>(new OutputBuffer(courier, 
 				genomic_coords_out, fname_prefix, ".quals." + to_string(cluster_id) + ".prefix.lz" ) );
@@ -243,7 +247,8 @@ public:
 
 	////////////////////////////////////////////////////////////////
 	void closeOutputStream() {
-		output_str->flush();
+		if (output_str != nullptr) output_str->flush();
+		if (core_str != nullptr) core_str->flush();
 		if (prefix_str != nullptr) prefix_str->flush();
 		if (suffix_str != nullptr) suffix_str->flush();
 	}
@@ -1,131 +1,19 @@
 /* 
-Quality values compressor: finds and refines the clusters based on the first 2mln qual vectors,
-maintains OutputBuffers for the clusters
+Quality values compressor: clusters a uniform sample of the quality vectors in the
+background (see QualityDiscovery.hpp), maintains OutputBuffers for the clusters
 */
 
 #ifndef QUALITY_COMP_H
 #define QUALITY_COMP_H
 
-#include <chrono>
-
-#include "QualityCluster.hpp"
+#include "RefereeProfile.hpp"
+#include "QualityDiscovery.hpp"
+#include "QualityModelFile.hpp"
+#include "QualityBinning.hpp"
 
 #define GENERIC_PILE_ID 0
 
 
-chrono::duration<double> elapsed_seconds_d2_loop2;
-chrono::duration<double> elapsed_seconds_d2_loop3;
-
-////////////////////////////////////////////////////////////////
-//
-////////////////////////////////////////////////////////////////
-float d2_fast(shared_ptr<unordered_map<int, int>> profile_kmers, float const f1, 
-	unordered_map<int,int> const & counts, float const f2) {
-	chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
-	// compare kmer profiles
-	float d2_ = 0;
-	// all things in cluster profile, but not in this string AND things shared
-	for (auto p : *profile_kmers) {
-		auto it = counts.find(p.first);
-		if (it == counts.end() )
-			d2_ += (p.second / f1) * (p.second / f1);
-		else {
-			float delta = p.second / f1 - (*it).second / f2;
-			d2_ += delta * delta;
-		}
-	}
-	chrono::time_point<std::chrono::system_clock> end = chrono::system_clock::now();
-	elapsed_seconds_d2_loop2 += (end - start);
-
-	// counts all things in this string, but not in cluster profile
-	start = chrono::system_clock::now();
-	for (auto p : counts) {
-		if (profile_kmers->find(p.first) == profile_kmers->end()) {
-			d2_ += p.second / f2 * p.second/f2;
-		}
-		// else -- already counted above
-	}
-	end = chrono::system_clock::now();
-	elapsed_seconds_d2_loop3 += (end - start);
-	return d2_;
-}
-
-
-////////////////////////////////////////////////////////////////
-//
-////////////////////////////////////////////////////////////////
-chrono::duration<double> elapsed_trim_ends;
-string trim_ends_s(string & q_v, char mode, string & prefix, string & suffix) {
-	chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
-	int i = 0, j = q_v.size() - 1;
-	while (i < q_v.size() - 1 ) {
-		if (q_v[i] != mode && q_v[i+1] != mode) i++; // stricter
-		else {
-			i++;
-			break;
-		}
-	}
-	while (j > (i + 1) ) {
-		if (q_v[j] != mode && q_v[j-1] != mode) j--;
-		else {
-			// j--;
-			break;
-		}
-	}
-	if (i < 8) {
-		// do not cut prefix
-		prefix = "";
-		i = 0;
-	}
-	else {
-		prefix = q_v.substr(0, i);
-	}
-	if (q_v.size() - j < 8) {
-		// do not cut suffix
-		suffix = "";
-		j = string::npos;
-	}
-	else {
-		suffix = q_v.substr(j);
-	}
-	chrono::time_point<std::chrono::system_clock> end = chrono::system_clock::now();
-	elapsed_trim_ends += (end - start);
-	return q_v.substr(i, j-i);
-}
-
-////////////////////////////////////////////////////////////////
-//
-////////////////////////////////////////////////////////////////
-chrono::duration<double> elapsed_mode_time;
-char weighted_mode(string & qual, int & f) {
-	chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
-	// TODO: a more careful implementation: need 90 or less? space or smthing else?
-	float weights[90];
-	int frequencies[90];
-	for (int i = 0; i < 90; i++)  {
-		weights[i] = 0;
-		frequencies[i] = 0;
-	}
-	for (auto c: qual) {
-		int w = c - ' ';
-		weights[c - ' '] += 0.1 * w; // w * w
-		frequencies[c-' ']++;
-	}
-	// find max
-	float max_f = 0, max_i = -1;
-	for (int i = 0; i < 90; i++) {
-		if (weights[i] >= max_f) {
-			// max_f = weights[i];
-			max_f = frequencies[i];
-			max_i = i;
-		}
-	}
-	f = max_f;
-	chrono::time_point<std::chrono::system_clock> end = chrono::system_clock::now();
-	elapsed_mode_time += (end - start);
-	return max_i + ' ';
-}
-
 ////////////////////////////////////////////////////////////////
 //
 ////////////////////////////////////////////////////////////////
@@ -165,13 +53,44 @@ class QualityCompressor {
 
 	int observed_vectors = 0;
 
-	int bootstrap_size = 0;
+	int bootstrap_size = 0;	// vectors kept in the reservoir
 
 	int K_c = 3;
 
+	// qualities compacted to the observed values; fixed by the first discovery round
+	QualityAlphabet alphabet;
+
+	bool alphabet_ready = false;
+
+	// uniform sample of all vectors seen so far
+	shared_ptr<QualityReservoir> reservoir;
+
+	// discovery round running in the background, if any
+	shared_ptr<QualityDiscovery> discovery;
+
+	// start the next discovery round once this many vectors were seen
+	int next_discovery = 0;
+
 	// clusters
 	vector<shared_ptr<QualityCluster>> clusters;
 
+	// matches vectors to the clusters; replaced whenever new clusters are installed
+	shared_ptr<QualityAssigner> assigner;
+
+	int num_threads = 1;
+
+	// vectors waiting to be submitted to the assigner
+	QualityBatch * batch = nullptr;
+
+	int batch_size = 1024;
+
+	int max_batches_in_flight = 4;
+
+	// lossy modes: vectors are binned and coded into a single stream, no clustering
+	QualityBinning binning;
+
+	shared_ptr<QualityCoreBuffer<BinnedQualityModel>> binned;
+
 	// used to hold quality vectors that do not fit anywhere else
 	shared_ptr<QualityCluster> others;//(new QualityCluster());
 
@@ -185,175 +104,189 @@ class QualityCompressor {
 		members_wrote++;
 	}
 
-	///////////////////////////////////////////////////////////
-	// Assumes that q_v is already reversed according to the reverse complement bit
-	///////////////////////////////////////////////////////////
-	void assignQualityVector(string & q_v, int q_v_len, int id) {
-		int mode_frequency = 0;
-		char m = weighted_mode(q_v, mode_frequency);
-		if (mode_frequency < 0.26 * q_v_len) {
-			others->add(q_v, id);
-			// record the the vector when into a general pile
-			// cluster_membership.push_back(GENERIC_PILE_ID);
-			return;
-		}
-		else {
-			string prefix, suffix;
-			q_v = trim_ends_s(q_v, m, prefix, suffix);
-			unordered_map<int,int> q_kmers = countKmers(q_v, K_c);
-			float f2 = q_v.size() - K_c + 1;
-			// try to assign to an existing cluster
-			bool found = false;
-			for (auto clust : clusters) {
-				float d = d2_fast(clust->getProfileKmers(), clust->getProfileSize() - K_c + 1.0, q_kmers, f2);
-				if (d < 0.05) {
-					found = true;
-					clust->add(q_v, id, prefix, suffix);
-					// cluster_membership.push_back(clust->getClusterID());
-					break;
-				}
-			}
-
-			if (!found) {
-				// create a new cluster w/ this guy in it
-				shared_ptr<QualityCluster> cluster(new QualityCluster(courier, q_v, K_c, m));
-				cluster->add(q_v, id, prefix, suffix);
-				clusters.push_back(cluster);
-				if (clusters.size() % 100 == 0) cerr << clusters.size() << 
-					" (" << (id - others->size() ) << "|" << others->size() << ") ";
-			}
-		}
-	}
-
 	// write a quality value w/o splitting it into prefix, core, suffix
-	chrono::duration<double> elapsed_writes;
 	void write(string & s, shared_ptr<QualityCluster> c, GenomicCoordinate & gc) {
-		chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
+		PROFILE_SCOPE("quals.write");
 		c->writeCore( s, gc );
-		chrono::time_point<std::chrono::system_clock> end = chrono::system_clock::now();
-		elapsed_writes += (end - start);
 	}
 
 	void write(string & q_v, string & prefix, string & suffix,shared_ptr<QualityCluster> clust, GenomicCoordinate & gc) {
-		chrono::time_point<std::chrono::system_clock> start = chrono::system_clock::now();
+		PROFILE_SCOPE("quals.write");
 		clust->writeCore( q_v, gc);
 		clust->writePrefix(prefix, gc);
 		clust->writeSuffix(suffix, gc);
-		chrono::time_point<std::chrono::system_clock> end = chrono::system_clock::now();
-		elapsed_writes += (end - start);
 	}
 
-	/////
-	void writeToCluster(string & q_v, int q_v_len, int num_align, GenomicCoordinate & gc) {
-		int mode_frequency = 0;
-		char m = weighted_mode(q_v, mode_frequency);
-		if (mode_frequency < 0.26 * q_v_len) {
-			write(q_v, others, gc);
+	///////////////////////////////////////////////////////////
+	// write out an assigned vector; called in the order the vectors were observed
+	///////////////////////////////////////////////////////////
+	void writeAssignment(QualityAssignment & a) {
+		if (a.cluster_idx < 0) {
+			write(a.core, others, a.gc);
 			// record the the vector when into a general pile
-			writeMembership(GENERIC_PILE_ID, gc, num_align);
-			return;
+			writeMembership(GENERIC_PILE_ID, a.gc, a.num_align);
 		}
 		else {
-			string prefix, suffix;
-			q_v = trim_ends_s(q_v, m, prefix, suffix);
-			auto q_kmers = countKmers(q_v, K_c);
-			float f2 = q_v.size() - K_c + 1;
-			// try to assign to an existing cluster
-			bool found = false;
-			for (auto clust : clusters) {
-				float d = d2_fast(clust->getProfileKmers(), clust->getProfileSize() - K_c + 1.0f, q_kmers, f2);
-				if (d < 0.05) {
-					write(q_v, prefix, suffix, clust, gc);
-					writeMembership( clust->getClusterID(), gc, num_align );
-					return;
-				}
-			}
-
-			if (!found) {
-				write(q_v, others, gc);
-				writeMembership( GENERIC_PILE_ID, gc, num_align );
-			}
+			auto clust = clusters[a.cluster_idx];
+			write(a.core, a.prefix, a.suffix, clust, a.gc);
+			writeMembership(clust->getClusterID(), a.gc, a.num_align);
 		}
 	}
 
 	///////////////////////////////////////////////////////////
-	//
+	// write out batches that came back from the assigner; waits until no more
+	// than max_in_flight batches are outstanding
 	///////////////////////////////////////////////////////////
-	void refineClusters() {
-		// allocate enough for the bootstrap vectors, initialize to 0 to idicate
-		// membership in the generic pile
-		// cluster_membership.resize(observed_vectors, GENERIC_PILE_ID);
-		// vector(size, value)
-		vector<int> temp_cluster_ids(observed_vectors, GENERIC_PILE_ID);
-
-		cerr << "Initial clusters: " << clusters.size() << endl;
-		int clust_id = GENERIC_PILE_ID + 1; // all other cluster IDs will have ids starting with 1
-		vector<int> remove;
-		cerr << "[INFO] Filtering clusters that are too small..." << endl;
-		for (auto i = 0; i < clusters.size(); i++) {
-			// cerr << i << " ";
-			auto clust = clusters[i];
-			float percent = clust->size() / (float)observed_vectors;
-			// cerr << percent << " ";
-			if (percent > percent_abundance) { // one percent
-				clust->setClusterID(clust_id);
-				cerr << "Cluster " << clust_id << ": " << (percent * 100) << "% of vectors seen so far" << endl;
-				// record cluster membership for items in this cluster
-				// clust->fillOutClusterMembership(cluster_membership);
-				clust->fillOutClusterMembership(temp_cluster_ids);
-				clust_id++; // only increment for the clusters that we will retain
-			}
-			else {
-				remove.push_back(i);
+	void drainAssigned(int max_in_flight) {
+		QualityBatch * b;
+		while (true) {
+			{
+				PROFILE_SCOPE("quals.assign_wait");
+				b = assigner->collect(assigner->inFlight() > max_in_flight);
 			}
+			if (b == nullptr) break;
+			for (auto & a : b->items) writeAssignment(a);
+			memoryBudget().release(b->charged);
+			delete b;
 		}
-		// merge vectors in the clusters that were too small into a sh*tpile
-		cerr << "[INFO] merging vectors from rejected clusters..." << endl;
-
-		int i = 1;
-		 // TODO empty genomic coord -- set appropriately
-		cerr << "writing " << temp_cluster_ids.size() << " bootstrap qual memb" << endl;
-		for (auto id : temp_cluster_ids) {
-			writeMembership(id, startCoord, i);
-			i++;
+	}
+
+	///////////////////////////////////////////////////////////
+	// hand over the partial batch and write out everything still in flight
+	///////////////////////////////////////////////////////////
+	void finishAssigner() {
+		if (assigner == nullptr) return;
+		if (batch != nullptr) {
+			assigner->submit(batch);
+			batch = nullptr;
 		}
+		drainAssigned(0);
+		assigner->finish();
+	}
 
-		while (remove.size() > 0) {
-			int idx = remove.back();
-			remove.pop_back();
-			clusters.erase(clusters.begin() + idx);
+	///////////////////////////////////////////////////////////
+	// queue a vector for assignment to one of the clusters
+	///////////////////////////////////////////////////////////
+	void writeToCluster(string & q_v, int num_align, GenomicCoordinate & gc) {
+		if (batch == nullptr) {
+			batch = new QualityBatch();
+			batch->items.reserve(batch_size);
 		}
-		cerr << "Clusters remaining: " << (clusters.size() + 1) << endl;
-		cerr << "Quality vectors in generic pile: " << others->size() << 
-			" (" << (float)others->size() / observed_vectors * 100 << "%)" << endl;
-
-		// write out clusters, empty their containers, keep references to the output buffers around
-		for (auto i = 0; i < clusters.size(); i++) {
-			clusters[i]->openOutputStream(fname, genomic_coord_out, K_c);
-			// write accumualted vectors to the stream
-			clusters[i]->flushBootstrapData();
+		batch->items.emplace_back();
+		auto & a = batch->items.back();
+		a.core.swap(q_v);
+		a.gc = gc;
+		a.num_align = num_align;
+		size_t cost = sizeof(QualityAssignment) + a.core.size() + WORKING_ENTRY_BYTES;
+		batch->charged += cost;
+		memoryBudget().charge(cost);
+		if ((int)batch->items.size() >= batch_size) {
+			assigner->submit(batch);
+			batch = nullptr;
+			drainAssigned(max_batches_in_flight);
+			// out of memory: wait for the batches in flight one at a time
+			while (memoryBudget().exhausted() && assigner->inFlight() > 0)
+				drainAssigned(assigner->inFlight() - 1);
 		}
+	}
 
-		others->openOutputStream(fname, genomic_coord_out, K_c);
-		others->flushBootstrapData();
+	///////////////////////////////////////////////////////////
+	// cluster the reservoir in the background; it stays frozen until the
+	// round is installed
+	///////////////////////////////////////////////////////////
+	void startDiscovery() {
+		reservoir->freeze();
+		discovery = shared_ptr<QualityDiscovery>(new QualityDiscovery(courier, reservoir,
+			clusters, alphabet, alphabet_ready, K_c, percent_abundance) );
+		discovery->start();
+		next_discovery *= 2;
+	}
+
+	///////////////////////////////////////////////////////////
+	// append clusters to the cluster list and start matching vectors against them
+	///////////////////////////////////////////////////////////
+	void addClusters(vector<shared_ptr<QualityCluster>> & found) {
+		if (found.size() == 0) return;
+		// the running assigner holds an index over the old cluster list
+		finishAssigner();
+		for (auto & c : found) {
+			// a context model per cluster; vectors of the clusters left out go to the pile
+			if (!memoryBudget().fits(QualityModel::footprint() ) ) {
+				cerr << "[INFO] Quality clusters are past the memory limit, " <<
+					(found.size() - (&c - &found[0]) ) << " left out" << endl;
+				break;
+			}
+			c->setClusterID(clusters.size() + 1); // the generic pile is cluster 0
+			c->openOutputStream(fname, genomic_coord_out, K_c);
+			clusters.push_back(c);
+		}
+		cerr << "[INFO] Quality clusters: " << clusters.size() << " after " << observed_vectors << " vectors" << endl;
+		assigner = shared_ptr<QualityAssigner>(new QualityAssigner(clusters, alphabet, K_c, num_threads) );
+		max_batches_in_flight = 4 * assigner->getNumThreads();
+	}
+
+	///////////////////////////////////////////////////////////
+	// install the clusters of a finished discovery round
+	///////////////////////////////////////////////////////////
+	void installClusters() {
+		PROFILE_SCOPE("quals.install");
+		discovery->join();
+		reservoir->thaw();
+		if (!alphabet_ready) {
+			alphabet = discovery->getAlphabet();
+			alphabet_ready = true;
+			cerr << "[INFO] Quality alphabet: " << alphabet.size() << " symbols" << endl;
+		}
+		addClusters(discovery->getClusters() );
+		discovery = nullptr;
 	}
 
 public:
 	///////////////////////////////////////////////////////////
-	QualityCompressor(Packet_courier * c, shared_ptr<ofstream> gc_out, string const & fname, float pa, int bs, int k):
+	QualityCompressor(Packet_courier * c, shared_ptr<ofstream> gc_out, string const & fname, float pa, int bs, int k,
+			int n_threads = 1, QualityBinning const & qb = QualityBinning(),
+			shared_ptr<TrainedQualityModel const> model = nullptr):
 		courier(c),
 		genomic_coord_out(gc_out),
 		fname(fname),
 		percent_abundance(pa), 
 		bootstrap_size(bs), 
-		K_c(k) {
+		K_c(k),
+		num_threads(n_threads),
+		binning(qb) {
+			if (binning.lossy()) {
+				cerr << "[INFO] Binning quality values (" << binning.spec << ")" << endl;
+				binned = shared_ptr<QualityCoreBuffer<BinnedQualityModel>>(new QualityCoreBuffer<BinnedQualityModel>(
+					courier, gc_out, fname, BINNED_QUALS_SUFFIX, BinnedQualityModel(binning) ) );
+				if (model != nullptr)
+					cerr << "[INFO] Quality model " << model->path << " is not used in the binned modes" << endl;
+				return;
+			}
+			// first round early, so that few vectors end up in the pile while waiting;
+			// later rounds see a sample of everything read so far
+			reservoir = shared_ptr<QualityReservoir>(new QualityReservoir(bootstrap_size) );
+			next_discovery = std::max(1, bootstrap_size / 4);
+
 			others = shared_ptr<QualityCluster>(new QualityCluster(courier, true));
+			others->openOutputStream(this->fname, genomic_coord_out, K_c);
 
 			cluster_membership = shared_ptr<OutputBuffer>(new OutputBuffer(courier, 
 				gc_out, fname, ".membership.lz", 3 << 20,  12 ) );
+
+			// trained clusters: no sampling, no discovery
+			if (model != nullptr) {
+				vector<shared_ptr<QualityCluster>> trained;
+				instantiateQualityModel(*model, courier, alphabet, K_c, trained);
+				alphabet_ready = true;
+				reservoir = nullptr;
+				addClusters(trained);
+			}
 	}
 
 	~QualityCompressor() {
+		if (batch != nullptr) memoryBudget().release(batch->charged);
+		delete batch;
+		if (binned != nullptr) return;
 		cerr << "wrote " << members_wrote << " membership ids" << endl;
 		cluster_membership->flush();
 		for (auto cluster : clusters) {
@@ -361,24 +294,24 @@ public:
 		}
 		others->closeOutputStream();
 
-		// cerr << endl << "Total times in d2 loops: " << elapsed_seconds_d2_loop1.count() << "," <<
-			// elapsed_seconds_d2_loop2.count() << "," << elapsed_seconds_d2_loop3.count() << "sec" << endl;
-		// cerr << "Total mode time: " << elapsed_mode_time.count() << "s" << endl;
-		// cerr << "Total trimming time: " << elapsed_trim_ends.count() << "s" << endl;
-		// cerr << "Total writing time: " << elapsed_writes.count() << "s" << endl;
 	}
 
+	// recorded in the *.head file
+	string const & getMode() { return binning.spec; }
+
 	void setInitialCoordinate(int chromo, int offset) {
 		startCoord.chromosome = chromo;
 		startCoord.offset = offset;
-		cluster_membership->setInitialCoordinate(chromo, offset);
+		if (cluster_membership != nullptr)
+			cluster_membership->setInitialCoordinate(chromo, offset);
 	}
 
 	void setLastCoordinate(int c, int off, size_t num) {
 		endCoord.chromosome = c;
 		endCoord.offset = off;
 		// observed_vectors = num;
-		cluster_membership->setLastCoordinate(c, off, num);
+		if (cluster_membership != nullptr)
+			cluster_membership->setLastCoordinate(c, off, num);
 	}
 
 	///////////////////////////////////////////////////////////
@@ -386,15 +319,29 @@ public:
 		string s;
 		// TODO: is this a documented fact that need to add '!'
 		for (auto i = 0; i < len; i++) s += qual_read[i] + '!';
-		if (observed_vectors <= bootstrap_size) {
-			assignQualityVector(s, len, observed_vectors);
-			if (observed_vectors == bootstrap_size) {
-				refineClusters();
+		if (binned != nullptr) {
+			binned->write(s, gc);
+			observed_vectors++;
+			return;
+		}
+		if (reservoir != nullptr) {
+			{
+				PROFILE_SCOPE("quals.sample");
+				reservoir->offer(s);
 			}
+			// out of memory: wait for the round instead of queuing more replacements
+			if (discovery != nullptr && (discovery->done() || memoryBudget().exhausted() ) )
+				installClusters();
+			if (discovery == nullptr && observed_vectors + 1 >= next_discovery)
+				startDiscovery();
 		}
+
+		if (assigner != nullptr)
+			writeToCluster(s, observed_vectors, gc);
 		else {
-			// have fixed clusters -- assign read to one of the existing clusters, output
-			writeToCluster(s, len, observed_vectors, gc);
+			// no clusters yet -- provisionally into the generic pile
+			write(s, others, gc);
+			writeMembership(GENERIC_PILE_ID, gc, observed_vectors);
 		}
 		observed_vectors++;
 	}
@@ -402,6 +349,19 @@ public:
 	///////////////////////////////////////////////////////////
 	void flush() {
 		cerr << "flushing quals" << endl;
+		if (binned != nullptr) {
+			binned->flush();
+			return;
+		}
+		// clusters found this late would stay empty
+		if (discovery != nullptr) {
+			discovery->join();
+			discovery = nullptr;
+		}
+		// wait for all assignments to be written
+		finishAssigner();
+		cerr << "Quality vectors in generic pile: " << others->getTotalVectors() << 
+			" (" << (float)others->getTotalVectors() / std::max(1, observed_vectors) * 100 << "%)" << endl;
 		cluster_membership->flush();
 		for (auto c : clusters) c->flush();
 		others->flush();
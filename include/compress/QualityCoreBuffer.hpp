@@ -0,0 +1,118 @@
+/*
+Output stream for the cores of a quality cluster: cores are range coded with
+the cluster's own context model into self-contained blocks; blocks bypass
+LZMA on their way through the courier. Model is QualityModel for the clusters
+or BinnedQualityModel for the lossy quality modes.
+*/
+
+#ifndef QUALITY_CORE_BUFFER_H
+#define QUALITY_CORE_BUFFER_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <compress.h>
+
+#include "IntervalTree.h"
+#include "QualityCodec.hpp"
+#include "RefereeProfile.hpp"
+#include "MemoryBudget.hpp"
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+template <class Model>
+class QualityCoreBuffer {
+
+	Packet_courier * courier;
+
+	shared_ptr<ofstream> genomic_coordinates_out;
+
+	string stream_suffix;
+
+	string path;
+
+	// opened w/ the first block: clusters installed late may never get a vector
+	int out_fd = -1;
+
+	int block_size;	// coded bytes per block
+
+	Model model;
+
+	RangeEncoder encoder;
+
+	uint32_t block_vectors = 0;	// cores coded into the current block
+
+	GenomicCoordinate startCoord, endCoord;
+
+	////////////////////////////////////////////////////////////////
+	// finish the current block and hand it to the courier
+	////////////////////////////////////////////////////////////////
+	void dump() {
+		if (block_vectors == 0) return;
+		PROFILE_SCOPE("quals.core_dump");
+		encoder.finish();
+		auto & coded = encoder.bytes();
+		int size = QUALITY_BLOCK_HEADER + coded.size();
+		uint8_t * block_data = new( std::nothrow ) uint8_t[ size ];
+		if (block_data == nullptr) {
+			cerr << "[ERROR] Not enough memory for a quality block" << endl;
+			exit(1);
+		}
+		memcpy(block_data, QUALITY_BLOCK_MAGIC, 4);
+		putUint32(block_data + 4, block_vectors);
+		putUint32(block_data + 8, coded.size() );
+		memcpy(block_data + QUALITY_BLOCK_HEADER, coded.data(), coded.size() );
+
+		// one line per block, up to its last core
+		if (genomic_coordinates_out != nullptr)
+			(*genomic_coordinates_out) << stream_suffix << " " << block_vectors << " " <<
+				startCoord.chromosome << ":" << startCoord.offset << "-" <<
+				endCoord.chromosome << ":" << endCoord.offset << endl;
+		startCoord = endCoord;
+
+		if (out_fd < 0) {
+			int flags = O_CREAT | O_WRONLY | O_TRUNC | o_binary;
+			out_fd = open( path.c_str(), flags, outfd_mode );
+		}
+		courier->receive_packet( block_data, size, out_fd, true );
+
+		encoder.reset();
+		model.reset();
+		block_vectors = 0;
+	}
+
+public:
+	QualityCoreBuffer(Packet_courier * c, shared_ptr<ofstream> genomic_coord_out,
+		string const & fn, string const & suff, Model const & m = Model(), int bs = 1 << 20):
+		courier(c),
+		genomic_coordinates_out(genomic_coord_out),
+		stream_suffix(suff),
+		path(fn + suff),
+		block_size(memoryBudget().reserveBlock(bs) ),
+		model(m) {
+		// the context model lives as long as the stream
+		memoryBudget().charge(Model::footprint() );
+	}
+
+	~QualityCoreBuffer() {
+		if (out_fd >= 0) close(out_fd);
+		memoryBudget().releaseBlock(block_size);
+		memoryBudget().release(Model::footprint() );
+	}
+
+	void write(string const & core, GenomicCoordinate & currentCoord) {
+		model.encode(core, encoder);
+		block_vectors++;
+		endCoord = currentCoord;
+		if (encoder.size() >= (size_t)block_size) dump();
+	}
+
+	void flush() {
+		dump();
+	}
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+Quality cluster discovery: a reservoir keeps a uniform sample of all quality
+vectors seen so far; every so often the sample is clustered on a background
+thread while the parser keeps encoding. Vectors that arrive before the first
+clusters are ready go to the generic pile. Later rounds only look at the
+sampled vectors that do not match any of the clusters found before, so cluster
+ids are never reassigned.
+*/
+
+#ifndef QUALITY_DISCOVERY_H
+#define QUALITY_DISCOVERY_H
+
+#include <stdint.h>
+
+#include <compress.h>
+
+#include "QualityAssigner.hpp"
+#include "MemoryBudget.hpp"
+
+////////////////////////////////////////////////////////////////
+// uniform sample of the quality vectors (Algorithm R); the generator is
+// seeded with a constant so that archives are reproducible. While a
+// discovery round reads the sample it is frozen: replacements are queued
+// and applied by thaw(), so the round needs no copy of the sample
+////////////////////////////////////////////////////////////////
+class QualityReservoir {
+
+	vector<string> sample;
+
+	size_t capacity;
+
+	// slots filled so far, counting the queued ones
+	size_t filled = 0;
+
+	uint64_t seen = 0;
+
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+	bool frozen = false;
+
+	vector<pair<size_t, string>> pending;
+
+	// xorshift64
+	uint64_t next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+
+	// charged to the memory budget per vector
+	static size_t cost(string const & q_v) { return q_v.size() + WORKING_ENTRY_BYTES; }
+
+	void put(size_t i, string const & q_v) {
+		memoryBudget().charge(cost(q_v) );
+		if (frozen)
+			pending.emplace_back(i, q_v);
+		else if (i == sample.size() )
+			sample.push_back(q_v);
+		else {
+			memoryBudget().release(cost(sample[i]) );
+			sample[i] = q_v;
+		}
+	}
+
+public:
+	QualityReservoir(size_t cap): capacity(cap) {
+		sample.reserve(capacity);
+	}
+
+	~QualityReservoir() {
+		for (auto & q_v : sample) memoryBudget().release(cost(q_v) );
+		for (auto & p : pending) memoryBudget().release(cost(p.second) );
+	}
+
+	void offer(string const & q_v) {
+		seen++;
+		// the sample stops growing once the memory budget is exhausted
+		if (filled < capacity && filled > 0 && memoryBudget().exhausted() )
+			capacity = filled;
+		if (filled < capacity)
+			put(filled++, q_v);
+		else {
+			uint64_t j = next() % seen;
+			if (j < capacity) put(j, q_v);
+		}
+	}
+
+	void freeze() { frozen = true; }
+
+	////////////////////////////////////////////////////////////////
+	// apply the replacements queued while frozen; the reader is done by now
+	////////////////////////////////////////////////////////////////
+	void thaw() {
+		frozen = false;
+		for (auto & p : pending) {
+			if (p.first == sample.size() )
+				sample.push_back(std::move(p.second) );
+			else {
+				memoryBudget().release(cost(sample[p.first]) );
+				sample[p.first] = std::move(p.second);
+			}
+		}
+		vector<pair<size_t, string>>().swap(pending);
+	}
+
+	vector<string> const & getSample() {return sample;}
+
+	uint64_t getSeen() {return seen;}
+};
+
+////////////////////////////////////////////////////////////////
+//
+// One round of discovery over the (frozen) reservoir
+//
+////////////////////////////////////////////////////////////////
+class QualityDiscovery {
+
+	Packet_courier * courier;
+
+	shared_ptr<QualityReservoir> reservoir;
+
+	vector<string> const & sample;
+
+	// clusters found in the earlier rounds; their profiles do not change
+	vector<shared_ptr<QualityCluster>> known;
+
+	QualityAlphabet alphabet;
+
+	bool alphabet_ready;
+
+	int K;
+
+	float percent_abundance;
+
+	// clusters w/ enough support in the sample
+	vector<shared_ptr<QualityCluster>> found;
+
+	pthread_t thread;
+
+	bool running = false;
+
+	pthread_mutex_t mutex;
+
+	bool finished = false;
+
+	///////////////////////////////////////////////////////////
+	// nearest candidate under the d2 threshold, -1 if none; the index covers
+	// the candidates that existed at the last rebuild, newer ones are scanned
+	///////////////////////////////////////////////////////////
+	int nearestCandidate(vector<shared_ptr<QualityCluster>> & candidates,
+		ProfileIndex & index, vector<float> const & q_kmers) {
+		// below this many clusters a linear scan is just as fast
+		if ((int)candidates.size() >= 2 * index.size() && candidates.size() >= 32)
+			index.build(candidates, candidates.size());
+		float best_d = 0;
+		int best = index.nearest(q_kmers, 0.05, best_d);
+		for (int i = index.size(); i < (int)candidates.size(); i++) {
+			float d = d2_dense(candidates[i]->getProfileKmers().data(), q_kmers.data(), q_kmers.size());
+			if (d < best_d) {
+				best_d = d;
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	///////////////////////////////////////////////////////////
+	void discover() {
+		PROFILE_SCOPE("quals.discover");
+		if (!alphabet_ready) {
+			alphabet.build(sample);
+			alphabet_ready = true;
+		}
+		ProfileIndex known_index, index;
+		known_index.build(known, known.size() );
+		vector<shared_ptr<QualityCluster>> candidates;
+		vector<int> support;
+		vector<float> q_kmers;
+		string prefix, suffix;
+		for (auto & q_v : sample) {
+			int mode_frequency = 0;
+			char m = weighted_mode(q_v, mode_frequency);
+			// goes into the generic pile
+			if (mode_frequency < 0.26 * q_v.size()) continue;
+			string core = trim_ends_s(q_v, m, prefix, suffix);
+			countKmers(core, K, alphabet, q_kmers);
+			float d = 0;
+			if (known_index.nearest(q_kmers, 0.05, d) >= 0) continue;
+			int idx = nearestCandidate(candidates, index, q_kmers);
+			if (idx >= 0)
+				support[idx]++;
+			else {
+				candidates.push_back(shared_ptr<QualityCluster>(
+					new QualityCluster(courier, core, K, m, alphabet) ) );
+				support.push_back(1);
+			}
+		}
+		for (size_t i = 0; i < candidates.size(); i++) {
+			if (support[i] > percent_abundance * sample.size() )
+				found.push_back(candidates[i]);
+		}
+		cerr << "[INFO] Quality sample of " << sample.size() << " vectors: " << candidates.size() <<
+			" candidate clusters, " << found.size() << " retained" << endl;
+	}
+
+	///////////////////////////////////////////////////////////
+	static void * run(void * arg) {
+		QualityDiscovery & qd = *(QualityDiscovery *)arg;
+		qd.discover();
+		xlock(&qd.mutex);
+		qd.finished = true;
+		xunlock(&qd.mutex);
+		return 0;
+	}
+
+public:
+	///////////////////////////////////////////////////////////
+	QualityDiscovery(Packet_courier * c, shared_ptr<QualityReservoir> r,
+		vector<shared_ptr<QualityCluster>> const & k, QualityAlphabet const & a, bool a_ready,
+		int K, float pa):
+		courier(c),
+		reservoir(r),
+		sample(r->getSample() ),
+		known(k),
+		alphabet(a),
+		alphabet_ready(a_ready),
+		K(K),
+		percent_abundance(pa) {
+		xinit(&mutex);
+	}
+
+	~QualityDiscovery() {
+		join();
+		xdestroy(&mutex);
+	}
+
+	void start() {
+		int errcode = pthread_create(&thread, 0, run, this);
+		if (errcode) {
+			cerr << "[ERROR] Can't create quality discovery thread" << endl;
+			exit(1);
+		}
+		running = true;
+	}
+
+	// true once the clusters are ready; does not block
+	bool done() {
+		xlock(&mutex);
+		bool f = finished;
+		xunlock(&mutex);
+		return f;
+	}
+
+	void join() {
+		if (!running) return;
+		int errcode = pthread_join(thread, 0);
+		if (errcode) {
+			cerr << "[ERROR] Can't join quality discovery thread" << endl;
+			exit(1);
+		}
+		running = false;
+	}
+
+	vector<shared_ptr<QualityCluster>> & getClusters() {return found;}
+
+	QualityAlphabet const & getAlphabet() {return alphabet;}
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+Trained quality models: the alphabet and the cluster profiles found by
+"referee train-quals", loaded with --qual-model to skip the discovery. Plain
+text, quality values are written as numbers:
+
+	referee-quality-model 1
+	K <k-mer size>
+	alphabet <size> <ranked symbols>
+	clusters <n>
+	<mode> <profile length> <profile values>	(one line per cluster, ids 1..n)
+*/
+
+#ifndef QUALITY_MODEL_FILE_H
+#define QUALITY_MODEL_FILE_H
+
+#include <fstream>
+
+#include "QualityCluster.hpp"
+
+#define QUALITY_MODEL_MAGIC "referee-quality-model"
+#define QUALITY_MODEL_VERSION 1
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+void saveQualityModel(string const & path, QualityAlphabet const & alphabet, int K,
+	vector<shared_ptr<QualityCluster>> const & clusters) {
+	ofstream out(path);
+	check_file_open(out, path);
+	out << QUALITY_MODEL_MAGIC << " " << QUALITY_MODEL_VERSION << endl;
+	out << "K " << K << endl;
+	out << "alphabet ";
+	alphabet.save(out);
+	out << "clusters " << clusters.size() << endl;
+	for (auto & c : clusters) {
+		auto & profile = c->getProfile();
+		out << (int)(uint8_t)c->getMode() << " " << profile.size();
+		for (auto q : profile) out << " " << (int)(uint8_t)q;
+		out << endl;
+	}
+	out.close();
+	cerr << "[INFO] Quality model w/ " << clusters.size() << " clusters written to " << path << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// a parsed model; read once and shared read-only by the files of a batch
+////////////////////////////////////////////////////////////////
+struct TrainedQualityModel {
+	string path;
+	int K = 0;
+	QualityAlphabet alphabet;
+	vector<pair<char, string>> profiles;	// mode and profile of each cluster
+};
+
+////////////////////////////////////////////////////////////////
+// clusters come back in the order they were saved
+////////////////////////////////////////////////////////////////
+shared_ptr<TrainedQualityModel const> loadQualityModel(string const & path) {
+	shared_ptr<TrainedQualityModel> model(new TrainedQualityModel() );
+	model->path = path;
+	ifstream in(path);
+	check_file_open(in, path);
+	string magic, key;
+	int version = 0, n = 0;
+	bool ok = (in >> magic >> version) && magic.compare(QUALITY_MODEL_MAGIC) == 0 &&
+		version == QUALITY_MODEL_VERSION;
+	ok = ok && (in >> key >> model->K) && key.compare("K") == 0 && model->K > 0;
+	ok = ok && (in >> key) && key.compare("alphabet") == 0 && model->alphabet.load(in);
+	ok = ok && (in >> key >> n) && key.compare("clusters") == 0 && n >= 0;
+	for (int i = 0; ok && i < n; i++) {
+		int mode = 0, len = 0;
+		ok = (in >> mode >> len) && len > 0;
+		string profile(len, 0);
+		for (int j = 0; ok && j < len; j++) {
+			int q = 0;
+			ok = (in >> q) && q >= 0 && q < 256;
+			profile[j] = (char)q;
+		}
+		if (ok) model->profiles.emplace_back( (char)mode, profile);
+	}
+	if (!ok) {
+		cerr << "[ERROR] Could not parse the quality model in " << path << endl;
+		exit(1);
+	}
+	cerr << "[INFO] Loaded " << model->profiles.size() << " quality clusters from " << path << endl;
+	return model;
+}
+
+////////////////////////////////////////////////////////////////
+// clusters of one file, writing through the given courier
+////////////////////////////////////////////////////////////////
+void instantiateQualityModel(TrainedQualityModel const & model, Packet_courier * courier,
+	QualityAlphabet & alphabet, int & K, vector<shared_ptr<QualityCluster>> & clusters) {
+	alphabet = model.alphabet;
+	K = model.K;
+	for (auto & p : model.profiles) {
+		string profile = p.second;
+		clusters.push_back(shared_ptr<QualityCluster>(
+			new QualityCluster(courier, profile, K, p.first, alphabet) ) );
+	}
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*
+Tokenized read names: a control stream plus one column stream per token
+position; see ReadNameCodec.hpp for the format
+*/
+
+#ifndef READ_NAME_ENCODER_H
+#define READ_NAME_ENCODER_H
+
+#include <compress.h>
+
+#include "OutputBuffer.hpp"
+#include "ReadNameCodec.hpp"
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class ReadNameEncoder {
+
+	Packet_courier * courier;
+
+	shared_ptr<ofstream> genomic_coord_out;
+
+	string fname;
+
+	shared_ptr<OutputBuffer> control;
+
+	// opened when a token position first needs data
+	vector<shared_ptr<OutputBuffer>> columns;
+
+	// tokens of the previous name
+	vector<string> prev_tokens;
+
+	vector<bool> prev_numeric;
+
+	vector<uint32_t> prev_values;
+
+	// control block the previous name started in
+	size_t name_block = 0;
+
+	vector<int> bounds;
+
+	GenomicCoordinate startCoord;
+
+	shared_ptr<OutputBuffer> column(int i) {
+		if (columns[i] == nullptr) {
+			columns[i] = shared_ptr<OutputBuffer>(new OutputBuffer(courier, genomic_coord_out,
+				fname, ".ids." + to_string(i) + ".lz", 1 << 20, 12) );
+			columns[i]->setInitialCoordinate(startCoord.chromosome, startCoord.offset);
+		}
+		return columns[i];
+	}
+
+public:
+	ReadNameEncoder(Packet_courier * c, shared_ptr<ofstream> gc_out, string const & fn):
+		courier(c),
+		genomic_coord_out(gc_out),
+		fname(fn),
+		columns(NAME_MAX_TOKENS),
+		prev_tokens(NAME_MAX_TOKENS),
+		prev_numeric(NAME_MAX_TOKENS, false),
+		prev_values(NAME_MAX_TOKENS, 0) {
+		control = shared_ptr<OutputBuffer>(new OutputBuffer(courier, gc_out, fname, ".ids.lz", 1 << 20, 12) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	void encode(char const * name, GenomicCoordinate & gc, size_t num) {
+		// the decoder starts w/o a previous name after a seek
+		if (control->blocks() != name_block) {
+			name_block = control->blocks();
+			for (int i = 0; i < NAME_MAX_TOKENS; i++) {
+				prev_tokens[i].clear();
+				prev_numeric[i] = false;
+				prev_values[i] = 0;
+			}
+		}
+		tokenizeName(name, bounds);
+		int n = bounds.size() - 1;
+		for (int i = 0; i < n; i++) {
+			char const * token = name + bounds[i];
+			int len = bounds[i + 1] - bounds[i];
+			if ( (int)prev_tokens[i].size() == len && prev_tokens[i].compare(0, len, token, len) == 0) {
+				addUnsignedByte(NAME_TOK_MATCH, control, gc, num);
+				continue;
+			}
+			uint32_t value = 0;
+			if (nameTokenNumber(token, len, value) ) {
+				if (prev_numeric[i] && value > prev_values[i] && value - prev_values[i] < 256) {
+					addUnsignedByte(NAME_TOK_DELTA, control, gc, num);
+					addUnsignedByte(value - prev_values[i], column(i), gc, num);
+				}
+				else {
+					addUnsignedByte(NAME_TOK_NUMBER, control, gc, num);
+					writeVarint(value, column(i), gc, num);
+				}
+				prev_numeric[i] = true;
+				prev_values[i] = value;
+			}
+			else {
+				addUnsignedByte(NAME_TOK_STRING, control, gc, num);
+				writeNameToken(token, len, column(i), gc, num);
+				prev_numeric[i] = false;
+			}
+			prev_tokens[i].assign(token, len);
+		}
+		addUnsignedByte(NAME_TOK_END, control, gc, num);
+	}
+
+	void setInitialCoordinate(int chromo, int offset) {
+		startCoord.chromosome = chromo;
+		startCoord.offset = offset;
+		control->setInitialCoordinate(chromo, offset);
+		for (auto & c : columns)
+			if (c != nullptr) c->setInitialCoordinate(chromo, offset);
+	}
+
+	void setLastCoordinate(int chromo, int offset, size_t num) {
+		control->setLastCoordinate(chromo, offset, num);
+		for (auto & c : columns)
+			if (c != nullptr) c->setLastCoordinate(chromo, offset, num);
+	}
+
+	void flush() {
+		control->flush();
+		for (auto & c : columns)
+			if (c != nullptr) c->flush();
+	}
+};
+
+#endif
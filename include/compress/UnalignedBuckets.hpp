@@ -0,0 +1,185 @@
+/*
+Reordering of the unaligned reads: reads are grouped by their canonical
+minimizer across the whole input so that overlapping reads end up next to
+each other in the unaligned stream. Reads are spread over buckets by a hash
+of the minimizer; once the reads held in memory pass the memory cap, every
+bucket is appended to its own temporary file. At the end the buckets are
+loaded one at a time, sorted by minimizer and sequence, and written out.
+*/
+
+#ifndef UNALIGNED_BUCKETS_H
+#define UNALIGNED_BUCKETS_H
+
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+#include "OutputBuffer.hpp"
+#include "IOLibAlignment.hpp"
+
+#define UNALIGNED_BUCKETS 256
+
+// bytes of unaligned reads to keep in memory before spilling to disk
+#define UNALIGNED_MEMORY_CAP (1 << 28)
+
+// minimizer length for unaligned reads
+#define UNALIGNED_K 12
+
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+struct BucketedRead {
+	uint32_t minimizer;
+	UnalignedRead read;
+
+	BucketedRead() {}
+
+	BucketedRead(uint32_t m, UnalignedRead && r): minimizer(m), read(std::move(r) ) {}
+};
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class UnalignedBuckets {
+
+	string prefix;
+
+	size_t memory_cap;
+
+	vector<vector<BucketedRead>> buckets;
+
+	// buckets that have reads on disk
+	vector<bool> spilled;
+
+	size_t in_memory = 0;
+
+	uint64_t total = 0;
+
+	int spills = 0;
+
+	// a temporary file could not be written or read back
+	bool failed_ = false;
+
+	string spillPath(int b) {
+		return prefix + ".unaligned." + to_string(b) + ".tmp";
+	}
+
+	static size_t footprint(UnalignedRead const & r) {
+		return sizeof(BucketedRead) + r.seq.size() + r.qual.size() + r.read_name.size();
+	}
+
+	static int bucketOf(uint32_t minimizer) {
+		// multiplicative hash; raw minimizers are skewed towards A-rich k-mers
+		return (minimizer * 2654435761u) >> 24;
+	}
+
+	////////////////////////////////////////////////////////////////
+	void writeVector(ofstream & out, vector<uint8_t> const & v) {
+		uint32_t len = v.size();
+		out.write( (char const *)&len, sizeof(len) );
+		out.write( (char const *)v.data(), len);
+	}
+
+	bool readVector(ifstream & in, vector<uint8_t> & v) {
+		uint32_t len = 0;
+		if (!in.read( (char *)&len, sizeof(len) ) ) return false;
+		v.resize(len);
+		return (bool)in.read( (char *)v.data(), len);
+	}
+
+	////////////////////////////////////////////////////////////////
+	void spill() {
+		PROFILE_SCOPE("encode.unaligned_spill");
+		for (int b = 0; b < UNALIGNED_BUCKETS; b++) {
+			if (buckets[b].empty() ) continue;
+			// a stale file of a crashed run w/ the same prefix is overwritten
+			ofstream out(spillPath(b), ios::binary | (spilled[b] ? ios::app : ios::trunc) );
+			if (!out) {
+				cerr << "[ERROR] Could not open file " << spillPath(b) << endl;
+				failed_ = true;
+			}
+			for (auto & br : buckets[b]) {
+				out.write( (char const *)&br.minimizer, sizeof(br.minimizer) );
+				out.put(br.read.rc);
+				writeVector(out, br.read.read_name);
+				writeVector(out, br.read.seq);
+				writeVector(out, br.read.qual);
+			}
+			out.close();
+			spilled[b] = true;
+			vector<BucketedRead>().swap(buckets[b]);
+		}
+		in_memory = 0;
+		spills++;
+	}
+
+	////////////////////////////////////////////////////////////////
+	void loadSpilled(int b) {
+		ifstream in(spillPath(b), ios::binary);
+		if (!in) {
+			cerr << "[ERROR] Could not open file " << spillPath(b) << endl;
+			failed_ = true;
+			return;
+		}
+		BucketedRead br;
+		while (in.read( (char *)&br.minimizer, sizeof(br.minimizer) ) ) {
+			br.read.rc = in.get() != 0;
+			if (!readVector(in, br.read.read_name) || !readVector(in, br.read.seq) ||
+				!readVector(in, br.read.qual) ) {
+				cerr << "[ERROR] Truncated temporary file " << spillPath(b) << endl;
+				failed_ = true;
+				break;
+			}
+			buckets[b].push_back(br);
+		}
+		in.close();
+		remove(spillPath(b).c_str() );
+	}
+
+public:
+	UnalignedBuckets(string const & p, size_t cap = UNALIGNED_MEMORY_CAP):
+		prefix(p),
+		memory_cap(cap),
+		buckets(UNALIGNED_BUCKETS),
+		spilled(UNALIGNED_BUCKETS, false) {}
+
+	////////////////////////////////////////////////////////////////
+	void add(uint32_t minimizer, UnalignedRead && read) {
+		in_memory += footprint(read);
+		buckets[bucketOf(minimizer)].emplace_back(minimizer, std::move(read) );
+		total++;
+		if (in_memory >= memory_cap) spill();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// write out all reads, bucket by bucket
+	////////////////////////////////////////////////////////////////
+	void flush(bool seq_only, shared_ptr<OutputBuffer> out) {
+		PROFILE_SCOPE("encode.unaligned_flush");
+		if (spills > 0)
+			cerr << "[INFO] Unaligned reads spilled to disk " << spills << " time(s)" << endl;
+		for (int b = 0; b < UNALIGNED_BUCKETS; b++) {
+			if (spilled[b]) loadSpilled(b);
+			auto & bucket = buckets[b];
+			sort(bucket.begin(), bucket.end(), [] (BucketedRead const & a, BucketedRead const & b) {
+				if (a.minimizer != b.minimizer) return a.minimizer < b.minimizer;
+				return a.read.seq < b.read.seq;
+			});
+			for (auto & br : bucket)
+				writeUnaligned(br.read, seq_only, out);
+			vector<BucketedRead>().swap(bucket);
+			spilled[b] = false;
+		}
+		in_memory = 0;
+		total = 0;
+		spills = 0;
+	}
+
+	uint64_t size() {return total;}
+
+	bool failed() {return failed_;}
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef AUX_TAG_STREAM_HPP
+#define AUX_TAG_STREAM_HPP
+
+#include <memory>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+
+#include "decompress/InputStream.hpp"
+#include "AuxTagCodec.hpp"
+
+////////////////////////////////////////////////////////////////
+// optional fields: data_in is the layout stream, columns are keyed by their
+// file suffix (see AuxTagCodec.hpp)
+////////////////////////////////////////////////////////////////
+class AuxTagStream : public InputStream {
+
+	struct Column {
+		shared_ptr<InputBuffer> buf;
+
+		int64_t prev = 0;
+
+		vector<string> dict;
+	};
+
+	unordered_map<string, Column> columns;
+
+	// keys and types of every layout, by id; id 0 is unused
+	vector<string> layouts;
+
+	uint8_t nextByte(shared_ptr<InputBuffer> & in) {
+		if (in == nullptr || !in->hasMoreBytes() ) {
+			cerr << "[ERROR] Optional field stream is truncated" << endl;
+			exit(1);
+		}
+		return in->getNextByte();
+	}
+
+	uint64_t readVarint(shared_ptr<InputBuffer> & in) {
+		uint8_t b = nextByte(in);
+		uint64_t v = b & 0x7F;
+		int shift = 7;
+		while (b & 0x80) {
+			b = nextByte(in);
+			v |= (uint64_t)(b & 0x7F) << shift;
+			shift += 7;
+		}
+		return v;
+	}
+
+	float readFloat(shared_ptr<InputBuffer> & in) {
+		uint8_t bytes[4];
+		for (int i = 0; i < 4; i++) bytes[i] = nextByte(in);
+		return auxFloat(bytes);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// %g unless it loses bits; then the fewest digits that read back exactly
+	////////////////////////////////////////////////////////////////
+	void appendFloat(string & record, float f) {
+		char s[32];
+		for (int precision = 6; precision <= 9; precision++) {
+			snprintf(s, sizeof(s), "%.*g", precision, f);
+			if (strtof(s, NULL) == f) break;
+		}
+		record += s;
+	}
+
+	Column & column(char key0, char key1, char type) {
+		auto it = columns.find(auxColumnSuffix(key0, key1, type) );
+		if (it == columns.end() ) {
+			cerr << "[ERROR] No stream for optional field " << key0 << key1 << ":" << type << endl;
+			exit(1);
+		}
+		return it->second;
+	}
+
+	////////////////////////////////////////////////////////////////
+	void appendValue(string & record, Column & c, char type) {
+		switch (type) {
+			case 'i':
+				c.prev += unzigzag(readVarint(c.buf) );
+				record += to_string(c.prev);
+				break;
+			case 'A':
+				record.push_back(nextByte(c.buf) );
+				break;
+			case 'f':
+				appendFloat(record, readFloat(c.buf) );
+				break;
+			case 'Z':
+			case 'H': {
+				uint64_t idx = readVarint(c.buf);
+				if (idx > 0) {
+					if (idx > c.dict.size() ) {
+						cerr << "[ERROR] Bad dictionary reference in the optional fields" << endl;
+						exit(1);
+					}
+					record += c.dict[idx - 1];
+					break;
+				}
+				string value;
+				uint8_t ch = nextByte(c.buf);
+				while (ch != 0) {
+					value.push_back(ch);
+					ch = nextByte(c.buf);
+				}
+				record += value;
+				if (c.dict.size() < AUX_DICT_MAX) c.dict.push_back(value);
+				break;
+			}
+			case 'B': {
+				char subtype = nextByte(c.buf);
+				uint64_t count = readVarint(c.buf);
+				record.push_back(subtype);
+				for (uint64_t i = 0; i < count; i++) {
+					record.push_back(',');
+					if (subtype == 'f')
+						appendFloat(record, readFloat(c.buf) );
+					else
+						record += to_string(unzigzag(readVarint(c.buf) ) );
+				}
+				break;
+			}
+			default:
+				cerr << "[ERROR] Unknown optional field type: " << type << endl;
+				exit(1);
+		}
+	}
+
+public:
+
+	AuxTagStream(shared_ptr<InputBuffer> buf, unordered_map<string, shared_ptr<InputBuffer>> const & cols):
+		InputStream(buf),
+		layouts(1) {
+		for (auto & c : cols) columns[c.first].buf = c.second;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// queue every block of the layout stream and the columns: the fields
+	// are decoded from the first record on (see AuxTagCodec.hpp)
+	////////////////////////////////////////////////////////////////
+	pair<int, unsigned long> seekToBlockStart(int const ref_id, int const start_coord, int const end_coord) {
+		if (ref_id >= 0) {
+			cerr << "[ERROR] Optional fields can only be decompressed from the start" << endl;
+			exit(1);
+		}
+		auto start = InputStream::seekToBlockStart(ref_id, start_coord, end_coord);
+		for (auto & c : columns) {
+			bool t = false;
+			c.second.buf->loadOverlappingBlock(ref_id, start_coord, end_coord, t);
+		}
+		return start;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// append the fields of the next alignment, each preceded by a tab; md is
+	// the MD field rebuilt from the edits
+	////////////////////////////////////////////////////////////////
+	void appendFields(string & record, string const & md) {
+		if ( !data_in->hasMoreBytes() ) return;
+		uint64_t id = readVarint(data_in);
+		if (id == 0) {
+			uint64_t n = readVarint(data_in);
+			string layout;
+			for (uint64_t i = 0; i < 3 * n; i++) layout.push_back(nextByte(data_in) );
+			layouts.push_back(layout);
+			id = layouts.size() - 1;
+		}
+		if (id >= layouts.size() ) {
+			cerr << "[ERROR] Unknown optional field layout: " << id << endl;
+			exit(1);
+		}
+		string const & layout = layouts[id];
+		for (size_t i = 0; i < layout.size(); i += 3) {
+			record += '\t';
+			if (layout[i] == 'M' && layout[i + 1] == 'D') {
+				record += md;
+				continue;
+			}
+			record.push_back(layout[i]);
+			record.push_back(layout[i + 1]);
+			record.push_back(':');
+			record.push_back(layout[i + 2]);
+			record.push_back(':');
+			appendValue(record, column(layout[i], layout[i + 1], layout[i + 2]), layout[i + 2]);
+		}
+	}
+};
+
+#endif
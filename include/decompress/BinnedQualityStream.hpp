@@ -0,0 +1,55 @@
+#ifndef BINNED_QUAL_STREAM_HPP
+#define BINNED_QUAL_STREAM_HPP
+
+#include "QualityBinning.hpp"
+#include "decompress/QualityStream.hpp"
+
+////////////////////////////////////////////////////////////////
+//
+// Quality vectors written in one of the lossy modes: a single range coded
+// stream, one vector per alignment that carries qualities
+//
+////////////////////////////////////////////////////////////////
+class BinnedQualityStream : public QualitySource {
+
+	QualityCoreReader<BinnedQualityModel> vectors;
+
+	string q_v;
+
+public:
+	BinnedQualityStream(string const & fname, shared_ptr<vector<TrueGenomicInterval>> genomic_intervals,
+		QualityBinning const & binning):
+		QualitySource(nullptr),
+		vectors(fname, genomic_intervals, BinnedQualityModel(binning) ) {
+	}
+
+	// overloaded base function
+	pair<int, unsigned long> seekToBlockStart(int const ref_id,
+		int const start_coord, int const end_coord) {
+		if ( !vectors.seekToBlockStart(ref_id, start_coord, end_coord) ) {
+			cerr << "[ERROR] Could not navigate to the begining of the interval" << endl;
+			exit(1);
+		}
+		return make_pair(start_coord, 0);
+	}
+
+	////////////////////////////////////////////////////////
+	void appendNextQualVector(string & out, bool reverse) {
+		if (!reverse) {
+			if ( !vectors.appendNextCore(out) ) {
+				cerr << "[ERROR] Requesting more data from quality stream, but stream is depleted." << endl;
+				out.push_back('*');
+			}
+			return;
+		}
+		q_v.clear();
+		if ( !vectors.appendNextCore(q_v) ) {
+			cerr << "[ERROR] Requesting more data from quality stream, but stream is depleted." << endl;
+			out.push_back('*');
+			return;
+		}
+		out.append(q_v.rbegin(), q_v.rend() );
+	}
+};
+
+#endif
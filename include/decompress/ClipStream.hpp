@@ -2,14 +2,66 @@
 #define CLIP_STREAM_H
 
 #include <memory>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 #include "decompress/InputStream.hpp"
 
+////////////////////////////////////////////////////////////////
+// four bases for every value of a packed byte
+////////////////////////////////////////////////////////////////
+struct ClipUnpackTable {
+	char bases[256][4];
+
+	ClipUnpackTable() {
+		for (int b = 0; b < 256; b++)
+			for (int i = 0; i < 4; i++)
+				bases[b][i] = "ACGT"[(b >> (2 * i) ) & 3];
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// unpack 2-bit bases (see writeClip); out has room for a multiple of 4
+////////////////////////////////////////////////////////////////
+void unpackBases(uint8_t const * packed, int n_bytes, char * out) {
+	static const ClipUnpackTable table;
+	int i = 0;
+#if defined(__SSSE3__)
+	// 16 packed bytes -> 64 bases
+	__m128i const mask = _mm_set1_epi8(3);
+	__m128i const acgt = _mm_setr_epi8('A','C','G','T',0,0,0,0,0,0,0,0,0,0,0,0);
+	for (; i + 16 <= n_bytes; i += 16) {
+		__m128i v = _mm_loadu_si128( (__m128i const *)(packed + i) );
+		__m128i c0 = _mm_and_si128(v, mask);
+		__m128i c1 = _mm_and_si128(_mm_srli_epi16(v, 2), mask);
+		__m128i c2 = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i c3 = _mm_and_si128(_mm_srli_epi16(v, 6), mask);
+		// interleave so that the bases of a byte come out in order
+		__m128i lo01 = _mm_unpacklo_epi8(c0, c1), hi01 = _mm_unpackhi_epi8(c0, c1);
+		__m128i lo23 = _mm_unpacklo_epi8(c2, c3), hi23 = _mm_unpackhi_epi8(c2, c3);
+		char * o = out + 4 * i;
+		_mm_storeu_si128( (__m128i *)o, _mm_shuffle_epi8(acgt, _mm_unpacklo_epi16(lo01, lo23) ) );
+		_mm_storeu_si128( (__m128i *)(o + 16), _mm_shuffle_epi8(acgt, _mm_unpackhi_epi16(lo01, lo23) ) );
+		_mm_storeu_si128( (__m128i *)(o + 32), _mm_shuffle_epi8(acgt, _mm_unpacklo_epi16(hi01, hi23) ) );
+		_mm_storeu_si128( (__m128i *)(o + 48), _mm_shuffle_epi8(acgt, _mm_unpackhi_epi16(hi01, hi23) ) );
+	}
+#endif
+	for (; i < n_bytes; i++)
+		memcpy(out + 4 * i, table.bases[packed[i]], 4);
+}
+
 
 class ClipStream : public InputStream {
 
 	string current_clip;
 
+	vector<uint8_t> packed;
+
+	vector<char> unpacked;
+
 public:
 
 	ClipStream(shared_ptr<InputBuffer> ib): InputStream(ib) {}
@@ -21,21 +73,29 @@ public:
 
 	int getNext(string & clip) {
 		if ( !data_in->hasMoreBytes() ) return END_OF_STREAM;
-		string chunk;
-		char c = data_in->getNextByte();
-		while (c != '\n' && data_in->hasMoreBytes()) {
-			chunk.push_back(c);
-			c = data_in->getNextByte();
-		}
-		clip = chunk;
-		// cerr << "Clip: " << clip << endl;
-		current_clip = chunk;
-		if (chunk.size() == 0 || c == 0) {
-			return END_OF_STREAM;
+		uint64_t header = data_in->getNextVarint();
+		int len = header >> 1;
+		if (len == 0) return END_OF_STREAM;
+		int n_bytes = (len + 3) >> 2;
+		packed.resize(n_bytes);
+		for (int i = 0; i < n_bytes; i++) packed[i] = data_in->getNextByte();
+		unpacked.resize(4 * n_bytes);
+		unpackBases(packed.data(), n_bytes, unpacked.data() );
+		clip.assign(unpacked.data(), len);
+		// bases other than A, C, G, T
+		if (header & 1) {
+			uint64_t n = data_in->getNextVarint();
+			int pos = 0;
+			for (uint64_t i = 0; i < n; i++) {
+				pos += data_in->getNextVarint();
+				char base = data_in->getNextByte();
+				if (pos < len) clip[pos] = base;
+			}
 		}
+		current_clip = clip;
 		return SUCCESS;
 	}
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <queue>
+#include <deque>
 // #include <memory>
 
 #include <iostream>
@@ -15,11 +16,18 @@
 #include "EditsStream.hpp"
 #include "ClipStream.hpp"
 #include "ReadIDStream.hpp"
+#include "AuxTagStream.hpp"
+#include "ReadLenStream.hpp"
+#include "PrimaryRefStream.hpp"
 #include "FlagsStream.hpp"
 #include "QualityStream.hpp"
+#include "BinnedQualityStream.hpp"
 // #include "MergedEditsStream.hpp"
 #include "TranscriptsStream.hpp"
 #include "RefereeHeader.hpp"
+#include "RefereeProfile.hpp"
+#include "MateQueue.hpp"
+#include "ConsensusVariants.hpp"
 
 
 
@@ -42,10 +50,13 @@ struct InputStreams {
 	shared_ptr<ClipStream> right_clips;
 	shared_ptr<OffsetsStream> offs;
 	shared_ptr<EditsStream> edits;
+	shared_ptr<ReadLenStream> read_lens;
 
 	shared_ptr<FlagsStream> flags;
 	shared_ptr<ReadIDStream> readIDs;
-	shared_ptr<QualityStream> qualities;
+	shared_ptr<PrimaryRefStream> primary_refs;
+	shared_ptr<QualitySource> qualities;
+	shared_ptr<AuxTagStream> optional_fields;
 
 	InputStreams() {}
 };
@@ -101,6 +112,10 @@ class Decompressor {
 			offset_num_al++;
 		}
 		cerr << "offs_num_al: " << offset_num_al << endl;
+		if (is.read_lens != nullptr)
+			is.read_lens->seekToAlignment(target_ref_id, target_coord, target_coord, offset_num_al);
+		if (is.primary_refs != nullptr)
+			is.primary_refs->seekToAlignment(target_ref_id, target_coord, target_coord, offset_num_al);
 
 		// now seek to the target coordinate
 		cerr << "seeking to a target coordinate chr=" << target_ref_id << ":" << target_coord << endl;
@@ -123,7 +138,13 @@ class Decompressor {
 			// advance to the next edit
 			is.edits->next();
 			if (is.edits->hasEdits() ) is.edits->getEdits();
+			if (is.read_lens != nullptr) is.read_lens->next();
+			if (is.primary_refs != nullptr) is.primary_refs->next();
+			offset_num_al++;
 		}
+		// primaries before the interval are not available
+		alignment_index = offset_num_al;
+		recent_primaries.clear();
 		cerr << "after seeking current coord is: chr=" << ref_id << ":" << offset << endl;
 	}
 
@@ -144,10 +165,12 @@ public:
 	// Reconstruct SAM file by combining the inputs; restoring reads and quals
 	////////////////////////////////////////////////////////////////////////////
 	void decompress(RefereeHeader & header, InputStreams & is, uint8_t const options) {
+		PROFILE_SCOPE("decode.total");
 		// sequence-specific streams
 		int read_len = header.getReadLen();
 		auto t_map = header.getTranscriptIDsMap();
 		cerr << "[decompress the entire contents]" << endl;
+		consensus_edits = header.hasConsensusEdits();
 		cerr << "Read length:\t" << (int)read_len << endl;
 		assert(read_len > 0);
 		TranscriptsStream transcripts(file_name, ref_path, "-d", t_map);
@@ -160,9 +183,12 @@ public:
 		is.edits->seekToBlockStart(-1, 0, 0);
 		is.left_clips->seekToBlockStart(-1, 0, 0);
 		is.right_clips->seekToBlockStart(-1, 0, 0);
-		is.flags->seekToBlockStart(-1, 0, 0);
-		is.readIDs->seekToBlockStart(-1, 0, 0);
-		is.qualities->seekToBlockStart(-1, 0, 0);
+		if (is.read_lens != nullptr) is.read_lens->seekToBlockStart(-1, 0, 0);
+		if (is.primary_refs != nullptr) is.primary_refs->seekToBlockStart(-1, 0, 0);
+		if (is.flags != nullptr) is.flags->seekToBlockStart(-1, 0, 0);
+		if (is.readIDs != nullptr) is.readIDs->seekToBlockStart(-1, 0, 0);
+		if (is.qualities != nullptr) is.qualities->seekToBlockStart(-1, 0, 0);
+		if (is.optional_fields != nullptr) is.optional_fields->seekToBlockStart(-1, 0, 0);
 
 		int ref_id = is.offs->getCurrentTranscript();
 		// cerr << "Starting with transcript " << ref_id << endl;
@@ -178,6 +204,7 @@ public:
 				ref_id = is.offs->getNextTranscript();
 				if (ref_id == END_OF_STREAM) {
 					cerr << "Done" << endl;
+					mate_queue.flush();
 					return;
 				}
 				cerr << "chr=" << transcripts.getMapping(ref_id) << " ";
@@ -192,9 +219,11 @@ public:
 				if (ret == END_OF_STREAM) {
 					cerr << "no more edits" << endl;
 				}
-				reconstructAlignment(offset_0, read_len, ref_id, transcripts,
+				// lengths vary in trimmed and long read data
+				int len = (is.read_lens != nullptr) ? is.read_lens->next() : read_len;
+				reconstructAlignment(offset_0, len, ref_id, transcripts,
 					is.edits,
-					is.left_clips, is.right_clips, is.readIDs, is.flags, is.qualities,
+					is.left_clips, is.right_clips, is.readIDs, is.primary_refs, is.flags, is.qualities, is.optional_fields,
 					options);
 			}
 			i++;
@@ -207,6 +236,7 @@ public:
 		cerr << "quals covered: " << quals_covered << endl;
 		cerr << "new qual requested: " << new_requested << endl;
 
+		mate_queue.flush();
 		recovered_file.close();
 	}
 
@@ -216,6 +246,11 @@ public:
 	////////////////////////////////////////////////////////////////
 	void decompressInterval(GenomicInterval interval, RefereeHeader & header, InputStreams & is,
 		const uint8_t options) {
+		PROFILE_SCOPE("decode.total");
+		if (header.hasConsensusEdits() ) {
+			cerr << "[ERROR] Archives compressed w/ --consensusEdits can only be decompressed as a whole" << endl;
+			exit(1);
+		}
 		int read_len = header.getReadLen();
 		auto t_map = header.getTranscriptIDsMap();
 		TranscriptsStream transcripts(file_name, ref_path, "-d", t_map);
@@ -275,9 +310,10 @@ public:
 					// break;
 				}
 
-				reconstructAlignment(offset, read_len, ref_id, transcripts,
+				int len = (is.read_lens != nullptr) ? is.read_lens->next() : read_len;
+				reconstructAlignment(offset, len, ref_id, transcripts,
 					is.edits,
-					is.left_clips, is.right_clips, is.readIDs, is.flags, is.qualities,
+					is.left_clips, is.right_clips, is.readIDs, is.primary_refs, is.flags, is.qualities, is.optional_fields,
 					options);
 			}
 			i++;
@@ -286,6 +322,7 @@ public:
 			}
 		}
 		cerr << endl;
+		mate_queue.flush();
 		recovered_file.close();
 	}
 
@@ -304,6 +341,11 @@ private:
 
 	uint8_t read_len; // uniform read length
 
+	// mismatches may refer to known variants (see ConsensusVariants.hpp)
+	bool consensus_edits = false;
+
+	ConsensusVariants consensus;
+
 	ofstream recovered_file;
 
 	////////////////////////////////////////////////////////////////
@@ -316,16 +358,21 @@ private:
 			shared_ptr<ClipStream> left_clips,
 			shared_ptr<ClipStream> right_clips,
 			shared_ptr<ReadIDStream> read_ids,
+			shared_ptr<PrimaryRefStream> primary_refs,
 			shared_ptr<FlagsStream> flags,
-			shared_ptr<QualityStream> qualities,
+			shared_ptr<QualitySource> qualities,
+			shared_ptr<AuxTagStream> optional_fields,
 			uint8_t const options) {
+		PROFILE_SCOPE("decode.reconstruct");
+		PROFILE_COUNT("decode.alignments", 1);
 
 		string cigar, md_string, read;
 		bool has_edits = edits->hasEdits();
 		if (has_edits) {
 			// cerr << "read with edits" << endl;
 			md_string = "MD:Z:";
-			vector<uint8_t> edit_ops = edits->getEdits();
+			vector<int> edit_ops = edits->getEdits();
+			if (consensus_edits) consensus.resolve(ref_id, offset, edit_ops);
 			read = buildEditStrings(read_len, edit_ops, cigar, md_string,
 				left_clips, right_clips, offset, ref_id, transcripts);
 		}
@@ -337,18 +384,41 @@ private:
 		// std::transform(read.begin(), read.end(), read.begin(), ::toupper);
 
 		// cerr << "getting all other fields " << read_ids << endl;
+		// assemble the whole record before handing it to the output stream
+		string & record = record_buf;
+		record.clear();
+
+		// secondary and supplementary alignments may take the name and
+		// qualities from their primary
+		size_t ordinal = ++alignment_index;
+		uint64_t primary_ref = (primary_refs != nullptr) ? primary_refs->next() : 0;
+		DecodedPrimaries::DecodedPrimary * primary = nullptr, * self = nullptr;
+		if (primary_ref > 0)
+			primary = recent_primaries.find(ordinal - primaryRefDistance(primary_ref) );
+		else
+			self = recent_primaries.push(ordinal, read_len);
+
 		if (options & D_READIDS) {
 			string read_id = "*";
-			if (read_ids != nullptr) {
+			if (primary_ref > 0) {
+				if (primary != nullptr && primary->name.size() > 0) read_id = primary->name;
+			}
+			else if (read_ids != nullptr) {
 				int status = 0;
 				read_id = read_ids->getNextID(status);
 				if (status != SUCCESS) read_id = "*";
+				self->name = read_id;
 			}
-			recovered_file << read_id << "\t";
+			record += read_id;
+			record += '\t';
 		}
 
 		int flag = -1, mapq = -1, rnext = -1, pnext = -1, tlen = -1;
+		// pnext and tlen of this record wait for the mate
+		bool pending = false;
+		size_t insert_at = 0, mate_index = 0;
 		if (options & D_FLAGS) {
+			size_t index = mate_queue.nextIndex();
 			if (flags != nullptr) {
 				// cerr << "bla " << flags << endl;
 				auto alignment_flags = flags->getNextFlagSet();
@@ -360,58 +430,122 @@ private:
 				tlen = alignment_flags[4];
 			}
 
-			recovered_file << flag << "\t";
+			record += to_string(flag);
+			record += '\t';
 			// write out reference name, offset (SAM files use 1-based offsets)
-			recovered_file << transcripts.getMapping(ref_id) << "\t" << (offset + 1);
-			recovered_file << "\t" << mapq;
+			record += transcripts.getMapping(ref_id);
+			record += '\t';
+			record += to_string(offset + 1);
+			record += '\t';
+			record += to_string(mapq);
+			record += '\t';
 			if (has_edits)
-				recovered_file << "\t" << cigar;
-			else
-				recovered_file << "\t" << (int)read_len << "M";
-			recovered_file << "\t";
+				record += cigar;
+			else {
+				record += to_string( (int)read_len);
+				record += 'M';
+			}
+			record += '\t';
 			if (rnext < 0) {
-				recovered_file << "*";
+				record += '*';
 				pnext = 0;
 				tlen = 0;
 			}
 			else if (rnext == 0) {
-				recovered_file << "=";
+				record += '=';
 				tlen = pnext - tlen;
 			}
-			else recovered_file << rnext;
-
-			recovered_file << "\t" << pnext << "\t" << tlen << "\t";
+			else record += to_string(rnext);
+			record += '\t';
+
+			int end = offset + (has_edits ? referenceSpan(cigar) : read_len);
+			bool rev = flag >= 0 && (flag & 16);
+			if (flags != nullptr && flags->mateAhead() > 0) {
+				mate_index = index + flags->mateAhead();
+				mate_queue.expect(mate_index, offset, end, rev, flags->mateModel() );
+				pending = true;
+				insert_at = record.size();
+			}
+			else if (flags != nullptr && flags->mateBehind() )
+				mate_queue.resolve(index, offset, end, rev, pnext, tlen);
+
+			if (!pending) {
+				record += to_string(pnext);
+				record += '\t';
+				record += to_string(tlen);
+				record += '\t';
+			}
 		}
 		// cerr << "got flags 'n all" << endl;
 
 		if (options & D_SEQ) {
-			recovered_file << read;
+			record += read;
 				// more data to come -- separate
 			if ( (options & D_QUALS) || (options & D_OPTIONAL_FIELDS) )
-				recovered_file << "\t";
+				record += '\t';
 		}
-		// write out qual vector
-		bool secondary_alignment = (flag >= 0) ? (flag & 0x100) > 0 : true;
-		if (options & D_QUALS) {
+		// write out qual vector; secondary and supplementary alignments carry none
+		bool secondary_alignment = (flag >= 0) ? (flag & 0x900) > 0 : true;
+		if ( (options & D_QUALS) && qualities != nullptr) {
 			quals_covered++;
-			if (secondary_alignment)
-				recovered_file << "*";
+			if (primary_ref > 0 && primaryRefQuals(primary_ref) && primary != nullptr && primary->quals.size() > 0) {
+				if (primaryRefReversed(primary_ref) )
+					record.append(primary->quals.rbegin(), primary->quals.rend() );
+				else
+					record += primary->quals;
+			}
+			else if (secondary_alignment)
+				record += '*';
 			else {
 				new_requested++;
-				recovered_file << qualities->getNextQualVector();
+				// the compressor flipped the vectors of forward strand alignments
+				// (see IOLibAlignment::isRC)
+				size_t quals_start = record.size();
+				qualities->appendNextQualVector(record, (flag & 16) == 0);
+				if (self != nullptr) self->quals.assign(record, quals_start, string::npos);
 			}
 		}
 		else {
-			recovered_file << "*";
+			record += '*';
 		}
 		// cerr << "wrote out quals" << endl;
 
 		if (options & D_OPTIONAL_FIELDS) {
-			if (has_edits)
-				recovered_file << "\t" << md_string << " ";
-			// TODO: write out other optional fields
+			// w/o edits the read matches the reference over its entire length
+			if (!has_edits) md_string = "MD:Z:" + to_string(read_len);
+			if (optional_fields != nullptr)
+				optional_fields->appendFields(record, md_string);
+			else {
+				record += '\t';
+				record += md_string;
+			}
+		}
+		record += '\n';
+		mate_queue.emit(record, pending, insert_at, mate_index);
+	}
+	string record_buf; // reused across records
+
+	DecodedPrimaries recent_primaries;
+
+	size_t alignment_index = 0;
+
+	// records wait here for the pnext/tlen of their mates
+	MateQueue mate_queue {recovered_file};
+
+	////////////////////////////////////////////////////////////////
+	// reference bases covered by a CIGAR string
+	////////////////////////////////////////////////////////////////
+	int referenceSpan(string const & cigar) {
+		int span = 0, len = 0;
+		for (char c : cigar) {
+			if (isdigit(c) ) {
+				len = 10 * len + (c - '0');
+				continue;
+			}
+			if (c == 'M' || c == 'D' || c == 'N' || c == '=' || c == 'X') span += len;
+			len = 0;
 		}
-		recovered_file << endl;
+		return span;
 	}
 	int quals_covered = 0;
 	int new_requested = 0;
@@ -420,7 +554,7 @@ private:
 	// build CIGAR, MD strings for the read with edits
 	// offset -- zero based
 	////////////////////////////////////////////////////////////////
-	string buildEditStrings(int read_len, vector<uint8_t> & edits,
+	string buildEditStrings(int read_len, vector<int> & edits,
 		string & cigar, string & md_string,
 		shared_ptr<ClipStream> left_clips,
 		shared_ptr<ClipStream> right_clips,
@@ -430,7 +564,6 @@ private:
 		string right_cigar, right_clip, read = transcripts.getTranscriptSequence(ref_id, offset, read_len);
 		int j = 0, last_md_edit_pos = 0, last_cigar_edit_pos = 0, clipped_read_len = read_len;
 		int offset_since_last_cigar = 0; // reset to 0 when on the cigar edit, incremented when on MD edit
-		int offset_since_last_md = 0;
 		int splice_offset = 0;
 		int last_abs_pos = 0, Ds = 0, Is = 0; // number of deletions
 		bool first_md_edit = true, first_cigar_was_clip = false;
@@ -445,7 +578,7 @@ private:
 		// }
 
 		uint8_t op;
-		while (j < edits.size() ) {
+		while (j < (int)edits.size() ) {
 			op = edits[j];
 			// if (offset == 57509325)
 				// cerr << op << " ";
@@ -468,7 +601,6 @@ private:
 						last_cigar_edit_pos += left_clip.length();
 						last_abs_pos += left_clip.length();
 						offset_since_last_cigar = 0;
-						offset_since_last_md = 0;
 						last_md_edit_pos = 0;
 						clipped_read_len -= left_clip.length();
 					}
@@ -498,7 +630,6 @@ private:
 					last_cigar_edit_pos += edits[j];
 					last_abs_pos += edits[j];
 					offset_since_last_cigar = 0;
-					offset_since_last_md = 0;
 					clipped_read_len -= edits[j];
 				}
 				break;
@@ -515,7 +646,7 @@ private:
 					int ds = 0;
 					bool first_d = true;
 					offset_since_last_cigar += edits[j+1] - Is;
-					while (j < edits.size()) {// consume all Ds
+					while (j < (int)edits.size()) {// consume all Ds
 						if (edits[j] != 'D') {
 							// end of run of D's
 							break;
@@ -532,7 +663,7 @@ private:
 						j += 2;
 					}
 					j--;
-					assert(j < edits.size());
+					assert(j < (int)edits.size());
 					Ds += ds;
 					// cerr << "D's pos: " << last_abs_pos << " #=" << ds << " ";
 
@@ -587,10 +718,10 @@ private:
 					// update the read
 					// TODO: test with hard clipped strings
 					if (offset == 57509325) cerr << offset << endl;
-					if (read.size() <= last_cigar_edit_pos) {
+					if ((int)read.size() <= last_cigar_edit_pos) {
 						cerr << "weird stuff: " << read.size() << " cigar: " << last_cigar_edit_pos << " offs: " << offset << endl;
 					}
-					assert(read.size() > last_cigar_edit_pos);
+					assert( (int)read.size() > last_cigar_edit_pos);
 					read.replace(last_cigar_edit_pos, read_len - last_cigar_edit_pos,
 						transcripts.getTranscriptSequence(ref_id, offset + splice_offset, read_len - last_cigar_edit_pos));
 					// cerr << "read: " << read << endl;
@@ -607,7 +738,7 @@ private:
 					int is = 0;
 					bool first_i = true;
 					offset_since_last_cigar += edits[j+1] - Is;
-					while (j < edits.size()) {// consume all Is
+					while (j < (int)edits.size()) {// consume all Is
 						if (edits[j] < 'V' || edits[j] > 'Z') {
 							// not an I -- break the loop
 							// cerr << "break loop 1 ";
@@ -622,14 +753,15 @@ private:
 						// cerr << (char)edits[j] << "-" << (int)edits[j+1] << ",";
 						last_abs_pos += edits[j+1];
 						// insert the missing base
-						read.insert(read.begin() + last_abs_pos, reverseReplace(edits[j]) );// insert a single char
+						uint8_t ins_op = edits[j];
+						read.insert(read.begin() + last_abs_pos, reverseReplace(ins_op) );// insert a single char
 						j += 2;
 						first_i = false;
 						 // adjust by one base for every insert
 						last_abs_pos++;
 					}
 					j--;
-					assert(j < edits.size());
+					assert(j < (int)edits.size());
 					// cerr << "I's pos: " << last_abs_pos << " ";
 					// trim the read to be of appropriate length
 					read.resize(read_len);
@@ -673,7 +805,6 @@ private:
 					// add correct read to have its original base
 					read[last_abs_pos] = op;
 					offset_since_last_cigar += edits[j];
-					offset_since_last_md = 0;
 				}
 			}
 			j++;
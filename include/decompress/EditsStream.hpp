@@ -5,6 +5,8 @@
 #include <memory>
 
 #include "InputStream.hpp"
+#include "LongEdits.hpp"
+#include "SpliceJunctions.hpp"
 
 class EditsStream : public InputStream {
 private:
@@ -22,6 +24,12 @@ private:
 
 	size_t alignments_expected = 0;
 
+	// splice lengths of the current block
+	JunctionTable junctions;
+
+	// block the first byte of the last record came from
+	size_t table_block = 0;
+
 	////////////////////////////////////////////////////////////////////////////
 	//
 	////////////////////////////////////////////////////////////////////////////
@@ -84,6 +92,8 @@ public:
 			cerr << "[ERROR] Could not navigate to the begining of the interval" << endl;
 			exit(1);
 		}
+		junctions.clear();
+		table_block = data_in->blocksLoaded();
 		// sync these streams
 		auto synced_coord = syncEditStreams(edits_start, has_edits_start);
 		// cerr << "Synced edit streams: " << synced_coord.first << ", " << synced_coord.second << endl;
@@ -94,13 +104,33 @@ public:
 	size_t getAlignmentCount() {return alignments_expected; }
 
 	//////////////////////////////////////////////////////////////////////////////////////////////
-	vector<uint8_t> getEdits() {
+	// ops of the short form; the long form is expanded (see LongEdits.hpp)
+	// and junction ids are replaced w/ splices (see SpliceJunctions.hpp)
+	vector<int> getEdits() {
 		uint8_t num_edit_bytes = data_in->getNextByte();
 		bytes_read++;
-		auto e = data_in->getNextNBytes(num_edit_bytes);
-		bytes_read += num_edit_bytes;
-		assert(e.size() == num_edit_bytes);
-		return e;
+		// the junction table starts over w/ every block; blocks are loaded
+		// when needed, so the last one loaded holds the byte just read
+		if (data_in->blocksLoaded() != table_block) {
+			junctions.clear();
+			table_block = data_in->blocksLoaded();
+		}
+		vector<int> edits;
+		if (num_edit_bytes == EDITS_LONG_FORM) {
+			uint64_t len = data_in->getNextVarint();
+			auto body = data_in->getNextNBytes(len);
+			bytes_read += len;
+			assert(body.size() == len);
+			expandLongEdits(body, edits);
+		}
+		else {
+			auto e = data_in->getNextNBytes(num_edit_bytes);
+			bytes_read += num_edit_bytes;
+			assert(e.size() == num_edit_bytes);
+			edits.assign(e.begin(), e.end() );
+		}
+		junctions.resolve(edits);
+		return edits;
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////
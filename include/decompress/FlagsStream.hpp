@@ -15,6 +15,31 @@ class FlagsStream : public InputStream {
 
 	unordered_map<int,int> & r_rnext_map;
 
+	// pnext and tlen of the last flag set come from the mate (see MatePrediction.hpp)
+	int mate_ahead = 0, mate_model = 0;
+
+	bool mate_behind = false;
+
+	void addWord(string & chunk, vector<int> & loc_flags) {
+		if (chunk.size() > 0 && chunk[0] == '>') {
+			mate_ahead = stoi(chunk.substr(1) );
+			loc_flags.push_back(0);
+		}
+		else if (chunk == "<") {
+			mate_behind = true;
+			loc_flags.push_back(0);
+			loc_flags.push_back(0);
+		}
+		else if (mate_ahead > 0 && loc_flags.size() == 4) {
+			mate_model = stoi(chunk);
+			loc_flags.back() = 0;
+			loc_flags.push_back(0);
+		}
+		else
+			loc_flags.push_back(stoi(chunk) );
+		chunk = "";
+	}
+
 	void translate(vector<int> & indexed_flags) {
 		// flags
 		if (r_flags_map.find(indexed_flags[0]) != r_flags_map.end())
@@ -59,25 +84,34 @@ public:
 			value = r_flags_map[value];
 	}
 
+	// lines to the mate if the mate comes later and pnext/tlen follow from it
+	int mateAhead() { return mate_ahead; }
+
+	int mateModel() { return mate_model; }
+
+	// pnext/tlen follow from the mate that came earlier
+	bool mateBehind() { return mate_behind; }
+
 	// get next set of flags for an alignment
 	vector<int> getNextFlagSet() {
 		vector<int> loc_flags;
 		if ( !data_in->hasMoreBytes() ) return loc_flags;
 
+		mate_ahead = 0;
+		mate_model = 0;
+		mate_behind = false;
+
 		string chunk;
 		char c = data_in->getNextByte();
 		while (c != '\n' && data_in->hasMoreBytes()) {
-			if (c == ' ') {
-				int value = stoi(chunk);
-				loc_flags.push_back(value);
-				chunk = "";
-			}
+			if (c == ' ')
+				addWord(chunk, loc_flags);
 			else
 				chunk.push_back(c);
 			c = data_in->getNextByte();
 		}
 		// add the last 'word' we observed before \n
-		loc_flags.push_back(stoi(chunk));
+		addWord(chunk, loc_flags);
 
 		// translate values
 		translate(loc_flags);
@@ -19,6 +19,7 @@
 // #include "tbb/concurrent_queue.h"
 
 #include "IntervalTree.h"
+#include "RefereeProfile.hpp"
 
 using namespace std;
 // using namespace tbb;
@@ -58,6 +59,8 @@ public:
 //
 ////////////////////////////////////////////////////////////////
 vector<uint8_t> unzipData(shared_ptr<vector<uint8_t>> raw_data, int const new_data_size) {
+	PROFILE_SCOPE("decode.unzip");
+	PROFILE_COUNT("decode.unzip", new_data_size);
 	// cerr << "New data size: " <<  new_data_size << endl;
 	vector<uint8_t> unzipped_data(new_data_size, 0); // allocate needed amount of bytes
 
@@ -123,6 +126,83 @@ vector<uint8_t> unzipData(shared_ptr<vector<uint8_t>> raw_data, int const new_da
 }
 
 
+////////////////////////////////////////////////////////////////
+//
+////////////////////////////////////////////////////////////////
+void createTree(int const chromo,
+	vector<RawDataInterval> & chromo_intervals,
+	map<chromo_id_t, IntervalTree<int,int> > & chromosome_trees) {
+	chromosome_trees[chromo] =
+			IntervalTree<int,int>(chromo_intervals);
+}
+
+////////////////////////////////////////////////////////////////
+// one interval tree of blocks per chromosome; blocks are the lzip members
+// of a stream (or the range coded blocks of a .ac stream) in file order
+////////////////////////////////////////////////////////////////
+void createChromosomeIntervalTree(
+	shared_ptr<vector<TrueGenomicInterval>> genomic_intervals,
+	vector<MyBlock> & lzip_blocks,
+	map<chromo_id_t, IntervalTree<int,int> > & chromosome_trees) {
+
+	// cerr << lzip_blocks.size() << " gen: " << genomic_intervals->size() << endl;
+	assert(lzip_blocks.size() <= genomic_intervals->size());
+
+	int prev_chromo = genomic_intervals->at(0).start.chromosome;
+	vector<RawDataInterval> chromo_intervals;
+	for (int i = 0; i < genomic_intervals->size(); i++) {
+		auto interval = genomic_intervals->at(i);
+		auto block = lzip_blocks[i];
+		if (prev_chromo != interval.start.chromosome) {
+			// create a tree for intervals in [range_start, range_end]
+			createTree(prev_chromo, chromo_intervals, chromosome_trees);
+			// start a new range at this index
+			chromo_intervals.clear();
+			prev_chromo = interval.start.chromosome;
+		}
+
+		// interval.start.chromosome is prev_chromo
+		if (interval.start.chromosome == interval.end.chromosome) {
+			// start and end chromosome are the same and equal prev_chromo
+			chromo_intervals.emplace_back(
+				block.offset, block.compressed_size, block.decompressed_size,
+				interval.start.chromosome, interval.start.offset, interval.end.offset, 
+				interval.num_alignments, interval.is_aligned);
+			// moving on...
+		}
+		else {
+			// figure out how many chromos this interval spans
+			auto chromo_span = interval.end.chromosome - interval.start.chromosome - 1;
+			// split the interval as many times as needed (at least 2 pieces)
+			// first create a tree for chromo_intervals w/ a starting piece of the current interval
+			chromo_intervals.emplace_back(
+				block.offset, block.compressed_size, block.decompressed_size,
+				interval.start.chromosome, interval.start.offset, chromo_max, interval.num_alignments, interval.is_aligned);
+			// then create tree(s) for every chromo that is in between the start and the end
+			createTree(interval.start.chromosome, chromo_intervals, chromosome_trees);
+			chromo_intervals.clear();
+			int k = 0;
+			while (k < chromo_span) {
+				chromo_intervals.emplace_back(
+					block.offset, block.compressed_size, block.decompressed_size,
+					interval.start.chromosome + k + 1, chromo_min, chromo_max, interval.num_alignments, interval.is_aligned);
+				createTree(interval.start.chromosome + k + 1, chromo_intervals, chromosome_trees);
+				chromo_intervals.clear();
+				k++;
+			}
+			// then add the leftover piece to the chromo_intervals
+			chromo_intervals.emplace_back(
+				block.offset, block.compressed_size, block.decompressed_size,
+				interval.end.chromosome, chromo_min, interval.end.offset, interval.num_alignments, interval.is_aligned);
+			prev_chromo = interval.end.chromosome;
+		}
+
+	}
+	// create a tree for intervals in chromo_intervals
+	createTree(prev_chromo, chromo_intervals, chromosome_trees);
+}
+
+
 ////////////////////////////////////////////////////////////////
 //
 //
@@ -150,6 +230,8 @@ class InputBuffer {
 
 	int buffer_size;
 
+	size_t blocks_loaded = 0;
+
 	void readMoreLZIPBlocks() {
 		// cerr << "read mode blocks " << name << " q: " << block_queue.size() << endl;
 		if (block_queue.size() > 0) {
@@ -216,10 +298,29 @@ class InputBuffer {
 		return blocks;
 	}
 
+	////////////////////////////////////////////////////////////////
+	// add all blocks from all trees (in order) to the block queue
+	////////////////////////////////////////////////////////////////
+	void queueAllBlocks() {
+		for (auto tree_p : chromosome_trees) {
+			auto tree = tree_p.second;
+			for (auto b : tree.intervals ) {
+				// need to check if this block was part of the previous tree
+				// and only add the block if it is different
+				if (block_queue.size() == 0) {
+					block_queue.push_back(b);
+				}
+				else if (block_queue.back().byte_offset != b.byte_offset)
+					block_queue.push_back(b);
+			}
+		}
+	}
+
 	////////////////////////////////////////////////////////////////
 	//
 	////////////////////////////////////////////////////////////////
 	vector<uint8_t> decompressBlock(RawDataInterval & block) {
+		blocks_loaded++;
 		// read block bytes from the LZ stream
 		// different non-C++11 compliant compilers may set failbit upon reaching eof
 		// we reset all flags just in case
@@ -240,82 +341,6 @@ class InputBuffer {
 		return unzipped_data;
 	}
 
-	/////////////////////////////////////////////////////tellg2///////////
-	//
-	////////////////////////////////////////////////////////////////
-	void createTree(int const chromo,
-		vector<RawDataInterval> & chromo_intervals,
-		map<chromo_id_t, IntervalTree<int,int> > & chromosome_trees) {
-		chromosome_trees[chromo] =
-				IntervalTree<int,int>(chromo_intervals);
-	}
-
-	////////////////////////////////////////////////////////////////
-	//
-	////////////////////////////////////////////////////////////////
-	void createChromosomeIntervalTree(
-		shared_ptr<vector<TrueGenomicInterval>> genomic_intervals,
-		vector<MyBlock> & lzip_blocks,
-		map<chromo_id_t, IntervalTree<int,int> > & chromosome_trees) {
-
-		// cerr << lzip_blocks.size() << " gen: " << genomic_intervals->size() << endl;
-		assert(lzip_blocks.size() <= genomic_intervals->size());
-
-		int prev_chromo = genomic_intervals->at(0).start.chromosome;
-		vector<RawDataInterval> chromo_intervals;
-		for (int i = 0; i < genomic_intervals->size(); i++) {
-			auto interval = genomic_intervals->at(i);
-			auto block = lzip_blocks[i];
-			if (prev_chromo != interval.start.chromosome) {
-				// create a tree for intervals in [range_start, range_end]
-				createTree(prev_chromo, chromo_intervals, chromosome_trees);
-				// start a new range at this index
-				chromo_intervals.clear();
-				prev_chromo = interval.start.chromosome;
-			}
-
-			// interval.start.chromosome is prev_chromo
-			if (interval.start.chromosome == interval.end.chromosome) {
-				// start and end chromosome are the same and equal prev_chromo
-				chromo_intervals.emplace_back(
-					block.offset, block.compressed_size, block.decompressed_size,
-					interval.start.chromosome, interval.start.offset, interval.end.offset, 
-					interval.num_alignments, interval.is_aligned);
-				// moving on...
-			}
-			else {
-				// figure out how many chromos this interval spans
-				auto chromo_span = interval.end.chromosome - interval.start.chromosome - 1;
-				// split the interval as many times as needed (at least 2 pieces)
-				// first create a tree for chromo_intervals w/ a starting piece of the current interval
-				chromo_intervals.emplace_back(
-					block.offset, block.compressed_size, block.decompressed_size,
-					interval.start.chromosome, interval.start.offset, chromo_max, interval.num_alignments, interval.is_aligned);
-				// then create tree(s) for every chromo that is in between the start and the end
-				createTree(interval.start.chromosome, chromo_intervals, chromosome_trees);
-				chromo_intervals.clear();
-				int k = 0;
-				while (k < chromo_span) {
-					chromo_intervals.emplace_back(
-						block.offset, block.compressed_size, block.decompressed_size,
-						interval.start.chromosome + k + 1, chromo_min, chromo_max, interval.num_alignments, interval.is_aligned);
-					createTree(interval.start.chromosome + k + 1, chromo_intervals, chromosome_trees);
-					chromo_intervals.clear();
-					k++;
-				}
-				// then add the leftover piece to the chromo_intervals
-				chromo_intervals.emplace_back(
-					block.offset, block.compressed_size, block.decompressed_size,
-					interval.end.chromosome, chromo_min, interval.end.offset, interval.num_alignments, interval.is_aligned);
-				prev_chromo = interval.end.chromosome;
-			}
-
-		}
-		// create a tree for intervals in chromo_intervals
-		createTree(prev_chromo, chromo_intervals, chromosome_trees);
-	}
-
-
 ////////////////////////////////////////////////////////////////
 //
 //
@@ -356,47 +381,30 @@ public:
 
 		if (at_num_alignments >= 0) {
 			cerr << "choosing block by a number of alignments" << endl;
-			RawDataInterval * start_block;
-			bool found_block = false;
-			for (auto tree_p : chromosome_trees) {
-				auto tree = tree_p.second;
-				for (auto block : tree.intervals ) {
-					if (block.num_alignments < at_num_alignments) {
-						start_block = &block;
-					}
-					else {
-						// previous block contained the needed point
-						found_block = true;
-						break;
-					}
-				}
-				if (found_block) break;
+			queueAllBlocks();
+			// the alignment is in the last block that starts at or before it
+			// (the first one if several blocks start there); the blocks after
+			// it stay in the queue
+			size_t start = 0;
+			for (size_t i = 0; i < block_queue.size(); i++) {
+				if (block_queue[i].num_alignments > (unsigned long)at_num_alignments) break;
+				if (block_queue[i].num_alignments > block_queue[start].num_alignments) start = i;
 			}
-			if (!found_block) {
+			if (block_queue.size() == 0 || block_queue[start].num_alignments > (unsigned long)at_num_alignments) {
 				cerr << "[error] Could not find a starting block that aligns with the given number of alignments" << endl;
 				exit(1);
 			}
-
-			is_transcript_start = start_block->isAlignedWithTranscriptStart();
-			auto unzipped_data = decompressBlock(*start_block);
+			block_queue.erase(block_queue.begin(), block_queue.begin() + start);
+			RawDataInterval block = block_queue.front();
+			is_transcript_start = block.isAlignedWithTranscriptStart();
+			block_queue.pop_front();
+			auto unzipped_data = decompressBlock(block);
 			for (auto b : unzipped_data) bytes.push_back(b);
-			return make_pair(start_block->start, start_block->num_alignments);
+			return make_pair(block.start, block.num_alignments);
 		}
 		else if (chromo == -1) {
 			// cerr << "Loading the very first block" << endl;
-			// add all blocks from all trees (in order) to the block queue
-			for (auto tree_p : chromosome_trees) {
-				auto tree = tree_p.second;
-				for (auto b : tree.intervals ) {
-					// need to check if this block was part of the previous tree
-					// and only add the block if it is different
-					if (block_queue.size() == 0) {
-						block_queue.push_back(b);
-					}
-					else if (block_queue.back().byte_offset != b.byte_offset)
-						block_queue.push_back(b);
-				}
-			}
+			queueAllBlocks();
 			// cerr << "Added block to queue" << endl;
 
 			// decompress the first one
@@ -455,6 +463,12 @@ public:
 	////////////////////////////////////////////////////////////////////////////
 	bool opened() {return f_in.is_open();}
 
+	////////////////////////////////////////////////////////////////////////////
+	// blocks decompressed so far; blocks are loaded when the previous one
+	// runs out, so this changes when a read crosses into the next block
+	////////////////////////////////////////////////////////////////////////////
+	size_t blocksLoaded() {return blocks_loaded;}
+
 	////////////////////////////////////////////////////////////////////////////
 	//
 	////////////////////////////////////////////////////////////////////////////
@@ -477,15 +491,30 @@ public:
 		return c;
 	}
 
+	////////////////////////////////////////////////////////////////////////////
+	// 7 bits per byte, least significant first
+	////////////////////////////////////////////////////////////////////////////
+	uint64_t getNextVarint() {
+		uint64_t v = 0;
+		int shift = 0;
+		uint8_t b;
+		do {
+			b = getNextByte();
+			v |= (uint64_t)(b & 0x7F) << shift;
+			shift += 7;
+		} while ( (b & 0x80) && hasMoreBytes() );
+		return v;
+	}
+
+	////////////////////////////////////////////////////////////////////////////
+	// n bytes, fewer only if the stream runs out; long form edits may span
+	// several blocks
 	////////////////////////////////////////////////////////////////////////////
 	vector<uint8_t> getNextNBytes(int n) {
-		if (bytes.size() < n) {
-			// technically, should always have the next needed N bytes
-			// blocks should align with the boundaries of the edit sequences
-			cerr << "[ATTN] Should not need to load more data in the middle of the edit sequence" << endl;
+		while ( (int)bytes.size() < n && block_queue.size() > 0)
 			readMoreLZIPBlocks();
-		}
 		vector<uint8_t> local_bytes;
+		local_bytes.reserve(n);
 		while (n > 0 && bytes.size() > 0) {
 			local_bytes.push_back(bytes.front());
 			bytes.pop_front();
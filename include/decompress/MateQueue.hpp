@@ -0,0 +1,142 @@
+/*
+Output queue of the decoder for records whose pnext/tlen come from a mate
+further down the flags stream (see MatePrediction.hpp): such a record is
+held back until the mate is decoded, and the records behind it wait as
+well. A record whose mate never shows up gets 0 for both.
+*/
+
+#ifndef MATE_QUEUE_H
+#define MATE_QUEUE_H
+
+#include <deque>
+#include <string>
+#include <ostream>
+#include <iostream>
+#include <unordered_map>
+
+#include "MatePrediction.hpp"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class MateQueue {
+
+	struct QueuedRecord {
+		string text;
+		bool pending;
+		size_t insert_at;
+		size_t mate_index;
+	};
+
+	struct ExpectedMate {
+		size_t record; // position in the output queue
+		int offset, end;
+		bool rev;
+		int model;
+	};
+
+	ostream & out;
+
+	deque<QueuedRecord> out_queue;
+
+	// number of records that have left the queue
+	size_t queue_front = 0;
+
+	// index of the next flag set
+	size_t record_index = 0;
+
+	// expected mates by their index in the flags stream
+	unordered_map<size_t, ExpectedMate> expected_mates;
+
+	size_t lost_mates = 0;
+
+	void resolveMate(QueuedRecord & r, int pnext, int tlen) {
+		r.text.insert(r.insert_at, to_string(pnext) + '\t' + to_string(tlen) + '\t');
+		r.pending = false;
+	}
+
+public:
+	MateQueue(ostream & o): out(o) {}
+
+	////////////////////////////////////////////////////////////////
+	// index of the record whose flag set was just read
+	////////////////////////////////////////////////////////////////
+	size_t nextIndex() { return record_index++; }
+
+	////////////////////////////////////////////////////////////////
+	// the record being built waits for the mate at mate_index
+	////////////////////////////////////////////////////////////////
+	void expect(size_t mate_index, int offset, int end, bool rev, int model) {
+		expected_mates[mate_index] = ExpectedMate{queue_front + out_queue.size(), offset, end, rev, model};
+	}
+
+	////////////////////////////////////////////////////////////////
+	// record at index w/ its mate behind: pnext and tlen of both from the
+	// model; false (and both 0) if the mate is gone
+	////////////////////////////////////////////////////////////////
+	bool resolve(size_t index, int offset, int end, bool rev, int & pnext, int & tlen) {
+		pnext = 0;
+		tlen = 0;
+		auto it = expected_mates.find(index);
+		if (it == expected_mates.end() ) return false;
+		ExpectedMate & a = it->second;
+		int a_tlen = 0;
+		predictTlen(a.model, a.offset, a.end, a.rev, offset, end, rev, a_tlen, tlen);
+		// same (0-based) pnext as on the explicit path
+		pnext = a.offset;
+		resolveMate(out_queue[a.record - queue_front], offset, a_tlen);
+		expected_mates.erase(it);
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// a pending record gets pnext and tlen inserted at insert_at later
+	////////////////////////////////////////////////////////////////
+	void emit(string & record, bool pending, size_t insert_at, size_t mate_index) {
+		if (out_queue.empty() && !pending) {
+			out.write(record.data(), record.size() );
+			return;
+		}
+		out_queue.push_back(QueuedRecord{record, pending, insert_at, mate_index});
+		while (!out_queue.empty() ) {
+			QueuedRecord & r = out_queue.front();
+			if (r.pending) {
+				// mate went by w/o picking this record up
+				if (record_index <= r.mate_index) break;
+				expected_mates.erase(r.mate_index);
+				resolveMate(r, 0, 0);
+				lost_mates++;
+			}
+			out.write(r.text.data(), r.text.size() );
+			out_queue.pop_front();
+			queue_front++;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////
+	// write out what is held back, at the end of an interval or the file
+	////////////////////////////////////////////////////////////////
+	void flush() {
+		for (auto & r : out_queue) {
+			if (r.pending) {
+				resolveMate(r, 0, 0);
+				lost_mates++;
+			}
+			out.write(r.text.data(), r.text.size() );
+		}
+		queue_front += out_queue.size();
+		out_queue.clear();
+		expected_mates.clear();
+		if (lost_mates > 0)
+			cerr << "[INFO] Mates of " << lost_mates << " alignments were not found; pnext/tlen set to 0" << endl;
+		lost_mates = 0;
+	}
+
+	size_t held() { return out_queue.size(); }
+};
+
+#endif
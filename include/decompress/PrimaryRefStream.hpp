@@ -0,0 +1,95 @@
+#ifndef PRIMARY_REF_STREAM_HPP
+#define PRIMARY_REF_STREAM_HPP
+
+#include <memory>
+#include <deque>
+#include <algorithm>
+
+#include "decompress/InputStream.hpp"
+#include "PrimaryRef.hpp"
+
+////////////////////////////////////////////////////////////////
+// per-alignment references to the primary alignment (see PrimaryRef.hpp)
+////////////////////////////////////////////////////////////////
+class PrimaryRefStream : public InputStream {
+
+	// alignments read so far
+	unsigned long num_al = 0;
+
+public:
+
+	PrimaryRefStream(shared_ptr<InputBuffer> buf): InputStream(buf) {}
+
+	uint64_t next() {
+		if ( !data_in->hasMoreBytes() ) return 0;
+		num_al++;
+		return data_in->getNextVarint();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// position the stream at the given alignment number
+	////////////////////////////////////////////////////////////////
+	void seekToAlignment(int const ref_id, int const start_coord, int const end_coord,
+		unsigned long const at_num_alignments) {
+		bool t = false;
+		auto start = data_in->loadOverlappingBlock(ref_id, start_coord, end_coord, t, at_num_alignments);
+		if (start.first < 0) {
+			cerr << "[ERROR] Could not navigate to the begining of the interval" << endl;
+			exit(1);
+		}
+		num_al = start.second;
+		while (num_al < at_num_alignments) next();
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// names and qualities of the alignments w/ a 0 token in the primary
+// window (see PrimaryRef.hpp), by their number (1-based)
+////////////////////////////////////////////////////////////////
+class DecodedPrimaries {
+public:
+	struct DecodedPrimary {
+		size_t num = 0;
+		int len = 0;
+		string name;
+		string quals;
+	};
+
+private:
+	deque<DecodedPrimary> recent;
+
+	size_t window_bytes = 0;
+
+public:
+	DecodedPrimary * find(size_t num) {
+		auto it = lower_bound(recent.begin(), recent.end(), num,
+			[](DecodedPrimary const & p, size_t n) { return p.num < n; });
+		if (it == recent.end() || it->num != num) return nullptr;
+		return &(*it);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// drops the oldest entries the same way the encoder does
+	////////////////////////////////////////////////////////////////
+	DecodedPrimary * push(size_t num, int len) {
+		while (!recent.empty() &&
+				(num - recent.front().num >= PRIMARY_WINDOW ||
+				window_bytes + len > PRIMARY_WINDOW_BYTES) ) {
+			window_bytes -= recent.front().len;
+			recent.pop_front();
+		}
+		recent.emplace_back();
+		DecodedPrimary & p = recent.back();
+		p.num = num;
+		p.len = len;
+		window_bytes += len;
+		return &p;
+	}
+
+	void clear() {
+		recent.clear();
+		window_bytes = 0;
+	}
+};
+
+#endif
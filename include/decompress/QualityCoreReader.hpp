@@ -0,0 +1,163 @@
+/*
+Reads the range coded cores of a quality cluster (.quals.N.ac) or the binned
+qualities (.quals.binned.ac) block by block; see compress/QualityCoreBuffer.hpp
+for the writing side. Blocks are listed in the genomic intervals file like the
+lzip members of the other streams, so seeking picks the block the same way.
+*/
+
+#ifndef QUALITY_CORE_READER_H
+#define QUALITY_CORE_READER_H
+
+#include <fstream>
+#include <cstring>
+
+#include "QualityCodec.hpp"
+#include "RefereeProfile.hpp"
+#include "decompress/InputBuffer.hpp"
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+template <class Model>
+class QualityCoreReader {
+
+	string fname;
+
+	ifstream f_in;
+
+	Model model;
+
+	string block;	// decoded cores of the current block, back to back
+
+	vector<uint32_t> ends;	// end of every core in the block
+
+	int next = 0;	// next core to hand out
+
+	map<chromo_id_t, IntervalTree<int,int> > chromosome_trees;
+
+	////////////////////////////////////////////////////////////////
+	// offset and size of every block, from the block headers
+	////////////////////////////////////////////////////////////////
+	vector<MyBlock> scanBlocks() {
+		vector<MyBlock> blocks;
+		uint8_t header[QUALITY_BLOCK_HEADER];
+		int64_t pos = 0;
+		f_in.clear();
+		f_in.seekg(0);
+		while (f_in.read( (char *)header, QUALITY_BLOCK_HEADER) ) {
+			if (memcmp(header, QUALITY_BLOCK_MAGIC, 4) != 0) {
+				cerr << "[ERROR] Corrupted quality block in " << fname << endl;
+				exit(1);
+			}
+			uint32_t num_vectors = getUint32(header + 4);
+			uint32_t coded_size = getUint32(header + 8);
+			blocks.emplace_back(QUALITY_BLOCK_HEADER + coded_size, num_vectors, pos);
+			pos += QUALITY_BLOCK_HEADER + coded_size;
+			f_in.seekg(pos);
+		}
+		return blocks;
+	}
+
+	////////////////////////////////////////////////////////////////
+	bool loadBlock() {
+		uint8_t header[QUALITY_BLOCK_HEADER];
+		if ( !f_in.read( (char *)header, QUALITY_BLOCK_HEADER) ) return false;
+		if (memcmp(header, QUALITY_BLOCK_MAGIC, 4) != 0) {
+			cerr << "[ERROR] Corrupted quality block in " << fname << endl;
+			exit(1);
+		}
+		uint32_t num_vectors = getUint32(header + 4);
+		uint32_t coded_size = getUint32(header + 8);
+		vector<uint8_t> coded(coded_size);
+		if ( !f_in.read( (char *)coded.data(), coded_size) ) {
+			cerr << "[ERROR] Truncated quality block in " << fname << endl;
+			exit(1);
+		}
+
+		PROFILE_SCOPE("decode.quals_block");
+		block.clear();
+		ends.clear();
+		ends.reserve(num_vectors);
+		model.reset();
+		RangeDecoder rc(coded.data(), coded.size() );
+		for (uint32_t i = 0; i < num_vectors; i++) {
+			model.decode(rc, block);
+			ends.push_back(block.size() );
+		}
+		next = 0;
+		return true;
+	}
+
+public:
+	QualityCoreReader(string const & fn, shared_ptr<vector<TrueGenomicInterval>> genomic_intervals,
+		Model const & m = Model()): fname(fn), model(m) {
+		f_in.open(fname, ios::binary);
+		check_file_open(f_in, fname);
+		auto blocks = scanBlocks();
+		if (blocks.size() != genomic_intervals->size() ) {
+			cerr << "[ERROR] " << fname << " has " << blocks.size() << " blocks, the intervals file lists " <<
+				genomic_intervals->size() << endl;
+			exit(1);
+		}
+		if (blocks.size() > 0)
+			createChromosomeIntervalTree(genomic_intervals, blocks, chromosome_trees);
+		rewind();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// back to the first block
+	////////////////////////////////////////////////////////////////
+	void rewind() {
+		f_in.clear();
+		f_in.seekg(0);
+		block.clear();
+		ends.clear();
+		next = 0;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// position at the first block overlapping the interval; false if there
+	// is none (nothing left to read then)
+	////////////////////////////////////////////////////////////////
+	bool seekToBlockStart(int const chromo, int const start_coord, int const end_coord) {
+		rewind();
+		if (chromo == -1) return true;
+		auto tree = chromosome_trees.find(chromo);
+		if (tree == chromosome_trees.end() || tree->second.getFirstInterval().chromosome < 0) {
+			f_in.seekg(0, f_in.end);
+			return false;
+		}
+		int actual_start_coord = std::max(start_coord, tree->second.getFirstInterval().start);
+		vector<RawDataInterval> overlapping;
+		tree->second.findOverlapping(actual_start_coord, end_coord, overlapping);
+		if (overlapping.size() == 0) {
+			f_in.seekg(0, f_in.end);
+			return false;
+		}
+		// the tree does not hand them out in file order
+		size_t offset = overlapping.front().byte_offset;
+		for (auto & b : overlapping) offset = std::min(offset, b.byte_offset);
+		f_in.seekg(offset);
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////
+	bool hasMoreCores() {
+		return next < (int)ends.size() || loadBlock();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// append the next core to out
+	////////////////////////////////////////////////////////////////
+	bool appendNextCore(string & out) {
+		if ( !hasMoreCores() ) return false;
+		uint32_t start = (next > 0) ? ends[next - 1] : 0;
+		uint32_t end = ends[next++];
+		out.append(block, start, end - start);
+		return true;
+	}
+};
+
+#endif
@@ -4,16 +4,238 @@
 
 #include <memory>
 #include <numeric>
+#include <deque>
+#include <lzip.h>
 #include "decompress/InputBuffer.hpp"
+#include "decompress/QualityCoreReader.hpp"
 
 #define END_OF_STREAM -2
 
-class QualityStream : public InputStream {
+////////////////////////////////////////////////////////////////
+// append the next line (core, prefix, suffix or a whole vector from the
+// generic pile) to out; false if the stream is depleted
+////////////////////////////////////////////////////////////////
+bool appendLine(shared_ptr<InputBuffer> buf, string & out) {
+	if ( !buf->hasMoreBytes() ) return false;
+	char c = buf->getNextByte();
+	while (c != '\n') {
+		out.push_back(c);
+		if (!buf->hasMoreBytes()) break;
+		c = buf->getNextByte();
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// decoded quality vectors of one cluster, back to back
+////////////////////////////////////////////////////////////////
+struct QualityChunk {
+	string data;
+	vector<uint32_t> ends;
+};
+
+////////////////////////////////////////////////////////////////
+//
+// Decodes the streams of one cluster (or of the generic pile) on its own
+// thread, a few chunks ahead of the reader
+//
+////////////////////////////////////////////////////////////////
+class ClusterDecoder {
+
+	shared_ptr<QualityCoreReader<QualityModel>> cores;
+
+	shared_ptr<InputBuffer> prefixes;
+
+	shared_ptr<InputBuffer> suffixes;
+
+	shared_ptr<InputBuffer> pile;
+
+	int chunk_size = 4096;	// vectors per chunk
+
+	int max_ready = 4;	// chunks decoded ahead
+
+	pthread_t thread;
+
+	bool running = false;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;	// chunk decoded, chunk consumed or stop requested
+
+	deque<QualityChunk *> ready;
+
+	bool done = false;	// decoder thread reached the end of the streams
+
+	bool stop = false;	// reader is going away
+
+	// chunk being read from
+	QualityChunk * current = nullptr;
+
+	int next = 0;
+
+	///////////////////////////////////////////////////////////
+	// decode up to chunk_size vectors into c
+	///////////////////////////////////////////////////////////
+	void fill(QualityChunk & c) {
+		c.data.clear();
+		c.ends.clear();
+		for (int i = 0; i < chunk_size; i++) {
+			if (pile != nullptr) {
+				if ( !appendLine(pile, c.data) ) break;
+			}
+			else {
+				if (cores == nullptr || !cores->hasMoreCores() ) break;
+				appendLine(prefixes, c.data);
+				cores->appendNextCore(c.data);
+				appendLine(suffixes, c.data);
+			}
+			c.ends.push_back(c.data.size() );
+		}
+	}
+
+	///////////////////////////////////////////////////////////
+	static void * run(void * arg) {
+		ClusterDecoder & cd = *(ClusterDecoder *)arg;
+		while (true) {
+			xlock(&cd.mutex);
+			while ((int)cd.ready.size() >= cd.max_ready && !cd.stop)
+				xwait(&cd.changed, &cd.mutex);
+			bool stop = cd.stop;
+			xunlock(&cd.mutex);
+			if (stop) break;
+
+			QualityChunk * c = new QualityChunk();
+			{
+				PROFILE_SCOPE("decode.quals");
+				cd.fill(*c);
+				PROFILE_COUNT("decode.quals", c->ends.size() );
+			}
+			bool last = c->ends.empty();
+
+			xlock(&cd.mutex);
+			if (last) {
+				delete c;
+				cd.done = true;
+			}
+			else
+				cd.ready.push_back(c);
+			xsignal(&cd.changed);
+			xunlock(&cd.mutex);
+			if (last) break;
+		}
+		return 0;
+	}
+
+	///////////////////////////////////////////////////////////
+	// make sure current has a vector to hand out
+	///////////////////////////////////////////////////////////
+	bool advance() {
+		if (current != nullptr && next < (int)current->ends.size() ) return true;
+		delete current;
+		current = nullptr;
+		xlock(&mutex);
+		while (ready.empty() && !done)
+			xwait(&changed, &mutex);
+		if (!ready.empty() ) {
+			current = ready.front();
+			ready.pop_front();
+			xsignal(&changed);
+		}
+		xunlock(&mutex);
+		next = 0;
+		return current != nullptr;
+	}
+
+	void init() {
+		xinit(&mutex);
+		xinit(&changed);
+	}
+
+public:
+	ClusterDecoder(shared_ptr<QualityCoreReader<QualityModel>> c, shared_ptr<InputBuffer> p, shared_ptr<InputBuffer> s):
+		cores(c),
+		prefixes(p),
+		suffixes(s) {
+		init();
+	}
+
+	ClusterDecoder(shared_ptr<InputBuffer> p): pile(p) {
+		init();
+	}
+
+	~ClusterDecoder() {
+		if (running) {
+			xlock(&mutex);
+			stop = true;
+			xsignal(&changed);
+			xunlock(&mutex);
+			pthread_join(thread, 0);
+		}
+		for (auto c : ready) delete c;
+		delete current;
+		xdestroy(&changed);
+		xdestroy(&mutex);
+	}
+
+	///////////////////////////////////////////////////////////
+	// streams must be positioned before the thread is started
+	///////////////////////////////////////////////////////////
+	void start() {
+		if (running) return;
+		int errcode = pthread_create(&thread, 0, run, this);
+		if (errcode) {
+			cerr << "[ERROR] Can't create quality decoding threads" << endl;
+			exit(1);
+		}
+		running = true;
+	}
+
+	///////////////////////////////////////////////////////////
+	// append the next vector to out, reversed if requested
+	///////////////////////////////////////////////////////////
+	bool appendNext(string & out, bool reverse) {
+		if ( !advance() ) return false;
+		uint32_t start = (next > 0) ? current->ends[next - 1] : 0;
+		uint32_t end = current->ends[next++];
+		if (reverse)
+			out.append(current->data.rbegin() + (current->data.size() - end),
+				current->data.rbegin() + (current->data.size() - start) );
+		else
+			out.append(current->data, start, end - start);
+		return true;
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// common interface of the clustered (lossless) and the binned quality streams
+////////////////////////////////////////////////////////////////
+class QualitySource : public InputStream {
+public:
+	QualitySource(shared_ptr<InputBuffer> in) : InputStream(in) {}
+
+	virtual ~QualitySource() {}
+
+	// append the next quality vector to out; reverse undoes the flip
+	// the compressor applied
+	virtual void appendNextQualVector(string & out, bool reverse) = 0;
+
+	string getNextQualVector() {
+		string q_v;
+		appendNextQualVector(q_v, false);
+		return q_v;
+	}
+};
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class QualityStream : public QualitySource {
 
 	////////////////////////////////////////////////////////
 	vector<int> seen_so_far;
 
-	vector<shared_ptr<InputBuffer>> cores;
+	vector<shared_ptr<QualityCoreReader<QualityModel>>> cores;
 
 	vector<shared_ptr<InputBuffer>> prefixes;
 
@@ -21,22 +243,8 @@ class QualityStream : public InputStream {
 
 	shared_ptr<InputBuffer> other_qvs;
 
-	// attempts to retrive the next line from the quality stream (core, prefix or suffix)
-	string getLine(shared_ptr<InputBuffer> buf) {
-		if ( !buf->hasMoreBytes() ) {
-			cerr << "[ERROR] Requesting more data from quality stream, but stream is depleted." << endl;
-			// exit(1);
-			return "*";
-		}
-		string chunk;
-		char c = buf->getNextByte();
-		while (c != '\n') {
-			chunk.push_back(c);
-			if (!buf->hasMoreBytes()) break;
-			c = buf->getNextByte();
-		}
-		return chunk;
-	}
+	// the generic pile first, then one per cluster
+	vector<shared_ptr<ClusterDecoder>> decoders;
 
 	int getNextMember() {
 		if ( !data_in->hasMoreBytes() ) {
@@ -47,123 +255,87 @@ class QualityStream : public InputStream {
 			exit(1);
 			return -1;
 		}
-		string chunk;
+		int value = 0;
 		char c = data_in->getNextByte();
-		// chunk.push_back(c);
 		while (c != ' ') {
-			chunk.push_back(c);
+			value = value * 10 + (c - '0');
 			if (!data_in->hasMoreBytes()) break;
 			c = data_in->getNextByte();
 		}
-		int value = stoi(chunk);
 		return value;
 	}
 
-	/*
-	Explode the compact string format to recover the original core
-
-	Compacting code in compress/QualityCluster::writeCore(string const & core, GenomicCoordinate & currentCoord)
-
-	# python pseudocode
-	# for i in xrange(n):
-	# 	symbol = line[i]
-	# 	if symbol.isdigit():
-	# 		# remap to a 130 range
-	# 		symbol =  chr(130 + int(symbol) )
-	# 	if symbol != 'J':
-	# 		delta = i - prev_pos - 1
-	# 		if delta > 0:
-	# 			edit_str += str(delta)
-	# 		edit_str += symbol
-	# 		prev_pos = i
-	*/
-	string explodeString(const string & q_v) {
-		// cerr << "explode string: " << q_v << endl;
-		string core;
-		bool had_low_quals = (q_v.find('!') != string::npos);
-		if (had_low_quals) {
-			// was not transformed
-			return q_v;
-		}
-		else {
-			// string was transformed
-			for (int i = 0; i < q_v.size(); i++) {
-				if ( (uint8_t)q_v[i] > 130) {
-					// was a digit
-					uint8_t d = q_v[i] - (uint8_t)130;
-					// cerr << (char)d << " ";
-					core.push_back(d);
-				}
-				else {
-					string digits;
-					while (isdigit(q_v[i]) ) {
-						// cerr << q_v[i] << " ";
-						digits.push_back(q_v[i]);
-						i++;
-					}
-					int reps = 1;
-					if (digits.size() > 0) {
-						// cerr << "digits: " << digits << " ";
-						reps = stoi(digits);
-					}
-					uint8_t symbol = q_v[i];
-					// cerr << symbol << " ";
-					for (int j = 0; j < reps; j++) {
-						core.push_back(symbol);
-					}
-				}
-			}
-			// cerr << endl;
-		}
-		// cerr << "recovered: " << core << endl;
-		return core;
+	///////////////////////////////////////////////////////////
+	// spin up a decoding thread per cluster once the streams are positioned
+	///////////////////////////////////////////////////////////
+	void startDecoders() {
+		decoders.push_back(shared_ptr<ClusterDecoder>(new ClusterDecoder(other_qvs) ) );
+		for (size_t i = 0; i < cores.size(); i++)
+			decoders.push_back(shared_ptr<ClusterDecoder>(
+				new ClusterDecoder(cores[i], prefixes[i], suffixes[i]) ) );
+		for (auto & d : decoders) d->start();
 	}
 
 public:
 
 	// add buffers for clusters
-	QualityStream(shared_ptr<InputBuffer> memb, const string & path, 
+	QualityStream(shared_ptr<InputBuffer> memb, const string & path,
 		const unordered_map<string,shared_ptr<vector<TrueGenomicInterval>>> & all_intervals,
-		const int buffer_size) : 
-		InputStream(memb) {
+		const int buffer_size) :
+		QualitySource(memb) {
 			// cerr << "settting up quals stream" << endl;
 		auto i = path.find(".membership");
 		auto prefix = path.substr(0, i);
 		// cerr << prefix << endl;
-		bool exists = true;
-		i = 1;
-		while (exists) {
-			string core_suf = ".quals." + to_string(i) + ".lz";
+		// clusters installed late may have received no vectors and left no blocks
+		int num_clusters = 0;
+		for (auto & p : all_intervals) {
+			auto & key = p.first;
+			if (key.compare(0, 7, ".quals.") != 0 || key.size() < 11 ||
+				key.compare(key.size() - 3, 3, ".ac") != 0) continue;
+			string id = key.substr(7, key.size() - 10);
+			if (id.find_first_not_of("0123456789") != string::npos) continue;
+			num_clusters = std::max(num_clusters, stoi(id) );
+		}
+		for (int i = 1; i <= num_clusters; i++) {
+			string core_suf = ".quals." + to_string(i) + ".ac";
 			string prefix_suf = ".quals." + to_string(i) + ".prefix.lz";
 			string suffix_suf = ".quals." + to_string(i) + ".suffix.lz";
-			
-			if ( all_intervals.find(core_suf) == all_intervals.end() ) break;
 
-			shared_ptr<InputBuffer> cluster_core(new InputBuffer(prefix + core_suf,
-				all_intervals.find(core_suf)->second, buffer_size, 0) );
-			// check that it opened
-			// else exists = false;
+			if ( all_intervals.find(core_suf) == all_intervals.end() ) {
+				cores.push_back(nullptr);
+				prefixes.push_back(nullptr);
+				suffixes.push_back(nullptr);
+				continue;
+			}
+
+			shared_ptr<QualityCoreReader<QualityModel>> cluster_core(new QualityCoreReader<QualityModel>(prefix + core_suf,
+				all_intervals.find(core_suf)->second) );
 			cores.push_back(cluster_core);
-			shared_ptr<InputBuffer> cluster_prefixes(new InputBuffer(prefix + prefix_suf, 
+			shared_ptr<InputBuffer> cluster_prefixes(new InputBuffer(prefix + prefix_suf,
 				all_intervals.find(prefix_suf)->second, buffer_size, 0) );
 			prefixes.push_back(cluster_prefixes);
 			shared_ptr<InputBuffer> cluster_suffixes(new InputBuffer(prefix + suffix_suf,
 				all_intervals.find(suffix_suf)->second, buffer_size, 0) );
 			suffixes.push_back(cluster_suffixes);
-			i++;
 		}
 		seen_so_far.resize(cores.size() + 1, 0);
 
 		string other_suf = ".quals.other.lz";
 		// cerr << "onto the general: " << (prefix + other_suf) << endl;
 		// cerr << (all_intervals.find(other_suf) != all_intervals.end() ) << endl;
-		other_qvs = shared_ptr<InputBuffer>(new InputBuffer(prefix + other_suf, 
-			all_intervals.find(other_suf)->second, buffer_size, 0) );
+		if (all_intervals.find(other_suf) != all_intervals.end() )
+			other_qvs = shared_ptr<InputBuffer>(new InputBuffer(prefix + other_suf,
+				all_intervals.find(other_suf)->second, buffer_size, 0) );
 	}
 
 	// overloaded base function
-	pair<int, unsigned long> seekToBlockStart(int const ref_id, 
+	pair<int, unsigned long> seekToBlockStart(int const ref_id,
 		int const start_coord, int const end_coord) {
+		if (decoders.size() > 0) {
+			cerr << "[ERROR] Quality streams can not be repositioned once decoding started" << endl;
+			exit(1);
+		}
 		// seek to block start on the membership stream
 		bool t = false;
 		auto start = data_in->loadOverlappingBlock(ref_id, start_coord, end_coord, t);
@@ -172,32 +344,29 @@ public:
 			exit(1);
 		}
 		// now seek for all of our core, prefix, suffix streams
-		for (auto &str : cores) str->loadOverlappingBlock(ref_id,start_coord,end_coord, t);
-		for (auto &str : prefixes) str->loadOverlappingBlock(ref_id,start_coord,end_coord, t);
-		for (auto &str : suffixes) str->loadOverlappingBlock(ref_id,start_coord,end_coord, t);
+		for (auto &str : cores) if (str != nullptr) str->seekToBlockStart(ref_id, start_coord, end_coord);
+		for (auto &str : prefixes) if (str != nullptr) str->loadOverlappingBlock(ref_id,start_coord,end_coord, t);
+		for (auto &str : suffixes) if (str != nullptr) str->loadOverlappingBlock(ref_id,start_coord,end_coord, t);
 
-		other_qvs->loadOverlappingBlock(ref_id, start_coord, end_coord, t);
+		if (other_qvs != nullptr) other_qvs->loadOverlappingBlock(ref_id, start_coord, end_coord, t);
 		return start;
 	}
 
 	////////////////////////////////////////////////////////
-	string getNextQualVector() {
+	void appendNextQualVector(string & out, bool reverse) {
+		if (decoders.size() == 0) startDecoders();
 		// read from the membership vector
 		int i = getNextMember();
-		string q_v = "*";
-		if (i == GENERIC_PILE_ID) {// the general pile
-			seen_so_far[0]++;
-			q_v = getLine(other_qvs);
+		if (i < 0 || i >= (int)decoders.size() ) {
+			cerr << "[ERROR] Unknown quality cluster id: " << i << endl;
+			exit(1);
 		}
-		else {
-			seen_so_far[i]++;
-			auto core = getLine(cores[i-1]);
-			auto pref = getLine(prefixes[i-1]);
-			auto suf = 	getLine(suffixes[i-1]);
-			q_v = pref + explodeString(core) + suf;
+		seen_so_far[i]++;
+		if ( !decoders[i]->appendNext(out, reverse) ) {
+			cerr << "[ERROR] Requesting more data from quality stream, but stream is depleted." << endl;
+			out.push_back('*');
 		}
-		return q_v;
 	}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,40 +4,126 @@
 
 #include <memory>
 #include "decompress/InputStream.hpp"
+#include "ReadNameCodec.hpp"
 
 
+////////////////////////////////////////////////////////////////
+// tokenized read names: data_in is the control stream, one column per token
+// position (nullptr if the position never carried data)
+////////////////////////////////////////////////////////////////
 class ReadIDStream : public InputStream {
 
+	vector<shared_ptr<InputBuffer>> columns;
+
+	// tokens of the previous name
+	vector<string> prev_tokens;
+
+	vector<bool> prev_numeric;
+
+	vector<uint32_t> prev_values;
+
+	uint8_t nextColumnByte(int i) {
+		if (columns[i] == nullptr || !columns[i]->hasMoreBytes() ) {
+			cerr << "[ERROR] Read name column " << i << " is truncated" << endl;
+			exit(1);
+		}
+		return columns[i]->getNextByte();
+	}
+
+	uint32_t readVarint(int i) {
+		uint32_t v = 0;
+		int shift = 0;
+		uint8_t b;
+		do {
+			b = nextColumnByte(i);
+			v |= (uint32_t)(b & 0x7F) << shift;
+			shift += 7;
+		} while (b & 0x80);
+		return v;
+	}
+
 public:
 
-	ReadIDStream(shared_ptr<InputBuffer> buf) : InputStream(buf) {}
+	ReadIDStream(shared_ptr<InputBuffer> buf, vector<shared_ptr<InputBuffer>> const & cols) :
+		InputStream(buf),
+		columns(cols),
+		prev_tokens(NAME_MAX_TOKENS),
+		prev_numeric(NAME_MAX_TOKENS, false),
+		prev_values(NAME_MAX_TOKENS, 0) {
+		columns.resize(NAME_MAX_TOKENS);
+	}
+
+	pair<int, unsigned long> seekToBlockStart(int const ref_id, int const start_coord, int const end_coord) {
+		auto start = InputStream::seekToBlockStart(ref_id, start_coord, end_coord);
+		for (auto & c : columns) {
+			if (c == nullptr) continue;
+			bool t = false;
+			c->loadOverlappingBlock(ref_id, start_coord, end_coord, t);
+		}
+		for (int i = 0; i < NAME_MAX_TOKENS; i++) {
+			prev_tokens[i].clear();
+			prev_numeric[i] = false;
+			prev_values[i] = 0;
+		}
+		return start;
+	}
 
 	string getNextID(int & status) {
 		// exhausted the input stream
-		// cerr << "IDs: " << data_in << endl;
 		if ( !data_in->hasMoreBytes() ) {
 			status = END_OF_STREAM;
 			return "";
 		}
 
-		string chunk = "";
-		char c = data_in->getNextByte();
-		
-		while (c != '\n' && data_in->hasMoreBytes()) {
-			// cerr << c;
-			chunk.push_back(c);
-			c = data_in->getNextByte();
+		string name;
+		int i = 0;
+		uint8_t op = data_in->getNextByte();
+		while (op != NAME_TOK_END) {
+			if (i >= NAME_MAX_TOKENS) {
+				cerr << "[ERROR] Too many tokens in a read name" << endl;
+				exit(1);
+			}
+			switch (op) {
+				case NAME_TOK_MATCH:
+					break;
+				case NAME_TOK_STRING: {
+					prev_tokens[i].clear();
+					uint8_t c = nextColumnByte(i);
+					while (c != 0) {
+						prev_tokens[i].push_back(c);
+						c = nextColumnByte(i);
+					}
+					prev_numeric[i] = false;
+					break;
+				}
+				case NAME_TOK_NUMBER:
+					prev_values[i] = readVarint(i);
+					prev_tokens[i] = to_string(prev_values[i]);
+					prev_numeric[i] = true;
+					break;
+				case NAME_TOK_DELTA:
+					prev_values[i] += nextColumnByte(i);
+					prev_tokens[i] = to_string(prev_values[i]);
+					prev_numeric[i] = true;
+					break;
+				default:
+					cerr << "[ERROR] Unknown read name token type: " << (int)op << endl;
+					exit(1);
+			}
+			name += prev_tokens[i];
+			i++;
+			if (!data_in->hasMoreBytes() ) break;
+			op = data_in->getNextByte();
 		}
-		// cerr << "cha" << endl;
-		if (chunk.size() == 0 || c == 0) {
+		if (name.size() == 0) {
 			status = END_OF_STREAM;
 			return "";
 		}
 		status = SUCCESS;
-		return chunk;
+		return name;
 	}
 
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,50 @@
+#ifndef READ_LEN_STREAM_HPP
+#define READ_LEN_STREAM_HPP
+
+#include <memory>
+
+#include "decompress/InputStream.hpp"
+
+////////////////////////////////////////////////////////////////
+// per-alignment read lengths: 0 for the same length as the previous
+// alignment, length + 1 otherwise; blocks end after a whole record and
+// start w/ a length (see writeReadLen)
+////////////////////////////////////////////////////////////////
+class ReadLenStream : public InputStream {
+
+	int read_len;
+
+	// alignments read so far
+	unsigned long num_al = 0;
+
+public:
+
+	ReadLenStream(shared_ptr<InputBuffer> buf, int default_len):
+		InputStream(buf),
+		read_len(default_len) {}
+
+	int next() {
+		if ( !data_in->hasMoreBytes() ) return read_len;
+		uint64_t v = data_in->getNextVarint();
+		if (v > 0) read_len = v - 1;
+		num_al++;
+		return read_len;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// position the stream at the given alignment number
+	////////////////////////////////////////////////////////////////
+	void seekToAlignment(int const ref_id, int const start_coord, int const end_coord,
+		unsigned long const at_num_alignments) {
+		bool t = false;
+		auto start = data_in->loadOverlappingBlock(ref_id, start_coord, end_coord, t, at_num_alignments);
+		if (start.first < 0) {
+			cerr << "[ERROR] Could not navigate to the begining of the interval" << endl;
+			exit(1);
+		}
+		num_al = start.second;
+		while (num_al < at_num_alignments) next();
+	}
+};
+
+#endif
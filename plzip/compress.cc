@@ -32,6 +32,7 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <lzlib.h>
 
 #include "compress.h"
@@ -253,6 +254,12 @@ extern "C" void * cworker( void * arg )
     }
 
     // std::cerr << "got a packet!" << std::endl;
+    if( packet->raw ) {   // pass through to the muxer, keeping its place in line
+      courier.collect_packet( packet );
+      continue;
+      }
+    PROFILE_SCOPE( "worker.compress" );
+    PROFILE_COUNT( "worker.compress", packet->size );
 
     const int max_compr_size = 42 + packet->size + ( ( packet->size + 7 ) / 8 );
     uint8_t * const new_data = new( std::nothrow ) uint8_t[max_compr_size];
@@ -328,10 +335,179 @@ extern "C" void * cworker( void * arg )
 }
 
 
-// get the processed and sorted packets from courier, write
-// their contents to the output file.
-void muxer( Packet_courier & courier /*, const Pretty_print & pp*/) {
+// Returns the number of bytes really written.
+// If (returned value < total size of iov), it is always an error.
+//
+long long writevblock( const int fd, struct iovec * iov, int count )
+  {
+  long long done = 0;
+  errno = 0;
+  while( count > 0 )
+    {
+    const ssize_t n = writev( fd, iov, count );
+    if( n < 0 )
+      {
+      if( errno != EINTR && errno != EAGAIN ) break;
+      errno = 0; continue;
+      }
+    done += n;
+    size_t rest = n;
+    while( count > 0 && rest >= iov->iov_len )  // skip what was written
+      { rest -= iov->iov_len; ++iov; --count; }
+    if( count > 0 )
+      { iov->iov_base = (uint8_t *)iov->iov_base + rest; iov->iov_len -= rest; }
+    }
+  return done;
+  }
+
+
+// Write-behind for the muxer. Packets are handed to a few writer
+// threads; each fd belongs to one writer, so writes to a file stay in
+// order. A writer takes all the packets queued for one fd and writes
+// them w/ a single writev. The muxer waits once write_window bytes are
+// queued and not yet written.
+class Write_behind
+  {
+  enum { num_writers = 4, max_run = 64 };
+
+  struct Writer
+    {
+    Write_behind * owner;
+    std::vector< const Packet * > queue;
+    pthread_cond_t work_av;   // packets queued or no more coming
+    pthread_t thread;
+    };
+
+  Packet_courier & courier;
+  pthread_mutex_t mutex;
+  pthread_cond_t space_av;    // bytes were written
+  std::vector< Writer > writers;
+  long long in_flight;        // bytes queued, not yet written
+  const long long window;
+  bool eof;
+
+  Write_behind( const Write_behind & );   // declared as private
+  void operator=( const Write_behind & ); // declared as private
+
+  static void * run( void * arg )
+    {
+    Writer & w = *(Writer *)arg;
+    w.owner->write_loop( w );
+    return 0;
+    }
+
+  void write_loop( Writer & w )
+    {
+    std::vector< const Packet * > run;
+    struct iovec iov[max_run];
+    while( true )
+      {
+      xlock( &mutex );
+      while( w.queue.empty() && !eof ) xwait( &w.work_av, &mutex );
+      if( w.queue.empty() ) { xunlock( &mutex ); break; }
+      // every packet queued for the fd at the front, in order
+      run.clear();
+      const int fd = w.queue.front()->outfd;
+      unsigned j = 0;
+      for( unsigned i = 0; i < w.queue.size(); ++i )
+        {
+        if( w.queue[i]->outfd == fd && (int)run.size() < max_run )
+          run.push_back( w.queue[i] );
+        else w.queue[j++] = w.queue[i];
+        }
+      w.queue.resize( j );
+      xunlock( &mutex );
+
+      long long bytes = 0;
+      for( unsigned i = 0; i < run.size(); ++i )
+        {
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = run[i]->size;
+        bytes += run[i]->size;
+        }
+      {
+      PROFILE_SCOPE( "muxer.write" );
+      PROFILE_COUNT( "muxer.write", bytes );
+      if( writevblock( fd, iov, run.size() ) != bytes )
+        { show_error( "Write error", errno ); cleanup_and_fail(); }
+      }
+      for( unsigned i = 0; i < run.size(); ++i )
+        {
+        courier.packet_written( run[i]->source );
+        delete[] run[i]->data; delete run[i];
+        }
+
+      xlock( &mutex );
+      in_flight -= bytes;
+      xsignal( &space_av );
+      xunlock( &mutex );
+      }
+    }
+
+public:
+  Write_behind( Packet_courier & c, const long long w )
+    : courier( c ), writers( num_writers ), in_flight( 0 ), window( w ), eof( false )
+    {
+    xinit( &mutex ); xinit( &space_av );
+    for( unsigned i = 0; i < writers.size(); ++i )
+      {
+      writers[i].owner = this;
+      xinit( &writers[i].work_av );
+      const int errcode =
+        pthread_create( &writers[i].thread, 0, run, &writers[i] );
+      if( errcode )
+        { show_error( "Can't create writer threads", errcode ); cleanup_and_fail(); }
+      }
+    }
+
+  ~Write_behind()
+    {
+    for( unsigned i = 0; i < writers.size(); ++i )
+      xdestroy( &writers[i].work_av );
+    xdestroy( &space_av ); xdestroy( &mutex );
+    }
+
+  // queue a packet; waits while the window is full. A packet larger
+  // than the window still goes out once everything else is written
+  void push( const Packet * const opacket )
+    {
+    xlock( &mutex );
+    {
+    PROFILE_SCOPE( "muxer.window_wait" );
+    while( in_flight > 0 && in_flight + opacket->size > window )
+      xwait( &space_av, &mutex );
+    }
+    in_flight += opacket->size;
+    Writer & w = writers[opacket->outfd % writers.size()];
+    w.queue.push_back( opacket );
+    xsignal( &w.work_av );
+    xunlock( &mutex );
+    }
+
+  // write out what is queued, then stop the writers
+  void finish()
+    {
+    xlock( &mutex );
+    eof = true;
+    for( unsigned i = 0; i < writers.size(); ++i )
+      xsignal( &writers[i].work_av );
+    xunlock( &mutex );
+    for( unsigned i = 0; i < writers.size(); ++i )
+      {
+      const int errcode = pthread_join( writers[i].thread, 0 );
+      if( errcode )
+        { show_error( "Can't join writer threads", errcode ); cleanup_and_fail(); }
+      }
+    }
+  };
+
+
+// get the processed and sorted packets from courier, hand them to
+// the writer threads
+void muxer( Packet_courier & courier /*, const Pretty_print & pp*/,
+            const long long write_window ) {
   std::vector< const Packet * > packet_vector;
+  Write_behind writer( courier, write_window );
   while ( true ) {
     // block call -- synchronises on a mutex
     courier.deliver_packets( packet_vector );
@@ -344,24 +520,19 @@ void muxer( Packet_courier & courier /*, const Pretty_print & pp*/) {
       const Packet * const opacket = packet_vector[i];
       out_size += opacket->size;
 
-      int outfd = opacket->outfd;
-
-      if( outfd >= 0 ) {
-        // std::cerr << "writing a compressed block (size=" << opacket->size << ") to fd=" << outfd << std::endl;
-        const int wr = writeblock( outfd, opacket->data, opacket->size );
-        if( wr != opacket->size )
-          { 
-            // std::cerr << "wr=" << wr << " packet_size=" << opacket->size << std::endl;
-          /*pp();*/ show_error( "Write error", errno ); cleanup_and_fail(); }
+      if( opacket->outfd >= 0 ) {
+        writer.push( opacket );
       }
       else {
         std::cerr << "ZZZ" << std::endl;
+        courier.packet_written( opacket->source );
+        delete[] opacket->data;
+        delete opacket;
       }
-      // std::cerr << "removing temp compressed data" << std::endl;
-      delete[] opacket->data;
-      delete opacket;
     }
   }
+  // all files are complete once the writers are done
+  writer.finish();
     // std::cerr << "muxer exited" << std::endl;
 }
 
@@ -2,18 +2,37 @@
 #define PLZIP_COMPRESS_LIB_H
 
 #include <queue>
+#include <map>
 
 #include "lzip.h"
+#include "../include/RefereeProfile.hpp"
 
 struct Packet     // data block with a serial number
   {
   unsigned id;      // serial number assigned as received
+  unsigned seq;     // serial number within the packet's output stream
   uint8_t * data;
   int size;     // number of bytes in data (if any)
   int outfd;    // output stream to which this packet belongs
+  int source;   // producer that sent it (see Packet_courier::source)
+  bool raw;     // already encoded; written out as is
   };
 
 
+struct Stream_queue     // finished packets of one output stream
+  {
+  unsigned receive_seq;   // seq assigned to the next packet received
+  unsigned deliver_seq;   // seq of the next packet to be delivered
+  std::map< unsigned, const Packet * > done;  // finished, waiting for their turn
+  Stream_queue() : receive_seq( 0 ), deliver_seq( 0 ) {}
+  };
+
+
+// Packets are delivered in order within each output stream only, so a
+// slow packet holds back its own stream but not the others. Several
+// producers (one per input file in a batch) can share the workers:
+// workers take packets from the producers in turn, and each producer
+// can wait until everything it sent is written before closing its files.
 class Packet_courier      // moves packets around
   {
 public:
@@ -23,10 +42,16 @@ public:
   unsigned owait_counter;
 private:
   unsigned receive_id;      // id assigned to next packet received
-  unsigned deliver_id;      // id of next packet to be delivered
   Slot_tally slot_tally;    // limits the number of input packets
-  std::queue< Packet * > packet_queue;
-  std::vector< const Packet * > circular_buffer;
+  std::map< int, std::queue< Packet * > > packet_queues;  // by source
+  int num_queued;     // packets in packet_queues
+  int last_source;    // source of the last packet distributed
+  int num_producers;    // producers that have not finished yet
+  std::map< int, int > num_unwritten;   // by source
+  pthread_cond_t written;   // a packet was written
+  std::map< int, Stream_queue > streams;  // by output fd
+  std::vector< int > ready_fds;   // streams whose next packet is done
+  int num_done;     // finished packets not yet delivered
   int num_working;      // number of workers still running
   const int num_slots;      // max packets in circulation
   pthread_mutex_t imutex;
@@ -42,31 +67,55 @@ public:
   Packet_courier( const int workers, const int slots )
     : icheck_counter( 0 ), iwait_counter( 0 ),
       ocheck_counter( 0 ), owait_counter( 0 ),
-      receive_id( 0 ), deliver_id( 0 ),
-      slot_tally( slots ), circular_buffer( slots, (Packet *) 0 ),
+      receive_id( 0 ),
+      slot_tally( slots ), num_queued( 0 ), last_source( 0 ),
+      num_producers( 1 ), num_done( 0 ),
       num_working( workers ), num_slots( slots ), eof( false )
     {
     xinit( &imutex ); xinit( &iav_or_eof );
-    xinit( &omutex ); xinit( &oav_or_exit );
+    xinit( &omutex ); xinit( &oav_or_exit ); xinit( &written );
     }
 
   ~Packet_courier()
     {
+    xdestroy( &written );
     xdestroy( &oav_or_exit ); xdestroy( &omutex );
     xdestroy( &iav_or_eof ); xdestroy( &imutex );
     }
 
+  // producer id of the calling thread, 0 unless set
+  static int & source()
+    {
+    static __thread int s = 0;
+    return s;
+    }
+
+  // number of producers that will call finish(); set before they start
+  void set_producers( const int n ) { num_producers = n; }
+
   // make a packet with data received from splitter
-  void receive_packet( uint8_t * const data, const int size, const int outfd )
+  void receive_packet( uint8_t * const data, const int size, const int outfd,
+                       const bool raw = false )
     {
     Packet * const ipacket = new Packet;
     ipacket->id = receive_id++; // ensures packets are process in order of their arrival
     ipacket->data = data;
     ipacket->size = size;
     ipacket->outfd = outfd;
+    ipacket->raw = raw;
+    ipacket->source = source();
+    PROFILE_COUNT( "courier.bytes_in", size );
+    {
+    PROFILE_SCOPE( "courier.slot_wait" );
     slot_tally.get_slot();    // wait for a free slot
+    }
+    xlock( &omutex );
+    ipacket->seq = streams[outfd].receive_seq++;
+    ++num_unwritten[ipacket->source];
+    xunlock( &omutex );
     xlock( &imutex );
-    packet_queue.push( ipacket );
+    packet_queues[ipacket->source].push( ipacket );
+    ++num_queued;
     xsignal( &iav_or_eof );
     xunlock( &imutex );
     }
@@ -75,17 +124,30 @@ public:
   Packet * distribute_packet()
     {
     Packet * ipacket = 0;
+    {
+    PROFILE_SCOPE( "courier.worker_wait" );
     xlock( &imutex );
     ++icheck_counter;
-    while( packet_queue.empty() && !eof )
+    while( num_queued == 0 && !eof )
       {
       ++iwait_counter;
       xwait( &iav_or_eof, &imutex );
       }
-    if( !packet_queue.empty() )
+    }
+    if( num_queued > 0 )    // next source after the last one, in turn
       {
-      ipacket = packet_queue.front();
-      packet_queue.pop();
+      std::map< int, std::queue< Packet * > >::iterator it =
+        packet_queues.upper_bound( last_source );
+      while( true )
+        {
+        if( it == packet_queues.end() ) it = packet_queues.begin();
+        if( !it->second.empty() ) break;
+        ++it;
+        }
+      ipacket = it->second.front();
+      it->second.pop();
+      --num_queued;
+      last_source = it->first;
       }
     xunlock( &imutex );
     if( !ipacket )
@@ -101,48 +163,75 @@ public:
   // collect a packet from a worker (contains compress bytes)
   void collect_packet( const Packet * const opacket )
     {
-    const int i = opacket->id%num_slots;
     xlock( &omutex );
-    // id collision shouldn't happen
-    if( circular_buffer[i] != 0 )
-      internal_error( "id collision in collect_packet" );
-    // merge packet into circular buffer
-    circular_buffer[i] = opacket;
-    if( opacket->id == deliver_id ) xsignal( &oav_or_exit );
+    Stream_queue & stream = streams[opacket->outfd];
+    // seq collision shouldn't happen
+    if( !stream.done.insert( std::make_pair( opacket->seq, opacket ) ).second )
+      internal_error( "seq collision in collect_packet" );
+    ++num_done;
+    if( opacket->seq == stream.deliver_seq )
+      {
+      ready_fds.push_back( opacket->outfd );
+      xsignal( &oav_or_exit );
+      }
     xunlock( &omutex );
     }
 
-  // deliver packets to muxer. 
-  // sorts?
+  // deliver packets to muxer: every run of consecutive packets that is
+  // ready, in order within each stream
   void deliver_packets( std::vector< const Packet * > & packet_vector )
     {
+    {
+    PROFILE_SCOPE( "courier.muxer_wait" );
     xlock( &omutex );
     ++ocheck_counter;
-    int i = deliver_id % num_slots;
-    while( circular_buffer[i] == 0 && num_working > 0 )
+    while( ready_fds.empty() && num_working > 0 )
       {
       ++owait_counter;
       xwait( &oav_or_exit, &omutex );
       }
+    }
     packet_vector.clear();
-    while( true )
+    for( unsigned j = 0; j < ready_fds.size(); ++j )
       {
-      const Packet * const opacket = circular_buffer[i];
-      if( !opacket ) break;
-      packet_vector.push_back( opacket );
-      circular_buffer[i] = 0;
-      ++deliver_id;
-      i = deliver_id % num_slots;
+      Stream_queue & stream = streams[ready_fds[j]];
+      while( !stream.done.empty() &&
+             stream.done.begin()->first == stream.deliver_seq )
+        {
+        packet_vector.push_back( stream.done.begin()->second );
+        stream.done.erase( stream.done.begin() );
+        ++stream.deliver_seq;
+        --num_done;
+        }
       }
+    ready_fds.clear();
     xunlock( &omutex );
     if( packet_vector.size() )    // return slots to the tally
       slot_tally.leave_slots( packet_vector.size() );
     }
 
+  // the muxer wrote a packet of the source out
+  void packet_written( const int source )
+    {
+    xlock( &omutex );
+    --num_unwritten[source];
+    xbroadcast( &written );
+    xunlock( &omutex );
+    }
+
+  // wait until everything the calling thread's source sent is written
+  void wait_written()
+    {
+    xlock( &omutex );
+    while( num_unwritten[source()] > 0 ) xwait( &written, &omutex );
+    xunlock( &omutex );
+    }
+
   void finish()     // splitter has no more packets to send
     {
-    std::cerr << "Courier finished." << std::endl;
     xlock( &imutex );
+    if( --num_producers > 0 ) { xunlock( &imutex ); return; }
+    std::cerr << "Courier finished." << std::endl;
     eof = true;
     xbroadcast( &iav_or_eof );
     xunlock( &imutex );
@@ -150,11 +239,9 @@ public:
 
   bool finished()   // all packets delivered to muxer
     {
-    if( !slot_tally.all_free() || !eof || !packet_queue.empty() ||
+    if( !slot_tally.all_free() || !eof || num_queued != 0 ||
         num_working != 0 ) return false;
-    for( int i = 0; i < num_slots; ++i )
-      if( circular_buffer[i] != 0 ) return false;
-    return true;
+    return num_done == 0;
     }
   };
 
@@ -170,7 +257,11 @@ struct Worker_arg
 
 extern "C" void * cworker( void * arg );
 
-void muxer( Packet_courier & courier/*, const Pretty_print & pp*/);
+// bytes handed to the writer threads but not yet written
+const long long default_write_window = 1LL << 26;
+
+void muxer( Packet_courier & courier/*, const Pretty_print & pp*/,
+            const long long write_window = default_write_window );
 
 struct Splitter_arg
   {
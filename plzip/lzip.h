@@ -274,15 +274,17 @@ public:
   void leave_slot()				// return a slot to the tally
     {
     xlock( &mutex );
-    if( ++num_free == 1 ) xsignal( &slot_av );	// num_free was 0
+    if( ++num_free == 1 ) xbroadcast( &slot_av );	// num_free was 0
+				// broadcast: several producers may be waiting
     xunlock( &mutex );
     }
 
   void leave_slots( const int slots )		// return slots to the tally
     {
     xlock( &mutex );
+    const bool was_empty = ( num_free <= 0 );
     num_free += slots;
-    if( num_free == slots ) xsignal( &slot_av );	// num_free was 0
+    if( was_empty ) xbroadcast( &slot_av );
     xunlock( &mutex );
     }
   };
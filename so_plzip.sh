@@ -9,6 +9,10 @@ cd $PLZIPDIR
 INCLUDE="-I /usr/local/include/ -I $PLZIPDIR -I$HOME/local/include/"
 LIBS="-L /usr/local/lib/ -L /usr/lib/ -L$HOME/local/lib -llz -lpthread"
 SRC="compress.cc dec_stream.cc dec_stdout.cc decompress.cc file_index.cc"
+# PROFILE=1 ./so_plzip.sh compiles in the courier/worker/muxer timers
+if [ -n "$PROFILE" ]; then
+	INCLUDE="$INCLUDE -DREFEREE_PROFILE"
+fi
 # echo "g++ -c -Wall -Werror -fPIC $INCLUDE $SRC $LIBS"
 # g++ -c -Wall -Werror -fPIC $INCLUDE $SRC $LIBS
 
@@ -3,6 +3,8 @@
 #include <string>
 #include <cstring>
 #include <cassert>
+#include <climits>
+#include <cstdlib>
 
 #include "RefereeCompress.hpp"
 #include "RefereeDecompress.hpp"
@@ -12,26 +14,51 @@ using namespace std;
 ////////////////////////////////////////////////////////////////
 struct Params {
     bool decompress = false; // true for decompress, false for compress
-    string input_file;  // path to the input file
+    bool train_quals = false; // cluster quality vectors and save the model
+    bool batch = false; // input_file is a manifest of files to compress
+    int jobs = 2;       // files compressed at a time in a batch
+    string input_file;  // path to the input file, "-" for stdin
+    string output_prefix; // compressed streams go to <output_prefix>.*; defaults to input_file
     int threads = 4;    // max number of threads to use
     bool seq_only = false;
     bool discard_secondary_alignments = false;
+    bool consensus_edits = false; // encode recurrent mismatches against a running consensus
     string ref_file;    // path to the reference sequence in *.fa format
     string location;
+    string profile_report; // path to the JSON dump of stage timings
+    QualityBinning binning; // lossless or one of the lossy quality modes
+    string qual_model;  // trained quality clusters: read when compressing, written by train-quals
+    size_t max_memory = 0; // compression memory budget in bytes, 0 for no limit
 };
 
 ////////////////////////////////////////////////////////////////
 void printUsage() {
     cerr << "Referee -- separable compression for sequence alignments" << endl;
     cerr << "To compress:" << endl << 
-        "\treferee [options] -r reference.fa alignments.sam" << endl;
+        "\treferee [options] -r reference.fa alignments.sam" << endl <<
+        "\tsamtools view -h ... | referee [options] -r reference.fa -o prefix -" << endl;
     cerr << "To decompress:" << endl << 
         "\treferee -d [options] -r reference.fa alignments.sam" << endl;
+    cerr << "To compress many files in one process:" << endl << 
+        "\treferee compress-batch [options] -r reference.fa manifest.tsv" << endl <<
+        "\t(one file per line: input<TAB>output prefix[<TAB>reference])" << endl;
+    cerr << "To train a quality model:" << endl << 
+        "\treferee train-quals [options] --qual-model model.txt alignments.sam" << endl;
     cerr << "Options:" << endl;
     cerr << "\t-t=N                 number of threads" << endl;
+    cerr << "\t-o prefix            name the compressed streams prefix.* (required w/ stdin)" << endl;
     cerr << "\t--seqOnly            encode sequencing data only" << endl;
     cerr << "\t--discardSecondary   discard secondary alignments" << endl;
-    cerr << "\tview chrK:L-M        retrieve data from interval [L,M) on chromosome K" << endl;
+    cerr << "\t--consensusEdits     encode recurrent mismatches as known variants" << endl;
+    cerr << "\t                     (sequential decompression only)" << endl;
+    cerr << "\tview chrK:L-M        retrieve data from interval [L,M) on chromosome K (w/o the" << endl;
+    cerr << "\t                     optional fields)" << endl;
+    cerr << "\t--qual-mode M        quality encoding: lossless (default), bin8 (Illumina 8-level)," << endl;
+    cerr << "\t                     or custom:lo-hi=q,... (Phred ranges and their representatives)" << endl;
+    cerr << "\t--qual-model F       use the quality clusters in F (written by train-quals)" << endl;
+    cerr << "\t--jobs N             files compressed at a time by compress-batch (default 2)" << endl;
+    cerr << "\t--max-memory S       keep compression buffers within S bytes (e.g. 2G, 512M)" << endl;
+    cerr << "\t--profile-report F   write stage timings to F as JSON (needs make PROFILE=1)" << endl;
     cerr << "\t-h, --help           this help" << endl;
 }
 
@@ -57,11 +84,79 @@ Params parseParameters(int argc, char * argv[]) {
         else if (strcmp(argv[i], "--discardSecondary") == 0) {
             p.discard_secondary_alignments = true;
         }
+        else if (strcmp(argv[i], "--consensusEdits") == 0) {
+            p.consensus_edits = true;
+        }
+        else if ( strcmp(argv[i], "-o") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a prefix for -o" << endl;
+                exit(1);
+            }
+            p.output_prefix = argv[i];
+        }
         else if ( strcmp(argv[i], "-r") == 0) {
             i++;
             // TODO: check that next arg exists
             p.ref_file = argv[i]; // path to the reference sequence
         }
+        else if (strcmp(argv[i], "--qual-mode") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a mode for --qual-mode" << endl;
+                exit(1);
+            }
+            if ( !parseQualityMode(argv[i], p.binning) ) exit(1);
+        }
+        else if (strcmp(argv[i], "--qual-model") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a file name for --qual-model" << endl;
+                exit(1);
+            }
+            p.qual_model = argv[i];
+        }
+        else if (strcmp(argv[i], "--max-memory") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a size for --max-memory" << endl;
+                exit(1);
+            }
+            p.max_memory = parseMemorySize(argv[i]);
+            if (p.max_memory == 0) {
+                cerr << "[ERROR] Can not parse the memory size: " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "compress-batch") == 0) {
+            p.batch = true;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a number for --jobs" << endl;
+                exit(1);
+            }
+            char * end = NULL;
+            long jobs = strtol(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0' || jobs < 1 || jobs > INT_MAX) {
+                cerr << "[ERROR] --jobs needs a positive number: " << argv[i] << endl;
+                printUsage();
+                exit(1);
+            }
+            p.jobs = jobs;
+        }
+        else if (strcmp(argv[i], "train-quals") == 0) {
+            p.train_quals = true;
+        }
+        else if (strcmp(argv[i], "--profile-report") == 0) {
+            i++;
+            if (i >= argc) {
+                cerr << "[ERROR] Missing a file name for --profile-report" << endl;
+                exit(1);
+            }
+            p.profile_report = argv[i];
+        }
         else if (strcmp(argv[i], "view") == 0) {
             i++;
             if (i >= argc) {
@@ -85,6 +180,14 @@ Params parseParameters(int argc, char * argv[]) {
         cerr << "[ERROR] Missing required argument: <input_file>" << endl;
         exit(1);
     }
+    if (p.input_file == "-" && p.output_prefix.size() == 0 && !p.decompress) {
+        cerr << "[ERROR] Compressing from stdin needs an output prefix: -o prefix" << endl;
+        exit(1);
+    }
+    if (p.train_quals && p.qual_model.size() == 0) {
+        cerr << "[ERROR] train-quals needs an output file: --qual-model F" << endl;
+        exit(1);
+    }
     return p;
 }
 
@@ -109,16 +212,34 @@ int main(int argc, char * argv []) {
     // if parameter not provided -- take up all free threads
         numParseThreads = std::min( (long)numParseThreads, std::min( num_online, max_workers ) );
 
-    if (!p.decompress) {
+    int status = 0;
+    if (p.batch) {
+        cerr << "Compressing the files in " << p.input_file << endl;
+        auto entries = readBatchManifest(p.input_file, p.ref_file);
+        int failed = compressBatch(entries, numParseThreads, p.jobs, p.seq_only, p.discard_secondary_alignments,
+            p.binning, p.qual_model, p.consensus_edits, p.max_memory);
+        if (failed > 0) status = 1;
+    }
+    else if (p.train_quals) {
+        cerr << "Training a quality model on " << p.input_file << endl;
+        trainQualityModel(p.input_file, p.qual_model, numParseThreads);
+    }
+    else if (!p.decompress) {
         ////////////////////////////////////////////////
         //
         // compress
         //
         ////////////////////////////////////////////////
-        cerr << "Compressing " << p.input_file << endl;
+        string prefix = p.output_prefix.size() > 0 ? p.output_prefix : p.input_file;
+        cerr << "Compressing " << (p.input_file == "-" ? "stdin" : p.input_file) << endl;
         cerr << "Reference genome: " << p.ref_file << endl;
-        compressFile(p.input_file, p.ref_file, numParseThreads, p.seq_only, p.discard_secondary_alignments);
-        cerr << endl << "Compressed streams written to " << p.input_file << ".*" << endl;
+        if (compressFile(p.input_file, prefix, p.ref_file, numParseThreads, p.seq_only, p.discard_secondary_alignments, p.binning,
+                p.qual_model, p.consensus_edits, p.max_memory) )
+            cerr << endl << "Compressed streams written to " << prefix << ".*" << endl;
+        else {
+            cerr << "[ERROR] Could not compress " << (p.input_file == "-" ? "stdin" : p.input_file) << endl;
+            status = 1;
+        }
     }
     else {
         ////////////////////////////////////////////////
@@ -126,9 +247,18 @@ int main(int argc, char * argv []) {
         // decompress
         //
         ////////////////////////////////////////////////
-        // trim input name. assuming <fname>.sam<.optional stuff>
-        auto first_occurrence = p.input_file.find(".sam");
-        p.input_file = p.input_file.substr(0, first_occurrence + 4);
+        // trim input name. assuming <fname>.sam<.optional stuff>; a prefix
+        // given w/ -o when compressing need not have .sam in it. Only the
+        // file name counts, and only a ".sam" that ends it or a suffix of it
+        auto name_start = p.input_file.find_last_of('/');
+        name_start = name_start == string::npos ? 0 : name_start + 1;
+        for (auto at = p.input_file.find(".sam", name_start); at != string::npos;
+            at = p.input_file.find(".sam", at + 1) ) {
+            if (at + 4 == p.input_file.size() || p.input_file[at + 4] == '.') {
+                p.input_file = p.input_file.substr(0, at + 4);
+                break;
+            }
+        }
 
         string fname_out = p.input_file + ".recovered";
         if (p.ref_file.size() == 0) {
@@ -146,5 +276,7 @@ int main(int argc, char * argv []) {
         decompressFileSequential(p.input_file, p.ref_file, fname_out, p.location);
         cerr << "Restored file written to " << fname_out << endl;
     }
-    return 0;
+    if (p.profile_report.size() > 0)
+        writeProfileReport(p.profile_report);
+    return status;
 }
@@ -1,16 +1,35 @@
 /* Some useful tools: depth of coverage, number of edits */
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 #include <cmath>
 #include <numeric>
 #include <cassert>
 #include <deque>
 
-#include "decompress/OffsetsStream.hpp"
-#include "decompress/EditsStream.hpp"
+#include "RefereeUtils.hpp"
+#include "TranscriptsStream.hpp"
+#include "RefereeDecompress.hpp"
 
 using namespace std;
 
+////////////////////////////////////////////////
+// stream w/ the given suffix of a compressed file, positioned at the start
+////////////////////////////////////////////////
+shared_ptr<InputBuffer> openStream(string const & fname, string const & suffix, int id) {
+	auto all_intervals = parseGenomicIntervals(intervalsFile(fname) );
+	auto it = all_intervals.find(suffix);
+	if (it == all_intervals.end() ) {
+		cerr << "[ERROR] No " << suffix << " stream for " << fname << endl;
+		exit(1);
+	}
+	return shared_ptr<InputBuffer>(new InputBuffer(fname + suffix, it->second, id) );
+}
+
 ////////////////////////////////////////////////
 // does not account for splicing events
 // are clipped regions part of the coverage?
@@ -21,7 +40,8 @@ double depth(string & fname, size_t & genome_len, int const read_len) {
 	vector<uint32_t> covered_bases(6 * pow(10, 6), 0);
 
 	cerr << "Max size: " << covered_bases.max_size() << endl;
-	OffsetsStream offs(fname);
+	OffsetsStream offs(openStream(fname, ".offs.lz", 0) );
+	offs.seekToBlockStart(-1, 0, 0);
 
 	// TODO: fill out covered_bases
 	int ref_id = offs.getNextTranscript();
@@ -91,7 +111,8 @@ double rolling_depth(string & fname, size_t & genome_len, int const read_len) {
 	// initialize vector long enough for a bacterial genome
 	deque<int> covered_bases(read_len, 0);
 	size_t sum = 0;
-	OffsetsStream offs(fname);
+	OffsetsStream offs(openStream(fname, ".offs.lz", 0) );
+	offs.seekToBlockStart(-1, 0, 0);
 	int ref_id = offs.getNextTranscript();
 	int last_offset = 0, huh = 0;
 	cerr << "ref=" << ref_id+1 << " ";
@@ -146,57 +167,31 @@ double rolling_depth(string & fname, size_t & genome_len, int const read_len) {
 }
 
 ////////////////////////////////////////////////
-//
-// 
-//
+// EditsStream resolves the junction ids against its JunctionTable, so
+// splices come as E ops; known variants (K) count as mismatches
 ////////////////////////////////////////////////
-size_t total_edits(string & fname) {
-	uint8_t readlen;
-	EditsStream edits(fname);
-	size_t edit_cnt = 0;
-	size_t total_alignments = edits.getAlignmentCount();
-	short read_len = edits.getReadLen();
-	// if counted inside the loop -- get 2x of actual alignment count
+size_t total_edits(string & fname, int const read_len) {
+	EditsStream edits(openStream(fname, ".edits.lz", 0), openStream(fname, ".has_edits.lz", 1) );
+	edits.seekToBlockStart(-1, 0, 0);
+	size_t edit_cnt = 0, splice_cnt = 0;
+	size_t total_alignments = 0;
 	size_t alignments_with_edits = 0;
 
-	int return_value = 0;
-	// size_t alignments = 0;
-	while ( (return_value = edits.next() ) != END_OF_STREAM) { // advance to the next alignment)
-		// alignments++;
-		// total_alignments++;
+	while (edits.next() != END_OF_STREAM) { // advance to the next alignment
+		total_alignments++;
 		if (edits.hasEdits() ) {
 			alignments_with_edits++;
-			vector<uint8_t> edit_ops = edits.getEdits();
-			for (int i = 0; i < edit_ops.size(); i++) {
-				switch (edit_ops[i]) {
-					case 'L':
-					case 'R':
-						// do nothing
-					break;
-					case 'E':
-						i+=3;
-					break;
-					case 197:
-						i += 4;
-					break;
-					case 'l':
-					case 'r':
-					case 'D':
-					case 'V':
-					case 'W':
-					case 'X':
-					case 'Y':
-					case 'Z':
-						i++;
-					break;
-				}
+			vector<int> edit_ops = edits.getEdits();
+			for (size_t i = 0; i < edit_ops.size(); i += editOpSize(edit_ops[i]) ) {
+				if (edit_ops[i] == 'E' || edit_ops[i] == ('E' | 128) ) splice_cnt++;
 				edit_cnt++;
 			}
 		}
 	}
 	cerr << "Saw " << total_alignments << " total alignments; of them " << alignments_with_edits << " had edits." << endl;
-	cerr << "Error rate: " << (long double)edit_cnt / (total_alignments * read_len) * 100 << "%" << endl;
-	// TODO: total_alignments almost 2x that of actual number. figure it out
+	cerr << "Splices: " << splice_cnt << endl;
+	if (total_alignments > 0)
+		cerr << "Error rate: " << (long double)edit_cnt / (total_alignments * read_len) * 100 << "%" << endl;
 	return edit_cnt;
 }
 
@@ -222,7 +217,7 @@ int main(int argc, char * argv []) {
     }
     else if (task.compare("edits") == 0) {
     	// compute the total number of edits (clips, mm, indels, splices)
-    	size_t edit_cnt = total_edits(fname);
+    	size_t edit_cnt = total_edits(fname, read_len);
     	cerr << "Total edits: " << edit_cnt << endl;
     }
 }
@@ -0,0 +1,172 @@
+/* Optional fields through AuxTagEncoder and AuxTagStream: typed columns, deltas, dictionaries, arrays */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+// floats and the text SAM has for them
+float const floats[] = {0.5f, -2.75f, 3.14159274f, 0.001f, 1e10f, 0.0f};
+char const * float_texts[] = {"0.5", "-2.75", "3.1415927", "0.001", "1e+10", "0"};
+
+////////////////////////////////////////////////////////////////
+// a field in BAM form (bam) and SAM form (sam)
+////////////////////////////////////////////////////////////////
+struct Fields {
+	string bam, sam;
+
+	void key(char const * k, char type, char sam_type) {
+		bam.push_back(k[0]);
+		bam.push_back(k[1]);
+		bam.push_back(type);
+		sam += '\t';
+		sam += k;
+		sam += ':';
+		sam.push_back(sam_type);
+		sam += ':';
+	}
+
+	void littleEndian(int64_t v, int size) {
+		for (int i = 0; i < size; i++) bam.push_back( (char)( (uint64_t)v >> (8 * i) ) );
+	}
+
+	void integer(char const * k, char type, int64_t v) {
+		key(k, type, 'i');
+		littleEndian(v, auxValueSize(type) );
+		sam += to_string(v);
+	}
+
+	void real(char const * k, int f) {
+		key(k, 'f', 'f');
+		uint32_t bits;
+		memcpy(&bits, &floats[f], 4);
+		littleEndian(bits, 4);
+		sam += float_texts[f];
+	}
+
+	void text(char const * k, char type, string const & s) {
+		key(k, type, type);
+		bam += s;
+		bam.push_back(0);
+		sam += s;
+	}
+
+	void array(char const * k, char subtype, int count) {
+		key(k, 'B', 'B');
+		bam.push_back(subtype);
+		littleEndian(count, 4);
+		sam.push_back(subtype);
+		for (int i = 0; i < count; i++) {
+			sam += ',';
+			if (subtype == 'f') {
+				int f = rand() % 6;
+				uint32_t bits;
+				memcpy(&bits, &floats[f], 4);
+				littleEndian(bits, 4);
+				sam += float_texts[f];
+				continue;
+			}
+			int64_t v = rand() % 100;
+			if (subtype == 'c' || subtype == 's' || subtype == 'i') v -= 50;
+			if (subtype == 'I') v = 4000000000LL - v;
+			if (subtype == 'i' && rand() % 2) v = -2000000000LL + v;
+			littleEndian(v, auxValueSize(subtype) );
+			sam += to_string(v);
+		}
+	}
+};
+
+////////////////////////////////////////////////////////////////
+// fields of record i; MD is left to the edits (md)
+////////////////////////////////////////////////////////////////
+void randomFields(int i, Fields & f, string const & md) {
+	char const * int_types = "cCsSiI";
+	char const * array_types = "cCsSiIf";
+	char const * groups[] = {"grp1", "grp2", "sample.lane3"};
+	// a few common layouts, now and then a field less
+	int layout = rand() % 4;
+	if (layout != 3) f.integer("NM", int_types[rand() % 6], rand() % 100);
+	f.bam += "MDZ";
+	f.bam += md.substr(5);
+	f.bam.push_back(0);
+	f.sam += '\t' + md;
+	// signed values going up and down, unsigned values past 2^31
+	if (layout != 1) f.integer("AS", rand() % 2 ? 's' : 'i', rand() % 60000 - 30000);
+	f.integer("XI", 'I', 4294967295LL - rand() % 1000);
+	f.text("RG", 'Z', groups[rand() % 3]);
+	if (layout == 0) {
+		f.text("XZ", 'Z', rand() % 2 ? "r" + to_string(i) : "common");
+		f.text("XH", 'H', rand() % 2 ? "1AE301" : "FF");
+		f.key("XA", 'A', 'A');
+		char c = "+-*ACGT"[rand() % 7];
+		f.bam.push_back(c);
+		f.sam.push_back(c);
+		f.real("XF", rand() % 6);
+	}
+	if (layout >= 2) f.array("ZB", array_types[rand() % 7], rand() % 200);
+}
+
+int main() {
+	srand(36);
+	int const num_alignments = 20000;
+	vector<Fields> records(num_alignments);
+	vector<string> mds(num_alignments);
+	for (int i = 0; i < num_alignments; i++) {
+		mds[i] = "MD:Z:" + to_string(rand() % 50) + "A" + to_string(rand() % 50);
+		randomFields(i, records[i], mds[i]);
+	}
+
+	TestArchive archive("aux_tags");
+	AuxTagEncoder encoder(archive.packetCourier(), archive.intervalsOut(), archive.prefix);
+	archive.removeLater(".opt.lz");
+	for (auto c : {"NMi", "ASi", "XIi", "RGZ", "XZZ", "XHH", "XAA", "XFf", "ZBB"})
+		archive.removeLater(auxColumnSuffix(c[0], c[1], c[2]) );
+	archive.compress({[&] () {
+		// as Compressor::handleOptionalFields
+		encoder.setInitialCoordinate(0, 0);
+		vector<AuxField> fields;
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, i);
+			fields.clear();
+			string const & bam = records[i].bam;
+			size_t start = 0;
+			while (start < bam.size() ) {
+				// key, type, then the value up to the next key
+				char type = bam[start + 2];
+				size_t len = 3;
+				if (type == 'Z' || type == 'H')
+					len += bam.find('\0', start + 3) - (start + 3) + 1;
+				else if (type == 'B')
+					len += 5 + auxValueSize(bam[start + 3]) * auxInteger('I', (uint8_t const *)bam.data() + start + 4);
+				else
+					len += type == 'A' ? 1 : auxValueSize(type);
+				fields.push_back(AuxField(bam.data() + start, len) );
+				start += len;
+			}
+			encoder.encode(fields, gc, i);
+		}
+		encoder.setLastCoordinate(0, num_alignments, num_alignments);
+		encoder.flush();
+	}});
+
+	// as RefereeDecompress: the layout stream plus one stream per column
+	auto all_intervals = parseGenomicIntervals(archive.prefix + INTERVALS_SUFFIX);
+	unordered_map<string, shared_ptr<InputBuffer>> columns;
+	for (auto & p : all_intervals)
+		if (p.first.compare(0, 5, ".opt.") == 0 && p.first.compare(".opt.lz") != 0)
+			columns[p.first] = archive.open(p.first);
+	CHECK(columns.size() == 9);
+	// the arrays fill several blocks of their column
+	CHECK(all_intervals[".opt.ZBB.lz"]->size() > 1);
+
+	AuxTagStream in(archive.open(".opt.lz"), columns);
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		string record;
+		in.appendFields(record, mds[i]);
+		CHECK(record == records[i].sam);
+		if (record != records[i].sam) {
+			cerr << "alignment " << i << ":" << endl << record << endl << records[i].sam << endl;
+			break;
+		}
+	}
+	return testResult("AuxTagTest");
+}
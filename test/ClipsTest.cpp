@@ -0,0 +1,64 @@
+/* 2-bit packed soft clips, w/ exceptions for bases other than A, C, G, T */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////
+// read as BAM stores it: 4 bits a base, the first base in the high bits
+////////////////////////////////////////////////////////////////
+vector<char> bamSeq(string const & read) {
+	string const codes = "=ACMGRSVTWYHKDBN";
+	vector<char> seq( (read.size() + 1) >> 1, 0);
+	for (size_t i = 0; i < read.size(); i++)
+		seq[i >> 1] |= codes.find(read[i]) << ( (~i & 1) << 2);
+	return seq;
+}
+
+int main() {
+	srand(38);
+	vector<string> clips;
+	for (int i = 0; i < 3000; i++) {
+		// long clips go through the 16 byte unpacking, short ones through the table
+		int len = 1 + ( (i % 10 == 0) ? rand() % 300 : rand() % 40);
+		string clip(len, 'A');
+		for (auto & c : clip) c = "ACGT"[rand() % 4];
+		// Ns and IUPAC codes at the ends and in the middle
+		if (i % 3 == 0) clip[rand() % len] = 'N';
+		if (i % 7 == 0) clip[0] = 'N';
+		if (i % 11 == 0) clip[len - 1] = "NRYKM"[rand() % 5];
+		if (i % 13 == 0) clip = string(len, 'N');
+		clips.push_back(clip);
+	}
+
+	TestArchive archive("clips");
+	// small blocks, so that clips span blocks
+	auto out = archive.stream(".left_clip.lz", 1 << 12);
+	archive.compress({[&] () {
+		vector<pair<int,uint8_t>> exceptions;
+		for (size_t i = 0; i < clips.size(); i++) {
+			GenomicCoordinate gc(0, i);
+			// right clips start anywhere in the read, left clips at 0
+			int start = (i % 2) ? rand() % 50 : 0;
+			string read(start, 'C');
+			auto seq = bamSeq(read + clips[i]);
+			auto packed = packBases(seq.data(), start, clips[i].size(), exceptions);
+			writeClip(packed, clips[i].size(), exceptions, out, gc, i);
+		}
+		TestArchive::flush(out, clips.size() );
+	}});
+
+	ClipStream in(archive.open(".left_clip.lz") );
+	in.seekToBlockStart(-1, 0, 0);
+	string clip;
+	for (size_t i = 0; i < clips.size(); i++) {
+		int status = in.getNext(clip);
+		CHECK(status == SUCCESS);
+		CHECK(clip == clips[i]);
+		if (clip != clips[i]) {
+			cerr << "clip " << i << ": " << clip << " vs " << clips[i] << endl;
+			break;
+		}
+	}
+	CHECK(in.getNext(clip) != SUCCESS);
+	return testResult("ClipsTest");
+}
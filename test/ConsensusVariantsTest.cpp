@@ -0,0 +1,114 @@
+/* Known variants (K <rank>) against the running consensus, through the edits stream */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+// a variant every VARIANT_STEP reference positions
+#define VARIANT_STEP 37
+
+////////////////////////////////////////////////////////////////
+// edits of a read at offset: mismatches at most of the variant sites it
+// covers, a few errors, and a splice in every tenth read; the short form
+// ops the decoder should return go to ops (a long hard clip makes every
+// fifteenth read take the long form)
+////////////////////////////////////////////////////////////////
+void readEdits(int i, int offset, vector<edit_pair> & edits, EditClips & clips, vector<int> & ops) {
+	int const read_len = 100, splice_at = 50, splice_len = 1000;
+	bool spliced = i % 10 == 0, long_form = i % 15 == 0;
+	clips = EditClips{0, 0, long_form ? 300 : 0, 0};
+	edits.clear();
+	ops.clear();
+	if (long_form) {
+		ops.push_back('l');
+		ops.push_back(clips.lhc);
+	}
+	int prev = 0;
+	for (int rp = 0; rp < read_len; rp++) {
+		int pos = clips.lhc + rp;
+		if (spliced && rp == splice_at) {
+			edits.push_back(edit_pair('E', pos, splice_len) );
+			ops.push_back('E');
+			ops.push_back(rp - prev);
+			ops.push_back(splice_len >> 8);
+			ops.push_back(splice_len & 255);
+			prev = rp;
+		}
+		int ref = offset + rp + ( (spliced && rp >= splice_at) ? splice_len : 0);
+		uint8_t base = 0;
+		if (ref % VARIANT_STEP == 0 && rand() % 10 != 0)
+			base = "ACGT"[(ref / VARIANT_STEP) % 4];
+		else if (rand() % 200 == 0)
+			base = "ACGTN"[rand() % 5];
+		if (base == 0) continue;
+		edits.push_back(edit_pair(base, pos) );
+		ops.push_back(base);
+		ops.push_back(rp - prev);
+		prev = rp;
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// the long form expands splices to the long op, junction ids come back as
+// the op that fits the length: compare short splices as E
+////////////////////////////////////////////////////////////////
+void shortSplices(vector<int> & ops) {
+	for (size_t j = 0; j < ops.size(); j += editOpSize(ops[j]) )
+		if (ops[j] == ('E' | 128) && j + 2 < ops.size() && ops[j + 2] == 0) {
+			ops[j] = 'E';
+			ops.erase(ops.begin() + j + 2);
+		}
+}
+
+int main() {
+	srand(43);
+	int const num_alignments = 3000;
+	vector<int> offsets(num_alignments);
+	vector<vector<edit_pair>> edits(num_alignments);
+	vector<EditClips> clips(num_alignments);
+	vector<vector<int>> expected(num_alignments);
+	for (int i = 0; i < num_alignments; i++) {
+		offsets[i] = 3 * i + rand() % 3;
+		readEdits(i, offsets[i], edits[i], clips[i], expected[i]);
+	}
+
+	TestArchive archive("consensus");
+	auto out = archive.stream(".edits.lz", 1 << 12);
+	auto has = archive.stream(".has_edits.lz", 1 << 12);
+	size_t known_variants = 0, long_records = 0;
+	archive.compress({[&] () {
+		// as Compressor::handleEdits w/ --consensusEdits
+		EditsEncoder encoder(true);
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, offsets[i]);
+			bool has_edits = expected[i].size() > 0;
+			writeBool(has_edits, has, gc, i);
+			if (has_edits) encoder.write(edits[i], clips[i], out, gc, i);
+		}
+		known_variants = encoder.known_variants_written;
+		long_records = encoder.long_edits_written;
+		TestArchive::flush(out, num_alignments);
+		TestArchive::flush(has, num_alignments);
+	}});
+	// most variant sites are known by the time a read covers them
+	CHECK(known_variants > num_alignments);
+	CHECK(long_records > 0);
+
+	// as Decompressor::reconstructAlignment
+	ConsensusVariants consensus;
+	EditsStream in(archive.open(".edits.lz"), archive.open(".has_edits.lz") );
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		CHECK(in.next() == SUCCESS);
+		CHECK(in.hasEdits() == (expected[i].size() > 0) );
+		if (!in.hasEdits() ) continue;
+		auto ops = in.getEdits();
+		consensus.resolve(0, offsets[i], ops);
+		shortSplices(ops);
+		CHECK(ops == expected[i]);
+		if (ops != expected[i]) {
+			cerr << "alignment " << i << ": " << ops.size() << " ops vs " << expected[i].size() << endl;
+			break;
+		}
+	}
+	return testResult("ConsensusVariantsTest");
+}
@@ -0,0 +1,66 @@
+/* Blocks come out in order within every stream, w/ several producers and streams */
+#include <random>
+#include "TestArchive.hpp"
+
+using namespace std;
+
+// a record: a running count per stream, then padding
+#define RECORD_SIZE 16
+
+int main() {
+	// streams w/ small and large blocks: large blocks take longer to
+	// compress, so blocks of other streams finish ahead of them
+	vector<string> suffixes = {".small.lz", ".medium.lz", ".large.lz"};
+	vector<int> block_sizes = {1 << 11, 1 << 13, 1 << 15};
+	vector<string> files = {"a", "b"};
+	int const records = 20000;
+
+	TestArchive archive("courier_order", 4);
+	vector<function<void()>> producers;
+	for (auto & file : files) {
+		vector<shared_ptr<OutputBuffer>> streams;
+		for (size_t s = 0; s < suffixes.size(); s++)
+			streams.push_back(archive.stream(suffixes[s], block_sizes[s], file) );
+		producers.push_back([streams, block_sizes, records, file] () {
+			// records interleaved across the streams; the padding is random
+			// in every other block of a stream and zeros in the rest, so a
+			// block often takes longer to compress than the one after it
+			minstd_rand rng(47 + file[0]);
+			vector<uint32_t> next(streams.size(), 0);
+			for (int i = 0; i < records; i++) {
+				GenomicCoordinate gc(0, i);
+				int s = rng() % streams.size();
+				uint8_t bytes[RECORD_SIZE] = {0};
+				memcpy(bytes, &next[s], 4);
+				if ( (next[s] * RECORD_SIZE / block_sizes[s]) % 2 == 0)
+					for (int j = 4; j < RECORD_SIZE; j++) bytes[j] = rng() % 256;
+				next[s]++;
+				writeBytes(bytes, RECORD_SIZE, streams[s], gc, i);
+			}
+			for (auto & s : streams) TestArchive::flush(s, records);
+		});
+	}
+	archive.compress(producers);
+
+	for (auto & file : files) {
+		size_t total = 0;
+		for (auto & suffix : suffixes) {
+			auto bytes = archive.read(suffix, file);
+			CHECK(bytes.size() % RECORD_SIZE == 0);
+			uint32_t expected = 0;
+			for (size_t j = 0; j + RECORD_SIZE <= bytes.size(); j += RECORD_SIZE) {
+				uint32_t x;
+				memcpy(&x, &bytes[j], 4);
+				CHECK(x == expected);
+				if (x != expected) {
+					cerr << file << suffix << ": " << x << " at " << expected << endl;
+					break;
+				}
+				expected++;
+			}
+			total += expected;
+		}
+		CHECK(total == records);
+	}
+	return testResult("CourierOrderTest");
+}
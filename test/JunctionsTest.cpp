@@ -0,0 +1,96 @@
+/* Splices written as references to the per-block junction table, through EditsEncoder and EditsStream */
+#include <array>
+#include "TestArchive.hpp"
+
+using namespace std;
+
+typedef vector<array<int, 3>> Ops;
+
+////////////////////////////////////////////////////////////////
+// (op, gap, splice length) of the ops EditsStream returns; a splice comes
+// as E or E|128 depending on the form and the length
+////////////////////////////////////////////////////////////////
+Ops normalize(vector<int> const & ops) {
+	Ops out;
+	for (size_t j = 0; j < ops.size(); j += editOpSize(ops[j]) ) {
+		int op = ops[j];
+		if (op == 'E' && j + 3 < ops.size() )
+			out.push_back({{'E', ops[j + 1], (ops[j + 2] << 8) | ops[j + 3]}});
+		else if (op == ('E' | 128) && j + 4 < ops.size() )
+			out.push_back({{'E', ops[j + 1], (ops[j + 2] << 16) | (ops[j + 3] << 8) | ops[j + 4]}});
+		else if (j + 1 < ops.size() )
+			out.push_back({{op, ops[j + 1], 0}});
+	}
+	return out;
+}
+
+int main() {
+	srand(44);
+	// more lengths than the short form can refer to, some past 16 bits
+	vector<int> lengths;
+	for (int k = 0; k < 400; k++)
+		lengths.push_back(k % 4 == 0 ? 65536 + rand() % 1000000 : 50 + rand() % 20000);
+	int const num_alignments = 4000;
+	vector<vector<edit_pair>> edits(num_alignments);
+	vector<EditClips> clips(num_alignments);
+	vector<Ops> expected(num_alignments);
+	size_t splices = 0;
+	for (int i = 0; i < num_alignments; i++) {
+		// a long hard clip makes every seventh record take the long form
+		clips[i] = EditClips{0, 0, i % 7 == 0 ? 300 : 0, 0};
+		if (clips[i].lhc > 0) expected[i].push_back({{'l', clips[i].lhc, 0}});
+		// splices w/ lengths skewed towards the first ones, a mismatch now and then
+		int n = 1 + rand() % 3, pos = clips[i].lhc;
+		for (int k = 0; k < n; k++) {
+			int gap = rand() % 100;
+			pos += gap;
+			if (rand() % 4 == 0) {
+				char base = "ACGT"[rand() % 4];
+				edits[i].push_back(edit_pair(base, pos) );
+				expected[i].push_back({{base, gap, 0}});
+				continue;
+			}
+			int len = lengths[rand() % (1 + rand() % lengths.size() )];
+			edits[i].push_back(edit_pair('E', pos, len) );
+			expected[i].push_back({{'E', gap, len}});
+			splices++;
+		}
+	}
+
+	TestArchive archive("junctions");
+	auto out = archive.stream(".edits.lz", 1 << 12);
+	auto has = archive.stream(".has_edits.lz", 1 << 12);
+	size_t junctions_written = 0, long_records = 0, blocks = 0;
+	archive.compress({[&] () {
+		// as Compressor::handleEdits
+		EditsEncoder encoder;
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, i);
+			writeBool(true, has, gc, i);
+			encoder.write(edits[i], clips[i], out, gc, i);
+		}
+		junctions_written = encoder.junctions_written;
+		long_records = encoder.long_edits_written;
+		blocks = out->blocks();
+		TestArchive::flush(out, num_alignments);
+		TestArchive::flush(has, num_alignments);
+	}});
+	// most repeated splices refer to the table, which starts over many times
+	CHECK(junctions_written > splices / 2);
+	CHECK(long_records > 0);
+	CHECK(blocks > 4);
+
+	EditsStream in(archive.open(".edits.lz"), archive.open(".has_edits.lz") );
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		CHECK(in.next() == SUCCESS);
+		CHECK(in.hasEdits() );
+		auto ops = normalize(in.getEdits() );
+		CHECK(ops == expected[i]);
+		if (ops != expected[i]) {
+			cerr << "alignment " << i << ": " << ops.size() << " ops vs " << expected[i].size() << endl;
+			break;
+		}
+	}
+	return testResult("JunctionsTest");
+}
@@ -0,0 +1,169 @@
+/* Short and long form edits through EditsEncoder and EditsStream */
+#include <array>
+#include "TestArchive.hpp"
+
+using namespace std;
+
+typedef vector<array<int, 3>> Ops;
+
+////////////////////////////////////////////////////////////////
+// (op, gap, splice length) of the short form ops EditsStream returns;
+// splices come as E or E|128 depending on the form and the length
+////////////////////////////////////////////////////////////////
+Ops normalize(vector<int> const & ops) {
+	Ops out;
+	for (size_t j = 0; j < ops.size(); j += editOpSize(ops[j]) ) {
+		int op = ops[j];
+		if (op == 'L' || op == 'R')
+			out.push_back({{op, 0, 0}});
+		else if (op == 'E' && j + 3 < ops.size() )
+			out.push_back({{'E', ops[j + 1], (ops[j + 2] << 8) | ops[j + 3]}});
+		else if (op == ('E' | 128) && j + 4 < ops.size() )
+			out.push_back({{'E', ops[j + 1], (ops[j + 2] << 16) | (ops[j + 3] << 8) | ops[j + 4]}});
+		else if (j + 1 < ops.size() )
+			out.push_back({{op, ops[j + 1], 0}});
+	}
+	return out;
+}
+
+////////////////////////////////////////////////////////////////
+// what the decoder should see for the edits of an alignment
+////////////////////////////////////////////////////////////////
+Ops expectedOps(vector<edit_pair> const & edits, EditClips const & clips) {
+	Ops out;
+	if (clips.lsc > 0) out.push_back({{'L', 0, 0}});
+	if (clips.rsc > 0) out.push_back({{'R', 0, 0}});
+	if (clips.lhc > 0) out.push_back({{'l', clips.lhc, 0}});
+	if (clips.rhc > 0) out.push_back({{'r', clips.rhc, 0}});
+	int prev = clips.lsc + clips.lhc;
+	for (auto & e : edits) {
+		if (e.edit_op == 'L' || e.edit_op == 'R') continue;
+		out.push_back({{e.edit_op, e.edit_pos - prev, e.edit_op == 'E' ? e.splice_len : 0}});
+		prev = e.edit_pos;
+	}
+	return out;
+}
+
+////////////////////////////////////////////////////////////////
+// edits as the parser leaves them in merged_edits: sorted by read
+// position, soft clips as L and R; long reads get long gaps, long runs
+// and long hard clips
+////////////////////////////////////////////////////////////////
+void randomEdits(vector<edit_pair> & edits, EditClips & clips, bool long_read, vector<int> const & introns) {
+	edits.clear();
+	int span = long_read ? 20000 : 30;
+	clips.lsc = rand() % 3 == 0 ? 1 + rand() % 20 : 0;
+	clips.rsc = rand() % 3 == 0 ? 1 + rand() % 20 : 0;
+	clips.lhc = long_read && rand() % 3 == 0 ? 1 + rand() % 1000 : 0;
+	clips.rhc = long_read && rand() % 3 == 0 ? 1 + rand() % 1000 : 0;
+	if (clips.lsc > 0) edits.push_back(edit_pair('L', clips.lsc) );
+	int pos = clips.lsc + clips.lhc;
+	int num_ops = long_read ? 1 + rand() % 40 : 1 + rand() % 5;
+	for (int k = 0; k < num_ops; k++) {
+		pos += rand() % span;
+		int n = long_read ? 1 + rand() % 300 : 1 + rand() % 3;
+		switch (rand() % 5) {
+			case 0:
+				edits.push_back(edit_pair("ACGTN"[rand() % 5], pos) );
+				break;
+			case 1:
+				// adjacent mismatches
+				for (int i = 0; i < n; i++) edits.push_back(edit_pair("ACGTN"[rand() % 5], pos + i) );
+				pos += n - 1;
+				break;
+			case 2:
+				for (int i = 0; i < n; i++) edits.push_back(edit_pair('D', pos) );
+				break;
+			case 3:
+				for (int i = 0; i < n; i++) edits.push_back(edit_pair("VWXYZ"[rand() % 5], pos) );
+				break;
+			default:
+				edits.push_back(edit_pair('E', pos, introns[rand() % introns.size()]) );
+		}
+	}
+	if (clips.rsc > 0) edits.push_back(edit_pair('R', clips.rsc) );
+}
+
+int main() {
+	srand(39);
+	// introns shared by many alignments, some too long for the short form
+	vector<int> introns;
+	for (int k = 0; k < 20; k++)
+		introns.push_back(k % 5 == 0 ? 0x1000000 + rand() % 1000 : 50 + rand() % 100000);
+
+	int const num_alignments = 300;
+	vector<vector<edit_pair>> edits(num_alignments);
+	vector<EditClips> clips(num_alignments);
+	vector<bool> has_edits(num_alignments), backwards(num_alignments);
+	for (int i = 0; i < num_alignments; i++) {
+		has_edits[i] = i % 5 != 0;
+		if (!has_edits[i]) continue;
+		randomEdits(edits[i], clips[i], i % 4 == 1, introns);
+		// now and then an edit before the previous one
+		if (i % 23 == 2) {
+			edits[i].push_back(edit_pair('A', edits[i].back().edit_pos + 5) );
+			edits[i].push_back(edit_pair('C', edits[i].back().edit_pos - 3) );
+			backwards[i] = true;
+		}
+	}
+
+	TestArchive archive("long_edits");
+	auto out = archive.stream(".edits.lz", 1 << 11);
+	auto has = archive.stream(".has_edits.lz", 1 << 11);
+	auto runs = archive.stream(".runs.lz", 1 << 20);
+	size_t long_records = 0, run_bytes = 0;
+	bool rejected_ok = true;
+	archive.compress({[&] () {
+		EditsEncoder encoder;
+		size_t num = 0;
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, i);
+			if (backwards[i]) {
+				// left out of the stream, the Compressor keeps them as unaligned reads
+				int before = out->size();
+				rejected_ok &= EditsEncoder::backwards(edits[i], clips[i]) &&
+					!encoder.write(edits[i], clips[i], out, gc, num) && out->size() == before;
+				continue;
+			}
+			writeBool(has_edits[i], has, gc, num);
+			if (has_edits[i]) encoder.write(edits[i], clips[i], out, gc, num);
+			num++;
+		}
+		long_records = encoder.long_edits_written;
+
+		// a read w/ a 5000 base deletion, 200 inserted and 100 mismatched bases
+		vector<edit_pair> long_read;
+		for (int i = 0; i < 5000; i++) long_read.push_back(edit_pair('D', 300) );
+		for (int i = 0; i < 200; i++) long_read.push_back(edit_pair('W', 9000) );
+		for (int i = 0; i < 100; i++) long_read.push_back(edit_pair('T', 20000 + i) );
+		EditsEncoder run_encoder;
+		GenomicCoordinate gc(0, 0);
+		run_encoder.write(long_read, EditClips{0, 0, 0, 0}, runs, gc, 0);
+		run_bytes = runs->size();
+
+		TestArchive::flush(out, num);
+		TestArchive::flush(has, num);
+		TestArchive::flush(runs, 1);
+	}});
+	CHECK(rejected_ok);
+	CHECK(long_records > 0 && long_records < (size_t)num_alignments / 2);
+	// D, I and B ops w/ the 200 + 100 bases
+	CHECK(run_bytes > 300 && run_bytes < 330);
+
+	EditsStream in(archive.open(".edits.lz"), archive.open(".has_edits.lz") );
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		if (backwards[i]) continue;
+		CHECK(in.next() == SUCCESS);
+		CHECK(in.hasEdits() == has_edits[i]);
+		if (!in.hasEdits() ) continue;
+		auto ops = normalize(in.getEdits() );
+		auto expected = expectedOps(edits[i], clips[i]);
+		CHECK(ops == expected);
+		if (ops != expected) {
+			cerr << "alignment " << i << ": " << ops.size() << " ops vs " << expected.size() << endl;
+			break;
+		}
+	}
+	return testResult("LongEditsTest");
+}
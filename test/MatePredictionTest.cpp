@@ -0,0 +1,165 @@
+/* pnext and tlen predicted from the mate through the flags stream */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+struct TestAlignment {
+	string name;
+	int flags, pos, end, mate_ref, pnext, tlen;
+};
+
+////////////////////////////////////////////////////////////////
+// a pair w/ tlen values from one of the models, or made up ones
+////////////////////////////////////////////////////////////////
+void addPair(vector<TestAlignment> & als, string const & name, int pos, int dist, bool consistent) {
+	int a_len = 50 + rand() % 100, b_len = 50 + rand() % 100;
+	bool a_rev = rand() % 4 == 0, b_rev = !a_rev;
+	TestAlignment a{name, 1 | 2 | 64 | (a_rev ? 16 : 0) | (b_rev ? 32 : 0), pos, pos + a_len, 0, pos + dist, 0};
+	TestAlignment b{name, 1 | 2 | 128 | (b_rev ? 16 : 0) | (a_rev ? 32 : 0), pos + dist, pos + dist + b_len, 0, pos, 0};
+	if (consistent)
+		predictTlen(rand() % MATE_MODELS, a.pos, a.end, a_rev, b.pos, b.end, b_rev, a.tlen, b.tlen);
+	else {
+		a.tlen = rand() % 1000;
+		b.tlen = rand() % 1000;
+	}
+	als.push_back(a);
+	als.push_back(b);
+}
+
+int main() {
+	srand(41);
+	vector<TestAlignment> als;
+	for (int i = 0; i < 20000; i++) {
+		string name = "pair" + to_string(i);
+		int pos = rand() % 1000000;
+		switch (i % 20) {
+			case 0:
+				// unpaired
+				als.push_back(TestAlignment{name, 0, pos, pos + 100, -1, 0, 0});
+				break;
+			case 1:
+				// mate on another chromosome
+				als.push_back(TestAlignment{name, 1 | 64, pos, pos + 100, 1, rand() % 1000, 0});
+				break;
+			case 2:
+				// tlen from neither model
+				addPair(als, name, pos, rand() % 500, false);
+				break;
+			case 3:
+				// mates at the same position
+				addPair(als, name, pos, 0, true);
+				break;
+			case 4:
+				// mate past the look-ahead window
+				addPair(als, name, pos, 900000, true);
+				break;
+			default:
+				addPair(als, name, pos, rand() % 500, true);
+		}
+	}
+	stable_sort(als.begin(), als.end(), [] (TestAlignment const & a, TestAlignment const & b) {
+		return a.pos < b.pos;
+	});
+
+	TestArchive archive("mates");
+	auto out = archive.stream(".flags.lz", 1 << 14);
+	archive.compress({[&] () {
+		MateWindow mates(out);
+		for (size_t i = 0; i < als.size(); i++) {
+			auto & al = als[i];
+			MateEntry e;
+			e.flags = al.flags;
+			e.mapq = 60;
+			e.rnext = 0;
+			e.raw_flags = al.flags;
+			e.ref = 0;
+			e.pos = al.pos;
+			e.end = al.end;
+			e.mate_ref = al.mate_ref;
+			e.pnext = al.pnext;
+			e.tlen = al.tlen;
+			e.name = al.name;
+			e.gc = GenomicCoordinate(0, al.pos);
+			e.num = i;
+			mates.add(e);
+		}
+		mates.flush();
+		TestArchive::flush(out, als.size() );
+	}});
+
+	// as Decompressor::reconstructAlignment: one line per alignment w/ its
+	// name, pnext, tlen and number; decoding stops after limit alignments
+	size_t predicted = 0, most_held = 0;
+	auto decode = [&] (size_t limit) {
+		unordered_map<int,short> flags_map;
+		unordered_map<int,int> mapq_map, rnext_map;
+		FlagsStream in(archive.open(".flags.lz"), flags_map, mapq_map, rnext_map);
+		in.seekToBlockStart(-1, 0, 0);
+		ostringstream sam;
+		MateQueue queue(sam);
+		for (size_t i = 0; i < limit; i++) {
+			auto & al = als[i];
+			auto fields = in.getNextFlagSet();
+			CHECK(fields.size() == 5);
+			if (fields.size() != 5) break;
+			CHECK(fields[0] == al.flags);
+			size_t index = queue.nextIndex();
+			string record = al.name + '\t';
+			int pnext = fields[3], tlen = fields[3] - fields[4];
+			bool rev = al.flags & 16, pending = false;
+			size_t insert_at = 0, mate_index = 0;
+			if (in.mateAhead() > 0) {
+				mate_index = index + in.mateAhead();
+				queue.expect(mate_index, al.pos, al.end, rev, in.mateModel() );
+				pending = true;
+				insert_at = record.size();
+				predicted++;
+			}
+			else if (in.mateBehind() ) {
+				CHECK(queue.resolve(index, al.pos, al.end, rev, pnext, tlen) );
+				predicted++;
+			}
+			if (!pending) record += to_string(pnext) + '\t' + to_string(tlen) + '\t';
+			record += to_string(i) + '\n';
+			queue.emit(record, pending, insert_at, mate_index);
+			most_held = max(most_held, queue.held() );
+		}
+		queue.flush();
+		return sam.str();
+	};
+
+	// lines come out in the order of the alignments w/ the values of the input
+	istringstream sam(decode(als.size() ) );
+	string name;
+	int pnext, tlen;
+	size_t line, lines = 0;
+	while (sam >> name >> pnext >> tlen >> line) {
+		CHECK(line == lines);
+		if (line != lines++ || line >= als.size() ) break;
+		CHECK(name == als[line].name);
+		CHECK(pnext == als[line].pnext && tlen == als[line].tlen);
+		if (pnext != als[line].pnext || tlen != als[line].tlen) {
+			cerr << "line " << line << ": " << pnext << " " << tlen << " vs " <<
+				als[line].pnext << " " << als[line].tlen << endl;
+			break;
+		}
+	}
+	CHECK(lines == als.size() );
+	CHECK(most_held > 1);
+	// most pairs are predicted
+	CHECK(predicted > als.size() / 2);
+
+	// stopping halfway: held back lines whose mate is not decoded get 0 and 0
+	size_t half = als.size() / 2;
+	istringstream part(decode(half) );
+	lines = 0;
+	size_t lost = 0;
+	while (part >> name >> pnext >> tlen >> line) {
+		CHECK(line == lines++);
+		if (pnext == 0 && tlen == 0 && als[line].pnext != 0) lost++;
+		else CHECK(pnext == als[line].pnext && tlen == als[line].tlen);
+	}
+	CHECK(lines == half);
+	CHECK(lost > 0);
+	return testResult("MatePredictionTest");
+}
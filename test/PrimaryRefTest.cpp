@@ -0,0 +1,102 @@
+/* Secondary alignments take the name and qualities of their primary through .primary.lz */
+#include "TestArchive.hpp"
+#include "compress/PrimaryWindow.hpp"
+
+using namespace std;
+
+struct TestAlignment {
+	string name;
+	int flags;
+	string quals;
+};
+
+int main() {
+	srand(42);
+	vector<TestAlignment> als;
+	// primaries and their secondaries; some secondaries come after the
+	// window has moved past their primary
+	vector<size_t> primaries;
+	int const num_alignments = PRIMARY_WINDOW + 20000;
+	while ( (int)als.size() < num_alignments) {
+		if (primaries.empty() || rand() % 3 == 0) {
+			string name = "read" + to_string(als.size() );
+			int mate = rand() % 3 == 0 ? 0 : (rand() % 2 ? 64 : 128);
+			string quals(50 + rand() % 100, ' ');
+			for (auto & c : quals) c = 33 + rand() % 40;
+			primaries.push_back(als.size() );
+			als.push_back(TestAlignment{name, (rand() % 2 ? 16 : 0) | mate, quals});
+			continue;
+		}
+		// mostly recent primaries, now and then one far back
+		size_t back = rand() % 50 == 0 ? rand() % primaries.size() : rand() % min(primaries.size(), (size_t)20);
+		TestAlignment al = als[primaries[primaries.size() - 1 - back]];
+		bool flip = rand() % 2 == 0;
+		if (flip) {
+			al.flags ^= 16;
+			reverse(al.quals.begin(), al.quals.end() );
+		}
+		al.flags |= rand() % 2 ? 0x100 : 0x800;
+		switch (rand() % 5) {
+			case 0:
+				// a single value differs
+				al.quals[rand() % al.quals.size()]++;
+				break;
+			case 1:
+				// no qualities
+				al.quals = string(al.quals.size(), (char)0xff);
+				break;
+			case 2:
+				// the other read of the pair
+				if (al.flags & 192) al.flags ^= 192;
+				break;
+		}
+		als.push_back(al);
+	}
+
+	TestArchive archive("primary_refs");
+	auto out = archive.stream(".primary.lz", 1 << 16);
+	size_t inherited_names = 0, inherited_quals = 0;
+	archive.compress({[&] () {
+		PrimaryWindow window(out);
+		for (size_t i = 0; i < als.size(); i++) {
+			auto & al = als[i];
+			GenomicCoordinate gc(0, i);
+			window.add(i + 1, al.name.c_str(), al.flags, al.quals.data(), al.quals.size(), gc);
+		}
+		inherited_names = window.inherited_names;
+		inherited_quals = window.inherited_quals;
+		TestArchive::flush(out, als.size() );
+	}});
+	CHECK(inherited_names > als.size() / 2);
+	CHECK(inherited_quals > 0 && inherited_quals < inherited_names);
+
+	// as Decompressor::reconstructAlignment
+	PrimaryRefStream in(archive.open(".primary.lz") );
+	in.seekToBlockStart(-1, 0, 0);
+	DecodedPrimaries recent;
+	size_t names = 0, quals = 0;
+	for (size_t i = 0; i < als.size(); i++) {
+		auto & al = als[i];
+		uint64_t token = in.next();
+		if (token == 0) {
+			auto self = recent.push(i + 1, al.quals.size() );
+			self->name = al.name;
+			self->quals = al.quals;
+			continue;
+		}
+		CHECK(al.flags & 0x900);
+		auto primary = recent.find(i + 1 - primaryRefDistance(token) );
+		CHECK(primary != nullptr);
+		if (primary == nullptr) break;
+		CHECK(primary->name == al.name);
+		names++;
+		string q = primary->quals;
+		if (primaryRefReversed(token) ) reverse(q.begin(), q.end() );
+		// inherited exactly when they are the same
+		CHECK(primaryRefQuals(token) == (q == al.quals) );
+		if (primaryRefQuals(token) ) quals++;
+	}
+	CHECK(names == inherited_names);
+	CHECK(quals == inherited_quals);
+	return testResult("PrimaryRefTest");
+}
@@ -0,0 +1,96 @@
+/* Range coded quality cores through QualityCoreBuffer and QualityCoreReader, sought by coordinate */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+#define CORES_SUFFIX ".quals.0.ac"
+
+////////////////////////////////////////////////////////////////
+// a core w/ runs, drops to '#' and now and then a symbol past the model
+////////////////////////////////////////////////////////////////
+string randomCore() {
+	string core;
+	int len = 20 + rand() % 130;
+	char q = 'A' + rand() % 10;
+	for (int i = 0; i < len; i++) {
+		if (rand() % 8 == 0) q = '#' + rand() % 40;
+		core.push_back(rand() % 500 == 0 ? '~' : q);
+	}
+	return core;
+}
+
+int main() {
+	srand(30);
+	// two chromosomes, several cores at some offsets
+	int const num_cores = 12000;
+	vector<string> cores(num_cores);
+	vector<GenomicCoordinate> coords(num_cores);
+	int offset = 0;
+	for (int i = 0; i < num_cores; i++) {
+		if (i == num_cores / 2) offset = 0;
+		offset += rand() % 3 == 0 ? 0 : rand() % 100;
+		coords[i] = GenomicCoordinate(i < num_cores / 2 ? 0 : 1, offset);
+		cores[i] = randomCore();
+	}
+
+	TestArchive archive("quality_cores");
+	QualityCoreBuffer<QualityModel> out(archive.packetCourier(), archive.intervalsOut(), archive.prefix,
+		CORES_SUFFIX, QualityModel(), 1 << 12);
+	archive.removeLater(CORES_SUFFIX);
+	archive.compress({[&] () {
+		// as QualityCluster::addCore
+		for (int i = 0; i < num_cores; i++) out.write(cores[i], coords[i]);
+		out.flush();
+	}});
+
+	// block starts from the core counts in the intervals file
+	auto all_intervals = parseGenomicIntervals(archive.prefix + INTERVALS_SUFFIX);
+	auto intervals = all_intervals[CORES_SUFFIX];
+	vector<int> block_starts;
+	int total = 0;
+	for (auto & b : *intervals) {
+		block_starts.push_back(total);
+		total += b.num_alignments;
+	}
+	CHECK(total == num_cores);
+	CHECK(block_starts.size() > 10 && block_starts.size() < 100);
+
+	QualityCoreReader<QualityModel> in(archive.prefix + CORES_SUFFIX, intervals);
+	CHECK(in.seekToBlockStart(-1, 0, 0) );
+	for (int i = 0; i < num_cores; i++) {
+		string core;
+		CHECK(in.appendNextCore(core) );
+		CHECK(core == cores[i]);
+		if (core != cores[i]) {
+			cerr << "core " << i << ": " << core << " vs " << cores[i] << endl;
+			break;
+		}
+	}
+	CHECK(!in.hasMoreCores() );
+
+	// as QualityStream::seekToBlockStart: the first block whose last core is
+	// at or past the target, then every core after it
+	for (int k = 0; k < 200; k++) {
+		int target = rand() % num_cores;
+		GenomicCoordinate t = coords[target];
+		size_t b = 0;
+		while (b + 1 < block_starts.size() ) {
+			auto & last = coords[block_starts[b + 1] - 1];
+			if (last.chromosome > t.chromosome || (last.chromosome == t.chromosome && last.offset >= t.offset) ) break;
+			b++;
+		}
+		CHECK(in.seekToBlockStart(t.chromosome, t.offset, t.offset + 100) );
+		for (int i = block_starts[b]; i < num_cores; i++) {
+			string core;
+			CHECK(in.appendNextCore(core) );
+			CHECK(core == cores[i]);
+			if (core != cores[i]) {
+				cerr << "from " << coords[target].chromosome << ":" << coords[target].offset <<
+					", core " << i << " (block " << b << ")" << endl;
+				break;
+			}
+		}
+		CHECK(!in.hasMoreCores() );
+	}
+	return testResult("QualityCoresTest");
+}
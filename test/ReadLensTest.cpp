@@ -0,0 +1,65 @@
+/* Read lengths (0 or length + 1) through writeReadLen and ReadLenStream, sought by alignment */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+int main() {
+	srand(40);
+	// runs of trimmed reads, lengths past 127 take two bytes
+	int const num_alignments = 30000;
+	vector<int> lens(num_alignments);
+	int len = 150;
+	for (int i = 0; i < num_alignments; i++) {
+		if (rand() % 3 == 0) len = rand() % 2 ? 150 : 20 + rand() % 300;
+		lens[i] = len;
+	}
+
+	TestArchive archive("read_lens");
+	auto out = archive.stream(".read_lens.lz", 1 << 10);
+	out->keepRecordsWhole();
+	archive.compress({[&] () {
+		// as Compressor::handleOffsets: alignments are numbered from 1
+		int prev_len = -1;
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, i);
+			writeReadLen(lens[i], prev_len, out, gc, i + 1);
+		}
+		TestArchive::flush(out, num_alignments);
+	}});
+
+	// every block starts w/ a full length
+	auto all_intervals = parseGenomicIntervals(archive.prefix + INTERVALS_SUFFIX);
+	auto & blocks = *all_intervals[".read_lens.lz"];
+	CHECK(blocks.size() > 10 && blocks.size() < 64);
+	auto bytes = archive.read(".read_lens.lz");
+	size_t zeros = 0;
+	for (auto b : bytes) zeros += b == 0;
+	CHECK(zeros > (size_t)num_alignments / 2);
+
+	ReadLenStream in(archive.open(".read_lens.lz"), 0);
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		int l = in.next();
+		CHECK(l == lens[i]);
+		if (l != lens[i]) {
+			cerr << "alignment " << i << ": " << l << " vs " << lens[i] << endl;
+			break;
+		}
+	}
+
+	// as Decompressor::sync_streams: at, just before and just after every block start
+	for (auto & block : blocks) {
+		for (long d = -1; d <= 1; d++) {
+			long at = block.num_alignments + d;
+			if (at < 0 || at >= num_alignments) continue;
+			ReadLenStream sought(archive.open(".read_lens.lz"), 0);
+			sought.seekToAlignment(0, 0, 0, at);
+			for (long i = at; i < std::min(at + 3, (long)num_alignments); i++) {
+				int l = sought.next();
+				CHECK(l == lens[i]);
+				if (l != lens[i]) cerr << "from " << at << ", alignment " << i << ": " << l << " vs " << lens[i] << endl;
+			}
+		}
+	}
+	return testResult("ReadLensTest");
+}
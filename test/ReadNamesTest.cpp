@@ -0,0 +1,102 @@
+/* Tokenized read names through ReadNameEncoder and ReadIDStream */
+#include "TestArchive.hpp"
+
+using namespace std;
+
+// control blocks of ReadNameEncoder
+#define CONTROL_BLOCK (1 << 20)
+
+////////////////////////////////////////////////////////////////
+// Illumina style names w/ increasing tiles and coordinates; now and then
+// leading zeros, numbers too long for a varint, or more tokens than there
+// are columns
+////////////////////////////////////////////////////////////////
+string randomName(int i, int & x) {
+	string name = "HWI-ST" + to_string(1200 + i / 50000) + ":8:" + to_string(1101 + i / 20000) + ":";
+	x += rand() % 300;
+	name += to_string(x) + ":" + to_string(rand() % 20000);
+	switch (rand() % 20) {
+		case 0:
+			name += ":00" + to_string(rand() % 100);
+			break;
+		case 1:
+			name += ":" + to_string(1000000000LL + rand() );
+			break;
+		case 2:
+			for (int k = 0; k < 10; k++) name += "_" + to_string(rand() % 10);
+			break;
+	}
+	return name + (i % 2 ? "/2" : "/1");
+}
+
+int main() {
+	srand(35);
+	int const num_alignments = 200000;
+	vector<string> names(num_alignments);
+	int x = 0;
+	for (int i = 0; i < num_alignments; i++) {
+		if (i % 20000 == 0) x = 0;
+		names[i] = randomName(i, x);
+	}
+
+	TestArchive archive("read_names");
+	ReadNameEncoder encoder(archive.packetCourier(), archive.intervalsOut(), archive.prefix);
+	archive.removeLater(".ids.lz");
+	for (int i = 0; i < NAME_MAX_TOKENS; i++) archive.removeLater(".ids." + to_string(i) + ".lz");
+	archive.compress({[&] () {
+		// as Compressor::processRead
+		encoder.setInitialCoordinate(0, 0);
+		for (int i = 0; i < num_alignments; i++) {
+			GenomicCoordinate gc(0, i);
+			encoder.encode(names[i].c_str(), gc, i);
+		}
+		encoder.setLastCoordinate(0, num_alignments, num_alignments);
+		encoder.flush();
+	}});
+
+	// the control stream has token types only: names end at NAME_TOK_END
+	auto control = archive.read(".ids.lz");
+	CHECK(control.size() > 2 * CONTROL_BLOCK);
+	size_t name_start = 0, block = 0, refs = 0;
+	int self_contained = 0;
+	for (size_t j = 0; j < control.size(); j++) {
+		if (control[j] == NAME_TOK_MATCH || control[j] == NAME_TOK_DELTA) refs++;
+		if (control[j] != NAME_TOK_END) continue;
+		// the first name starting in a block refers to no earlier name
+		if (name_start / CONTROL_BLOCK != block) {
+			block = name_start / CONTROL_BLOCK;
+			self_contained++;
+			for (size_t k = name_start; k < j; k++) {
+				CHECK(control[k] == NAME_TOK_STRING || control[k] == NAME_TOK_NUMBER);
+			}
+		}
+		name_start = j + 1;
+	}
+	CHECK(self_contained >= 2);
+	// most tokens repeat or follow the previous name
+	CHECK(refs > (size_t)num_alignments * 4);
+
+	// as RefereeDecompress: the control stream plus one stream per token position
+	auto all_intervals = parseGenomicIntervals(archive.prefix + INTERVALS_SUFFIX);
+	vector<shared_ptr<InputBuffer>> columns(NAME_MAX_TOKENS);
+	for (int i = 0; i < NAME_MAX_TOKENS; i++) {
+		string suffix = ".ids." + to_string(i) + ".lz";
+		if (all_intervals.find(suffix) != all_intervals.end() ) columns[i] = archive.open(suffix);
+	}
+	ReadIDStream in(archive.open(".ids.lz"), columns);
+	in.seekToBlockStart(-1, 0, 0);
+	for (int i = 0; i < num_alignments; i++) {
+		int status = 0;
+		string name = in.getNextID(status);
+		CHECK(status == SUCCESS);
+		CHECK(name == names[i]);
+		if (name != names[i]) {
+			cerr << "alignment " << i << ": " << name << " vs " << names[i] << endl;
+			break;
+		}
+	}
+	int status = 0;
+	// END_OF_STREAM means different things to InputBuffer and QualityStream
+	CHECK(in.getNextID(status) == "" && status != SUCCESS);
+	return testResult("ReadNamesTest");
+}
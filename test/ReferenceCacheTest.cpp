@@ -0,0 +1,46 @@
+/* Jobs of a batch wait only for the reference sequence they need */
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "TestArchive.hpp"
+
+using namespace std;
+
+int main() {
+	ReferenceCache cache;
+	cache.setCap(1 << 20);
+	atomic<bool> chr1_loading(false), chr2_done(false), chr2_seen(false);
+	atomic<int> chr1_loads(0);
+
+	// chr1 takes until chr2 is in (or a few seconds, if chr2 waits for chr1)
+	auto slow_chr1 = [&] () {
+		chr1_loads++;
+		chr1_loading = true;
+		for (int i = 0; i < 500 && !chr2_done; i++)
+			this_thread::sleep_for(chrono::milliseconds(10) );
+		chr2_seen = chr2_done.load();
+		return make_shared<string>(1000, 'A');
+	};
+	shared_ptr<string> first, second;
+	thread a([&] () { first = cache.get("ref.fa", "chr1", slow_chr1); });
+	while (!chr1_loading) this_thread::sleep_for(chrono::milliseconds(1) );
+	// another job on chr1 waits for the load in flight instead of reading it again
+	thread b([&] () { second = cache.get("ref.fa", "chr1", slow_chr1); });
+
+	auto chr2 = cache.get("ref.fa", "chr2", [] () { return make_shared<string>(1000, 'C'); });
+	CHECK(chr2 != nullptr && (*chr2)[0] == 'C');
+	chr2_done = true;
+	a.join();
+	b.join();
+	CHECK(chr2_seen);
+	CHECK(chr1_loads == 1);
+	CHECK(first != nullptr && first == second);
+
+	// a failed load is not kept; the next job tries again
+	int tries = 0;
+	auto missing = [&] () { tries++; return shared_ptr<string>(); };
+	CHECK(cache.get("ref.fa", "chrM", missing) == nullptr);
+	CHECK(cache.get("ref.fa", "chrM", missing) == nullptr);
+	CHECK(tries == 2);
+	return testResult("ReferenceCacheTest");
+}
@@ -0,0 +1,184 @@
+/*
+Round trips through the compressed streams for the tests in this directory.
+A test opens streams of an archive, writes them w/ the encoder's helpers from
+one or more producer threads while the workers compress the blocks and the
+muxer writes them out, then reads the streams back w/ the decoder's classes.
+Producers flush their own streams; the archive keeps the streams (and their
+file descriptors) open until the muxer is done. Like compress-batch, every
+producer writes the streams of a file of its own (prefix + file).
+*/
+
+#ifndef TEST_ARCHIVE_H
+#define TEST_ARCHIVE_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <climits>
+#include <functional>
+#include <map>
+
+#include "RefereeCompress.hpp"
+#include "RefereeDecompress.hpp"
+
+using namespace std;
+
+int test_failures = 0;
+
+#define CHECK(cond) \
+	if ( !(cond) ) { \
+		cerr << "[ERROR] " << __FILE__ << ":" << __LINE__ << " failed: " << #cond << endl; \
+		test_failures++; \
+	}
+
+// exit code of a test
+int testResult(string const & name) {
+	if (test_failures > 0) {
+		cerr << "[ERROR] " << name << ": " << test_failures << " check(s) failed" << endl;
+		return 1;
+	}
+	cerr << "[INFO] " << name << ": ok" << endl;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////
+//
+//
+//
+////////////////////////////////////////////////////////////////
+class TestArchive {
+
+	Packet_courier courier;
+
+	int num_workers;
+
+	// intervals by file
+	map<string, shared_ptr<ofstream>> intervals;
+
+	vector<shared_ptr<OutputBuffer>> buffers;
+
+	vector<string> files;
+
+	static void * produce(void * arg) {
+		auto p = (pair<TestArchive *, function<void()> *> *)arg;
+		p->second->operator()();
+		p->first->courier.finish();
+		return 0;
+	}
+
+public:
+	string prefix;
+
+	TestArchive(string const & name, int workers = 2):
+		courier(workers, workers * 4),
+		num_workers(workers) {
+		char const * tmp = getenv("TMPDIR");
+		prefix = string(tmp != nullptr ? tmp : "/tmp") + "/referee_" + name + "_" + to_string(getpid() );
+	}
+
+	~TestArchive() {
+		buffers.clear();
+		for (auto & f : files) remove(f.c_str() );
+	}
+
+	////////////////////////////////////////////////////////////////
+	// stream of blocks of block_size bytes at chromosome 0, offset 0
+	////////////////////////////////////////////////////////////////
+	shared_ptr<OutputBuffer> stream(string const & suffix, int block_size, string const & file = "") {
+		shared_ptr<OutputBuffer> buf(new OutputBuffer(&courier, intervalsOut(file), prefix + file, suffix, block_size) );
+		buf->setInitialCoordinate(0, 0);
+		buffers.push_back(buf);
+		removeLater(suffix, file);
+		return buf;
+	}
+
+	////////////////////////////////////////////////////////////////
+	// for encoders that open their own streams (keep the encoder alive
+	// until compress returns): the courier, the intervals of a file, and
+	// the streams to remove at the end
+	////////////////////////////////////////////////////////////////
+	Packet_courier * packetCourier() { return &courier; }
+
+	shared_ptr<ofstream> intervalsOut(string const & file = "") {
+		auto & out = intervals[file];
+		if (out == nullptr) {
+			out = shared_ptr<ofstream>(new ofstream(prefix + file + INTERVALS_SUFFIX) );
+			files.push_back(prefix + file + INTERVALS_SUFFIX);
+		}
+		return out;
+	}
+
+	void removeLater(string const & suffix, string const & file = "") {
+		files.push_back(prefix + file + suffix);
+	}
+
+	////////////////////////////////////////////////////////////////
+	// producer side: blocks of the calling producer are all on disk,
+	// and so are the intervals of its file
+	////////////////////////////////////////////////////////////////
+	void waitWritten(string const & file = "") {
+		courier.wait_written();
+		intervals.at(file)->flush();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// the last record of the stream is the num-th one, written at (0, num)
+	////////////////////////////////////////////////////////////////
+	static void flush(shared_ptr<OutputBuffer> buf, size_t num) {
+		buf->setLastCoordinate(0, num, num);
+		buf->flush();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// runs every producer on a thread of its own, compresses and writes
+	// the streams; returns once all of them are on disk
+	////////////////////////////////////////////////////////////////
+	void compress(vector<function<void()>> producers, long long write_window = default_write_window) {
+		courier.set_producers(producers.size() );
+		vector<pair<TestArchive *, function<void()> *>> args;
+		for (auto & p : producers) args.emplace_back(this, &p);
+		vector<pthread_t> producer_threads(producers.size() );
+		for (size_t i = 0; i < producers.size(); i++) {
+			int errcode = pthread_create(&producer_threads[i], 0, produce, &args[i]);
+			assert(errcode == 0);
+		}
+		Worker_arg worker_arg;
+		worker_arg.courier = &courier;
+		worker_arg.dictionary_size = 1 << 16;
+		worker_arg.match_len_limit = 36;
+		vector<pthread_t> worker_threads(num_workers);
+		for (auto & t : worker_threads) pthread_create(&t, 0, cworker, &worker_arg);
+		muxer(courier, write_window);
+		for (auto & t : worker_threads) pthread_join(t, 0);
+		for (auto & t : producer_threads) pthread_join(t, 0);
+		CHECK(courier.finished() );
+		for (auto & out : intervals) out.second->close();
+	}
+
+	////////////////////////////////////////////////////////////////
+	// stream as the decompressor reads it; position it w/ seekToBlockStart(-1, 0, 0)
+	////////////////////////////////////////////////////////////////
+	shared_ptr<InputBuffer> open(string const & suffix, string const & file = "") {
+		auto all_intervals = parseGenomicIntervals(prefix + file + INTERVALS_SUFFIX);
+		assert(all_intervals.find(suffix) != all_intervals.end() );
+		return shared_ptr<InputBuffer>(new InputBuffer(prefix + file + suffix, all_intervals[suffix], 0) );
+	}
+
+	////////////////////////////////////////////////////////////////
+	// uncompressed contents of a stream
+	////////////////////////////////////////////////////////////////
+	vector<uint8_t> read(string const & suffix, string const & file = "") {
+		auto in = open(suffix, file);
+		bool t = false;
+		in->loadOverlappingBlock(-1, 0, 0, t);
+		vector<uint8_t> bytes;
+		while (in->hasMoreBytes() ) bytes.push_back(in->getNextByte() );
+		return bytes;
+	}
+};
+
+#endif
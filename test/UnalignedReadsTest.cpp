@@ -0,0 +1,140 @@
+/* Rolling canonical minimizers and the bucketed order of unaligned reads */
+#include <map>
+#include <set>
+
+#include "TestArchive.hpp"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////
+// k-mer of the given strand at position i, -1 if it has a base other than A, C, G, T
+////////////////////////////////////////////////////////////////
+int64_t kmerAt(vector<uint8_t> const & v, int i, int k, bool rev) {
+	int64_t x = 0;
+	for (int j = 0; j < k; j++) {
+		uint8_t c = rev ? v[i + k - 1 - j] : v[i + j];
+		int b = string("ACGT").find(c);
+		if (b == (int)string::npos) return -1;
+		x = (x << 2) | (rev ? 3 - b : b);
+	}
+	return x;
+}
+
+////////////////////////////////////////////////////////////////
+void checkMinimizers() {
+	srand(37);
+	char const * bases = "ACGTN";
+	for (int r = 0; r < 2000; r++) {
+		vector<uint8_t> seq(1 + rand() % 150);
+		// every fifth read w/ Ns
+		for (auto & c : seq) c = bases[rand() % (r % 5 == 0 ? 5 : 4)];
+		bool rc = false;
+		uint32_t m = canonicalMinimizer(seq, UNALIGNED_K, rc);
+		int64_t best = -1;
+		set<int64_t> forward;
+		for (int i = 0; i + UNALIGNED_K <= (int)seq.size(); i++) {
+			for (int strand = 0; strand < 2; strand++) {
+				int64_t x = kmerAt(seq, i, UNALIGNED_K, strand);
+				if (x < 0) continue;
+				if (best < 0 || x < best) best = x;
+				if (strand == 0) forward.insert(x);
+			}
+		}
+		if (best < 0) {
+			CHECK(m == ~0u);
+			continue;
+		}
+		CHECK(m == best);
+		// rc only when the minimizer is not on the forward strand
+		CHECK(rc == (forward.count(best) == 0) );
+	}
+}
+
+////////////////////////////////////////////////////////////////
+// reads come back once each, reads that share a minimizer next to each other
+////////////////////////////////////////////////////////////////
+void checkBuckets() {
+	TestArchive archive("unaligned");
+	auto out = archive.stream(".unaligned.lz", 1 << 16);
+	map<string, uint32_t> minimizers;
+	// spill files left behind by a crashed run w/ the same prefix
+	string const stale = "stale";
+	for (int b = 0; b < UNALIGNED_BUCKETS; b++) {
+		ofstream f(archive.prefix + ".unaligned." + to_string(b) + ".tmp", ios::binary);
+		uint32_t m = 0, len = stale.size(), empty = 0;
+		f.write( (char const *)&m, sizeof(m) );
+		f.put(0);
+		f.write( (char const *)&len, sizeof(len) );
+		f.write(stale.data(), len);
+		f.write( (char const *)&empty, sizeof(empty) );
+		f.write( (char const *)&empty, sizeof(empty) );
+	}
+	archive.compress({[&] () {
+		// a small cap, so the buckets spill to disk a few times
+		UnalignedBuckets buckets(archive.prefix, 1 << 14);
+		// overlapping reads from a few "genomes" so that minimizers repeat
+		srand(38);
+		vector<string> genomes(20, string(400, 'A') );
+		for (auto & g : genomes)
+			for (auto & c : g) c = "ACGT"[rand() % 4];
+		for (int r = 0; r < 2000; r++) {
+			int len = 50 + rand() % 50;
+			string & g = genomes[rand() % genomes.size()];
+			int start = rand() % (g.size() - len);
+			vector<uint8_t> seq(g.begin() + start, g.begin() + start + len);
+			string name = "read" + to_string(r);
+			string qual(seq.size(), 30);
+			bool rc = false;
+			uint32_t m = canonicalMinimizer(seq, UNALIGNED_K, rc);
+			minimizers[name] = m;
+			buckets.add(m, UnalignedRead( (char *)name.c_str(), name.size(), seq, (char *)qual.c_str(), rc) );
+		}
+		CHECK(buckets.size() == 2000);
+		buckets.flush(false, out);
+		TestArchive::flush(out, 0);
+	}});
+
+	// >name, seq, qual, strand
+	auto bytes = archive.read(".unaligned.lz");
+	vector<string> lines;
+	string line;
+	for (auto c : bytes) {
+		if (c == '\n') {
+			lines.push_back(line);
+			line.clear();
+		}
+		else line.push_back(c);
+	}
+	CHECK(lines.size() == 4 * 2000);
+	set<string> names;
+	set<uint32_t> done;
+	uint32_t prev = ~0u;
+	for (size_t i = 0; i + 3 < lines.size(); i += 4) {
+		string name = lines[i].substr(1);
+		CHECK(minimizers.count(name) == 1);
+		names.insert(name);
+		uint32_t m = minimizers[name];
+		if (m != prev) {
+			CHECK(done.count(m) == 0);
+			done.insert(prev);
+			prev = m;
+		}
+	}
+	CHECK(names.size() == 2000);
+	CHECK(names.count(stale) == 0);
+	// spilled buckets are gone; stale files of buckets that never spilled are left
+	int left = 0;
+	for (int b = 0; b < UNALIGNED_BUCKETS; b++) {
+		string path = archive.prefix + ".unaligned." + to_string(b) + ".tmp";
+		if (!ifstream(path).good() ) continue;
+		left++;
+		remove(path.c_str() );
+	}
+	CHECK(left < UNALIGNED_BUCKETS);
+}
+
+int main() {
+	checkMinimizers();
+	checkBuckets();
+	return testResult("UnalignedReadsTest");
+}
@@ -0,0 +1,92 @@
+/* Packets written behind the muxer: complete files under any write window */
+#include <random>
+#include "TestArchive.hpp"
+
+using namespace std;
+
+// a record: a running count per stream, then padding
+#define RECORD_SIZE 16
+
+////////////////////////////////////////////////////////////////
+// raw bytes of a file
+////////////////////////////////////////////////////////////////
+vector<uint8_t> readFile(string const & path) {
+	ifstream in(path, ios::binary);
+	return vector<uint8_t>(istreambuf_iterator<char>(in), istreambuf_iterator<char>() );
+}
+
+int main() {
+	// more streams than writer threads, so writers take turns between files
+	vector<string> suffixes = {".s0.lz", ".s1.lz", ".s2.lz", ".s3.lz", ".s4.lz", ".s5.lz"};
+	vector<int> block_sizes = {1 << 10, 1 << 12, 1 << 10, 1 << 12, 1 << 10, 1 << 12};
+	vector<string> files = {"a", "b"};
+	int const records = 12000;
+	// one packet at a time, a few packets, and the default window
+	vector<long long> windows = {1, 1 << 12, default_write_window};
+
+	// compressed files of the first window, to compare the others against
+	map<string, vector<uint8_t>> first;
+	for (auto window : windows) {
+		TestArchive archive("write_behind", 4);
+		// what each producer read back as soon as its blocks were written
+		map<string, vector<uint8_t>> early;
+		for (auto & file : files)
+			for (auto & suffix : suffixes)
+				early[file + suffix];
+		vector<function<void()>> producers;
+		for (auto & file : files) {
+			vector<shared_ptr<OutputBuffer>> streams;
+			for (size_t s = 0; s < suffixes.size(); s++)
+				streams.push_back(archive.stream(suffixes[s], block_sizes[s], file) );
+			producers.push_back([&archive, &early, &suffixes, streams, records, file] () {
+				minstd_rand rng(48 + file[0]);
+				vector<uint32_t> next(streams.size(), 0);
+				for (int i = 0; i < records; i++) {
+					GenomicCoordinate gc(0, i);
+					int s = rng() % streams.size();
+					uint8_t bytes[RECORD_SIZE] = {0};
+					memcpy(bytes, &next[s], 4);
+					for (int j = 4; j < RECORD_SIZE; j++) bytes[j] = rng() % 256;
+					next[s]++;
+					writeBytes(bytes, RECORD_SIZE, streams[s], gc, i);
+				}
+				for (auto & s : streams) TestArchive::flush(s, records);
+				// as compress-batch before closing a file: the other
+				// producer may still be writing its own
+				archive.waitWritten(file);
+				for (auto & suffix : suffixes)
+					early.at(file + suffix) = archive.read(suffix, file);
+			});
+		}
+		archive.compress(producers, window);
+
+		for (auto & file : files) {
+			size_t total = 0;
+			for (auto & suffix : suffixes) {
+				auto & bytes = early[file + suffix];
+				CHECK(bytes.size() % RECORD_SIZE == 0);
+				uint32_t expected = 0;
+				for (size_t j = 0; j + RECORD_SIZE <= bytes.size(); j += RECORD_SIZE) {
+					uint32_t x;
+					memcpy(&x, &bytes[j], 4);
+					CHECK(x == expected);
+					if (x != expected) break;
+					expected++;
+				}
+				total += expected;
+				CHECK(bytes == archive.read(suffix, file) );
+
+				// the window changes when packets are written, not the files
+				auto compressed = readFile(archive.prefix + file + suffix);
+				if (window == windows[0])
+					first[file + suffix] = compressed;
+				else
+					CHECK(compressed == first[file + suffix]);
+			}
+			CHECK(total == records);
+			if (total != records)
+				cerr << "window " << window << ", file " << file << ": " << total << " records read back" << endl;
+		}
+	}
+	return testResult("WriteBehindTest");
+}